@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace kit {
+
+struct AdmissionOption {
+    double k                = 2.0;  // accepts multiplier, requests above k x accepts are rejected locally
+    int    windowS          = 60;   // history of requests and accepts
+    double overloadWeight   = 1.0;  // rejection probability per unit of pool overload
+    double maxRejectRatio   = 0.9;  // always let some traffic through to notice recovery
+};
+
+// AdmissionController sheds requests on the client before they reach a saturated fleet.
+// it combines two signals into one rejection probability:
+//   client side:  max(0, (requests - k * accepts) / (requests + 1)) over the window,
+//                 requests counts the calls offered to the backend, accepts the ones it served
+//   server side:  overload of the candidate pool, from the zone cpu and instance loads
+// a request shed for the server side never reached the backend and stays out of the
+// client history, otherwise shedding on overload would feed the client term.
+// counters are per second buckets updated with relaxed atomics, Admit does not lock
+class AdmissionController {
+    struct Bucket {
+        std::atomic<uint64_t> second;
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> accepts;
+    };
+
+    AdmissionOption       option;
+    std::vector<Bucket>   buckets;      // ring indexed by second
+    std::atomic<uint64_t> sumSecond;    // second the sums below were computed in
+    std::atomic<uint64_t> sumRequests;  // completed seconds of the window
+    std::atomic<uint64_t> sumAccepts;
+    std::function<double()> random;     // uniform in [0, 1), a per thread xorshift when empty
+
+    Bucket& bucket(uint64_t second);
+    void sum(uint64_t second);
+    // the server part and the whole of the rejection probability, capped by maxRejectRatio
+    void probability(double overload, uint64_t nowMs, double& server, double& p);
+
+   public:
+    explicit AdmissionController(const AdmissionOption& option = AdmissionOption());
+
+    // count a request and decide whether to send it, false means shed it
+    bool Admit(double overload);
+    bool Admit(double overload, uint64_t nowMs);
+    // outcome of an admitted request, failures caused by overload should report false
+    void ReportResult(bool success);
+    void ReportResult(bool success, uint64_t nowMs);
+
+    double RejectProbability(double overload);
+    double RejectProbability(double overload, uint64_t nowMs);
+
+    // draws of Admit, e.g. a seeded generator in tests. called from every admitting thread,
+    // set before the first Admit
+    void SetRandom(const std::function<double()>& random) {
+        this->random = random;
+    }
+};
+
+}
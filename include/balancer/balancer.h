@@ -1,45 +1,706 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <log4cplus/logger.h>
+#include <log4cplus/loggingmacros.h>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <time.h>
+#include <utility>
 
+#include "admission.h"
+#include "connection_pool.h"
+#include "hedging.h"
 #include "consul_resolver.h"
+#include "metrics_sink.h"
+#include "selection_policy.h"
+#include "shm_pool.h"
+#include "update_scheduler.h"
+#include "util/constant.h"
+#include "util/metrics_server.h"
+#include "util/numa.h"
+#include "util/util.h"
+#include "zone_router.h"
 
 namespace kit {
 
-class Balancer {
-    ConsulResolver resolver;
+// candidate pool sharing across processes on the same host
+enum class SharedPoolMode {
+    NONE,        // every process polls consul itself
+    PUBLISHER,   // poll consul and publish the pool into shared memory
+    SUBSCRIBER,  // no consul access, select from the published pool
+};
+
+// BasicBalancer keeps a candidate pool fresh in the background and selects from it.
+// the three policies are held by value and called directly, no virtual dispatch:
+//   SelectionPolicy  picks a node of the pool, see selection_policy.h
+//   DiscoverySource  builds the pool, ConsulResolver or anything with
+//                      std::tuple<int, std::string> updateAll();
+//                      bool Converging() const;
+//                      std::shared_ptr<CandidatePool> getCandidatePool();
+//                      void SetCandidatePool(const std::shared_ptr<CandidatePool>&);
+//                      const std::string& getLocalZone() const;
+//                      json11::Json to_json() const;
+//                      void SetLogger(log4cplus::Logger*);
+//   MetricsSink      selection and refresh hooks, see metrics_sink.h
+// the ConsulResolver specific setters below only compile against a ConsulResolver
+template <typename SelectionPolicy, typename DiscoverySource, typename MetricsSink>
+class BasicBalancer {
+    DiscoverySource resolver;
+    SelectionPolicy selection;
+    MetricsSink metrics;
     int intervalS;
-    bool done;
+    UpdateScheduler scheduler;
     std::thread *serviceUpdater;
     log4cplus::Logger *logger;
     volatile uint64_t _lastUpdated = 0;
 
+    SharedPoolMode sharedPoolMode = SharedPoolMode::NONE;
+    int sharedPoolPollMs = 100;
+    std::shared_ptr<SharedPoolWriter> poolWriter;
+    std::shared_ptr<SharedPoolReader> poolReader;
+    std::shared_ptr<ConnectionPool> connectionPool;
+
+    // a copy of the pool with its own selection state, allocated on one numa node, replaced
+    // as a whole on every publish
+    struct Replica {
+        std::shared_ptr<CandidatePool> candidatePool;
+        SelectionPolicy selection;
+    };
+    std::unique_ptr<NumaTopology> numa;
+    std::unique_ptr<NodeWorkers> numaWorkers;        // one pinned thread per node, copies the pools
+    std::vector<std::shared_ptr<Replica>> replicas;  // numa node => replica, atomic_load, empty when disabled
+    std::shared_ptr<CandidatePool> replicated;       // pool the replicas were copied from
+    std::mutex replicaMutex;
+    // selection options, applied to the selection of every replica when it is published
+    std::function<void(SelectionPolicy &)> slowStartOption;
+    std::function<void(SelectionPolicy &)> transitionOption;
+    std::function<void(SelectionPolicy &)> traceOption;
+    std::shared_ptr<AdmissionController> admission;
+    std::shared_ptr<Hedger> hedger;
+    std::shared_ptr<ZoneRouter> router;
+    std::unique_ptr<MetricsServer> metricsServer;
+
+    std::shared_ptr<ServiceNode> selectNode(bool admit, int &code);
+    // selectNode without the metrics, pool is the candidate pool it picked from
+    std::shared_ptr<ServiceNode> pickNode(bool admit, int &code, std::shared_ptr<CandidatePool> &pool);
+    void publishSharedPool();
+    bool readSharedPool();
+    void refreshConnectionPool(bool prewarm);
+    void publishReplicas();
+
 public:
-    Balancer(const std::string &address,
-             const std::string &zone,
-             const std::string &service,
-             const std::string &cpuThresholdKey = "clb/rs/cpu_threshold.json",
-             const std::string &zoneCPUKey = "clb/rs/zone_cpu.json",
-             const std::string &instanceFactorKey = "clb/rs/instance_factor.json",
-             const std::string &onlinelabFactorKey = "clb/rs/onlinelab_factor.json",
-             int timeoutS = 5,
-             int intervalS = 60);
+    BasicBalancer(const std::string &address,
+                  const std::string &zone,
+                  const std::string &service,
+                  const std::string &cpuThresholdKey = "clb/rs/cpu_threshold.json",
+                  const std::string &zoneCPUKey = "clb/rs/zone_cpu.json",
+                  const std::string &instanceFactorKey = "clb/rs/instance_factor.json",
+                  const std::string &onlinelabFactorKey = "clb/rs/onlinelab_factor.json",
+                  int timeoutS = 5,
+                  int intervalS = 60)
+        : resolver(address, zone, service, cpuThresholdKey, zoneCPUKey, instanceFactorKey, onlinelabFactorKey, timeoutS),
+          intervalS(intervalS), scheduler(SchedulerOption(intervalS)) {
+        this->serviceUpdater = nullptr;
+        this->logger = nullptr;
+    }
+    // a discovery source other than consul, constructed from discoveryArgs
+    template <typename... Args>
+    explicit BasicBalancer(int intervalS, Args &&... discoveryArgs)
+        : resolver(std::forward<Args>(discoveryArgs)...), intervalS(intervalS), scheduler(SchedulerOption(intervalS)) {
+        this->serviceUpdater = nullptr;
+        this->logger = nullptr;
+    }
+
+    DiscoverySource &getDiscovery() {
+        return this->resolver;
+    }
+    SelectionPolicy &getSelection() {
+        return this->selection;
+    }
+    MetricsSink &getMetrics() {
+        return this->metrics;
+    }
 
     void SetLogger(log4cplus::Logger *logger) {
         this->resolver.SetLogger(logger);
         this->logger = logger;
     }
+    // adaptive polling, defaults derived from intervalS
+    void SetSchedulerOption(const SchedulerOption &option) {
+        this->scheduler.SetOption(option);
+    }
+    void SetStalenessPolicy(const StalenessPolicy &policy) {
+        this->resolver.SetStalenessPolicy(policy);
+    }
+    // read the instance loads published under prefix, see LoadPublisher
+    void SetInstanceLoadPrefix(const std::string &prefix, int maxAgeS = 30) {
+        this->resolver.SetInstanceLoadPrefix(prefix, maxAgeS);
+    }
+    // warm up joining and recovering nodes, see SlowStartOption
+    void SetSlowStartOption(const SlowStartOption &option) {
+        this->selection.SetSlowStartOption(option);
+        this->slowStartOption = [option](SelectionPolicy &selection) { selection.SetSlowStartOption(option); };
+    }
+    // smooth the factor changes of every refresh, see TransitionOption
+    void SetTransitionOption(const TransitionOption &option) {
+        this->selection.SetTransitionOption(option);
+        this->transitionOption = [option](SelectionPolicy &selection) { selection.SetTransitionOption(option); };
+    }
+    // split the per node work of a refresh over threads, for services of tens of thousands of nodes
+    void SetRefreshThreads(int threads) {
+        this->resolver.SetRefreshThreads(threads);
+    }
+    // record every selection and pool swap into trace, see SelectionTrace. call before Start,
+    // null to stop
+    void SetTrace(const std::shared_ptr<SelectionTrace> &trace) {
+        this->resolver.SetTrace(trace);
+        this->selection.SetTrace(trace.get());
+        this->traceOption = [trace](SelectionPolicy &selection) { selection.SetTrace(trace.get()); };
+    }
+    // consul side filtering of the service nodes, see ConsulResolver::SetServiceFilter
+    void SetServiceFilter(const ServiceFilter &filter, bool localZoneOnly = false) {
+        this->resolver.SetServiceFilter(filter, localZoneOnly);
+    }
+    // cap the nodes this client talks to, see Subsetter
+    void SetSubsetOption(const SubsetOption &option) {
+        this->resolver.SetSubsetOption(option);
+    }
+    DataFreshness getFreshness(DataSource source) {
+        return this->resolver.getFreshness(source);
+    }
     // TODO: this method should not be public, but test needed now
     void SetZone(const std::string& zone) {
         this->resolver.SetZone(zone);
     }
 
+    // share the candidate pool through the POSIX shared memory segment `name`, call before Start.
+    // the publisher must be started before subscribers, which look for a new pool every pollMs
+    void SetSharedPool(const std::string &name, SharedPoolMode mode, uint32_t capacity = 4096, int pollMs = 100);
+
+    // deltas of the candidate pool, delivered in order on a dispatcher thread.
+    // the current pool comes first as added nodes, return the id to unsubscribe
+    uint64_t Subscribe(const TopologyCallback &callback) {
+        return this->resolver.SubscribeTopology(callback);
+    }
+    void Unsubscribe(uint64_t id) {
+        this->resolver.UnsubscribeTopology(id);
+    }
+    void SetTopologyOption(const TopologyOption &option) {
+        this->resolver.SetTopologyOption(option);
+    }
+
+    // keep ready connections to the candidate nodes, call before Start
+    void SetConnectionPool(const ConnectionPoolOption &option);
+
+    // one copy of every pool per numa node, allocated on that node, selections read the copy
+    // of the node they run on and keep their round robin state there. call before Start,
+    // nothing happens on a single node host
+    void SetNumaReplicas(bool enabled, const NumaTopology &topology = NumaTopology::Default());
+
     std::tuple<int, std::string> Start();
     std::tuple<int, std::string> Stop();
     std::shared_ptr<ServiceNode> SelectedNode();
+    // shed load on the client before the fleet saturates, see AdmissionController. call before Start
+    void SetAdmission(const AdmissionOption &option) {
+        this->admission = std::make_shared<AdmissionController>(option);
+    }
+    // SelectedNode through the admission controller, ERROR_OVERLOAD means the request should be
+    // dropped. every admitted request reports its outcome with ReportResult
+    std::tuple<int, std::shared_ptr<ServiceNode>, std::string> AdmittedNode();
+    void ReportResult(bool success) {
+        if (this->admission!=nullptr) {
+            this->admission->ReportResult(success);
+        }
+    }
+
+    // hedged requests and bounded retries, see Hedger. call before Start
+    void SetHedging(const HedgeOption &option) {
+        this->hedger = std::make_shared<Hedger>(option);
+    }
+    // an admitted primary and how long to wait for it before hedging
+    std::tuple<int, HedgePlan, std::string> SelectedHedge();
+    // a node other than primary for a hedge or a retry, ERROR_OVERLOAD once the retry budget is spent
+    std::tuple<int, std::shared_ptr<ServiceNode>, std::string> SelectedBackup(const std::shared_ptr<ServiceNode> &primary);
+    // deadline aware cross zone routing, see ZoneRouter. call before Start
+    void SetZoneRouting(const ZoneRouterOption &option) {
+        this->router = std::make_shared<ZoneRouter>(option);
+    }
+    // an admitted node reachable within budgetUs, 0 for no deadline. tight requests stay in
+    // the local zone, requests with slack take over the cross zone share they gave up
+    std::tuple<int, std::shared_ptr<ServiceNode>, std::string> RoutedNode(uint64_t budgetUs);
+    // round trip of a request to node, feeds the rtt of its zone
+    void ReportRTT(const ServiceNode &node, uint64_t rttUs) {
+        if (this->router!=nullptr) {
+            this->router->ReportRTT(node.zone, rttUs);
+        }
+    }
+    // latency of a completed request, feeds the hedge delay
+    void ReportLatency(uint64_t latencyUs) {
+        if (this->hedger!=nullptr) {
+            this->hedger->ReportLatency(latencyUs, SteadyNowMs());
+        }
+    }
+    // admit and select a node, then lease a connection to it, needs SetConnectionPool
+    std::tuple<int, std::unique_ptr<Connection>, std::string> SelectedConnection();
     std::string getLocalZone();
     uint64_t getLastUpdated();
+
+    // the resolver and the enabled features in prometheus text format. out is cleared and
+    // reused, pass the same string to every scrape and nothing is allocated once it is grown
+    void RenderMetrics(std::string &out);
+    // serve RenderMetrics over http, port 0 picks a free one, see getMetricsPort. stopped by Stop
+    std::tuple<int, std::string> ServeMetrics(int port, const std::string &address = "0.0.0.0");
+    int getMetricsPort() const {
+        return this->metricsServer!=nullptr ? this->metricsServer->getPort() : 0;
+    }
 };
 
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::SetSharedPool(const std::string &name, SharedPoolMode mode, uint32_t capacity, int pollMs) {
+    this->sharedPoolMode = mode;
+    this->sharedPoolPollMs = pollMs;
+    this->poolWriter = nullptr;
+    this->poolReader = nullptr;
+    if (mode==SharedPoolMode::PUBLISHER) {
+        this->poolWriter = std::make_shared<SharedPoolWriter>(name, capacity);
+    } else if (mode==SharedPoolMode::SUBSCRIBER) {
+        this->poolReader = std::make_shared<SharedPoolReader>(name);
+    }
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::publishSharedPool() {
+    if (this->poolWriter==nullptr) {
+        return;
+    }
+    auto candidatePool = this->resolver.getCandidatePool();
+    if (candidatePool==nullptr) {
+        return;
+    }
+    std::string err;
+    int code;
+    std::tie(code, err) = this->poolWriter->Publish(*candidatePool, this->_lastUpdated);
+    if (code!=STATUSCODE::SUCCESS && this->logger!=nullptr) {
+        LOG4CPLUS_WARN(*(this->logger), "publish shared pool failed. code: [" << code << "], err: [" << err << "]");
+    }
+}
+
+// take the published pool when it changed, true when it did
+template <typename S, typename D, typename M>
+bool BasicBalancer<S, D, M>::readSharedPool() {
+    if (not this->poolReader->Changed()) {
+        return false;
+    }
+    std::shared_ptr<CandidatePool> candidatePool;
+    int code;
+    std::string err;
+    std::tie(code, candidatePool, err) = this->poolReader->Refresh();
+    if (code!=STATUSCODE::SUCCESS && this->logger!=nullptr) {
+        LOG4CPLUS_WARN(*(this->logger), "read shared pool failed. code: [" << code << "], err: [" << err << "]");
+    }
+    if (candidatePool==nullptr || candidatePool==this->resolver.getCandidatePool()) {
+        return false;
+    }
+    this->resolver.SetCandidatePool(candidatePool);
+    this->publishReplicas();
+    return true;
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::SetConnectionPool(const ConnectionPoolOption &option) {
+    this->connectionPool = std::make_shared<ConnectionPool>(option);
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::refreshConnectionPool(bool prewarm) {
+    if (this->connectionPool==nullptr) {
+        return;
+    }
+    auto candidatePool = this->resolver.getCandidatePool();
+    if (candidatePool!=nullptr) {
+        this->connectionPool->Refresh(*candidatePool, prewarm);
+    }
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::SetNumaReplicas(bool enabled, const NumaTopology &topology) {
+    this->numaWorkers = nullptr;
+    this->numa = nullptr;
+    this->replicas.clear();
+    this->replicated = nullptr;
+    if (not enabled || topology.NodeNum() <= 1) {
+        return;
+    }
+    this->numa.reset(new NumaTopology(topology));
+    this->numaWorkers.reset(new NodeWorkers(*this->numa));
+    this->replicas.resize(topology.NodeNum());
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::publishReplicas() {
+    if (this->replicas.empty()) {
+        return;
+    }
+    auto candidatePool = this->resolver.getCandidatePool();
+    std::lock_guard<std::mutex> lock_guard(this->replicaMutex);
+    if (candidatePool==nullptr || candidatePool==this->replicated) {
+        return;
+    }
+    // every node at once, first touch by its pinned worker so the copy is allocated there
+    this->numaWorkers->RunAll([this, &candidatePool](int node) {
+        auto replica = std::make_shared<Replica>();
+        replica->candidatePool = std::make_shared<CandidatePool>(*candidatePool);
+        for (auto &serviceNode : replica->candidatePool->nodes) {
+            serviceNode = std::make_shared<ServiceNode>(*serviceNode);
+        }
+        replica->candidatePool->weights.assign(candidatePool->nodes.size(), 0);
+        for (const auto &apply : {this->slowStartOption, this->transitionOption, this->traceOption}) {
+            if (apply) {
+                apply(replica->selection);
+            }
+        }
+        std::atomic_store(&this->replicas[node], replica);
+    });
+    this->replicated = candidatePool;
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::string> BasicBalancer<S, D, M>::Start() {
+    std::string err;
+    int code;
+    if (this->sharedPoolMode==SharedPoolMode::SUBSCRIBER) {
+        std::shared_ptr<CandidatePool> candidatePool;
+        std::tie(code, err) = this->poolReader->Open();
+        if (code!=STATUSCODE::SUCCESS) {
+            return std::make_tuple(code, err);
+        }
+        std::tie(code, candidatePool, err) = this->poolReader->Refresh();
+        if (code!=STATUSCODE::SUCCESS) {
+            return std::make_tuple(code, err);
+        }
+        if (candidatePool==nullptr) {
+            return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, "shared pool not published yet");
+        }
+        this->resolver.SetCandidatePool(candidatePool);
+        this->publishReplicas();
+        this->refreshConnectionPool(true);
+
+        // the copy, the replicas and the connections all off the selection path
+        this->scheduler.Reset();
+        this->serviceUpdater = new std::thread([this]() {
+            auto evicted = std::chrono::steady_clock::now();
+            while (this->scheduler.Wait(std::chrono::milliseconds(this->sharedPoolPollMs))) {
+                auto changed = this->readSharedPool();
+                // idle connections are evicted once per interval, as on the publisher
+                auto now = std::chrono::steady_clock::now();
+                if (changed || now - evicted >= std::chrono::seconds(this->intervalS)) {
+                    this->refreshConnectionPool(true);
+                    evicted = now;
+                }
+            }
+        });
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+    if (this->sharedPoolMode==SharedPoolMode::PUBLISHER) {
+        std::tie(code, err) = this->poolWriter->Open();
+        if (code!=STATUSCODE::SUCCESS) {
+            return std::make_tuple(code, err);
+        }
+    }
+
+    LOG4CPLUS_DEBUG(*(this->logger), "update consul metrics start");
+    std::tie(code, err) = this->resolver.updateAll();
+    this->metrics.OnUpdated(this->resolver, code);
+    if (code!=STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, err);
+    }
+    _lastUpdated = (uint64_t)time(nullptr);
+    this->publishSharedPool();
+    this->publishReplicas();
+    this->refreshConnectionPool(true);
+    LOG4CPLUS_INFO(*(this->logger), "update consul metrics finish, resolver" << this->resolver.to_json().dump());
+
+    this->scheduler.Reset();
+    this->serviceUpdater = new std::thread([&]() {
+        std::string local_err;
+        int local_code = STATUSCODE::SUCCESS;
+        // jittered, backs off on failures, returns false as soon as Stop is called
+        while (this->scheduler.Wait(this->scheduler.Next(local_code==STATUSCODE::SUCCESS, this->resolver.Converging()))) {
+            LOG4CPLUS_DEBUG(*(this->logger), "update consul metrics start");
+            std::tie(local_code, local_err) = this->resolver.updateAll();
+            this->metrics.OnUpdated(this->resolver, local_code);
+            if (local_code == STATUSCODE::SUCCESS) {
+                _lastUpdated = (uint64_t)time(nullptr);
+                this->publishSharedPool();
+                this->publishReplicas();
+            }
+            // evicts idle connections even when consul failed
+            this->refreshConnectionPool(true);
+            // the whole resolver only when asked for, not on every refresh of a large service
+            LOG4CPLUS_INFO(*(this->logger), "update consul metrics finish, code[" << local_code << "]");
+            LOG4CPLUS_DEBUG(*(this->logger), "resolver" << this->resolver.to_json().dump());
+        }
+    });
+
+    if (logger!=nullptr) {
+        LOG4CPLUS_INFO(*(this->logger), "consul resolver start ");
+    }
+
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::string> BasicBalancer<S, D, M>::Stop() {
+    this->scheduler.Stop();
+
+    for (const auto &t : {this->serviceUpdater}) {
+        if (t!=nullptr) {
+            if (t->joinable()) {
+                t->join();
+            }
+            delete t;
+        }
+    }
+    this->serviceUpdater = nullptr;
+    if (this->connectionPool!=nullptr) {
+        this->connectionPool->Close();
+    }
+    if (this->metricsServer!=nullptr) {
+        this->metricsServer->Stop();
+        this->metricsServer = nullptr;
+    }
+
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+template <typename S, typename D, typename M>
+std::shared_ptr<ServiceNode> BasicBalancer<S, D, M>::SelectedNode() {
+    int code;
+    return this->selectNode(false, code);
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::shared_ptr<ServiceNode>, std::string> BasicBalancer<S, D, M>::AdmittedNode() {
+    int code = STATUSCODE::SUCCESS;
+    auto node = this->selectNode(true, code);
+    if (code==STATUSCODE::ERROR_OVERLOAD) {
+        return std::make_tuple(code, node, "shed by admission control");
+    }
+    if (node==nullptr) {
+        return std::make_tuple(STATUSCODE::UNKNOWN, node, "have no service nodes");
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, node, "");
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, HedgePlan, std::string> BasicBalancer<S, D, M>::SelectedHedge() {
+    HedgePlan plan;
+    if (this->hedger==nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, plan, "hedging not enabled");
+    }
+    int code;
+    std::string err;
+    std::tie(code, plan.primary, err) = this->AdmittedNode();
+    if (code!=STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, plan, err);
+    }
+    plan.delayUs = this->hedger->Begin(SteadyNowMs());
+    return std::make_tuple(STATUSCODE::SUCCESS, plan, "");
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::shared_ptr<ServiceNode>, std::string> BasicBalancer<S, D, M>::SelectedBackup(
+    const std::shared_ptr<ServiceNode> &primary) {
+    if (this->hedger==nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, nullptr, "hedging not enabled");
+    }
+    if (not this->hedger->AcquireRetry(SteadyNowMs())) {
+        return std::make_tuple(STATUSCODE::ERROR_OVERLOAD, nullptr, "retry budget exhausted");
+    }
+    // the round robin moves on at every pick, a few tries skip the primary. only the
+    // backup returned counts as selected
+    int code = STATUSCODE::SUCCESS;
+    std::shared_ptr<CandidatePool> pool;
+    std::shared_ptr<ServiceNode> node;
+    for (int i = 0; i < this->hedger->getOption().maxBackupTries; i++) {
+        node = this->pickNode(false, code, pool);
+        if (node==nullptr || primary==nullptr || node->host!=primary->host || node->port!=primary->port) {
+            break;
+        }
+        node = nullptr;
+    }
+    if (node==nullptr) {
+        this->hedger->ReleaseRetry();
+        return std::make_tuple(STATUSCODE::UNKNOWN, nullptr, "have no other service nodes");
+    }
+    this->metrics.OnSelected(this->resolver, *node);
+    return std::make_tuple(STATUSCODE::SUCCESS, node, "");
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::shared_ptr<ServiceNode>, std::string> BasicBalancer<S, D, M>::RoutedNode(uint64_t budgetUs) {
+    if (this->router==nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, nullptr, "zone routing not enabled");
+    }
+    int code = STATUSCODE::SUCCESS;
+    std::shared_ptr<CandidatePool> pool;
+    auto node = this->pickNode(true, code, pool);
+    if (code==STATUSCODE::ERROR_OVERLOAD) {
+        return std::make_tuple(code, node, "shed by admission control");
+    }
+    if (node==nullptr) {
+        return std::make_tuple(STATUSCODE::UNKNOWN, node, "have no service nodes");
+    }
+
+    // the round robin picks once, a node of the wanted side is drawn from the same pool
+    // without moving the round robin on
+    auto &router = *(this->router);
+    const auto &local = this->resolver.getLocalZone();
+    auto nowMs = SteadyNowMs();
+    if (node->zone!=local) {
+        bool fits = router.Fits(node->zone, budgetUs);
+        if (not fits || not router.AllowCross(nowMs)) {
+            router.Defer();
+            auto idx = router.Pick(*pool, local, true, budgetUs);
+            if (idx >= 0) {
+                node = pool->nodes[idx];
+            } else if (not fits) {
+                return std::make_tuple(STATUSCODE::UNKNOWN, nullptr, "have no local service nodes within the budget");
+            }
+        }
+    } else if (router.HasDebt() && router.AllowCross(nowMs)) {
+        auto idx = router.Pick(*pool, local, false, budgetUs);
+        if (idx >= 0 && router.TakeDebt()) {
+            node = pool->nodes[idx];
+        }
+    }
+    this->metrics.OnSelected(this->resolver, *node);
+    router.Count(node->zone!=local);
+    return std::make_tuple(STATUSCODE::SUCCESS, node, "");
+}
+
+template <typename S, typename D, typename M>
+std::shared_ptr<ServiceNode> BasicBalancer<S, D, M>::selectNode(bool admit, int &code) {
+    std::shared_ptr<CandidatePool> candidatePool;
+    auto node = this->pickNode(admit, code, candidatePool);
+    if (node!=nullptr) {
+        this->metrics.OnSelected(this->resolver, *node);
+    }
+    return node;
+}
+
+template <typename S, typename D, typename M>
+std::shared_ptr<ServiceNode> BasicBalancer<S, D, M>::pickNode(bool admit, int &code,
+                                                              std::shared_ptr<CandidatePool> &candidatePool) {
+    std::shared_ptr<Replica> replica;
+    auto selection = &this->selection;
+    if (not this->replicas.empty()) {
+        replica = std::atomic_load(&this->replicas[this->numa->CurrentNode()]);
+    }
+    if (replica!=nullptr) {
+        candidatePool = replica->candidatePool;
+        selection = &replica->selection;
+    }
+    if (candidatePool==nullptr) {
+        // not replicated yet
+        candidatePool = this->resolver.getCandidatePool();
+        selection = &this->selection;
+    }
+    if (candidatePool==nullptr) {
+        return nullptr;
+    }
+    if (admit && this->admission!=nullptr && not this->admission->Admit(candidatePool->overload)) {
+        code = STATUSCODE::ERROR_OVERLOAD;
+        return nullptr;
+    }
+    auto idx = selection->Select(*candidatePool);
+    if (idx < 0) {
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_FATAL(*(this->logger), "SelectedNode: have no service nodes");
+        }
+        return nullptr;
+    }
+    return candidatePool->nodes[idx];
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::unique_ptr<Connection>, std::string> BasicBalancer<S, D, M>::SelectedConnection() {
+    if (this->connectionPool==nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, std::unique_ptr<Connection>(),
+                               "connection pool not enabled");
+    }
+    int code;
+    std::shared_ptr<ServiceNode> node;
+    std::string err;
+    std::tie(code, node, err) = this->AdmittedNode();
+    if (code!=STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, std::unique_ptr<Connection>(), err);
+    }
+    return this->connectionPool->Acquire(node);
+}
+
+template <typename S, typename D, typename M>
+std::string BasicBalancer<S, D, M>::getLocalZone() {
+    return this->resolver.getLocalZone();
+}
+
+template <typename S, typename D, typename M>
+uint64_t BasicBalancer<S, D, M>::getLastUpdated() {
+    if (this->poolReader!=nullptr) {
+        return this->poolReader->getLastUpdated();
+    }
+    return this->_lastUpdated;
+}
+
+template <typename S, typename D, typename M>
+void BasicBalancer<S, D, M>::RenderMetrics(std::string &out) {
+    PrometheusWriter writer(out);
+    this->resolver.RenderMetrics(writer);
+
+    const auto &service = this->resolver.getService();
+    auto candidatePool = this->resolver.getCandidatePool();
+    double overload = candidatePool!=nullptr ? candidatePool->overload : 0;
+    writer.Family("clb_last_updated_seconds", "gauge", "Unix time of the last candidate pool update.");
+    writer.Sample("clb_last_updated_seconds", {{"service", service}}, this->getLastUpdated());
+    writer.Family("clb_pool_overload", "gauge", "How far the least loaded zone is above the cpu threshold.");
+    writer.Sample("clb_pool_overload", {{"service", service}}, overload);
+    if (this->admission!=nullptr) {
+        writer.Family("clb_admission_reject_probability", "gauge", "Probability of a request shed by admission control.");
+        writer.Sample("clb_admission_reject_probability", {{"service", service}},
+                      this->admission->RejectProbability(overload));
+    }
+    if (this->hedger!=nullptr) {
+        writer.Family("clb_retry_budget_tokens", "gauge", "Hedges and retries left in the retry budget.");
+        writer.Sample("clb_retry_budget_tokens", {{"service", service}}, this->hedger->Tokens());
+    }
+    if (this->router!=nullptr) {
+        writer.Family("clb_routed_cross_zone_share", "gauge", "Share of the routed selections sent out of the local zone.");
+        writer.Sample("clb_routed_cross_zone_share", {{"service", service}}, this->router->CrossShare());
+    }
+}
+
+template <typename S, typename D, typename M>
+std::tuple<int, std::string> BasicBalancer<S, D, M>::ServeMetrics(int port, const std::string &address) {
+    if (this->metricsServer!=nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "metrics already served");
+    }
+    std::unique_ptr<MetricsServer> server(new MetricsServer([this](std::string &out) { this->RenderMetrics(out); }));
+    int code;
+    std::string err;
+    std::tie(code, err) = server->Start(port, address);
+    if (code!=STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, err);
+    }
+    this->metricsServer = std::move(server);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+// the consul backed balancer, compiled once in balancer.cpp
+using Balancer = BasicBalancer<SmoothWeightedSelection, ConsulResolver, ResolverMetrics>;
+extern template class BasicBalancer<SmoothWeightedSelection, ConsulResolver, ResolverMetrics>;
+
 }
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <log4cplus/logger.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "consul_resolver.h"
+#include "update_scheduler.h"
+#include "util/thread_pool.h"
+
+namespace kit {
+
+// BalancerRegistry resolves many services over one updater thread. kv keys shared
+// by several services (zone cpu, onlinelab, ...) are fetched once per refresh,
+// only the health of each service is fetched per service
+class BalancerRegistry {
+    struct ServiceEntry {
+        std::shared_ptr<ConsulResolver> resolver;
+        uint64_t                        applied[DATA_SOURCE_NUM] = {};  // kv version applied to the resolver
+        std::string                     healthIndex = "0";
+        std::string                     healthQuery;  // filter of the last health query
+        std::atomic<uint64_t>           lastUpdated{0};
+    };
+    // one distinct kv key
+    struct KeyState {
+        std::string  index = "0";
+        uint64_t     version = 0;  // bumped on every modified value
+        json11::Json kv;
+        int          code = 0;
+        std::string  err;
+        bool         prefix = false;  // recursive read, the instance loads
+    };
+    typedef std::unordered_map<std::string, std::shared_ptr<ServiceEntry>> ServiceMap;
+
+    ConsulClient                              client;
+    std::string                               address;
+    std::string                               zone;
+    std::string                               cpuThresholdKey;
+    std::string                               zoneCPUKey;
+    std::string                               instanceFactorKey;
+    std::string                               onlinelabFactorKey;
+    int                                       timeoutS;
+    std::unordered_map<std::string, KeyState> keys;          // updater thread only
+    // copy on write, a generation is published by a pointer and kept until the registry
+    // goes, lookups are a single acquire load. services are only ever added, so the
+    // generations stay few
+    std::atomic<const ServiceMap*>                  services;
+    std::vector<std::unique_ptr<const ServiceMap>>  generations;  // under registerMutex
+    std::mutex                                registerMutex;
+    std::unique_ptr<ThreadPool>               fetchPool;     // consul reads of a refresh
+    UpdateScheduler                           scheduler;
+    std::thread*                              serviceUpdater;
+    log4cplus::Logger*                        logger;
+
+    std::shared_ptr<ServiceEntry> find(const std::string& service) const;
+
+   public:
+    BalancerRegistry(const std::string& address,
+                     const std::string& zone,
+                     const std::string& cpuThresholdKey    = "clb/rs/cpu_threshold.json",
+                     const std::string& zoneCPUKey         = "clb/rs/zone_cpu.json",
+                     const std::string& instanceFactorKey  = "clb/rs/instance_factor.json",
+                     const std::string& onlinelabFactorKey = "clb/rs/onlinelab_factor.json",
+                     int                timeoutS           = 5,
+                     int                intervalS          = 60);
+    ~BalancerRegistry();
+
+    void SetLogger(log4cplus::Logger* logger);
+    void SetSchedulerOption(const SchedulerOption& option) {
+        this->scheduler.SetOption(option);
+    }
+    // threads reading the keys and the service health of a refresh, the updater thread
+    // reads too. 4 by default, call before Start
+    void SetFetchThreads(int threads) {
+        this->fetchPool.reset(new ThreadPool(threads));
+    }
+
+    // register a service with the registry kv keys, or its own ones. safe while running,
+    // the service is resolved from the next refresh on
+    std::tuple<int, std::string> Register(const std::string& service);
+    std::tuple<int, std::string> Register(const std::string& service,
+                                          const std::string& cpuThresholdKey,
+                                          const std::string& zoneCPUKey,
+                                          const std::string& instanceFactorKey,
+                                          const std::string& onlinelabFactorKey);
+
+    // refresh every registered service once
+    std::tuple<int, std::string> updateAll();
+
+    std::tuple<int, std::string> Start();
+    std::tuple<int, std::string> Stop();
+
+    // nullptr when the service is unknown or has no nodes yet
+    std::shared_ptr<ServiceNode>    SelectedNode(const std::string& service);
+    std::shared_ptr<ConsulResolver> getResolver(const std::string& service);
+    uint64_t                        getLastUpdated(const std::string& service);
+    std::string                     getLocalZone() const {
+        return this->zone;
+    }
+};
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "consul_node.h"
+
+namespace kit {
+
+struct ConnectionPoolOption {
+    int  maxIdlePerNode   = 8;      // idle connections kept per node
+    int  prewarm          = 1;      // connections opened when a node joins the candidate pool
+    int  connectTimeoutMs = 200;
+    int  idleTimeoutMs    = 60000;  // idle longer than this are closed
+    bool keepAlive        = true;   // SO_KEEPALIVE, and TCP_NODELAY
+};
+
+// idle connections of one node, shared by the pool and the leases
+struct NodeConnections {
+    struct Idle {
+        int      fd;
+        uint64_t idleSinceMs;
+    };
+
+    std::string             address;  // host:port
+    sockaddr_storage        addr;
+    socklen_t               addrLen;
+    size_t                  maxIdle;
+    std::mutex              mutex;
+    std::vector<Idle>       idle;     // last in first out, the warmest on top, under mutex
+    bool                    closed;   // node left the candidate pool, under mutex
+
+    ~NodeConnections();
+    // keep fd idle, false once closed or full and the caller closes it
+    bool Put(int fd, uint64_t nowMs);
+    // the node left, idle connections closed and leases close on release
+    void Close();
+};
+
+// Connection is a leased non blocking socket, it goes back to the idle list of its
+// node when destroyed, unless marked broken or the node was removed meanwhile
+class Connection {
+    int                            fd;
+    std::shared_ptr<ServiceNode>   node;
+    std::weak_ptr<NodeConnections> owner;
+    bool                           broken;
+
+   public:
+    Connection(int fd, const std::shared_ptr<ServiceNode>& node, const std::shared_ptr<NodeConnections>& owner);
+    ~Connection();
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int getFD() const {
+        return this->fd;
+    }
+    std::shared_ptr<ServiceNode> getNode() const {
+        return this->node;
+    }
+    // any io error or protocol desync, the socket is closed instead of reused
+    void MarkBroken() {
+        this->broken = true;
+    }
+};
+
+// ConnectionPool keeps ready connections per candidate node. Refresh follows the
+// candidate pool: joining nodes are pre-warmed, leaving ones torn down and idle
+// connections evicted. Acquire hands out an idle connection or connects one
+class ConnectionPool {
+    typedef std::unordered_map<std::string, std::shared_ptr<NodeConnections>> NodeMap;
+
+    ConnectionPoolOption           option;
+    std::shared_ptr<const NodeMap> nodes;  // copy on write, atomic_load to read
+    std::mutex                     refreshMutex;
+
+    std::tuple<int, std::string> resolve(const ServiceNode& node, NodeConnections& connections);
+    // a non blocking connect, pending while the handshake is still running
+    std::tuple<int, int, std::string> startConnect(const NodeConnections& connections, bool& pending);
+    std::tuple<int, int, std::string> connect(const NodeConnections& connections);
+    // connections of the joining nodes, all handshakes at once under one timeout
+    void prewarm(const std::vector<std::shared_ptr<NodeConnections>>& joined);
+    void evict(NodeConnections& connections, uint64_t nowMs);
+
+   public:
+    explicit ConnectionPool(const ConnectionPoolOption& option = ConnectionPoolOption());
+    ~ConnectionPool();
+
+    // prewarm false keeps the caller off connect, e.g. on the selection path
+    void Refresh(const CandidatePool& pool, bool prewarm = true);
+    std::tuple<int, std::unique_ptr<Connection>, std::string> Acquire(const std::shared_ptr<ServiceNode>& node);
+    // idle connections of a node, -1 for an unknown node
+    int IdleNum(const std::string& address) const;
+    void Close();
+};
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <json11.hpp>
+#include <map>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -10,6 +11,15 @@
 
 namespace kit {
 
+// server side filtering of the health query, only the matching nodes are sent back
+struct ServiceFilter {
+    std::string                        expression;  // consul filter expression, e.g. `Service.Meta.zone == "us-east-1a"`
+    std::map<std::string, std::string> nodeMeta;    // node-meta key:value pairs, all must match
+
+    // query string, empty or starting with '&'
+    std::string Query() const;
+};
+
 class ConsulClient {
     std::string address;
 
@@ -18,10 +28,16 @@ public:
         this->address = address;
     }
 
-    // TODO: making lastIndex working, for now useless
+    // lastIndex keeps the X-Consul-Index of one source, an unchanged index returns an empty result
     std::tuple<int, std::vector<std::shared_ptr<ServiceNode>>, std::string> GetService(const std::string &serviceName,
                                                                                        int timeoutS,
-                                                                                       std::string &lastIndex);
+                                                                                       std::string &lastIndex,
+                                                                                       const ServiceFilter &filter = ServiceFilter());
+    // a binary value, see factor_table, comes back as a json string holding the raw bytes
     std::tuple<int, json11::Json, std::string> GetKV(const std::string &path, int timeoutS, std::string &lastIndex);
+    // every key under prefix as {"<key without prefix>": "<raw value>"}
+    std::tuple<int, json11::Json, std::string> GetKVPrefix(const std::string &prefix, int timeoutS, std::string &lastIndex);
+    std::tuple<int, std::string> PutKV(const std::string &path, const std::string &value, int timeoutMs);
+    std::tuple<int, std::string> DeleteKV(const std::string &path, int timeoutMs);
 };
 }
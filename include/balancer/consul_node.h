@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -8,6 +12,18 @@
 
 namespace kit {
 
+// counters of an instance across the refreshes, shared by every copy of its node. the
+// updater keeps the rest of the instance state here too, found once per health update
+struct NodeStats {
+    std::atomic<uint64_t> selectNum{0};  // since the resolver first saw the instance
+    // updater only
+    uint64_t generation = 0;             // last health update the instance was in
+    uint64_t startMs = 0;                // slow start begin, 0 for the first nodes
+    uint32_t storeID = UINT32_MAX;       // FactorStore id, a hint checked on use
+    uint64_t poolVersion = 0;            // last pool built with the instance
+    double   poolFactor = 0;             // its factor in that pool
+};
+
 struct ServiceNode {
     std::string host;
     std::string instanceID;
@@ -17,6 +33,7 @@ struct ServiceNode {
     double balanceFactor;
     double currentFactor;
     double workload;
+    std::shared_ptr<NodeStats> stats;  // null for nodes not built by a resolver, e.g. from shared memory
 
     std::string Address() {
         std::stringstream ss;
@@ -48,6 +65,36 @@ struct ServiceNode {
     }
 };
 
+// load reported by a service instance itself, kept compact in consul kv:
+// "v1,<cpu>,<inflight>,<queueDepth>,<updated>"
+struct InstanceLoad {
+    double   cpu = 0;         // percent
+    int64_t  inflight = 0;    // requests in flight
+    int64_t  queueDepth = 0;  // requests waiting
+    uint64_t updated = 0;     // unix time of the sample
+
+    std::string Encode() const {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "v1,%.1f,%lld,%lld,%llu", this->cpu, (long long)this->inflight,
+                 (long long)this->queueDepth, (unsigned long long)this->updated);
+        return buf;
+    }
+
+    static bool Decode(const std::string &value, InstanceLoad &load) {
+        double cpu;
+        long long inflight, queueDepth;
+        unsigned long long updated;
+        if (sscanf(value.c_str(), "v1,%lf,%lld,%lld,%llu", &cpu, &inflight, &queueDepth, &updated)!=4) {
+            return false;
+        }
+        load.cpu = cpu;
+        load.inflight = inflight;
+        load.queueDepth = queueDepth;
+        load.updated = updated;
+        return true;
+    }
+};
+
 struct ServiceZone {
     std::string zone;
     double workload;
@@ -71,6 +118,12 @@ struct CandidatePool {
     std::vector<double> factors;
     std::vector<double> weights;
     double factorSum;
+    std::vector<uint64_t> rampStartMs;  // slow start begin of each node, 0 for none, may be empty
+    uint64_t rampNewestMs = 0;          // latest of rampStartMs
+    double overload = 0;                // how far the least loaded zone is above the cpu threshold, [0, 1]
+    std::vector<double> previousFactors;  // factor of each node in the pool this one replaced, 0 for joining nodes, may be empty
+    uint64_t transitionStartMs = 0;       // when this pool replaced the previous one
+    uint64_t version = 0;                 // pools built by a resolver count up, see SelectionTrace
 
     json11::Json to_json() const {
         std::vector<ServiceNode> nodes(this->nodes.size());
@@ -82,6 +135,7 @@ struct CandidatePool {
             {"factors", this->factors},
             {"factorSum", this->factorSum},
             {"weights", this->weights},
+            {"overload", this->overload},
         };
     }
 };
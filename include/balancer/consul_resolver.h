@@ -4,6 +4,7 @@
 #include <iostream>
 #include <json11.hpp>
 #include <log4cplus/logger.h>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <thread>
@@ -11,39 +12,94 @@
 #include <vector>
 
 #include "consul_client.h"
+#include "factor_learner.h"
+#include "factor_store.h"
+#include "factor_table.h"
+#include "freshness.h"
 #include "onlinelab.h"
 #include "resolver_metic.h"
+#include "selection_policy.h"
+#include "subsetter.h"
+#include "topology.h"
+#include "util/prometheus.h"
+#include "util/thread_pool.h"
 
 namespace kit {
 
+// one refresh worth of consul responses, fetched by the resolver itself or shared by a registry.
+// a null kv with SUCCESS means not modified
+struct ConsulFetch {
+    int                                       code[DATA_SOURCE_NUM] = {};
+    std::string                               err[DATA_SOURCE_NUM];
+    json11::Json                              kv[DATA_SOURCE_NUM];
+    std::vector<std::shared_ptr<ServiceNode>> nodes;                  // health
+    bool                                      nodesModified = true;
+};
+
 class ConsulResolver {
     ConsulClient                                               client;
     std::string                                                address;              // consul 地址，一般为本地 agent
     std::string                                                service;              // 要访问的服务名
-    std::string                                                lastIndex;            // blocking 访问 consul
+    std::string                                                sourceIndex[DATA_SOURCE_NUM];  // 各数据源的 consul index
     std::string                                                zone;                 // 服务地区
 
     std::shared_ptr<CandidatePool>                             candidatePool;        // candidate nodes
     std::shared_ptr<ServiceZone>                               localZone;            // 本地 zone
     std::shared_ptr<std::vector<std::shared_ptr<ServiceZone>>> serviceZones;         // 所有 zone 的服务节点
+    std::vector<std::shared_ptr<ServiceNode>>                  serviceNodes;         // 最近一次从 consul 获取的服务节点
+    std::vector<std::shared_ptr<NodeStats>>                    serviceStats;         // serviceNodes 各节点的实例状态
+    std::vector<uint32_t>                                      serviceZoneIndex;     // serviceNodes 各节点的 zone 下标，每次刷新复用
 
     std::unordered_map<std::string, double>                    zoneCPUMap;           // 各个 zone 负载情况，从 consul 中获取
     std::unordered_map<std::string, double>                    instanceFactorMap;    // 各个机型的权重，从 consul 中获取
-    std::unordered_map<std::string, double>                    balanceFactorCache;   // 内存中调整后的factor缓存
+    json11::Json                                               instanceFactorRaw;    // 二进制格式的 instance factor，instanceFactorTable 的内存
+    FactorTableView                                            instanceFactorTable;  // 二进制格式时代替 instanceFactorMap
+    FactorStore                                                factorStore;          // 内存中调整后的factor，按代过期
+    std::unordered_map<std::string, InstanceLoad>              instanceLoadMap;      // 各实例自己上报的负载，从 consul 中获取
+    bool                                                       instanceLoadUpdated;  // instance load updated
+    uint64_t                                                   instanceLoadNewest;   // 最新上报时间
+    int                                                        instanceLoadMaxAgeS;  // 单个上报超过这么久不再采用，实例下线后的残留
     double                                                     cpuThreshold;         // cpu 阀值，根据 qps 预测要访问的服务 cpu，超过阀值，跨 zone 访问，[0,1]
     OnlineLab                                                  onlinelab;
+    FactorLearner                                              learner;              // factor 学习
+    LearningBatch                                              learningBatch;        // 学习用的节点数组，每次刷新复用
+    Subsetter                                                  subsetter;            // 客户端子集
+    std::vector<std::shared_ptr<ServiceNode>>                  candidateNodes;       // 子集前的候选节点，每次刷新复用
+    std::vector<size_t>                                        candidateZoneBegin;   // 各 zone 在 candidateNodes 中的起点
+    std::vector<char>                                          candidateKeep;        // 是否在子集中
+    std::vector<uint32_t>                                      candidateIDs;         // 各候选节点在 factorStore 中的 id
+    SmoothWeightedSelection                                    selection;            // 节点选择，含新节点预热
+    bool                                                       nodeStartPrimed;      // 已有过节点
+    TopologyDiffer                                             topologyDiffer;       // 候选池变化
+    TopologyDispatcher                                         topologyDispatcher;   // 变化通知线程
+    bool                                                       topologyEnabled;      // 有订阅后才计算变化
+    std::mutex                                                 topologyMutex;        // 变化计算锁
 
 
     std::string                                                cpuThresholdKey;      // cpu 阀值，超过阀值跨 zone 访问，从 consul 中获取
     std::string                                                instanceFactorKey;    // 机器权重在 consul 中的 key
     std::string                                                onlinelabFactorKey;   // tuning factor
     std::string                                                zoneCPUKey;           // cpu 阀值在 consul 中的 key
+    std::string                                                instanceLoadPrefix;   // 实例上报负载在 consul 中的前缀，空则不读取
+    ServiceFilter                                              serviceFilter;        // 服务端过滤健康节点
+    bool                                                       localZoneOnly;        // 不跨 zone 时只拉取本 zone 节点
+    std::string                                                healthQuery;          // 上次健康查询的过滤参数
 
     std::shared_ptr<ResolverMetric>                            metric;               // metric of resolver
+    ResolverStats                                              stats;                // 累计的 metric，不随候选池重置
+    std::unordered_map<std::string, std::shared_ptr<NodeStats>> nodeStats;           // 各实例的累计 metric 与状态
+    uint64_t                                                   nodeStatsGeneration;  // 健康节点更新次数，清理消失的实例
+    std::unique_ptr<ThreadPool>                                refreshPool;          // 刷新时分片处理节点
+    uint64_t                                                   poolVersion;          // 已构建的候选池数
+    std::shared_ptr<SelectionTrace>                            trace;                // 选择与刷新事件记录，可为空
     bool                                                       zoneCPUUpdated;       // zone cpu updated
+    int                                                        unbalancedNodeNum;    // 上次学习时未均衡的节点数
+    time_t                                                     zoneCPULastUpdated;   // zone cpu 数据的生成时间
+    DataFreshness                                              freshness[DATA_SOURCE_NUM];  // 各数据源的新鲜度
+    StalenessPolicy                                            stalenessPolicy;      // 数据过期策略
+    mutable std::mutex                                         freshnessMutex;       // 新鲜度锁
     int                                                        timeoutS;             // 访问 consul 超时时间
     boost::shared_mutex                                        serviceUpdaterMutex;  // 服务更新锁
-    std::mutex                                                 discoverMutex;        // 阻塞调用 DiscoverNode
     log4cplus::Logger*                                         logger;               // 日志
 
    public:
@@ -65,8 +121,13 @@ class ConsulResolver {
             {"cpuThreshold", this->cpuThreshold},
             {"zoneCPUMap", this->zoneCPUMap},
             {"onlinelab", this->onlinelab},
+            {"freshness", this->freshnessJson()},
+            {"refresh", this->refreshJson()},
         };
     }
+    json11::Json freshnessJson() const;
+    // time of the last refresh and of its stages, us
+    json11::Json refreshJson() const;
 
     // consul update
     std::tuple<int, std::string> updateCPUThreshold();
@@ -76,9 +137,34 @@ class ConsulResolver {
     std::tuple<int, std::string> updateServiceZone();
     std::tuple<int, std::string> updateCandidatePool();
     std::tuple<int, std::string> updateAll();
+    std::tuple<int, std::string> applyAll(const ConsulFetch& fetch, uint64_t now);
+
+    // apply fetched consul data, a null kv means not modified
+    std::tuple<int, std::string> applyCPUThreshold(const json11::Json& kv);
+    std::tuple<int, std::string> applyZoneCPUMap(const json11::Json& kv);
+    std::tuple<int, std::string> applyInstanceFactorMap(const json11::Json& kv);
+    std::tuple<int, std::string> applyOnlinelabFactor(const json11::Json& kv);
+    std::tuple<int, std::string> applyInstanceLoadMap(const json11::Json& kv);
+    std::tuple<int, std::string> applyServiceNodes(const std::vector<std::shared_ptr<ServiceNode>>& nodes, bool modified);
+    void buildServiceZone();
+    // instance factor from the json or the binary table
+    bool instanceFactor(const std::string& instanceID, double& factor) const;
+
+    // freshness
+    void markFetched(DataSource source, int code, const std::string& err, uint64_t now);
+    void expireStaleData(uint64_t now);
+    void SetStalenessPolicy(const StalenessPolicy& policy);
+    DataFreshness getFreshness(DataSource source);
+
+    // factors still being learned, the updater polls faster meanwhile. nodes the factor
+    // limit holds back count as converged, see FactorLearner::Learn
+    bool Converging() const {
+        return this->unbalancedNodeNum > 0;
+    }
 
-    // clean factor cache
-    std::tuple<int, std::string> expireBalanceFactorCache();
+    const FactorStore& getFactorStore() const {
+        return this->factorStore;
+    }
 
     // balanced or not
     bool nodeBalanced(const ServiceNode&, const ServiceZone&);
@@ -86,7 +172,71 @@ class ConsulResolver {
 
     // selection
     std::shared_ptr<ServiceNode> SelectedNode();
-    std::string getLocalZone();
+    // count a selection into the metric of the current pool
+    void countSelected(const ServiceNode& node);
+    std::shared_ptr<ResolverMetric> getMetric();
+    // selections, factors, refresh time and consul health in prometheus text format
+    void RenderMetrics(PrometheusWriter& writer);
+    const std::string& getLocalZone() const;
+    const std::string& getService() const {
+        return this->service;
+    }
+    // consul key of a kv source, the service name for health
+    const std::string& getKey(DataSource source) const;
+    // consul index of the last fetch of a source, "0" until fetched or once expired
+    const std::string& getIndex(DataSource source) const {
+        return this->sourceIndex[source];
+    }
+    bool sourceEnabled(DataSource source) const;
+
+    // read the loads published by LoadPublisher under prefix, e.g. "clb/load/rs". a report
+    // older than maxAgeS is ignored, the key of an instance that died without Stop stays
+    void SetInstanceLoadPrefix(const std::string& prefix, int maxAgeS = 30);
+    // filter the health query on the consul side. localZoneOnly adds the local zone to the
+    // expression while onlinelab turns cross zone off, nodes must carry Service.Meta.zone
+    void SetServiceFilter(const ServiceFilter& filter, bool localZoneOnly = false);
+    // effective filter of the next health query, index is reset when the filter changed since lastQuery
+    ServiceFilter prepareHealthFilter(std::string& index, std::string& lastQuery) const;
+    // restrict this client to a subset of every zone, before the first update
+    void SetSubsetOption(const SubsetOption& option);
+
+    // candidate pool, SetCandidatePool installs a pool built elsewhere, e.g. copied from shared memory
+    std::shared_ptr<CandidatePool> getCandidatePool();
+    void SetCandidatePool(const std::shared_ptr<CandidatePool>& candidatePool);
+
+    // topology deltas, computed on every candidate pool swap once someone subscribed
+    void diffTopology(const std::shared_ptr<CandidatePool>& candidatePool);
+    uint64_t SubscribeTopology(const TopologyCallback& callback);
+    void UnsubscribeTopology(uint64_t id);
+    void SetTopologyOption(const TopologyOption& option);
+
+    // ramp the factor of joining nodes at selection
+    void SetSlowStartOption(const SlowStartOption& option) {
+        this->selection.SetSlowStartOption(option);
+    }
+    // move from the factors of the previous pool to the new ones at selection
+    void SetTransitionOption(const TransitionOption& option) {
+        this->selection.SetTransitionOption(option);
+    }
+    // record selections and pool swaps into trace, null to stop. call before Start
+    void SetTrace(const std::shared_ptr<SelectionTrace>& trace) {
+        this->trace = trace;
+        this->selection.SetTrace(trace.get());
+    }
+    void traceRefresh(const CandidatePool& candidatePool);
+
+    // threads besides the updater splitting the per node work of a refresh, 0 by default.
+    // worth it from tens of thousands of nodes, call before Start
+    void SetRefreshThreads(int threads) {
+        this->refreshPool.reset(new ThreadPool(threads));
+    }
+    uint64_t getStageUs(RefreshStage stage) const {
+        return this->stats.stageLastUs[stage].load(std::memory_order_relaxed);
+    }
+
+    void SetFactorLimit(const FactorLimit& limit) {
+        this->learner.SetLimit(limit);
+    }
 
     // logger
     void SetLogger(log4cplus::Logger* logger) {
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <json11.hpp>
+#include <vector>
+
+#include "onlinelab.h"
+
+namespace kit {
+
+// risk control of the learned factors
+struct FactorLimit {
+    double maxLocal   = 3000;
+    double minLocal   = 200;
+    double maxCross   = 1000;
+    double minCross   = 1;
+    double startCross = 50;   // floor of a cross zone factor when the local zone starts spilling
+    double crossRate  = 0.1;  // initial cross zone factor rate of the config factor
+
+    json11::Json to_json() const {
+        return json11::Json::object{
+            {"maxLocal", this->maxLocal},
+            {"minLocal", this->minLocal},
+            {"maxCross", this->maxCross},
+            {"minCross", this->minCross},
+            {"startCross", this->startCross},
+            {"crossRate", this->crossRate},
+        };
+    }
+};
+
+// LearningBatch holds one refresh worth of candidate nodes as dense arrays,
+// index i of every array describes the same node
+struct LearningBatch {
+    std::vector<double>  workload;      // node workload
+    std::vector<double>  zoneWorkload;  // workload of the node's zone
+    std::vector<double>  configFactor;  // factor from the consul service meta
+    std::vector<double>  cachedFactor;  // factor learned by the previous refreshes
+    std::vector<uint8_t> cached;        // cachedFactor is valid
+    std::vector<uint8_t> local;         // node in the local zone
+    std::vector<uint8_t> spill;         // cross zone node whose zone should absorb the local overload
+    std::vector<double>  factor;        // output
+
+    size_t Size() const {
+        return this->workload.size();
+    }
+
+    // keeps the capacity, so steady refreshes do not allocate
+    void Clear();
+    void Add(double workload, double zoneWorkload, double configFactor, bool cached, double cachedFactor, bool local,
+             bool spill);
+    // n nodes filled by Set, from several threads as long as each writes its own i
+    void Resize(size_t n);
+    void Set(size_t i, double workload, double zoneWorkload, double configFactor, bool cached, double cachedFactor,
+             bool local, bool spill) {
+        this->workload[i]     = workload;
+        this->zoneWorkload[i] = zoneWorkload;
+        this->configFactor[i] = configFactor;
+        this->cachedFactor[i] = cached ? cachedFactor : 0;
+        this->cached[i]       = cached;
+        this->local[i]        = local;
+        this->spill[i]        = spill;
+    }
+};
+
+// FactorLearner adjusts node factors toward equal workload within a zone and
+// spills load to cross zones, every pass is a branch light loop over the batch
+class FactorLearner {
+    FactorLimit limit;
+    double      localAvgFactor;  // local zone average factor for fresh new node
+
+   public:
+    FactorLearner();
+
+    void SetLimit(const FactorLimit& limit) {
+        this->limit = limit;
+    }
+    const FactorLimit& getLimit() const {
+        return this->limit;
+    }
+    double getLocalAvgFactor() const {
+        return this->localAvgFactor;
+    }
+
+    // fill batch.factor, learning is false when the zone cpu did not change since the
+    // previous refresh. return the number of nodes out of balance whose factor can still
+    // move, the ones clamped by the limit in the direction they are pushed are left out
+    int Learn(const OnlineLab& onlinelab, bool learning, LearningBatch& batch);
+};
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <json11.hpp>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kit {
+
+struct FactorStoreOption {
+    uint32_t ttl        = 500;     // refreshes a learned factor lives, each entry gets ttl/2 + hash % ttl
+    uint32_t departedTTL = 3;      // refreshes a node may be missing before its entry is dropped
+    uint32_t capacity   = 65536;   // max entries, the least recently seen go first
+};
+
+// FactorStore keeps the learned factor of every node in dense arrays indexed by
+// a compact id. one refresh is one generation: entries age out on their own,
+// departed nodes after departedTTL generations, learned ones after their ttl,
+// so the fleet never relearns all at once
+class FactorStore {
+    FactorStoreOption                         option;
+    std::unordered_map<std::string, uint32_t> ids;  // instanceID => id
+    std::vector<std::string>                  instanceIDs;
+    std::vector<double>                       factors;
+    std::vector<uint32_t>                     bornGen;    // generation the factor was first learned, 0 if none
+    std::vector<uint32_t>                     seenGen;    // last generation the node was in a refresh, 0 for a free id
+    std::vector<uint32_t>                     expireGen;  // bornGen + jittered ttl
+    std::vector<uint32_t>                     freeIDs;
+    std::vector<std::pair<uint32_t, uint32_t>> sweep;  // seenGen, id; reused by End
+    uint32_t                                  generation;
+
+    void     release(uint32_t id);
+    uint32_t jitteredTTL(const std::string& instanceID) const;
+
+   public:
+    explicit FactorStore(const FactorStoreOption& option = FactorStoreOption());
+
+    void SetOption(const FactorStoreOption& option) {
+        this->option = option;
+    }
+    const FactorStoreOption& getOption() const {
+        return this->option;
+    }
+
+    // start a refresh
+    void Begin();
+    // id of a node in this refresh, created when unknown
+    uint32_t Acquire(const std::string& instanceID);
+    // same, hint is the id the node got in an earlier refresh, used instead of the lookup
+    // while it still belongs to instanceID
+    uint32_t Acquire(const std::string& instanceID, uint32_t hint);
+    // learned factor of id, false when none or expired
+    bool Get(uint32_t id, double& factor) const;
+    void Set(uint32_t id, double factor);
+    // end a refresh, drop departed, expired and over capacity entries
+    void End();
+    void Clear();
+
+    size_t Size() const {
+        return this->ids.size();
+    }
+    json11::Json to_json() const;
+};
+
+}
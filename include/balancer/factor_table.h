@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kit {
+
+// compact binary encoding of the instance factor kv, an alternative to
+//   {"updated": ..., "data": [{"instanceid": "i-1", "CPUUtilization": 42.0}, ...]}
+//
+// little endian whatever the host, version 1:
+//   char     magic[4]            "CKIF"
+//   uint16_t version
+//   uint16_t reserved
+//   uint32_t count
+//   uint64_t updated             unix time of the producer, 0 if none
+//   uint32_t offsets[count + 1]  into ids, ids sorted bytewise
+//   float    values[count]
+//   char     ids[]               instance ids back to back, no separator
+namespace factor_table {
+
+const char     MAGIC[4]    = {'C', 'K', 'I', 'F'};
+const uint16_t VERSION     = 1;
+const size_t   HEADER_SIZE = 20;
+
+// fields are read and written byte by byte in little endian, a plain load on x86
+template <typename T>
+inline T LoadLE(const char* p) {
+    T v = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        v |= static_cast<T>(static_cast<uint8_t>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+inline float LoadFloatLE(const char* p) {
+    auto  bits = LoadLE<uint32_t>(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+inline bool IsBinary(const std::string& data) {
+    return data.size() >= sizeof(MAGIC) && memcmp(data.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// values need not be sorted
+std::string Encode(std::vector<std::pair<std::string, double>> values, uint64_t updated);
+
+}
+
+// FactorTableView reads an encoded table where it lies, lookups are binary
+// searches over the offsets, nothing is copied. the buffer must outlive the view
+class FactorTableView {
+    const char* data;
+    uint32_t    count;
+    uint64_t    updated;
+    const char* offsets;
+    const char* values;
+    const char* ids;
+
+    uint32_t offset(uint32_t i) const {
+        return factor_table::LoadLE<uint32_t>(this->offsets + i * sizeof(uint32_t));
+    }
+
+   public:
+    FactorTableView() : data(nullptr), count(0), updated(0), offsets(nullptr), values(nullptr), ids(nullptr) {}
+
+    // validate the header and every offset, false with err on a malformed table
+    bool Parse(const char* data, size_t size, std::string& err);
+    void Reset() {
+        *this = FactorTableView();
+    }
+
+    bool Find(const char* id, size_t len, double& value) const;
+    bool Find(const std::string& id, double& value) const {
+        return this->Find(id.data(), id.size(), value);
+    }
+
+    bool Valid() const {
+        return this->data != nullptr;
+    }
+    uint32_t Size() const {
+        return this->count;
+    }
+    uint64_t getUpdated() const {
+        return this->updated;
+    }
+    std::string ID(uint32_t i) const {
+        return std::string(this->ids + this->offset(i), this->offset(i + 1) - this->offset(i));
+    }
+    double Value(uint32_t i) const {
+        return factor_table::LoadFloatLE(this->values + i * sizeof(float));
+    }
+};
+
+}
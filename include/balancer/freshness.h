@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <json11.hpp>
+#include <string>
+
+namespace kit {
+
+// consul data sources feeding the resolver, each one ages independently
+enum DataSource {
+    DATA_CPU_THRESHOLD,
+    DATA_ZONE_CPU,
+    DATA_INSTANCE_FACTOR,
+    DATA_ONLINELAB,
+    DATA_INSTANCE_LOAD,  // self reported by the service instances, optional
+    DATA_HEALTH,
+    DATA_SOURCE_NUM
+};
+
+inline const char* DataSourceName(int source) {
+    static const char* names[DATA_SOURCE_NUM] = {
+        "cpuThreshold", "zoneCPU", "instanceFactor", "onlinelab", "instanceLoad", "health",
+    };
+    return source >= 0 && source < DATA_SOURCE_NUM ? names[source] : "unknown";
+}
+
+struct DataFreshness {
+    uint64_t    lastAttempt = 0;  // unix time of the last fetch
+    uint64_t    lastSuccess = 0;  // unix time of the last successful fetch, 0 if never
+    uint64_t    dataUpdated = 0;  // producer timestamp carried by the data, 0 if none
+    int         failures    = 0;  // consecutive failures
+    uint64_t    errors      = 0;  // failures in total
+    bool        expired     = false;  // older than the policy allows, fallback in use
+    std::string lastError;
+
+    // seconds since the data was produced, or fetched when it carries no timestamp
+    uint64_t Age(uint64_t now) const {
+        auto since = this->dataUpdated != 0 ? this->dataUpdated : this->lastSuccess;
+        if (since == 0) {
+            return UINT64_MAX;
+        }
+        return now > since ? now - since : 0;
+    }
+
+    json11::Json to_json() const {
+        return json11::Json::object{
+            {"lastAttempt", static_cast<double>(this->lastAttempt)},
+            {"lastSuccess", static_cast<double>(this->lastSuccess)},
+            {"dataUpdated", static_cast<double>(this->dataUpdated)},
+            {"failures", this->failures},
+            {"errors", static_cast<double>(this->errors)},
+            {"expired", this->expired},
+            {"lastError", this->lastError},
+        };
+    }
+};
+
+// StalenessPolicy bounds how old each source may get before the resolver falls back:
+//   cpuThreshold / onlinelab: back to the defaults
+//   zoneCPU / instanceFactor: back to the default workloads, factor learning is held
+//   instanceLoad: back to zoneCPU / instanceFactor
+//   health: the last known nodes keep serving, only reported
+// 0 means never expire
+struct StalenessPolicy {
+    int maxStalenessS[DATA_SOURCE_NUM];
+
+    StalenessPolicy() {
+        this->maxStalenessS[DATA_CPU_THRESHOLD]   = 3600;
+        this->maxStalenessS[DATA_ZONE_CPU]        = 600;
+        this->maxStalenessS[DATA_INSTANCE_FACTOR] = 600;
+        this->maxStalenessS[DATA_ONLINELAB]       = 3600;
+        this->maxStalenessS[DATA_INSTANCE_LOAD]   = 60;
+        this->maxStalenessS[DATA_HEALTH]          = 300;
+    }
+
+    bool Expired(int source, const DataFreshness& freshness, uint64_t now) const {
+        auto maxStaleness = this->maxStalenessS[source];
+        return maxStaleness > 0 && freshness.Age(now) > static_cast<uint64_t>(maxStaleness);
+    }
+};
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "consul_node.h"
+
+namespace kit {
+
+struct HedgeOption {
+    double   percentile      = 0.95;  // hedge once the primary is slower than this share of requests
+    uint64_t minDelayUs      = 1000;  // never hedge earlier than this
+    int      windowS         = 10;    // latency history, two windows are kept
+    int      minSamples      = 50;    // no hedge before this many reports in the history
+    int      maxBackupTries  = 3;     // selections tried to find a node other than the primary
+    double   budgetRatio     = 0.1;   // retry tokens earned per request, 0.1 allows 10% extra load
+    double   budgetPerSecond = 10;    // tokens earned per second regardless of traffic
+    double   budgetCapacity  = 100;   // max tokens saved up
+};
+
+// LatencyTracker keeps a log scaled histogram of the latencies reported by the caller,
+// quarter octave buckets, about 19% resolution. the current and the previous window
+// are summed, so a percentile never starts from an empty history
+class LatencyTracker {
+    static const int BUCKET_NUM = 160;
+
+    struct Window {
+        std::atomic<uint64_t> counts[BUCKET_NUM];
+    };
+
+    HedgeOption           option;
+    Window                windows[2];
+    std::atomic<uint64_t> current;       // rotations, windows[current % 2] takes the reports
+    std::atomic<uint64_t> rotateAtMs;
+    std::atomic<uint64_t> cachedAtMs;    // percentile computed at most once per 100ms
+    std::atomic<uint64_t> cachedUs;
+
+    void rotate(uint64_t nowMs);
+
+   public:
+    explicit LatencyTracker(const HedgeOption& option = HedgeOption());
+
+    static int Bucket(uint64_t latencyUs);
+    static uint64_t BucketUpper(int bucket);
+
+    void Report(uint64_t latencyUs, uint64_t nowMs);
+    // upper bound of the percentile bucket, 0 while there are fewer than minSamples reports
+    uint64_t Percentile(double percentile, uint64_t nowMs);
+    uint64_t Delay(uint64_t nowMs);
+};
+
+// RetryBudget is a token bucket bounding hedges and retries to a share of the traffic:
+// every request deposits budgetRatio, time adds budgetPerSecond, each retry takes one.
+// during an incident the budget drains and retries stop instead of multiplying the load
+class RetryBudget {
+    HedgeOption           option;
+    std::atomic<int64_t>  milliTokens;
+    std::atomic<uint64_t> refilledAtMs;
+
+    void add(int64_t milliTokens);
+
+   public:
+    explicit RetryBudget(const HedgeOption& option = HedgeOption());
+
+    void Deposit();
+    bool Withdraw(uint64_t nowMs);
+    // give back a token withdrawn for a retry that was not made
+    void Refund();
+    double Tokens() const {
+        return this->milliTokens.load(std::memory_order_relaxed) / 1000.0;
+    }
+};
+
+// one hedged request: send to primary, if it has not answered after delayUs ask for a
+// backup and take the first answer
+struct HedgePlan {
+    std::shared_ptr<ServiceNode> primary;
+    uint64_t                     delayUs = 0;  // 0 means do not hedge, not enough history
+};
+
+// Hedger is the per balancer state of hedging, see BasicBalancer::SelectedHedge
+class Hedger {
+    HedgeOption    option;
+    LatencyTracker latency;
+    RetryBudget    budget;
+
+   public:
+    explicit Hedger(const HedgeOption& option = HedgeOption());
+
+    const HedgeOption& getOption() const {
+        return this->option;
+    }
+
+    // a new request, it earns retry budget and gets the current hedge delay
+    uint64_t Begin(uint64_t nowMs);
+    // take one token for a hedge or a retry, false means give up
+    bool AcquireRetry(uint64_t nowMs);
+    // the token of AcquireRetry was not used
+    void ReleaseRetry();
+    void ReportLatency(uint64_t latencyUs, uint64_t nowMs);
+
+    double Tokens() const {
+        return this->budget.Tokens();
+    }
+};
+
+}
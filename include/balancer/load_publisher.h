@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "consul_client.h"
+#include "consul_node.h"
+
+namespace kit {
+
+struct LoadPublisherOption {
+    int    intervalMs      = 1000;  // sampling period
+    double cpuDelta        = 5;     // publish when cpu moved more than this, in percent
+    double inflightDelta   = 0.2;   // or inflight / queue depth moved more than this ratio
+    int    maxSilenceS     = 10;    // heartbeat, publish at least this often
+    int    timeoutMs       = 500;
+};
+
+// LoadPublisher lets a service instance report its own load into the consul kv
+// under "<prefix>/<instanceID>", the resolvers of its callers read the whole
+// prefix with one request. values are only written when they changed enough,
+// so a fleet of idle instances costs one write per maxSilenceS each. Stop deletes the
+// key; readers ignore reports older than their max age, which covers a crashed instance
+class LoadPublisher {
+    ConsulClient                  client;
+    std::string                   key;
+    LoadPublisherOption           option;
+    std::atomic<int64_t>          inflight;
+    std::function<int64_t()>      queueDepthFunc;
+    std::function<double()>       cpuFunc;
+    InstanceLoad                  published;  // last value written
+    std::mutex                    publishMutex;
+    bool                          stopped;
+    std::mutex                    mutex;
+    std::condition_variable       cond;
+    std::thread*                  publisher;
+
+   public:
+    LoadPublisher(const std::string& address,
+                  const std::string& prefix,
+                  const std::string& instanceID,
+                  const LoadPublisherOption& option = LoadPublisherOption());
+    ~LoadPublisher();
+
+    // wrap every request served, inflight is counted lock free
+    void Begin() {
+        this->inflight.fetch_add(1, std::memory_order_relaxed);
+    }
+    void End() {
+        this->inflight.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void SetQueueDepthFunc(const std::function<int64_t()>& func) {
+        this->queueDepthFunc = func;
+    }
+    // CPUUsage() by default
+    void SetCPUFunc(const std::function<double()>& func) {
+        this->cpuFunc = func;
+    }
+
+    InstanceLoad Sample() const;
+    // write the current load if it differs enough from the last one written
+    std::tuple<int, std::string> PublishOnce(bool force = false);
+
+    std::tuple<int, std::string> Start();
+    // stop publishing and delete the key of the instance
+    void Stop();
+
+    static bool ShouldPublish(const InstanceLoad& last, const InstanceLoad& current,
+                              const LoadPublisherOption& option);
+};
+
+}
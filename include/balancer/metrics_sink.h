@@ -0,0 +1,30 @@
+#pragma once
+
+#include "consul_node.h"
+
+namespace kit {
+
+// MetricsSink of BasicBalancer, notified with the discovery source of the balancer:
+//   void OnSelected(Source& source, const ServiceNode& node)  after every selection
+//   void OnUpdated(Source& source, int code)                  after every discovery refresh
+// hooks are called directly, an empty hook leaves nothing on the hot path
+
+// NullMetrics drops everything
+struct NullMetrics {
+    template <typename Source>
+    void OnSelected(Source&, const ServiceNode&) {}
+    template <typename Source>
+    void OnUpdated(Source&, int) {}
+};
+
+// ResolverMetrics counts into the per pool metric of a ConsulResolver, logged when the pool is swapped
+struct ResolverMetrics {
+    template <typename Source>
+    void OnSelected(Source& source, const ServiceNode& node) {
+        source.countSelected(node);
+    }
+    template <typename Source>
+    void OnUpdated(Source&, int) {}
+};
+
+}
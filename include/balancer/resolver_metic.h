@@ -1,11 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <json11.hpp>
 
+// counted by every selecting thread, read when the pool is swapped
 struct ResolverMetric {
-    int candidatePoolSize;
-    int crossZoneNum;
-    int selectNum;
+    std::atomic<int> candidatePoolSize;
+    std::atomic<int> crossZoneNum;
+    std::atomic<int> selectNum;
 
     ResolverMetric() {
         candidatePoolSize = 0;
@@ -15,9 +18,39 @@ struct ResolverMetric {
 
     json11::Json to_json() const {
         return json11::Json::object{
-            {"candidatePoolSize", candidatePoolSize},
-            {"crossZoneNum", crossZoneNum},
-            {"selectNum", selectNum},
+            {"candidatePoolSize", candidatePoolSize.load()},
+            {"crossZoneNum", crossZoneNum.load()},
+            {"selectNum", selectNum.load()},
         };
     }
 };
+
+// stages of a refresh once the consul data is in
+enum RefreshStage {
+    REFRESH_NODES,   // health nodes matched to the state of their instance
+    REFRESH_ZONE,    // nodes copied with their workload, grouped by zone
+    REFRESH_FACTOR,  // factors looked up and learned
+    REFRESH_POOL,    // candidate pool built and swapped
+    REFRESH_STAGE_NUM
+};
+
+inline const char* RefreshStageName(int stage) {
+    static const char* names[REFRESH_STAGE_NUM] = {"nodes", "zone", "factor", "pool"};
+    return stage >= 0 && stage < REFRESH_STAGE_NUM ? names[stage] : "unknown";
+}
+
+// counters since the resolver was created, never reset, see ConsulResolver::RenderMetrics
+struct ResolverStats {
+    std::atomic<uint64_t> selectNum{0};
+    std::atomic<uint64_t> crossZoneNum{0};
+    std::atomic<uint64_t> refreshNum{0};     // updateAll calls
+    std::atomic<uint64_t> refreshUs{0};      // time spent in them
+    std::atomic<uint64_t> refreshLastUs{0};
+    std::atomic<uint64_t> stageLastUs[REFRESH_STAGE_NUM];  // time of each stage in the last refresh
+
+    ResolverStats() {
+        for (auto &us : stageLastUs) {
+            us = 0;
+        }
+    }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <mutex>
+
+#include "consul_node.h"
+#include "selection_trace.h"
+#include "slow_start.h"
+
+namespace kit {
+
+// SelectionPolicy of BasicBalancer, picks a node out of the candidate pool:
+//   int Select(CandidatePool& pool)  index of the selected node, -1 for an empty pool
+// policies are plain classes held by value, the call inlines into SelectedNode
+
+// TransitionOption moves the factors from the pool being replaced to the new one
+// linearly over windowS, so a refresh is not a step in the traffic of every node.
+// keep it below the refresh interval, a refresh in the middle restarts from the
+// factors of the pool being replaced, not from where the transition was
+struct TransitionOption {
+    int windowS = 0;  // 0 switches at once
+
+    bool Enabled() const {
+        return this->windowS > 0;
+    }
+};
+
+// SmoothWeightedSelection is the smooth weighted round robin over the pool factors,
+// joining nodes ramped by SlowStartOption, refreshes smoothed by TransitionOption.
+// both are computed from the pool and the clock at selection, nothing is rewritten
+// by the updater
+class SmoothWeightedSelection {
+    SlowStartOption  slowStart;
+    TransitionOption transition;
+    SelectionTrace*  trace = nullptr;
+    std::mutex       mutex;  // weights are updated in place
+
+   public:
+    void SetSlowStartOption(const SlowStartOption& option) {
+        this->slowStart = option;
+    }
+    void SetTransitionOption(const TransitionOption& option) {
+        this->transition = option;
+    }
+    // record every pick with the weight it won with, null to stop. set before selecting
+    void SetTrace(SelectionTrace* trace) {
+        this->trace = trace;
+    }
+
+    int Select(CandidatePool& pool) {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        if (pool.nodes.empty()) {
+            return -1;
+        }
+
+        int      idx = 0;
+        double   max = 0;
+        double   factorSum = pool.factorSum;
+        uint64_t now = 0;
+        bool     ramping = false;
+        double   progress = 1;  // of the transition from previousFactors
+        if (this->slowStart.Enabled() && pool.rampNewestMs > 0 && pool.rampStartMs.size()==pool.factors.size()) {
+            now = SlowStartNowMs();
+            ramping = now < pool.rampNewestMs + static_cast<uint64_t>(this->slowStart.windowS)*1000;
+        }
+        if (this->transition.Enabled() && pool.transitionStartMs > 0 && pool.previousFactors.size()==pool.factors.size()) {
+            now = now==0 ? SlowStartNowMs() : now;
+            uint64_t windowMs = static_cast<uint64_t>(this->transition.windowS)*1000;
+            if (now < pool.transitionStartMs + windowMs) {
+                progress = now > pool.transitionStartMs ? static_cast<double>(now - pool.transitionStartMs)/windowMs : 0;
+            }
+        }
+        if (not ramping && progress >= 1) {
+            for (int i = 0; i < pool.factors.size(); i++) {
+                pool.weights[i] += pool.factors[i];
+                if (max < pool.weights[i]) {
+                    max = pool.weights[i];
+                    idx = i;
+                }
+            }
+        } else {
+            // some node still warming up or moving to its new factor, the sum follows
+            factorSum = 0;
+            for (int i = 0; i < pool.factors.size(); i++) {
+                auto factor = pool.factors[i];
+                if (progress < 1) {
+                    factor = pool.previousFactors[i] + (factor - pool.previousFactors[i])*progress;
+                }
+                auto rampStartMs = ramping ? pool.rampStartMs[i] : 0;
+                if (rampStartMs!=0) {
+                    factor *= this->slowStart.Ratio(now > rampStartMs ? now - rampStartMs : 0);
+                }
+                factorSum += factor;
+                pool.weights[i] += factor;
+                if (max < pool.weights[i]) {
+                    max = pool.weights[i];
+                    idx = i;
+                }
+            }
+        }
+        if (this->trace!=nullptr) {
+            this->trace->Record(TRACE_SELECT, pool.version, idx, max, factorSum);
+        }
+        pool.weights[idx] -= factorSum;
+        return idx;
+    }
+};
+
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace kit {
+
+enum TraceEventType {
+    TRACE_SELECT  = 1,  // node picked, weight: its weight when picked, factorSum: of the round
+    TRACE_REFRESH = 2,  // a new pool, node: its size, factorSum: of the pool
+    TRACE_FACTOR  = 3,  // one per node after TRACE_REFRESH, weight: the factor of node
+};
+
+// one event as decoded and dumped
+struct TraceRecord {
+    uint64_t timeNs;       // steady clock
+    uint64_t poolVersion;  // CandidatePool::version
+    int32_t  node;
+    uint16_t type;         // TraceEventType
+    uint16_t thread;       // ring of the event, one per recording thread
+    double   weight;
+    double   factorSum;
+};
+
+// dump file: the header then recordNum TraceRecord oldest first, host byte order
+struct TraceFileHeader {
+    char     magic[8];    // "CKTRACE\0"
+    uint32_t version;     // 1
+    uint32_t recordSize;  // sizeof(TraceRecord)
+    uint64_t recordNum;
+};
+
+struct TraceOption {
+    uint32_t capacity = 4096;  // events kept per thread, rounded up to a power of two, see Reserve
+};
+
+// cpu timestamp counter where there is one, converted to ns when decoded
+inline uint64_t TraceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// SelectionTrace records the selection and refresh events of a balancer into one ring per
+// thread, so the cause of a skew can be replayed: which pool, which factors and weights led
+// to each pick. a thread only writes its own ring, an event is a handful of relaxed stores
+// guarded by a per slot sequence, no lock and no shared cache line. readers copy the rings
+// at any time and drop the slots overwritten meanwhile. a ring goes back to the trace when
+// its thread exits and is handed to the next new thread with its events, so there are as
+// many rings as threads recording at once
+class SelectionTrace {
+    struct Slot {
+        std::atomic<uint64_t> seq;  // index + 1 once written, 0 while being written
+        std::atomic<uint64_t> ticks;
+        std::atomic<uint64_t> poolVersion;
+        std::atomic<uint64_t> nodeType;  // node in the low 32 bits, type above
+        std::atomic<uint64_t> weight;    // double bits
+        std::atomic<uint64_t> factorSum;
+    };
+    struct Ring {
+        std::unique_ptr<Slot[]> slots;
+        uint64_t                mask;
+        std::atomic<uint64_t>   head;  // events written, by the owner thread only
+        uint16_t                thread;
+        std::thread::id         owner;  // under Rings::mutex, none while free
+    };
+    // the rings of a trace, the threads holding one release it on exit through a weak_ptr
+    struct Rings {
+        std::mutex                         mutex;
+        std::vector<std::unique_ptr<Ring>> all;   // index is the thread of the ring
+        std::vector<Ring*>                 free;  // owners exited
+    };
+    // rings held by this thread, released when it exits
+    struct Held {
+        std::vector<std::pair<std::weak_ptr<Rings>, Ring*>> rings;
+        ~Held();
+    };
+    // last trace and ring of this thread, constant initialized, no guard on the fast path
+    struct Cache {
+        uint64_t id;
+        Ring*    ring;
+    };
+    static Cache& cache() {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    TraceOption                        option;
+    uint64_t                           id;  // tells the traces apart in the thread cache
+    uint64_t                           baseTicks;
+    uint64_t                           baseNs;
+    std::shared_ptr<Rings>             rings;
+    std::thread*                       watcher;
+    std::atomic<bool>                  watching;
+    int                                signo;  // of DumpOnSignal, 0 for none
+
+    Ring* ring();
+    static uint64_t bits(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+   public:
+    explicit SelectionTrace(const TraceOption& option = TraceOption());
+    ~SelectionTrace();
+
+    void Record(TraceEventType type, uint64_t poolVersion, int32_t node, double weight, double factorSum) {
+        auto& cache = SelectionTrace::cache();
+        auto  ring  = cache.id == this->id ? cache.ring : this->ring();
+        if (ring == nullptr) {
+            // more threads recording at once than a record can tell apart
+            return;
+        }
+        auto  i     = ring->head.load(std::memory_order_relaxed);
+        auto& slot  = ring->slots[i & ring->mask];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.ticks.store(TraceTicks(), std::memory_order_relaxed);
+        slot.poolVersion.store(poolVersion, std::memory_order_relaxed);
+        slot.nodeType.store(static_cast<uint32_t>(node) | static_cast<uint64_t>(type) << 32, std::memory_order_relaxed);
+        slot.weight.store(bits(weight), std::memory_order_relaxed);
+        slot.factorSum.store(bits(factorSum), std::memory_order_relaxed);
+        slot.seq.store(i + 1, std::memory_order_release);
+        ring->head.store(i + 1, std::memory_order_release);
+    }
+
+    // grow the ring of this thread to hold at least events, the ones it has are kept. a
+    // burst that has to be read whole, a refresh and the factors of its pool, reserves
+    // before recording
+    void Reserve(uint64_t events);
+
+    // events of every thread still in the rings, oldest first
+    void Snapshot(std::vector<TraceRecord>& records);
+    std::tuple<int, std::string> Dump(const std::string& path);
+    // dump into path each time the process gets signo, e.g. SIGUSR2. the handler only
+    // counts and calls the handler it replaced, a watcher thread of the trace writes the
+    // file within 100ms. the replaced handler is back once the last trace on signo goes
+    std::tuple<int, std::string> DumpOnSignal(int signo, const std::string& path);
+
+    static std::tuple<int, std::string> Load(const std::string& path, std::vector<TraceRecord>& records);
+};
+
+}
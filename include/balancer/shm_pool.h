@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "consul_node.h"
+
+namespace kit {
+
+// layout of the POSIX shared memory segment holding a candidate pool
+//
+// one publisher process owns the segment and rewrites it after every refresh,
+// worker processes map it read only. the header carries a seqlock counter:
+// odd while the publisher is writing, even when the records are consistent.
+// the counter only grows, also when a publisher takes the segment over with another
+// capacity, and the segment never shrinks under attached readers.
+namespace shm {
+
+const uint32_t MAGIC          = 0x434b4950;  // "CKIP"
+const uint32_t LAYOUT_VERSION = 4;
+
+struct NodeRecord {
+    char     host[64];
+    char     instanceID[64];
+    char     publicIP[48];
+    char     zone[32];
+    int32_t  port;
+    double   balanceFactor;
+    double   currentFactor;
+    double   workload;
+    double   factor;  // factor in the candidate pool
+    uint64_t rampStartMs;
+    double   previousFactor;
+};
+
+struct Header {
+    // magic to sequence keep their place in every layout version
+    uint32_t              magic;
+    uint32_t              layoutVersion;
+    uint32_t              capacity;   // max records in the segment
+    uint32_t              nodeNum;    // records in use
+    std::atomic<uint64_t> sequence;   // seqlock, odd while writing
+    uint64_t              updated;    // unix time of the last publish
+    double                factorSum;
+    uint64_t              rampNewestMs;
+    double                overload;
+    uint64_t              transitionStartMs;  // 0 without previous factors
+};
+
+inline size_t SegmentSize(uint32_t capacity) {
+    return sizeof(Header) + sizeof(NodeRecord) * capacity;
+}
+
+}
+
+// SharedPoolWriter publishes candidate pools into a named segment, only one
+// writer per segment is supported
+class SharedPoolWriter {
+    std::string  name;      // shm name, e.g. "/ckit.rs"
+    uint32_t     capacity;  // max nodes
+    int          fd;
+    void*        addr;
+    shm::Header* header;
+
+   public:
+    explicit SharedPoolWriter(const std::string& name, uint32_t capacity = 4096);
+    ~SharedPoolWriter();
+
+    std::tuple<int, std::string> Open();
+    std::tuple<int, std::string> Publish(const CandidatePool& pool, uint64_t updated);
+    // close and unlink the segment
+    void Close(bool unlink = true);
+};
+
+// SharedPoolReader attaches to a segment read only and keeps a process local
+// copy of the pool, so every worker runs its own smooth weighted round robin
+class SharedPoolReader {
+    std::string                           name;
+    int                                   fd;
+    void*                                 addr;
+    size_t                                size;
+    std::atomic<const shm::Header*>       header;
+    std::vector<std::pair<void*, size_t>> retired;   // mappings replaced by a remap, unmapped on Close
+    std::atomic<uint64_t>                 version;   // sequence of the local copy
+    std::atomic<uint64_t>                 updated;   // publish time of the local copy
+    std::shared_ptr<CandidatePool>        pool;      // local copy
+    std::mutex                            copyMutex;
+
+    // map the segment again once it grew past the mapping, under copyMutex
+    std::tuple<int, std::string> remap();
+
+   public:
+    explicit SharedPoolReader(const std::string& name);
+    ~SharedPoolReader();
+
+    std::tuple<int, std::string> Open();
+    void                         Close();
+
+    // cheap check, one atomic load
+    bool Changed() const {
+        auto header = this->header.load(std::memory_order_acquire);
+        return header != nullptr &&
+               header->sequence.load(std::memory_order_acquire) != this->version.load(std::memory_order_relaxed);
+    }
+
+    // copy the segment when it changed, return the local pool (nullptr before
+    // the first publish). code is non zero when the segment stays inconsistent
+    std::tuple<int, std::shared_ptr<CandidatePool>, std::string> Refresh();
+
+    uint64_t getLastUpdated() const {
+        return this->updated;
+    }
+};
+
+}
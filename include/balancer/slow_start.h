@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace kit {
+
+// SlowStartOption ramps the factor of a node that joined, or came back healthy,
+// from minRatio to full over windowS:
+//   ratio = max(minRatio, (elapsed / window) ^ (1 / aggression))
+// aggression 1 is linear, above 1 gives most of the traffic early
+struct SlowStartOption {
+    int    windowS    = 0;    // 0 disables the ramp
+    double aggression = 1.0;
+    double minRatio   = 0.1;
+
+    bool Enabled() const {
+        return this->windowS > 0;
+    }
+
+    double Ratio(uint64_t elapsedMs) const {
+        uint64_t windowMs = static_cast<uint64_t>(this->windowS) * 1000;
+        if (elapsedMs >= windowMs) {
+            return 1.0;
+        }
+        double x = static_cast<double>(elapsedMs) / windowMs;
+        if (this->aggression != 1.0) {
+            x = std::pow(x, 1.0 / this->aggression);
+        }
+        return std::max(this->minRatio, x);
+    }
+};
+
+// wall clock, ramp starts are shared across processes through the shared pool
+inline uint64_t SlowStartNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "consul_node.h"
+
+namespace kit {
+
+struct SubsetOption {
+    std::string clientID;        // stable id of the client process, e.g. "<host>:<port>"
+    int         subsetSize = 0;  // nodes kept per zone, 0 disables subsetting
+};
+
+// Subsetter restricts a client to a deterministic subset of every zone with
+// weighted rendezvous hashing: each node scores weight / -ln(hash(clientID, node))
+// and the subsetSize highest scores are kept. clients with different ids spread
+// over the whole zone, a node joining or leaving only moves the clients that
+// ranked it, so connections stay put across refreshes.
+//
+// scores only depend on the client id and the configured node weight, they are
+// computed once per node and kept until the node leaves or its weight changes
+class Subsetter {
+    struct Ranking {
+        double   weight;
+        double   score;
+        uint64_t round;  // last refresh the node was seen in
+    };
+
+    SubsetOption                             option;
+    std::unordered_map<std::string, Ranking> scores;  // instanceID => score
+    std::vector<std::pair<double, size_t>>   ranked;  // reused
+    uint64_t                                 round;
+
+   public:
+    explicit Subsetter(const SubsetOption& option = SubsetOption());
+
+    void SetOption(const SubsetOption& option);
+    bool Enabled() const {
+        return this->option.subsetSize > 0;
+    }
+
+    // start of a refresh
+    void Begin();
+    // keep[i] is cleared for the nodes of [begin, end) left out of the subset
+    void Select(const std::vector<std::shared_ptr<ServiceNode>>& nodes, size_t begin, size_t end,
+                std::vector<char>& keep);
+    // end of a refresh, forget the nodes gone since Begin
+    void End();
+
+    double Score(const std::string& instanceID, double weight) const;
+};
+
+}
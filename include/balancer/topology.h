@@ -0,0 +1,123 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <json11.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "consul_node.h"
+
+namespace kit {
+
+enum class TopologyEventType {
+    NODE_ADDED,
+    NODE_REMOVED,
+    FACTOR_CHANGED,       // candidate factor moved beyond factorThreshold
+    ZONE_WEIGHT_CHANGED,  // share of a zone in the pool moved beyond zoneThreshold
+};
+
+struct TopologyEvent {
+    TopologyEventType            type;
+    std::shared_ptr<ServiceNode> node;  // null for zone events
+    std::string                  zone;
+    double                       before;  // factor, or zone share in [0, 1]
+    double                       after;
+
+    json11::Json to_json() const {
+        static const char* names[] = {"nodeAdded", "nodeRemoved", "factorChanged", "zoneWeightChanged"};
+        return json11::Json::object{
+            {"type", names[static_cast<int>(this->type)]},
+            {"instanceID", this->node != nullptr ? this->node->instanceID : ""},
+            {"zone", this->zone},
+            {"before", this->before},
+            {"after", this->after},
+        };
+    }
+};
+
+// changes between two consecutive candidate pools
+struct TopologyDelta {
+    uint64_t                   version;  // 1 for the first pool, +1 per delta
+    std::vector<TopologyEvent> events;
+};
+
+typedef std::function<void(const std::shared_ptr<const TopologyDelta>&)> TopologyCallback;
+
+struct TopologyOption {
+    double factorThreshold = 0.1;   // relative to the factor last reported
+    double zoneThreshold   = 0.05;  // absolute, of the zone share
+};
+
+// TopologyDiffer remembers the last reported state, small moves accumulate
+// until they cross the thresholds
+class TopologyDiffer {
+    struct Reported {
+        std::shared_ptr<ServiceNode> node;
+        double                       factor;
+        bool                         seen;
+    };
+
+    TopologyOption                            option;
+    std::unordered_map<std::string, Reported> nodes;  // instanceID => last reported
+    std::map<std::string, double>             zones;  // zone => last reported share
+    uint64_t                                  version;
+
+   public:
+    explicit TopologyDiffer(const TopologyOption& option = TopologyOption());
+
+    void SetOption(const TopologyOption& option) {
+        this->option = option;
+    }
+    // nullptr when nothing crossed a threshold
+    std::shared_ptr<TopologyDelta> Diff(const CandidatePool& pool);
+    // the whole last reported state as added events, for late subscribers
+    std::shared_ptr<TopologyDelta> Snapshot() const;
+};
+
+// TopologyDispatcher delivers deltas in order on its own thread, callbacks never
+// run on the updater thread and a slow subscriber only delays the others
+class TopologyDispatcher {
+    struct Pending {
+        uint64_t                             subscriber;  // 0 for all
+        std::shared_ptr<const TopologyDelta> delta;
+    };
+    struct Subscriber {
+        TopologyCallback callback;
+        uint64_t         since;  // version of its snapshot, older deltas still queued are skipped
+    };
+
+    std::map<uint64_t, Subscriber>       subscribers;
+    uint64_t                             nextID;
+    std::deque<Pending>                  queue;
+    bool                                 stopped;
+    uint64_t                             calling;  // subscriber whose callback runs, 0 for none
+    std::mutex                           mutex;
+    std::condition_variable              cond;
+    std::condition_variable              called;   // a callback returned
+    std::thread*                         dispatcher;
+
+    void run();
+
+   public:
+    TopologyDispatcher();
+    ~TopologyDispatcher();
+
+    // return the subscription id, snapshot is delivered first to this subscriber only,
+    // then the deltas after it
+    uint64_t Subscribe(const TopologyCallback& callback, const std::shared_ptr<const TopologyDelta>& snapshot);
+    // once it returns the callback is not running and never runs again, unless called
+    // from the callback itself
+    void     Unsubscribe(uint64_t id);
+    void     Publish(const std::shared_ptr<const TopologyDelta>& delta);
+    void     Stop();
+};
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+
+namespace kit {
+
+struct SchedulerOption {
+    int    intervalS;          // base interval
+    int    minIntervalS;       // interval while factors are converging
+    int    maxIntervalS;       // interval in steady state
+    int    maxBackoffS;        // cap of the backoff on failures
+    int    steadyRounds;       // converged rounds before slowing down
+    double jitter;             // random spread, 0.2 means [0.8, 1.2] x interval
+    double backoffMultiplier;  // growth per consecutive failure
+    double slowdownMultiplier; // growth per steady round
+
+    explicit SchedulerOption(int intervalS = 60) {
+        this->intervalS          = intervalS > 0 ? intervalS : 1;
+        this->minIntervalS       = this->intervalS/4 > 0 ? this->intervalS/4 : 1;
+        this->maxIntervalS       = this->intervalS*2;
+        this->maxBackoffS        = this->intervalS*8;
+        this->steadyRounds       = 5;
+        this->jitter             = 0.2;
+        this->backoffMultiplier  = 2;
+        this->slowdownMultiplier = 1.5;
+    }
+};
+
+// UpdateScheduler decides how long the updater sleeps between two refreshes:
+// exponential backoff on failures, fast while converging, slow in steady state,
+// always jittered so a fleet restarted together does not poll consul in lockstep
+class UpdateScheduler {
+    SchedulerOption         option;
+    int                     failures;      // consecutive failures
+    int                     steady;        // consecutive converged rounds
+    double                  intervalS;     // current interval before jitter
+    bool                    stopped;
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::mt19937            mt;
+
+   public:
+    explicit UpdateScheduler(const SchedulerOption& option = SchedulerOption());
+
+    void SetOption(const SchedulerOption& option);
+
+    // wait before the next refresh given the result of the previous one
+    std::chrono::milliseconds Next(bool success, bool converging);
+
+    // sleep for d unless stopped, return false when stopped
+    bool Wait(std::chrono::milliseconds d);
+    void Stop();
+    void Reset();
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "consul_node.h"
+
+namespace kit {
+
+struct ZoneRouterOption {
+    double alpha          = 0.2;   // weight of a new rtt sample in the ewma
+    double crossZoneShare = 0.3;   // max share of the selections sent out of the local zone
+    int    windowS        = 10;    // share counters halve every window
+    int    maxDebt        = 1000;  // cross zone selections deferred and not yet made up for
+};
+
+// ZoneRouter keeps the cross zone spill of the learned factors away from requests that
+// cannot afford the extra hop. each zone has an ewma of the round trips reported by the
+// caller; a request whose latency budget is below the rtt of the zone it was routed to
+// stays local, and the selection it gave up is owed as debt that the next requests with
+// enough slack pay back by going cross zone. the share of cross zone selections is kept
+// under crossZoneShare either way
+class ZoneRouter {
+    struct RTT {
+        std::atomic<uint64_t> bits;  // ewma in us, a double
+    };
+    typedef std::unordered_map<std::string, std::shared_ptr<RTT>> RTTMap;
+
+    ZoneRouterOption        option;
+    std::shared_ptr<RTTMap> rtts;       // copy on write, new zones are rare
+    std::mutex              rttMutex;   // writers of rtts
+    std::atomic<uint64_t>   total;
+    std::atomic<uint64_t>   cross;
+    std::atomic<uint64_t>   windowAtMs;
+    std::atomic<int64_t>    debt;
+
+   public:
+    explicit ZoneRouter(const ZoneRouterOption& option = ZoneRouterOption());
+
+    const ZoneRouterOption& getOption() const {
+        return this->option;
+    }
+
+    void ReportRTT(const std::string& zone, uint64_t rttUs);
+    // ewma of zone, 0 when never reported
+    double ZoneRTT(const std::string& zone) const;
+    // a request with budgetUs can go to zone, 0 budget and unmeasured zones always fit
+    bool Fits(const std::string& zone, uint64_t budgetUs) const;
+
+    bool AllowCross(uint64_t nowMs);
+    void Count(bool crossZone);
+
+    // a cross zone selection given up by a tight request
+    void Defer();
+    bool HasDebt() const {
+        return this->debt.load(std::memory_order_relaxed) > 0;
+    }
+    bool TakeDebt();
+
+    // a node of pool drawn by factor, from the local zone or from the zones out of it
+    // that fit budgetUs. read only, the round robin weights are left alone. -1 for none
+    int Pick(const CandidatePool& pool, const std::string& localZone, bool local, uint64_t budgetUs) const;
+
+    double CrossShare() const;
+};
+
+}
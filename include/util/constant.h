@@ -6,7 +6,11 @@ namespace kit {
 enum STATUSCODE {
     SUCCESS,
     ERROR_CONSUL_VALUE,
-    UNKNOWN
+    UNKNOWN,
+    ERROR_SHARED_MEMORY,
+    ERROR_INVALID_ARGUMENT,
+    ERROR_CONNECT,
+    ERROR_OVERLOAD
 };
 
 }
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kit {
+
+const int CPU_SAMPLER_MAX_CORES   = 256;
+const int CPU_SAMPLER_MAX_WINDOWS = 8;
+
+enum CGROUP_VERSION {
+    CGROUP_NONE,
+    CGROUP_V1,
+    CGROUP_V2,
+};
+
+// usage over one window, all percents in [0, 100], -1 when unknown
+struct CPUUsageSnapshot {
+    uint64_t timestampMs;  // unix time of the newest sample
+    int      windowMs;     // span actually covered, may be shorter than asked right after start
+    double   host;         // host wide, /proc/stat
+    double   cgroup;       // the cgroup of this process, of its quota or of all cores when unlimited
+    double   cgroupCores;  // cores used by the cgroup
+    double   quotaCores;   // cpu limit of the cgroup in cores, 0 when unlimited
+    int      coreNum;
+    double   cores[CPU_SAMPLER_MAX_CORES];  // per core
+
+    // what a process should look at: its container when it has one, the host otherwise
+    double Usage() const {
+        return this->cgroup >= 0 ? this->cgroup : this->host;
+    }
+};
+
+struct CPUSamplerOption {
+    int              intervalMs = 1000;
+    std::vector<int> windowsS   = {1, 10, 60};
+    std::string      procRoot   = "/proc";
+    std::string      cgroupRoot = "/sys/fs/cgroup";
+};
+
+// CPUSampler reads /proc/stat and the cgroup cpu accounting on a background
+// thread with descriptors opened once, and publishes one snapshot per window
+// behind a seqlock, readers never block nor allocate
+class CPUSampler {
+    struct Sample {
+        uint64_t              timestampMs;
+        uint64_t              hostBusy;
+        uint64_t              hostTotal;
+        uint64_t              cgroupUsageUs;
+        std::vector<uint64_t> coreBusy;
+        std::vector<uint64_t> coreTotal;
+    };
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        CPUUsageSnapshot      snapshot;
+    };
+
+    CPUSamplerOption        option;
+    int                     statFD;
+    int                     cgroupFD;
+    int                     cgroupVersion;
+    double                  quotaCores;
+    std::vector<char>       buffer;
+    std::vector<Sample>     samples;   // ring, sampler thread only
+    size_t                  sampleNum;
+    size_t                  head;      // next position in the ring
+    Slot                    slots[CPU_SAMPLER_MAX_WINDOWS];
+    bool                    stopped;
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::thread*            sampler;
+
+    void openSources();
+    void closeSources();
+    bool readFile(int fd, std::string& content);
+    bool sample(Sample& s);
+    void publish();
+
+   public:
+    explicit CPUSampler(const CPUSamplerOption& option = CPUSamplerOption());
+    ~CPUSampler();
+
+    // wait takes the first samples synchronously, so snapshots are valid once Start
+    // returns. without it Start only takes one sample and the sampler thread the second
+    // one shortly after, snapshots stay unknown until then
+    void Start(bool wait = true);
+    void Stop();
+
+    // window index as in option.windowsS, return false for an unknown window
+    bool Snapshot(size_t window, CPUUsageSnapshot& snapshot) const;
+    // usage of the first window of option.windowsS, the 1s one by default
+    double Usage() const;
+
+    int getCgroupVersion() const {
+        return this->cgroupVersion;
+    }
+
+    // process wide sampler with the default option, started on first use without waiting,
+    // Usage is -1 for the first 100ms
+    static CPUSampler& Default();
+};
+
+}
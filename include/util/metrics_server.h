@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <tuple>
+
+namespace kit {
+
+// MetricsServer answers every http request on port with what render wrote, for a
+// prometheus scraper. one thread serves the connections one at a time and renders into
+// the same buffer each time, nothing to tune and nothing allocated per scrape once warm
+class MetricsServer {
+    std::function<void(std::string&)> render;
+    std::string                       body;     // rendered by the serving thread only
+    int                               fd;
+    int                               port;
+    std::atomic<bool>                 stopped;
+    std::thread*                      server;
+
+    void serve();
+
+   public:
+    explicit MetricsServer(const std::function<void(std::string&)>& render);
+    ~MetricsServer();
+
+    // listen on address:port, port 0 picks a free one, see getPort
+    std::tuple<int, std::string> Start(int port, const std::string& address = "0.0.0.0");
+    void Stop();
+
+    int getPort() const {
+        return this->port;
+    }
+};
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kit {
+
+// "0-3,8,10-11" => {0, 1, 2, 3, 8, 10, 11}, as in /sys/devices/system/node/node*/cpulist
+std::vector<int> ParseCPUList(const std::string& list);
+
+// NumaTopology maps cpus to NUMA nodes from sysfs, no libnuma needed.
+// a host without the node directory is a single node holding every cpu
+class NumaTopology {
+    std::vector<std::vector<int>> nodeCPUs;  // node => cpus
+    std::vector<int>              cpuNode;   // cpu => node
+
+   public:
+    explicit NumaTopology(const std::string& root = "/sys/devices/system/node");
+
+    int NodeNum() const {
+        return static_cast<int>(this->nodeCPUs.size());
+    }
+    const std::vector<int>& CPUs(int node) const {
+        return this->nodeCPUs[node];
+    }
+    // node of cpu, 0 when unknown
+    int NodeOf(int cpu) const {
+        return cpu >= 0 && cpu < static_cast<int>(this->cpuNode.size()) ? this->cpuNode[cpu] : 0;
+    }
+    // node of the cpu the calling thread runs on right now
+    int CurrentNode() const;
+
+    // pin the calling thread to the cpus of node, false when the host refuses
+    bool Pin(int node) const;
+    // run fn on a thread pinned to the cpus of node and wait for it, memory fn touches
+    // first is allocated on node by the default local policy. fn still runs when pinning fails
+    void RunOnNode(int node, const std::function<void()>& fn) const;
+
+    // topology of this host, loaded once
+    static const NumaTopology& Default();
+};
+
+// NodeWorkers keeps a thread pinned to every node for the life of the object, RunAll
+// runs fn(node) on each of them at once and waits. for work repeated on every node,
+// RunOnNode starts a thread per call
+class NodeWorkers {
+    typedef std::function<void(int node)> Body;
+
+    std::vector<std::thread> workers;  // node => worker
+    int                      nodeNum;
+    std::mutex               mutex;
+    std::condition_variable  wake;      // a new run or stop
+    std::condition_variable  finished;  // a worker is through the current run
+    uint64_t                 round;     // runs started
+    int                      arrived;   // workers through the current run
+    bool                     stopped;
+    const Body*              body;      // the current run, written under mutex
+
+    void work(int node);
+
+   public:
+    explicit NodeWorkers(const NumaTopology& topology);
+    ~NodeWorkers();
+    NodeWorkers(const NodeWorkers&) = delete;
+    NodeWorkers& operator=(const NodeWorkers&) = delete;
+
+    int NodeNum() const {
+        return this->nodeNum;
+    }
+    void RunAll(const Body& body);
+};
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+
+namespace kit {
+
+// a label of a sample, the value is referenced not copied
+struct PrometheusLabel {
+    const char* name;
+    const char* value;
+    size_t      size;
+
+    PrometheusLabel(const char* name, const std::string& value)
+        : name(name), value(value.data()), size(value.size()) {}
+    PrometheusLabel(const char* name, const char* value) : name(name), value(value), size(strlen(value)) {}
+};
+
+// PrometheusWriter appends the text exposition format (version 0.0.4) to out. out is
+// cleared and keeps its capacity, a buffer reused across scrapes stops allocating once
+// it has grown to the size of a scrape
+class PrometheusWriter {
+    std::string& out;
+
+    void appendValue(double value);
+    void appendLabels(std::initializer_list<PrometheusLabel> labels);
+
+   public:
+    explicit PrometheusWriter(std::string& out);
+
+    // # HELP and # TYPE of a metric, type is counter, gauge, summary or untyped.
+    // the samples of a metric follow its family without other metrics in between
+    void Family(const char* name, const char* type, const char* help);
+    void Sample(const char* name, double value);
+    void Sample(const char* name, std::initializer_list<PrometheusLabel> labels, double value);
+};
+
+}
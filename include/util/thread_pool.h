@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kit {
+
+// ThreadPool splits a loop over [0, n) into parts run by a few threads kept for the life
+// of the pool. the caller runs parts too and returns once all are done, so a pool of 0
+// threads runs every loop inline. one loop at a time: the per node passes of a refresh, or
+// a batch of independent blocking reads run one part per read
+class ThreadPool {
+    typedef std::function<void(size_t part, size_t begin, size_t end)> Body;
+
+    std::vector<std::thread> workers;
+    std::mutex               mutex;
+    std::condition_variable  wake;      // a new loop or stop
+    std::condition_variable  finished;  // a worker is through the current loop
+    uint64_t                 round;     // loops started
+    size_t                   arrived;   // workers through the current loop
+    bool                     stopped;
+    // the current loop, written under mutex before round moves
+    const Body*              body;
+    size_t                   n;
+    size_t                   parts;
+    std::atomic<size_t>      next;      // first part not claimed yet
+
+    void work();
+    void runParts();
+
+   public:
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int getThreads() const {
+        return static_cast<int>(this->workers.size());
+    }
+
+    // parts a loop over n is split into, one per thread and the caller at most, none
+    // smaller than minPart so small loops skip the wake up
+    size_t Parts(size_t n, size_t minPart) const;
+    // body(part, begin, end) for every part, part i covers [n*i/parts, n*(i+1)/parts)
+    void ParallelFor(size_t n, size_t parts, const Body& body);
+};
+
+}
@@ -1,13 +1,26 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
 
 namespace kit {
 
+// cpu usage percent of this container, or of the host outside containers, see CPUSampler.
+// never blocks, -1 until the default sampler has its first window
 double      CPUUsage();
+// availability zone, resolved once per process, see ZoneProvider
 std::string Zone();
 
+// steady clock in ms, for intervals and deadlines within the process
+uint64_t SteadyNowMs();
+// uniform in [0, 1), a xorshift per thread so concurrent draws never share a generator
+double   ThreadRandom01();
+
+std::string Base64Decode(const std::string& in);
+// percent encode everything but the unreserved characters of rfc 3986
+std::string UrlEncode(const std::string& in);
+
 // return status, output
 std::tuple<int, std::string> GetStatusOutput(const std::string& command);
 
@@ -17,4 +30,12 @@ std::tuple<int, std::string, std::string> HttpGet(const std::string& url);
 // return status, body, headers, error
 std::tuple<int, std::string, std::map<std::string, std::string>, std::string> HttpGet(const std::string& url, std::map<std::string, std::string> reqheader);
 
+// any method with millisecond timeouts, return status, body, error
+std::tuple<int, std::string, std::string> HttpRequest(const std::string&                        method,
+                                                      const std::string&                        url,
+                                                      const std::map<std::string, std::string>& reqheader,
+                                                      const std::string&                        reqbody,
+                                                      long                                      connectTimeoutMs,
+                                                      long                                      timeoutMs);
+
 }
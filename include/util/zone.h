@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace kit {
+
+struct ZoneOption {
+    std::string endpoint         = "http://169.254.169.254";  // instance metadata service
+    std::string envName          = "CKIT_ZONE";               // zone override
+    std::string fileEnvName      = "CKIT_ZONE_FILE";          // file holding the zone override
+    std::string file;                                         // file override, when the env does not name one
+    long        connectTimeoutMs = 200;
+    long        timeoutMs        = 500;
+    int         tokenTTLS        = 60;
+    long        retryMs          = 1000;   // first retry after the metadata service failed
+    long        maxRetryMs       = 60000;  // retries back off up to this
+};
+
+// ZoneProvider resolves the availability zone once: env override, file override,
+// then the metadata service (IMDSv2 token, falling back to IMDSv1), "unknown" otherwise.
+// an unknown zone is not final, the metadata service is asked again with backoff
+class ZoneProvider {
+    ZoneOption  option;
+    std::string zone;
+    std::string source;  // env, file, imdsv2, imdsv1, unknown
+    bool        resolved;
+    uint64_t    retryAtMs;  // next try while unresolved
+    long        backoffMs;
+    std::mutex  mutex;
+
+    std::string fromMetadata();
+
+   public:
+    explicit ZoneProvider(const ZoneOption& option = ZoneOption());
+
+    // cached once resolved, "unknown" until the next retry otherwise
+    std::string Get();
+    std::string getSource();
+
+    // process wide provider behind kit::Zone()
+    static ZoneProvider& Default();
+};
+
+}
@@ -0,0 +1,104 @@
+#include "balancer/admission.h"
+
+#include <algorithm>
+
+#include "util/util.h"
+
+namespace kit {
+
+AdmissionController::AdmissionController(const AdmissionOption& option)
+    : option(option), buckets(std::max(option.windowS, 1)) {
+    for (auto& b : this->buckets) {
+        b.second.store(0);
+        b.requests.store(0);
+        b.accepts.store(0);
+    }
+    this->sumSecond.store(0);
+    this->sumRequests.store(0);
+    this->sumAccepts.store(0);
+}
+
+AdmissionController::Bucket& AdmissionController::bucket(uint64_t second) {
+    auto& b   = this->buckets[second % this->buckets.size()];
+    auto  old = b.second.load(std::memory_order_relaxed);
+    // first touch in this second resets the slot, the few counts racing with it are lost
+    if (old != second && b.second.compare_exchange_strong(old, second, std::memory_order_relaxed)) {
+        b.requests.store(0, std::memory_order_relaxed);
+        b.accepts.store(0, std::memory_order_relaxed);
+    }
+    return b;
+}
+
+void AdmissionController::sum(uint64_t second) {
+    auto old = this->sumSecond.load(std::memory_order_relaxed);
+    if (old == second || !this->sumSecond.compare_exchange_strong(old, second, std::memory_order_relaxed)) {
+        return;
+    }
+    // once a second, over the completed seconds of the window
+    uint64_t requests = 0;
+    uint64_t accepts  = 0;
+    for (auto& b : this->buckets) {
+        auto s = b.second.load(std::memory_order_relaxed);
+        if (s < second && s + this->buckets.size() > second) {
+            requests += b.requests.load(std::memory_order_relaxed);
+            accepts += b.accepts.load(std::memory_order_relaxed);
+        }
+    }
+    this->sumRequests.store(requests, std::memory_order_relaxed);
+    this->sumAccepts.store(accepts, std::memory_order_relaxed);
+}
+
+void AdmissionController::probability(double overload, uint64_t nowMs, double& server, double& p) {
+    auto second = nowMs / 1000;
+    this->sum(second);
+    auto& b = this->bucket(second);
+    double requests = this->sumRequests.load(std::memory_order_relaxed) + b.requests.load(std::memory_order_relaxed);
+    double accepts  = this->sumAccepts.load(std::memory_order_relaxed) + b.accepts.load(std::memory_order_relaxed);
+
+    double client = std::max(0.0, (requests - this->option.k * accepts) / (requests + 1));
+    server        = std::min(1.0, std::max(0.0, overload * this->option.overloadWeight));
+    p             = 1 - (1 - client) * (1 - server);
+    if (p > this->option.maxRejectRatio) {
+        // both parts scaled down alike
+        server *= this->option.maxRejectRatio / p;
+        p = this->option.maxRejectRatio;
+    }
+}
+
+double AdmissionController::RejectProbability(double overload, uint64_t nowMs) {
+    double server, p;
+    this->probability(overload, nowMs, server, p);
+    return p;
+}
+
+double AdmissionController::RejectProbability(double overload) {
+    return this->RejectProbability(overload, SteadyNowMs());
+}
+
+bool AdmissionController::Admit(double overload) {
+    return this->Admit(overload, SteadyNowMs());
+}
+
+bool AdmissionController::Admit(double overload, uint64_t nowMs) {
+    double server, p;
+    this->probability(overload, nowMs, server, p);
+    double draw = p <= 0 ? 1 : (this->random ? this->random() : ThreadRandom01());
+    // [0, server) shed for the server side, never offered, [server, p) shed by the client term
+    if (draw < server) {
+        return false;
+    }
+    this->bucket(nowMs / 1000).requests.fetch_add(1, std::memory_order_relaxed);
+    return draw >= p;
+}
+
+void AdmissionController::ReportResult(bool success) {
+    this->ReportResult(success, SteadyNowMs());
+}
+
+void AdmissionController::ReportResult(bool success, uint64_t nowMs) {
+    if (success) {
+        this->bucket(nowMs / 1000).accepts.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+}
@@ -0,0 +1,251 @@
+#include "balancer/balancer_registry.h"
+#include <log4cplus/loggingmacros.h>
+#include <set>
+#include "util/constant.h"
+#include "util/util.h"
+
+namespace kit {
+
+BalancerRegistry::BalancerRegistry(
+    const std::string &address,
+    const std::string &zone,
+    const std::string &cpuThresholdKey,
+    const std::string &zoneCPUKey,
+    const std::string &instanceFactorKey,
+    const std::string &onlinelabFactorKey,
+    int timeoutS,
+    int intervalS
+) : client(address), scheduler(SchedulerOption(intervalS)) {
+    this->address = address;
+    this->zone = zone!="" ? zone : Zone();
+    this->cpuThresholdKey = cpuThresholdKey;
+    this->zoneCPUKey = zoneCPUKey;
+    this->instanceFactorKey = instanceFactorKey;
+    this->onlinelabFactorKey = onlinelabFactorKey;
+    this->timeoutS = timeoutS;
+    this->generations.emplace_back(new ServiceMap());
+    this->services = this->generations.back().get();
+    this->fetchPool.reset(new ThreadPool(4));
+    this->serviceUpdater = nullptr;
+    this->logger = nullptr;
+}
+
+BalancerRegistry::~BalancerRegistry() {
+    this->Stop();
+}
+
+void BalancerRegistry::SetLogger(log4cplus::Logger *logger) {
+    std::lock_guard<std::mutex> lock_guard(this->registerMutex);
+    this->logger = logger;
+    for (const auto &item : *this->services.load(std::memory_order_acquire)) {
+        item.second->resolver->SetLogger(logger);
+    }
+}
+
+std::tuple<int, std::string> BalancerRegistry::Register(const std::string &service) {
+    return this->Register(service, this->cpuThresholdKey, this->zoneCPUKey, this->instanceFactorKey,
+                          this->onlinelabFactorKey);
+}
+
+std::tuple<int, std::string> BalancerRegistry::Register(const std::string &service,
+                                                        const std::string &cpuThresholdKey,
+                                                        const std::string &zoneCPUKey,
+                                                        const std::string &instanceFactorKey,
+                                                        const std::string &onlinelabFactorKey) {
+    std::lock_guard<std::mutex> lock_guard(this->registerMutex);
+    auto services = this->services.load(std::memory_order_acquire);
+    if (services->count(service) > 0) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "service [" + service + "] registered already");
+    }
+
+    auto entry = std::make_shared<ServiceEntry>();
+    entry->resolver = std::make_shared<ConsulResolver>(this->address, this->zone, service, cpuThresholdKey, zoneCPUKey,
+                                                       instanceFactorKey, onlinelabFactorKey, this->timeoutS);
+    entry->resolver->SetLogger(this->logger);
+
+    auto next = new ServiceMap(*services);
+    (*next)[service] = entry;
+    this->generations.emplace_back(next);
+    this->services.store(next, std::memory_order_release);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> BalancerRegistry::updateAll() {
+    auto now = static_cast<uint64_t>(time(nullptr));
+    auto services = this->services.load(std::memory_order_acquire);
+
+    // distinct kv keys over all services
+    std::set<std::string> distinctKeys;
+    for (const auto &item : *services) {
+        for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+            auto &key = item.second->resolver->getKey(static_cast<DataSource>(source));
+            if (source!=DATA_HEALTH && !key.empty()) {
+                distinctKeys.insert(key);
+                this->keys[key].prefix = source==DATA_INSTANCE_LOAD;
+            }
+        }
+    }
+
+    // every distinct key, then every service health, read by the fetch pool
+    std::vector<KeyState*> keyStates;
+    std::vector<std::string> keyNames(distinctKeys.begin(), distinctKeys.end());
+    for (const auto &key : keyNames) {
+        keyStates.emplace_back(&this->keys[key]);
+    }
+    std::vector<std::tuple<int, json11::Json, std::string>> kvResults(keyNames.size());
+    std::vector<ServiceEntry*> entries;
+    std::vector<ServiceFilter> healthFilters;
+    std::unordered_map<std::string, std::string> healthIndexes;
+    for (const auto &item : *services) {
+        auto entry = item.second.get();
+        healthFilters.emplace_back(entry->resolver->prepareHealthFilter(entry->healthIndex, entry->healthQuery));
+        healthIndexes[item.first] = entry->healthIndex;
+        entries.emplace_back(entry);
+    }
+    std::vector<std::tuple<int, std::vector<std::shared_ptr<ServiceNode>>, std::string>> healthResults(entries.size());
+
+    // one part per read, claimed one at a time so a slow read holds up no other
+    auto fetchNum = keyNames.size() + entries.size();
+    this->fetchPool->ParallelFor(fetchNum, fetchNum, [&](size_t i, size_t, size_t) {
+        if (i < keyNames.size()) {
+            auto &state = *keyStates[i];
+            kvResults[i] = state.prefix ? this->client.GetKVPrefix(keyNames[i], this->timeoutS, state.index)
+                                        : this->client.GetKV(keyNames[i], this->timeoutS, state.index);
+            return;
+        }
+        auto j = i - keyNames.size();
+        healthResults[j] = this->client.GetService(entries[j]->resolver->getService(), this->timeoutS,
+                                                   entries[j]->healthIndex, healthFilters[j]);
+    });
+
+    for (size_t i = 0; i < keyNames.size(); i++) {
+        auto &state = *keyStates[i];
+        json11::Json kv;
+        std::tie(state.code, kv, state.err) = kvResults[i];
+        if (state.code==STATUSCODE::SUCCESS && !kv.is_null()) {
+            state.kv = kv;
+            state.version++;
+        }
+    }
+
+    // apply to every service, a kv value is handed to a resolver once per version
+    int code = STATUSCODE::SUCCESS;
+    std::string err;
+    size_t serviceIndex = 0;
+    for (const auto &item : *services) {
+        auto &entry = *item.second;
+        auto &health = healthResults[serviceIndex++];
+        ConsulFetch fetch;
+        for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+            if (source==DATA_HEALTH || !entry.resolver->sourceEnabled(static_cast<DataSource>(source))) {
+                continue;
+            }
+            auto &state = this->keys[entry.resolver->getKey(static_cast<DataSource>(source))];
+            fetch.code[source] = state.code;
+            fetch.err[source] = state.err;
+            if (state.code==STATUSCODE::SUCCESS && entry.applied[source]!=state.version) {
+                fetch.kv[source] = state.kv;
+                entry.applied[source] = state.version;
+            }
+        }
+        std::tie(fetch.code[DATA_HEALTH], fetch.nodes, fetch.err[DATA_HEALTH]) = std::move(health);
+        fetch.nodesModified = !(fetch.nodes.empty() && entry.healthIndex==healthIndexes[item.first]);
+
+        int serviceCode;
+        std::string serviceErr;
+        std::tie(serviceCode, serviceErr) = entry.resolver->applyAll(fetch, now);
+        // the resolver dropped expired data, hand it the next value even when the version
+        // is unchanged and fetch the key in full
+        for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+            if (!entry.resolver->getFreshness(static_cast<DataSource>(source)).expired) {
+                continue;
+            }
+            if (source==DATA_HEALTH) {
+                entry.healthIndex = "0";
+            } else if (entry.resolver->sourceEnabled(static_cast<DataSource>(source))) {
+                entry.applied[source] = 0;
+                this->keys[entry.resolver->getKey(static_cast<DataSource>(source))].index = "0";
+            }
+        }
+        if (serviceCode==STATUSCODE::SUCCESS) {
+            entry.lastUpdated = now;
+        } else if (code==STATUSCODE::SUCCESS) {
+            code = serviceCode;
+            err = "service [" + item.first + "] " + serviceErr;
+        }
+    }
+
+    return std::make_tuple(code, err);
+}
+
+std::tuple<int, std::string> BalancerRegistry::Start() {
+    int code;
+    std::string err;
+    std::tie(code, err) = this->updateAll();
+    if (code!=STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, err);
+    }
+
+    this->scheduler.Reset();
+    this->serviceUpdater = new std::thread([this]() {
+        std::string local_err;
+        int local_code = STATUSCODE::SUCCESS;
+        while (true) {
+            bool converging = false;
+            for (const auto &item : *this->services.load(std::memory_order_acquire)) {
+                converging = converging || item.second->resolver->Converging();
+            }
+            if (!this->scheduler.Wait(this->scheduler.Next(local_code==STATUSCODE::SUCCESS, converging))) {
+                break;
+            }
+            std::tie(local_code, local_err) = this->updateAll();
+            if (local_code!=STATUSCODE::SUCCESS && this->logger!=nullptr) {
+                LOG4CPLUS_WARN(*(this->logger),
+                               "registry update failed. code: [" << local_code << "], err: [" << local_err << "]");
+            }
+        }
+    });
+
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> BalancerRegistry::Stop() {
+    this->scheduler.Stop();
+    if (this->serviceUpdater!=nullptr) {
+        if (this->serviceUpdater->joinable()) {
+            this->serviceUpdater->join();
+        }
+        delete this->serviceUpdater;
+        this->serviceUpdater = nullptr;
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::shared_ptr<BalancerRegistry::ServiceEntry> BalancerRegistry::find(const std::string &service) const {
+    auto services = this->services.load(std::memory_order_acquire);
+    auto it = services->find(service);
+    if (it==services->end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+std::shared_ptr<ServiceNode> BalancerRegistry::SelectedNode(const std::string &service) {
+    auto entry = this->find(service);
+    if (entry==nullptr || entry->lastUpdated==0) {
+        return nullptr;
+    }
+    return entry->resolver->SelectedNode();
+}
+
+std::shared_ptr<ConsulResolver> BalancerRegistry::getResolver(const std::string &service) {
+    auto entry = this->find(service);
+    return entry==nullptr ? nullptr : entry->resolver;
+}
+
+uint64_t BalancerRegistry::getLastUpdated(const std::string &service) {
+    auto entry = this->find(service);
+    return entry==nullptr ? 0 : entry->lastUpdated.load();
+}
+
+}
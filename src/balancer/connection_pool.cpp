@@ -0,0 +1,324 @@
+#include "balancer/connection_pool.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "util/constant.h"
+#include "util/util.h"
+
+namespace kit {
+
+// the peer closed or reset an idle connection
+static bool alive(int fd) {
+    char c;
+    auto n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// SO_ERROR of a finished non blocking connect, errno set
+static bool connected(int fd) {
+    int soError = 0;
+    socklen_t len = sizeof(soError);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &soError, &len) != 0) {
+        return false;
+    }
+    errno = soError;
+    return soError == 0;
+}
+
+NodeConnections::~NodeConnections() {
+    for (const auto& idle : this->idle) {
+        close(idle.fd);
+    }
+}
+
+bool NodeConnections::Put(int fd, uint64_t nowMs) {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    if (this->closed || this->idle.size() >= this->maxIdle) {
+        return false;
+    }
+    this->idle.push_back(Idle{fd, nowMs});
+    return true;
+}
+
+void NodeConnections::Close() {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    this->closed = true;
+    for (const auto& idle : this->idle) {
+        close(idle.fd);
+    }
+    this->idle.clear();
+}
+
+Connection::Connection(int fd, const std::shared_ptr<ServiceNode>& node,
+                       const std::shared_ptr<NodeConnections>& owner)
+    : fd(fd), node(node), owner(owner), broken(false) {}
+
+Connection::~Connection() {
+    auto owner = this->owner.lock();
+    if (owner != nullptr && !this->broken && owner->Put(this->fd, SteadyNowMs())) {
+        return;
+    }
+    close(this->fd);
+}
+
+ConnectionPool::ConnectionPool(const ConnectionPoolOption& option) : option(option) {
+    this->nodes = std::make_shared<NodeMap>();
+}
+
+ConnectionPool::~ConnectionPool() {
+    this->Close();
+}
+
+std::tuple<int, std::string> ConnectionPool::resolve(const ServiceNode& node, NodeConnections& connections) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    auto port = std::to_string(node.port);
+    int rc = getaddrinfo(node.host.c_str(), port.c_str(), &hints, &result);
+    if (rc != 0 || result == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_CONNECT,
+                               "getaddrinfo [" + connections.address + "] failed. err: [" + gai_strerror(rc) + "]");
+    }
+    memcpy(&connections.addr, result->ai_addr, result->ai_addrlen);
+    connections.addrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, int, std::string> ConnectionPool::startConnect(const NodeConnections& connections, bool& pending) {
+    auto failed = [&connections](const std::string& what, int fd) {
+        auto err = what + " [" + connections.address + "] failed. errno: [" + std::to_string(errno) + "] " +
+                   strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return std::make_tuple(static_cast<int>(STATUSCODE::ERROR_CONNECT), -1, err);
+    };
+
+    int fd = socket(connections.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return failed("socket", fd);
+    }
+    if (this->option.keepAlive) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    pending = false;
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&connections.addr), connections.addrLen) != 0) {
+        if (errno != EINPROGRESS) {
+            return failed("connect", fd);
+        }
+        pending = true;
+    }
+    return std::make_tuple(static_cast<int>(STATUSCODE::SUCCESS), fd, std::string());
+}
+
+std::tuple<int, int, std::string> ConnectionPool::connect(const NodeConnections& connections) {
+    int code, fd;
+    bool pending;
+    std::string err;
+    std::tie(code, fd, err) = this->startConnect(connections, pending);
+    if (code != STATUSCODE::SUCCESS || !pending) {
+        return std::make_tuple(code, fd, err);
+    }
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int rc = poll(&pfd, 1, this->option.connectTimeoutMs);
+    if (rc == 0) {
+        errno = ETIMEDOUT;
+    }
+    if (rc <= 0 || !connected(fd)) {
+        err = "connect [" + connections.address + "] failed. errno: [" + std::to_string(errno) + "] " + strerror(errno);
+        close(fd);
+        return std::make_tuple(static_cast<int>(STATUSCODE::ERROR_CONNECT), -1, err);
+    }
+    return std::make_tuple(static_cast<int>(STATUSCODE::SUCCESS), fd, std::string());
+}
+
+void ConnectionPool::prewarm(const std::vector<std::shared_ptr<NodeConnections>>& joined) {
+    std::vector<std::shared_ptr<NodeConnections>> owners;
+    std::vector<struct pollfd> pending;
+    for (const auto& connections : joined) {
+        for (int i = 0; i < this->option.prewarm && i < this->option.maxIdlePerNode; i++) {
+            int code, fd;
+            bool inProgress;
+            std::tie(code, fd, std::ignore) = this->startConnect(*connections, inProgress);
+            if (code != STATUSCODE::SUCCESS) {
+                break;
+            }
+            if (!inProgress) {
+                if (!connections->Put(fd, SteadyNowMs())) {
+                    close(fd);
+                }
+                continue;
+            }
+            owners.emplace_back(connections);
+            pending.push_back(pollfd{fd, POLLOUT, 0});
+        }
+    }
+
+    auto deadline = SteadyNowMs() + this->option.connectTimeoutMs;
+    size_t left = pending.size();
+    while (left > 0) {
+        auto now = SteadyNowMs();
+        if (now >= deadline) {
+            break;
+        }
+        int rc = poll(pending.data(), pending.size(), static_cast<int>(deadline - now));
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            break;
+        }
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (pending[i].fd < 0 || pending[i].revents == 0) {
+                continue;
+            }
+            if (!connected(pending[i].fd) || !owners[i]->Put(pending[i].fd, SteadyNowMs())) {
+                close(pending[i].fd);
+            }
+            // poll skips negative fds
+            pending[i].fd = -1;
+            left--;
+        }
+    }
+    // timed out
+    for (const auto& pfd : pending) {
+        if (pfd.fd >= 0) {
+            close(pfd.fd);
+        }
+    }
+}
+
+void ConnectionPool::evict(NodeConnections& connections, uint64_t now) {
+    std::lock_guard<std::mutex> lock_guard(connections.mutex);
+    auto& idle = connections.idle;
+    size_t kept = 0;
+    for (size_t i = 0; i < idle.size(); i++) {
+        if (idle[i].idleSinceMs + this->option.idleTimeoutMs < now || !alive(idle[i].fd)) {
+            close(idle[i].fd);
+        } else {
+            idle[kept++] = idle[i];
+        }
+    }
+    idle.resize(kept);
+}
+
+void ConnectionPool::Refresh(const CandidatePool& pool, bool prewarm) {
+    std::lock_guard<std::mutex> lock_guard(this->refreshMutex);
+    auto nodes = std::atomic_load(&this->nodes);
+    auto next  = std::make_shared<NodeMap>();
+    std::vector<std::shared_ptr<NodeConnections>> joined;
+    auto now = SteadyNowMs();
+
+    for (const auto& node : pool.nodes) {
+        auto address = node->Address();
+        if (next->count(address) != 0) {
+            continue;
+        }
+        auto it = nodes->find(address);
+        if (it != nodes->end()) {
+            this->evict(*it->second, now);
+            (*next)[address] = it->second;
+            continue;
+        }
+        auto connections     = std::make_shared<NodeConnections>();
+        connections->address = address;
+        connections->maxIdle = this->option.maxIdlePerNode;
+        connections->closed  = false;
+        if (std::get<0>(this->resolve(*node, *connections)) != STATUSCODE::SUCCESS) {
+            continue;
+        }
+        (*next)[address] = connections;
+        joined.emplace_back(connections);
+    }
+    std::atomic_store(&this->nodes, std::shared_ptr<const NodeMap>(next));
+
+    // tear down the nodes gone, leases still out close on release
+    for (const auto& item : *nodes) {
+        if (next->count(item.first) == 0) {
+            item.second->Close();
+        }
+    }
+
+    if (prewarm) {
+        this->prewarm(joined);
+    }
+}
+
+std::tuple<int, std::unique_ptr<Connection>, std::string> ConnectionPool::Acquire(
+    const std::shared_ptr<ServiceNode>& node) {
+    if (node == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, std::unique_ptr<Connection>(), "no node");
+    }
+    auto nodes   = std::atomic_load(&this->nodes);
+    auto address = node->Address();
+    auto it      = nodes->find(address);
+
+    std::shared_ptr<NodeConnections> connections;
+    if (it != nodes->end()) {
+        connections = it->second;
+        auto now    = SteadyNowMs();
+        std::lock_guard<std::mutex> lock_guard(connections->mutex);
+        auto& idle = connections->idle;
+        while (!idle.empty()) {
+            auto last = idle.back();
+            idle.pop_back();
+            if (last.idleSinceMs + this->option.idleTimeoutMs >= now && alive(last.fd)) {
+                return std::make_tuple(STATUSCODE::SUCCESS,
+                                       std::unique_ptr<Connection>(new Connection(last.fd, node, connections)), "");
+            }
+            close(last.fd);
+        }
+    } else {
+        // not in the pool yet, connect without pooling
+        connections          = std::make_shared<NodeConnections>();
+        connections->address = address;
+        connections->maxIdle = 0;
+        connections->closed  = true;
+        int code;
+        std::string err;
+        std::tie(code, err) = this->resolve(*node, *connections);
+        if (code != STATUSCODE::SUCCESS) {
+            return std::make_tuple(code, std::unique_ptr<Connection>(), err);
+        }
+    }
+
+    int code, fd;
+    std::string err;
+    std::tie(code, fd, err) = this->connect(*connections);
+    if (code != STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, std::unique_ptr<Connection>(), err);
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, std::unique_ptr<Connection>(new Connection(fd, node, connections)),
+                           "");
+}
+
+int ConnectionPool::IdleNum(const std::string& address) const {
+    auto nodes = std::atomic_load(&this->nodes);
+    auto it    = nodes->find(address);
+    if (it == nodes->end()) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock_guard(it->second->mutex);
+    return it->second->idle.size();
+}
+
+void ConnectionPool::Close() {
+    std::lock_guard<std::mutex> lock_guard(this->refreshMutex);
+    auto nodes = std::atomic_load(&this->nodes);
+    std::atomic_store(&this->nodes, std::shared_ptr<const NodeMap>(std::make_shared<NodeMap>()));
+    for (const auto& item : *nodes) {
+        item.second->Close();
+    }
+}
+
+}
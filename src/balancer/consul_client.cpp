@@ -5,13 +5,29 @@
 #include <map>
 #include <sstream>
 
+#include "balancer/factor_table.h"
 #include "util/util.h"
 
 namespace kit {
 
+std::string ServiceFilter::Query() const {
+    // @see https://www.consul.io/api-docs/features/filtering
+    std::stringstream ss;
+    if (!this->expression.empty()) {
+        ss << "&filter=" << UrlEncode(this->expression);
+    }
+    for (const auto &item : this->nodeMeta) {
+        ss << "&node-meta=" << UrlEncode(item.first + ":" + item.second);
+    }
+    return ss.str();
+}
+
 std::tuple<int,
            std::vector<std::shared_ptr<ServiceNode>>,
-           std::string> ConsulClient::GetService(const std::string &serviceName, int timeoutS, std::string &lastIndex) {
+           std::string> ConsulClient::GetService(const std::string &serviceName,
+                                                 int timeoutS,
+                                                 std::string &lastIndex,
+                                                 const ServiceFilter &filter) {
     // @see https://www.consul.io/api/index.html#blocking-queries
     std::vector<std::shared_ptr<ServiceNode>> nodes;
     std::string body;
@@ -19,7 +35,8 @@ std::tuple<int,
     std::string err;
     std::map<std::string, std::string> header;
     std::stringstream ss;
-    ss << this->address << "/v1/health/service/" << serviceName << "?passing=true&wait=" << timeoutS << "s&stale=";
+    ss << this->address << "/v1/health/service/" << serviceName << "?passing=true&wait=" << timeoutS << "s&stale="
+       << filter.Query();
     std::tie(status, body, header, err) = HttpGet(ss.str(), std::map<std::string, std::string>{});
     if (status!=200) {
         return std::make_tuple(-1, nodes, "HttpGet failed. err [" + err + "]");
@@ -90,10 +107,83 @@ std::tuple<int, json11::Json, std::string> ConsulClient::GetKV(const std::string
         }
         lastIndex = header["X-Consul-Index"];
     }
+    // binary values are handed over as is, parsed in place by their consumer
+    if (factor_table::IsBinary(body)) {
+        return std::make_tuple(0, json11::Json(std::move(body)), "");
+    }
     auto jsonObj = json11::Json::parse(body, err);
     if (!err.empty()) {
         return std::make_tuple(-1, json11::Json(), "Json parse failed. err [" + err + "]");
     }
     return std::make_tuple(0, jsonObj, "");
 }
+
+std::tuple<int, json11::Json, std::string> ConsulClient::GetKVPrefix(const std::string &prefix,
+                                                                     int timeoutS,
+                                                                     std::string &lastIndex) {
+    std::string body;
+    int status = -1;
+    std::string err;
+    std::map<std::string, std::string> header;
+    std::stringstream ss;
+    ss << this->address << "/v1/kv/" << prefix << "?recurse=true&wait=" << timeoutS << "s&stale=";
+    std::tie(status, body, header, err) = HttpGet(ss.str(), std::map<std::string, std::string>{});
+    // no key under the prefix yet
+    if (status==404) {
+        return std::make_tuple(0, json11::Json::object{}, "");
+    }
+    if (status!=200) {
+        return std::make_tuple(-1, json11::Json(), "HttpGet failed. err [" + err + "]");
+    }
+    if (header.count("X-Consul-Index") > 0) {
+        if (lastIndex==header["X-Consul-Index"]) {
+            return std::make_tuple(0, json11::Json(), "");
+        }
+        lastIndex = header["X-Consul-Index"];
+    }
+    auto jsonObj = json11::Json::parse(body, err);
+    if (!err.empty()) {
+        return std::make_tuple(-1, json11::Json(), "Json parse failed. err [" + err + "]");
+    }
+
+    auto base = prefix;
+    if (!base.empty() && base.back()!='/') {
+        base += "/";
+    }
+    json11::Json::object values;
+    for (const auto &item : jsonObj.array_items()) {
+        auto key = item["Key"].string_value();
+        if (key.compare(0, base.size(), base)==0) {
+            key = key.substr(base.size());
+        }
+        if (!key.empty()) {
+            values[key] = Base64Decode(item["Value"].string_value());
+        }
+    }
+    return std::make_tuple(0, values, "");
+}
+
+std::tuple<int, std::string> ConsulClient::PutKV(const std::string &path, const std::string &value, int timeoutMs) {
+    int status = -1;
+    std::string body;
+    std::string err;
+    std::tie(status, body, err) = HttpRequest("PUT", this->address + "/v1/kv/" + path,
+                                              std::map<std::string, std::string>{}, value, timeoutMs, timeoutMs);
+    if (status!=200) {
+        return std::make_tuple(-1, "HttpRequest failed. err [" + err + "]");
+    }
+    return std::make_tuple(0, "");
+}
+
+std::tuple<int, std::string> ConsulClient::DeleteKV(const std::string &path, int timeoutMs) {
+    int status = -1;
+    std::string body;
+    std::string err;
+    std::tie(status, body, err) = HttpRequest("DELETE", this->address + "/v1/kv/" + path,
+                                              std::map<std::string, std::string>{}, "", timeoutMs, timeoutMs);
+    if (status!=200) {
+        return std::make_tuple(-1, "HttpRequest failed. err [" + err + "]");
+    }
+    return std::make_tuple(0, "");
+}
 }
@@ -2,13 +2,23 @@
 #include <log4cplus/loggingmacros.h>
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <future>
 #include <json11.hpp>
-#include <random>
+#include <numeric>
 #include "util/util.h"
 #include "util/constant.h"
 
 namespace kit {
 
+// nodes below which a refresh pass is not split, waking the threads would cost more
+static const size_t REFRESH_MIN_PART = 4096;
+
+static uint64_t elapsedUs(std::chrono::steady_clock::time_point begin,
+                          std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+}
+
 ConsulResolver::ConsulResolver(
     const std::string &address,
     const std::string &zone,
@@ -26,7 +36,9 @@ ConsulResolver::ConsulResolver(
     this->onlinelabFactorKey = onlinelabFactorKey,
     this->timeoutS = timeoutS;
     this->cpuThreshold = 0;
-    this->lastIndex = "0";
+    for (auto &index : this->sourceIndex) {
+        index = "0";
+    }
     if (zone != "") {
         this->zone = zone;
     } else {
@@ -34,55 +46,301 @@ ConsulResolver::ConsulResolver(
     }
     this->metric = std::make_shared<ResolverMetric>();
     this->logger = nullptr;
+    this->zoneCPUUpdated = false;
+    this->zoneCPULastUpdated = 0;
+    this->unbalancedNodeNum = 0;
+    this->instanceLoadUpdated = false;
+    this->instanceLoadNewest = 0;
+    this->instanceLoadMaxAgeS = 30;
+    this->topologyEnabled = false;
+    this->nodeStartPrimed = false;
+    this->localZoneOnly = false;
+    this->nodeStatsGeneration = 0;
+    this->poolVersion = 0;
+    this->refreshPool.reset(new ThreadPool(0));
+    // defaults until the onlinelab key is fetched
+    this->applyOnlinelabFactor(json11::Json::object{});
 }
 
 std::tuple<int, std::string> ConsulResolver::updateAll() {
+    auto now = static_cast<uint64_t>(time(nullptr));
+    auto startAt = std::chrono::steady_clock::now();
+
+    // fetch every source concurrently, a slow key only costs its own timeout
+    auto fetchKV = [this](DataSource source) {
+        return std::async(std::launch::async, [this, source]() {
+            if (source==DATA_INSTANCE_LOAD) {
+                return this->client.GetKVPrefix(this->getKey(source), this->timeoutS, this->sourceIndex[source]);
+            }
+            return this->client.GetKV(this->getKey(source), this->timeoutS, this->sourceIndex[source]);
+        });
+    };
+    std::future<std::tuple<int, json11::Json, std::string>> kvFutures[DATA_SOURCE_NUM];
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (source!=DATA_HEALTH && this->sourceEnabled(static_cast<DataSource>(source))) {
+            kvFutures[source] = fetchKV(static_cast<DataSource>(source));
+        }
+    }
+    auto healthFilter = this->prepareHealthFilter(this->sourceIndex[DATA_HEALTH], this->healthQuery);
+    auto healthIndex = this->sourceIndex[DATA_HEALTH];
+    auto healthFuture = std::async(std::launch::async, [this, healthFilter]() {
+        return this->client.GetService(this->service, this->timeoutS, this->sourceIndex[DATA_HEALTH], healthFilter);
+    });
+
+    ConsulFetch fetch;
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (kvFutures[source].valid()) {
+            std::tie(fetch.code[source], fetch.kv[source], fetch.err[source]) = kvFutures[source].get();
+        }
+    }
+    std::tie(fetch.code[DATA_HEALTH], fetch.nodes, fetch.err[DATA_HEALTH]) = healthFuture.get();
+    fetch.nodesModified = !(fetch.nodes.empty() && this->sourceIndex[DATA_HEALTH]==healthIndex);
+
+    auto result = this->applyAll(fetch, now);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startAt).count();
+    this->stats.refreshNum.fetch_add(1, std::memory_order_relaxed);
+    this->stats.refreshUs.fetch_add(us, std::memory_order_relaxed);
+    this->stats.refreshLastUs.store(us, std::memory_order_relaxed);
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_INFO(*(this->logger), "refresh: " << this->refreshJson().dump());
+    }
+    return result;
+}
+
+std::tuple<int, std::string> ConsulResolver::applyAll(const ConsulFetch &fetch, uint64_t now) {
+    // apply every source independently
     int code;
     std::string err;
-    std::tie(code, err) = this->updateCPUThreshold();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger), "update CPU threshold failed. code: [" << code << "], err: [" << err << "]");
-        return std::make_tuple(code, err);
+    typedef std::tuple<int, std::string> (ConsulResolver::*Apply)(const json11::Json &);
+    static const std::pair<DataSource, Apply> appliers[] = {
+        {DATA_CPU_THRESHOLD, &ConsulResolver::applyCPUThreshold},
+        {DATA_ZONE_CPU, &ConsulResolver::applyZoneCPUMap},
+        {DATA_ONLINELAB, &ConsulResolver::applyOnlinelabFactor},
+        {DATA_INSTANCE_FACTOR, &ConsulResolver::applyInstanceFactorMap},
+        {DATA_INSTANCE_LOAD, &ConsulResolver::applyInstanceLoadMap},
+    };
+    for (const auto &applier : appliers) {
+        if (!this->sourceEnabled(applier.first)) {
+            continue;
+        }
+        code = fetch.code[applier.first];
+        err = fetch.err[applier.first];
+        if (code==STATUSCODE::SUCCESS) {
+            std::tie(code, err) = (this->*applier.second)(fetch.kv[applier.first]);
+        }
+        this->markFetched(applier.first, code, err, now);
     }
-    std::tie(code, err) = this->updateZoneCPUMap();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger), "update zoneCPUMap failed. code: [" << code << "], err: [" << err << "]");
-        return std::make_tuple(code, err);
+
+    this->expireStaleData(now);
+
+    // topology, the last known nodes are rebuilt with the fresh kv data even when health failed
+    int healthCode = fetch.code[DATA_HEALTH];
+    std::string healthErr = fetch.err[DATA_HEALTH];
+    if (healthCode==STATUSCODE::SUCCESS) {
+        std::tie(healthCode, healthErr) = this->applyServiceNodes(fetch.nodes, fetch.nodesModified);
+    } else if (this->serviceZones!=nullptr) {
+        this->buildServiceZone();
     }
-    std::tie(code, err) = this->updateOnlinelabFactor();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger), "update onlinelabFactor failed. code: [" << code << "], err: [" << err << "]");
-        return std::make_tuple(code, err);
+    this->markFetched(DATA_HEALTH, healthCode, healthErr, now);
+    if (this->serviceZones==nullptr) {
+        return std::make_tuple(healthCode, healthErr);
     }
-    std::tie(code, err) = this->updateInstanceFactorMap();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger),
-                       "update instanceFactorMap failed. code: [" << code << "], err: [" << err << "]");
+
+    std::tie(code, err) = this->updateCandidatePool();
+    if (code!=STATUSCODE::SUCCESS) {
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_WARN(*(this->logger), "update candidate pool failed. code: [" << code << "], err: [" << err << "]");
+        }
         return std::make_tuple(code, err);
     }
-    std::tie(code, err) = this->updateServiceZone();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger), "update serviceZone failed. code: [" << code << "], err: [" << err << "]");
-        return std::make_tuple(code, err);
+    return std::make_tuple(healthCode, healthErr);
+}
+
+const std::string &ConsulResolver::getKey(DataSource source) const {
+    switch (source) {
+        case DATA_CPU_THRESHOLD: return this->cpuThresholdKey;
+        case DATA_ZONE_CPU: return this->zoneCPUKey;
+        case DATA_INSTANCE_FACTOR: return this->instanceFactorKey;
+        case DATA_ONLINELAB: return this->onlinelabFactorKey;
+        case DATA_INSTANCE_LOAD: return this->instanceLoadPrefix;
+        default: return this->service;
     }
+}
 
-    this->expireBalanceFactorCache();
-    std::tie(code, err) = this->updateCandidatePool();
-    if (code!=0 && this->logger!=nullptr) {
-        LOG4CPLUS_WARN(*(this->logger), "update candidate pool failed. code: [" << code << "], err: [" << err << "]");
-        return std::make_tuple(code, err);
+void ConsulResolver::SetSubsetOption(const SubsetOption &option) {
+    this->subsetter.SetOption(option);
+}
+
+void ConsulResolver::SetServiceFilter(const ServiceFilter &filter, bool localZoneOnly) {
+    this->serviceFilter = filter;
+    this->localZoneOnly = localZoneOnly;
+}
+
+ServiceFilter ConsulResolver::prepareHealthFilter(std::string &index, std::string &lastQuery) const {
+    auto filter = this->serviceFilter;
+    if (this->localZoneOnly && not this->onlinelab.crossZone) {
+        // cross zone nodes would be dropped by updateCandidatePool anyway
+        auto zone = "Service.Meta.zone == \"" + this->zone + "\"";
+        filter.expression = filter.expression.empty() ? zone : "(" + filter.expression + ") and " + zone;
     }
-    return std::make_tuple(0, "");
+    // another filter is another result set, its index starts over
+    auto query = filter.Query();
+    if (query!=lastQuery) {
+        index = "0";
+        lastQuery = query;
+    }
+    return filter;
+}
+
+bool ConsulResolver::sourceEnabled(DataSource source) const {
+    return !this->getKey(source).empty();
+}
+
+void ConsulResolver::SetInstanceLoadPrefix(const std::string &prefix, int maxAgeS) {
+    this->instanceLoadPrefix = prefix;
+    this->instanceLoadMaxAgeS = maxAgeS;
+}
+
+std::tuple<int, std::string> ConsulResolver::applyInstanceLoadMap(const json11::Json &kv) {
+    if (kv.is_null()) {
+        this->instanceLoadUpdated = false;
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+
+    auto instanceLoadMap = std::unordered_map<std::string, InstanceLoad>();
+    uint64_t newest = 0;
+    for (const auto &item : kv.object_items()) {
+        InstanceLoad load;
+        if (InstanceLoad::Decode(item.second.string_value(), load)) {
+            instanceLoadMap[item.first] = load;
+            newest = std::max(newest, load.updated);
+        }
+    }
+    this->instanceLoadUpdated = instanceLoadMap.size()!=this->instanceLoadMap.size() || newest > this->instanceLoadNewest;
+    this->instanceLoadNewest = newest;
+    this->instanceLoadMap = instanceLoadMap;
+    {
+        std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+        this->freshness[DATA_INSTANCE_LOAD].dataUpdated = newest;
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+void ConsulResolver::markFetched(DataSource source, int code, const std::string &err, uint64_t now) {
+    std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+    auto &freshness = this->freshness[source];
+    freshness.lastAttempt = now;
+    if (code==STATUSCODE::SUCCESS) {
+        freshness.lastSuccess = now;
+        freshness.failures = 0;
+        freshness.lastError = "";
+        return;
+    }
+    freshness.failures++;
+    freshness.errors++;
+    freshness.lastError = err;
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_WARN(*(this->logger), "update " << DataSourceName(source) << " failed. code: [" << code
+                                                  << "], err: [" << err << "], failures: [" << freshness.failures
+                                                  << "]");
+    }
+}
+
+void ConsulResolver::expireStaleData(uint64_t now) {
+    bool expired[DATA_SOURCE_NUM];
+    {
+        std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+        for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+            auto &freshness = this->freshness[source];
+            expired[source] = this->sourceEnabled(static_cast<DataSource>(source))
+                && this->stalenessPolicy.Expired(source, freshness, now);
+            if (expired[source]!=freshness.expired && this->logger!=nullptr) {
+                LOG4CPLUS_WARN(*(this->logger), DataSourceName(source) << (expired[source] ? " expired" : " recovered")
+                                                                       << ", age: [" << freshness.Age(now) << "s]");
+            }
+            freshness.expired = expired[source];
+        }
+    }
+
+    // an unchanged consul index reads as not modified, an expired source would only get a
+    // value back once it changed again
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (expired[source]) {
+            this->sourceIndex[source] = "0";
+        }
+    }
+
+    if (expired[DATA_CPU_THRESHOLD]) {
+        this->cpuThreshold = 0;
+    }
+    if (expired[DATA_ONLINELAB]) {
+        this->applyOnlinelabFactor(json11::Json::object{});
+    }
+    if (expired[DATA_ZONE_CPU]) {
+        this->zoneCPUMap.clear();
+        this->zoneCPULastUpdated = 0;
+    }
+    if (expired[DATA_INSTANCE_FACTOR]) {
+        this->instanceFactorMap.clear();
+        this->instanceFactorTable.Reset();
+        this->instanceFactorRaw = json11::Json();
+    }
+    if (expired[DATA_INSTANCE_LOAD]) {
+        this->instanceLoadMap.clear();
+        this->instanceLoadUpdated = false;
+        this->instanceLoadNewest = 0;
+    }
+    // never learn from default workloads
+    if (expired[DATA_ZONE_CPU] || expired[DATA_INSTANCE_FACTOR]) {
+        this->zoneCPUUpdated = false;
+    }
+}
+
+void ConsulResolver::SetStalenessPolicy(const StalenessPolicy &policy) {
+    std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+    this->stalenessPolicy = policy;
+}
+
+DataFreshness ConsulResolver::getFreshness(DataSource source) {
+    std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+    return this->freshness[source];
+}
+
+json11::Json ConsulResolver::refreshJson() const {
+    json11::Json::object refresh{{"us", static_cast<double>(this->stats.refreshLastUs.load(std::memory_order_relaxed))}};
+    for (int stage = 0; stage < REFRESH_STAGE_NUM; stage++) {
+        refresh[std::string(RefreshStageName(stage)) + "Us"] =
+            static_cast<double>(this->stats.stageLastUs[stage].load(std::memory_order_relaxed));
+    }
+    return refresh;
+}
+
+json11::Json ConsulResolver::freshnessJson() const {
+    std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+    auto obj = json11::Json::object{};
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        obj[DataSourceName(source)] = this->freshness[source];
+    }
+    return obj;
 }
 
 std::tuple<int, std::string> ConsulResolver::updateZoneCPUMap() {
-    static time_t lastUpdated = 0;
     int status = -1;
     json11::Json kv;
     std::string err;
-    std::tie(status, kv, err) = this->client.GetKV(this->zoneCPUKey, this->timeoutS, this->lastIndex);
-    if (status!=STATUSCODE::SUCCESS) {
-        return std::make_tuple(status, err);
+    std::tie(status, kv, err) = this->client.GetKV(this->zoneCPUKey, this->timeoutS, this->sourceIndex[DATA_ZONE_CPU]);
+    if (status==STATUSCODE::SUCCESS) {
+        std::tie(status, err) = this->applyZoneCPUMap(kv);
+    }
+    this->markFetched(DATA_ZONE_CPU, status, err, static_cast<uint64_t>(time(nullptr)));
+    return std::make_tuple(status, err);
+}
+
+std::tuple<int, std::string> ConsulResolver::applyZoneCPUMap(const json11::Json &kv) {
+    // same consul index, nothing changed
+    if (kv.is_null()) {
+        this->zoneCPUUpdated = false;
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
     }
 
     if (kv["data"].is_null() || kv["updated"].is_null()) {
@@ -91,12 +349,18 @@ std::tuple<int, std::string> ConsulResolver::updateZoneCPUMap() {
 
     // skip the same updated record
     time_t updated = static_cast<time_t>(kv["updated"].number_value());
-    if (updated==lastUpdated) {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+        this->freshness[DATA_ZONE_CPU].dataUpdated = static_cast<uint64_t>(updated);
+    }
+    if (updated==this->zoneCPULastUpdated) {
         this->zoneCPUUpdated = false;
-        LOG4CPLUS_INFO(*(this->logger), "zone cpu no update, will hold factor learning");
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_INFO(*(this->logger), "zone cpu no update, will hold factor learning");
+        }
         return std::make_tuple(STATUSCODE::SUCCESS, "");
     } else {
-        lastUpdated = updated;
+        this->zoneCPULastUpdated = updated;
         this->zoneCPUUpdated = true;
     }
 
@@ -117,9 +381,35 @@ std::tuple<int, std::string> ConsulResolver::updateInstanceFactorMap() {
     int status = -1;
     json11::Json kv;
     std::string err;
-    std::tie(status, kv, err) = this->client.GetKV(this->instanceFactorKey, this->timeoutS, this->lastIndex);
-    if (status!=STATUSCODE::SUCCESS) {
-        return std::make_tuple(status, err);
+    std::tie(status, kv, err) =
+        this->client.GetKV(this->instanceFactorKey, this->timeoutS, this->sourceIndex[DATA_INSTANCE_FACTOR]);
+    if (status==STATUSCODE::SUCCESS) {
+        std::tie(status, err) = this->applyInstanceFactorMap(kv);
+    }
+    this->markFetched(DATA_INSTANCE_FACTOR, status, err, static_cast<uint64_t>(time(nullptr)));
+    return std::make_tuple(status, err);
+}
+
+std::tuple<int, std::string> ConsulResolver::applyInstanceFactorMap(const json11::Json &kv) {
+    if (kv.is_null()) {
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+
+    if (kv.is_string()) {
+        // binary table, kept as fetched and read in place
+        FactorTableView table;
+        std::string err;
+        if (!table.Parse(kv.string_value().data(), kv.string_value().size(), err)) {
+            return std::make_tuple(STATUSCODE::ERROR_CONSUL_VALUE, err + ", please check instance factor");
+        }
+        this->instanceFactorRaw = kv;
+        auto &raw = this->instanceFactorRaw.string_value();
+        this->instanceFactorTable.Parse(raw.data(), raw.size(), err);
+        this->instanceFactorMap.clear();
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_DEBUG(*(this->logger), "update instanceFactorTable: [" << table.Size() << "] instances");
+        }
+        return std::make_tuple(0, "");
     }
 
     if (kv["data"].is_null()) {
@@ -132,21 +422,42 @@ std::tuple<int, std::string> ConsulResolver::updateInstanceFactorMap() {
     }
 
     this->instanceFactorMap = instanceFactorMap;
+    this->instanceFactorTable.Reset();
+    this->instanceFactorRaw = json11::Json();
 
-    LOG4CPLUS_DEBUG(*(this->logger),
-                    "update instanceFactorMap: [" << json11::Json(this->instanceFactorMap).dump() << "]");
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_DEBUG(*(this->logger),
+                        "update instanceFactorMap: [" << json11::Json(this->instanceFactorMap).dump() << "]");
+    }
     return std::make_tuple(0, "");
 }
 
+bool ConsulResolver::instanceFactor(const std::string &instanceID, double &factor) const {
+    if (this->instanceFactorTable.Valid()) {
+        return this->instanceFactorTable.Find(instanceID, factor);
+    }
+    auto it = this->instanceFactorMap.find(instanceID);
+    if (it==this->instanceFactorMap.end()) {
+        return false;
+    }
+    factor = it->second;
+    return true;
+}
+
 std::tuple<int, std::string> ConsulResolver::updateCPUThreshold() {
     int status = -1;
     json11::Json kv;
     std::string err;
-    std::tie(status, kv, err) = this->client.GetKV(this->cpuThresholdKey, this->timeoutS, this->lastIndex);
-    if (status!=0) {
-        LOG4CPLUS_INFO(*(this->logger), "update cpuThreshold: [" << this->cpuThreshold << "]");
-        return std::make_tuple(status, err);
+    std::tie(status, kv, err) =
+        this->client.GetKV(this->cpuThresholdKey, this->timeoutS, this->sourceIndex[DATA_CPU_THRESHOLD]);
+    if (status==STATUSCODE::SUCCESS) {
+        std::tie(status, err) = this->applyCPUThreshold(kv);
     }
+    this->markFetched(DATA_CPU_THRESHOLD, status, err, static_cast<uint64_t>(time(nullptr)));
+    return std::make_tuple(status, err);
+}
+
+std::tuple<int, std::string> ConsulResolver::applyCPUThreshold(const json11::Json &kv) {
     if (!kv["cpuThreshold"].is_null()) {
         this->cpuThreshold = kv["cpuThreshold"].int_value();
     }
@@ -158,10 +469,18 @@ std::tuple<int, std::string> ConsulResolver::updateOnlinelabFactor() {
     int status = -1;
     json11::Json kv;
     std::string err;
-    std::tie(status, kv, err) = this->client.GetKV(this->onlinelabFactorKey, this->timeoutS, this->lastIndex);
-    if (status!=0) {
-        LOG4CPLUS_ERROR(*(this->logger), "update OnlinelabFactor [" << this->onlinelabFactorKey << "] failed. " << err);
-        return std::make_tuple(status, err);
+    std::tie(status, kv, err) =
+        this->client.GetKV(this->onlinelabFactorKey, this->timeoutS, this->sourceIndex[DATA_ONLINELAB]);
+    if (status==STATUSCODE::SUCCESS) {
+        std::tie(status, err) = this->applyOnlinelabFactor(kv);
+    }
+    this->markFetched(DATA_ONLINELAB, status, err, static_cast<uint64_t>(time(nullptr)));
+    return std::make_tuple(status, err);
+}
+
+std::tuple<int, std::string> ConsulResolver::applyOnlinelabFactor(const json11::Json &kv) {
+    if (kv.is_null()) {
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
     }
     // TODO: return error when not enough parameter provided
     if (!kv["rateThreshold"].is_null()) {
@@ -205,170 +524,361 @@ std::tuple<int, std::string> ConsulResolver::updateServiceZone() {
     int status = -1;
     std::vector<std::shared_ptr<ServiceNode>> nodes;
     std::string err;
-    std::tie(status, nodes, err) = this->client.GetService(this->service, this->timeoutS, this->lastIndex);
-    if (status!=STATUSCODE::SUCCESS) {
-        return std::make_tuple(status, err);
-    }
-
-    std::unordered_map<std::string, std::shared_ptr<ServiceZone>> serviceZoneMap;
-    for (auto &node : nodes) {
-        if (this->instanceFactorMap.count(node->instanceID)==0) {
-            // TODO: default 100?
-            // set 70 to protect new rs until got its cpu load
-            node->workload = 70;
-        } else {
-            // TODO: enlarge the map content
-            node->workload = this->instanceFactorMap[node->instanceID];
-        }
-        if (serviceZoneMap.count(node->zone)==0) {
-            serviceZoneMap[node->zone] = std::make_shared<ServiceZone>();
-            serviceZoneMap[node->zone]->zone = node->zone;
-            if (this->zoneCPUMap.count(node->zone)==0) {
-                // TODO: default 100?
-                serviceZoneMap[node->zone]->workload = 50;
-            } else {
-                serviceZoneMap[node->zone]->workload = this->zoneCPUMap[node->zone];
+    auto filter = this->prepareHealthFilter(this->sourceIndex[DATA_HEALTH], this->healthQuery);
+    auto index = this->sourceIndex[DATA_HEALTH];
+    std::tie(status, nodes, err) =
+        this->client.GetService(this->service, this->timeoutS, this->sourceIndex[DATA_HEALTH], filter);
+    if (status==STATUSCODE::SUCCESS) {
+        std::tie(status, err) = this->applyServiceNodes(nodes, !(nodes.empty() && this->sourceIndex[DATA_HEALTH]==index));
+    }
+    this->markFetched(DATA_HEALTH, status, err, static_cast<uint64_t>(time(nullptr)));
+    return std::make_tuple(status, err);
+}
+
+std::tuple<int, std::string> ConsulResolver::applyServiceNodes(const std::vector<std::shared_ptr<ServiceNode>> &nodes,
+                                                               bool modified) {
+    auto startAt = std::chrono::steady_clock::now();
+    if (modified) {
+        std::vector<std::shared_ptr<ServiceNode>> previousNodes(nodes);
+        std::vector<std::shared_ptr<NodeStats>> previousStats;
+        previousNodes.swap(this->serviceNodes);
+        previousStats.swap(this->serviceStats);
+
+        // the state of every instance, looked up in parallel, the joining ones added after
+        auto &states = this->serviceStats;
+        auto &refreshPool = *(this->refreshPool);
+        states.assign(nodes.size(), nullptr);
+        refreshPool.ParallelFor(nodes.size(), refreshPool.Parts(nodes.size(), REFRESH_MIN_PART),
+                                [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                auto it = this->nodeStats.find(nodes[i]->instanceID);
+                if (it!=this->nodeStats.end()) {
+                    states[i] = it->second;
+                }
+            }
+        });
+
+        // nodes joining or back from unhealthy start their slow start now, the first ones are warm
+        auto now = SlowStartNowMs();
+        auto generation = ++this->nodeStatsGeneration;
+        size_t instanceNum = 0;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            auto &stats = states[i];
+            if (stats==nullptr) {
+                auto &joined = this->nodeStats[nodes[i]->instanceID];
+                if (joined==nullptr) {
+                    joined = std::make_shared<NodeStats>();
+                    joined->startMs = this->nodeStartPrimed ? now : 0;
+                }
+                stats = joined;
+            }
+            if (stats->generation!=generation) {
+                stats->generation = generation;
+                instanceNum++;
+            }
+        }
+        // instances gone since the previous update, all of them were in its nodes
+        if (this->nodeStats.size() > instanceNum) {
+            for (size_t i = 0; i < previousNodes.size(); i++) {
+                if (previousStats[i]->generation!=generation) {
+                    this->nodeStats.erase(previousNodes[i]->instanceID);
+                }
             }
         }
-        serviceZoneMap[node->zone]->nodes.emplace_back(node);
+        this->nodeStartPrimed = this->nodeStartPrimed || !nodes.empty();
     }
+    this->stats.stageLastUs[REFRESH_NODES].store(modified ? elapsedUs(startAt) : 0, std::memory_order_relaxed);
+    this->buildServiceZone();
+    return std::make_tuple(0, "");
+}
+
+void ConsulResolver::buildServiceZone() {
+    auto startAt = std::chrono::steady_clock::now();
+    auto now = static_cast<uint64_t>(time(nullptr));
+    auto maxAgeS = static_cast<uint64_t>(this->instanceLoadMaxAgeS);
+    const auto &serviceNodes = this->serviceNodes;
+    auto &zoneIndex = this->serviceZoneIndex;
+    auto &refreshPool = *(this->refreshPool);
+    auto parts = refreshPool.Parts(serviceNodes.size(), REFRESH_MIN_PART);
+
+    // zones of every part in the order first seen, the nodes are copied in a second pass
+    // straight to their place in the zone, both passes split the nodes the same way
+    struct ZonePart {
+        std::unordered_map<std::string, uint32_t> index;
+        std::vector<std::string>                  zones;
+        std::vector<uint32_t>                     global;    // part zone => zone
+        std::vector<size_t>                       nodeNum;   // per zone, offset in the zone after the merge
+        std::vector<std::pair<double, int>>       reported;  // per zone, reported workload sum, num
+    };
+    std::vector<ZonePart> zoneParts(parts);
+    zoneIndex.resize(serviceNodes.size());
+    refreshPool.ParallelFor(serviceNodes.size(), parts, [&](size_t part, size_t begin, size_t end) {
+        auto &zonePart = zoneParts[part];
+        uint32_t last = UINT32_MAX;
+        for (size_t i = begin; i < end; i++) {
+            const auto &zone = serviceNodes[i]->zone;
+            if (last==UINT32_MAX || zonePart.zones[last]!=zone) {
+                auto it = zonePart.index.find(zone);
+                if (it==zonePart.index.end()) {
+                    it = zonePart.index.emplace(zone, static_cast<uint32_t>(zonePart.zones.size())).first;
+                    zonePart.zones.emplace_back(zone);
+                    zonePart.nodeNum.emplace_back(0);
+                }
+                last = it->second;
+            }
+            zoneIndex[i] = last;
+            zonePart.nodeNum[last]++;
+        }
+    });
 
+    std::unordered_map<std::string, uint32_t> zoneMap;
     auto serviceZones = std::make_shared<std::vector<std::shared_ptr<ServiceZone>>>();
+    for (auto &zonePart : zoneParts) {
+        for (auto &zone : zonePart.zones) {
+            auto it = zoneMap.find(zone);
+            if (it==zoneMap.end()) {
+                it = zoneMap.emplace(zone, static_cast<uint32_t>(serviceZones->size())).first;
+                auto serviceZone = std::make_shared<ServiceZone>();
+                serviceZone->zone = zone;
+                auto cpu = this->zoneCPUMap.find(zone);
+                // TODO: default 100?
+                serviceZone->workload = cpu==this->zoneCPUMap.end() ? 50 : cpu->second;
+                serviceZones->emplace_back(serviceZone);
+            }
+            zonePart.global.emplace_back(it->second);
+        }
+    }
+    std::vector<size_t> zoneNodeNum(serviceZones->size(), 0);
+    for (auto &zonePart : zoneParts) {
+        for (size_t z = 0; z < zonePart.zones.size(); z++) {
+            auto num = zonePart.nodeNum[z];
+            zonePart.nodeNum[z] = zoneNodeNum[zonePart.global[z]];
+            zoneNodeNum[zonePart.global[z]] += num;
+        }
+        zonePart.reported.assign(zonePart.zones.size(), std::make_pair(0.0, 0));
+    }
+    for (size_t z = 0; z < serviceZones->size(); z++) {
+        (*serviceZones)[z]->nodes.resize(zoneNodeNum[z]);
+    }
+
+    refreshPool.ParallelFor(serviceNodes.size(), parts, [&](size_t part, size_t begin, size_t end) {
+        auto &zonePart = zoneParts[part];
+        for (size_t i = begin; i < end; i++) {
+            // nodes of the previous pool may still be read by selection, never modify them
+            auto node = std::make_shared<ServiceNode>(*serviceNodes[i]);
+            node->stats = this->serviceStats[i];
+            auto reported = this->instanceLoadMap.find(node->instanceID);
+            if (reported!=this->instanceLoadMap.end() && (maxAgeS==0 || reported->second.updated + maxAgeS >= now)) {
+                // self reported load, seconds old
+                node->workload = reported->second.cpu;
+                zonePart.reported[zoneIndex[i]].first += node->workload;
+                zonePart.reported[zoneIndex[i]].second++;
+            } else if (!this->instanceFactor(node->instanceID, node->workload)) {
+                // TODO: default 100?
+                // set 70 to protect new rs until got its cpu load
+                node->workload = 70;
+            }
+            auto z = zonePart.global[zoneIndex[i]];
+            (*serviceZones)[z]->nodes[zonePart.nodeNum[zoneIndex[i]]++] = std::move(node);
+        }
+    });
+
+    // zones mostly covered by self reports use their average, fresher than the zone cpu
+    std::vector<std::pair<double, int>> reportedZones(serviceZones->size(), std::make_pair(0.0, 0));
+    for (auto &zonePart : zoneParts) {
+        for (size_t z = 0; z < zonePart.zones.size(); z++) {
+            reportedZones[zonePart.global[z]].first += zonePart.reported[z].first;
+            reportedZones[zonePart.global[z]].second += zonePart.reported[z].second;
+        }
+    }
     auto localZone = std::make_shared<ServiceZone>();
-    for (auto &item : serviceZoneMap) {
-        serviceZones->emplace_back(item.second);
-        if (item.second->zone==this->zone) {
-            localZone = item.second;
+    for (size_t z = 0; z < serviceZones->size(); z++) {
+        auto &serviceZone = (*serviceZones)[z];
+        auto &reported = reportedZones[z];
+        if (reported.second > 0 && reported.second*2 >= static_cast<int>(serviceZone->nodes.size())) {
+            serviceZone->workload = reported.first/reported.second;
+        }
+        if (serviceZone->zone==this->zone) {
+            localZone = serviceZone;
+        }
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_INFO(*(this->logger), "zone: " << serviceZone->zone << " node: " << serviceZone->nodes.size());
         }
-        LOG4CPLUS_INFO(*(this->logger), "zone: " << item.first << " node: " << item.second->nodes.size());
     }
 
     this->serviceZones = serviceZones;
     this->localZone = localZone;
-
-    return std::make_tuple(0, "");
+    this->stats.stageLastUs[REFRESH_ZONE].store(elapsedUs(startAt), std::memory_order_relaxed);
 }
 
 std::tuple<int, std::string> ConsulResolver::updateCandidatePool() {
+    auto startAt = std::chrono::steady_clock::now();
     auto localZone = this->localZone;
     auto serviceZones = this->serviceZones;
-    auto &balanceFactorCache = this->balanceFactorCache;
+    auto &factorStore = this->factorStore;
+    auto &ids = this->candidateIDs;
+    auto &batch = this->learningBatch;
+    auto &refreshPool = *(this->refreshPool);
     auto candidatePool = std::make_shared<CandidatePool>();
-    // TODO: using onlinelab
-    static auto BALANCEFACTOR_MAX_LOCAL = 3000;
-    static auto BALANCEFACTOR_MIN_LOCAL = 200;
-    static auto BALANCEFACTOR_MAX_CROSS = 1000;
-    static auto BALANCEFACTOR_MIN_CROSS = 1;
-    static auto BALANCEFACTOR_START_CROSS = 50;
-    static auto BALANCEFACTOR_CROSS_RATE = 0.1;
-
-    // firstly, mark factor is cached or not
-    bool factorCached = not balanceFactorCache.empty();
-    // local zone average factor for fresh new node
-    static double localAvgFactor = 0;
 
+    // flatten the candidate nodes, local zone always, cross zones when enabled
+    struct CandidateZone {
+        double workload;
+        bool   local;
+        bool   spill;
+    };
+    std::vector<CandidateZone> zones;
+    auto &nodes = this->candidateNodes;
+    auto &zoneBegin = this->candidateZoneBegin;
+    nodes.clear();
+    zoneBegin.clear();
+    double minWorkload = -1;
     for (auto &serviceZone : *serviceZones) {
-        if (localZone->zone==serviceZone->zone) {
-            for (auto &node : serviceZone->nodes) {
-                candidatePool->nodes.emplace_back(node);
-                candidatePool->weights.emplace_back(0);
-
-                // node config factor by default
-                auto balanceFactor = node->balanceFactor;
-                if (factorCached) {
-                    // use cache when in cache
-                    if (balanceFactorCache.count(node->instanceID) > 0) {
-                        balanceFactor = balanceFactorCache[node->instanceID];
-                    } else if (localAvgFactor!=0) {
-                        // downshift the factor for fresh new node by avg
-                        balanceFactor = localAvgFactor;
-                    } else {
-                        // TODO: remove this logic later
-                        // downshift the factor for fresh new node by rate, default
-                        balanceFactor = node->balanceFactor*this->onlinelab.factorStartRate;
-                    }
-                }
+        bool local = localZone->zone==serviceZone->zone;
+        if (not local && not this->onlinelab.crossZone) {
+            continue;
+        }
+        if (not serviceZone->nodes.empty() && (minWorkload < 0 || serviceZone->workload < minWorkload)) {
+            minWorkload = serviceZone->workload;
+        }
+        // cross zone threshold double the node threshold
+        bool spill = not local && localZone->workload > this->cpuThreshold
+            && not zoneBalanced(*localZone, *serviceZone) && localZone->workload > serviceZone->workload;
+        zones.push_back(CandidateZone{serviceZone->workload, local, spill});
+        zoneBegin.emplace_back(nodes.size());
+        nodes.insert(nodes.end(), serviceZone->nodes.begin(), serviceZone->nodes.end());
+    }
+    zoneBegin.emplace_back(nodes.size());
 
-                if (this->zoneCPUUpdated && not nodeBalanced(*node, *serviceZone)) {
-                    if (node->workload > serviceZone->workload) {
-                        balanceFactor -= balanceFactor*this->onlinelab.learningRate;
-                    } else {
-                        balanceFactor += balanceFactor*this->onlinelab.learningRate;
-                    }
-                }
-                // risk control
-                if (balanceFactor > BALANCEFACTOR_MAX_LOCAL) {
-                    balanceFactor = BALANCEFACTOR_MAX_LOCAL;
-                } else if (balanceFactor < BALANCEFACTOR_MIN_LOCAL) {
-                    balanceFactor = BALANCEFACTOR_MIN_LOCAL;
-                }
-                node->currentFactor = balanceFactor;
-                candidatePool->factors.emplace_back(balanceFactor);
-                candidatePool->factorSum += balanceFactor;
-                balanceFactorCache[node->instanceID] = balanceFactor;
+    // the store id of an instance is kept in its state, a lookup only for the joining ones
+    auto storeOption = factorStore.getOption();
+    storeOption.ttl = static_cast<uint32_t>(std::max(this->onlinelab.factorCacheExpire, 1.0));
+    factorStore.SetOption(storeOption);
+    factorStore.Begin();
+    ids.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        auto &stats = nodes[i]->stats;
+        ids[i] = factorStore.Acquire(nodes[i]->instanceID, stats!=nullptr ? stats->storeID : UINT32_MAX);
+        if (stats!=nullptr) {
+            stats->storeID = ids[i];
+        }
+    }
+    auto parts = refreshPool.Parts(nodes.size(), REFRESH_MIN_PART);
+    batch.Resize(nodes.size());
+    refreshPool.ParallelFor(nodes.size(), parts, [&](size_t, size_t begin, size_t end) {
+        size_t z = std::upper_bound(zoneBegin.begin(), zoneBegin.end(), begin) - zoneBegin.begin() - 1;
+        for (size_t i = begin; i < end; i++) {
+            while (i >= zoneBegin[z+1]) {
+                z++;
             }
+            double cached = 0;
+            bool hit = factorStore.Get(ids[i], cached);
+            batch.Set(i, nodes[i]->workload, zones[z].workload, nodes[i]->balanceFactor, hit, cached, zones[z].local,
+                      zones[z].spill);
+        }
+    });
 
-            // update local zone avg factor for fresh new node
-            if (not candidatePool->factors.empty()) {
-                localAvgFactor = candidatePool->factorSum/candidatePool->factors.size();
-                LOG4CPLUS_DEBUG(*(this->logger), "localAvgFactor updated: " << localAvgFactor);
-            }
-        } else if (this->onlinelab.crossZone) {
-            // cross zone
-            for (auto &node: serviceZone->nodes) {
-                candidatePool->nodes.emplace_back(node);
-                candidatePool->weights.emplace_back(0);
-
-                // initial balanceFactor if cached, use cache
-                auto balanceFactor = node->balanceFactor;
-                if (balanceFactorCache.count(node->instanceID) > 0) {
-                    balanceFactor = balanceFactorCache[node->instanceID];
-                } else {
-                    // cross zone threshold double the node threshold
-                    if (localZone->workload > this->cpuThreshold && not zoneBalanced(*localZone, *serviceZone)
-                        && localZone->workload > serviceZone->workload) {
-                        // Too large
-                        // balanceFactor = balanceFactor*(localZone->workload - serviceZone->workload)/100.0;
-                        balanceFactor = balanceFactor*BALANCEFACTOR_CROSS_RATE;
-                    } else {
-                        balanceFactor = BALANCEFACTOR_MIN_CROSS;
-                    }
-                }
+    bool learning = this->zoneCPUUpdated || this->instanceLoadUpdated;
+    int unbalancedNodeNum = this->learner.Learn(this->onlinelab, learning, batch);
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_DEBUG(*(this->logger), "localAvgFactor updated: " << this->learner.getLocalAvgFactor());
+    }
 
-                if (this->zoneCPUUpdated) {
-                    // update cross zone all node factor
-                    if (localZone->workload > this->cpuThreshold && not zoneBalanced(*localZone, *serviceZone)
-                        && localZone->workload > serviceZone->workload) {
-                        // reset factor to speed cross when start
-                        if (balanceFactor < BALANCEFACTOR_START_CROSS) {
-                            balanceFactor = BALANCEFACTOR_START_CROSS;
-                        }
-                        balanceFactor += balanceFactor*this->onlinelab.learningRate;
-                    } else {
-                        balanceFactor -= balanceFactor*this->onlinelab.learningRate;
-                    }
-
-                    // update single lazy/busy node factor
-                    if (not nodeBalanced(*node, *serviceZone)) {
-                        if (node->workload > serviceZone->workload) {
-                            balanceFactor -= balanceFactor*this->onlinelab.learningRate;
-                        } else {
-                            balanceFactor += balanceFactor*this->onlinelab.learningRate;
-                        }
-                    }
-                }
-                // risk control
-                if (balanceFactor > BALANCEFACTOR_MAX_CROSS) {
-                    balanceFactor = BALANCEFACTOR_MAX_CROSS;
-                } else if (balanceFactor < BALANCEFACTOR_MIN_CROSS) {
-                    balanceFactor = BALANCEFACTOR_MIN_CROSS;
-                }
-                node->currentFactor = balanceFactor;
-                candidatePool->factors.emplace_back(balanceFactor);
-                candidatePool->factorSum += balanceFactor;
-                balanceFactorCache[node->instanceID] = balanceFactor;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]->currentFactor = batch.factor[i];
+        factorStore.Set(ids[i], batch.factor[i]);
+    }
+    factorStore.End();
+    auto poolAt = std::chrono::steady_clock::now();
+    this->stats.stageLastUs[REFRESH_FACTOR].store(elapsedUs(startAt, poolAt), std::memory_order_relaxed);
+
+    // keep the subset of every zone, scaled up so the zones still share the traffic as learned
+    auto &keep = this->candidateKeep;
+    keep.assign(nodes.size(), 1);
+    if (this->subsetter.Enabled()) {
+        this->subsetter.Begin();
+        for (size_t z = 0; z + 1 < zoneBegin.size(); z++) {
+            this->subsetter.Select(nodes, zoneBegin[z], zoneBegin[z+1], keep);
+        }
+        this->subsetter.End();
+    }
+    // batch.factor becomes the scaled factor, ids the place of the node in the pool
+    size_t kept = 0;
+    for (size_t z = 0; z + 1 < zoneBegin.size(); z++) {
+        double zoneSum = 0;
+        double keptSum = 0;
+        for (size_t i = zoneBegin[z]; i < zoneBegin[z+1]; i++) {
+            zoneSum += batch.factor[i];
+            keptSum += keep[i] ? batch.factor[i] : 0;
+        }
+        double scale = keptSum > 0 ? zoneSum/keptSum : 1;
+        for (size_t i = zoneBegin[z]; i < zoneBegin[z+1]; i++) {
+            batch.factor[i] *= scale;
+            ids[i] = keep[i] ? static_cast<uint32_t>(kept++) : UINT32_MAX;
+        }
+    }
+
+    // where the selection interpolates from, joining nodes start at 0. the instances remember
+    // their factor in the pool built last, a pool installed by SetCandidatePool has none
+    auto previousPool = this->getCandidatePool();
+    bool transition = previousPool!=nullptr && not previousPool->nodes.empty() && previousPool->version==this->poolVersion;
+    auto previousVersion = transition ? previousPool->version : 0;
+    candidatePool->nodes.resize(kept);
+    candidatePool->factors.resize(kept);
+    candidatePool->rampStartMs.resize(kept);
+    if (transition) {
+        candidatePool->previousFactors.resize(kept);
+    }
+    std::vector<size_t> movedParts(parts, 0);
+    std::vector<uint64_t> rampParts(parts, 0);
+    refreshPool.ParallelFor(nodes.size(), parts, [&](size_t part, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (ids[i]==UINT32_MAX) {
+                continue;
+            }
+            auto k = ids[i];
+            auto &stats = nodes[i]->stats;
+            auto rampStartMs = stats!=nullptr ? stats->startMs : 0;
+            candidatePool->nodes[k] = nodes[i];
+            candidatePool->factors[k] = batch.factor[i];
+            candidatePool->rampStartMs[k] = rampStartMs;
+            rampParts[part] = std::max(rampParts[part], rampStartMs);
+            if (transition) {
+                bool moved = stats!=nullptr && stats->poolVersion==previousVersion;
+                candidatePool->previousFactors[k] = moved ? stats->poolFactor : 0;
+                movedParts[part] += moved;
             }
         }
+    });
+    candidatePool->factorSum = 0;
+    for (size_t k = 0; k < kept; k++) {
+        candidatePool->factorSum += candidatePool->factors[k];
+    }
+    candidatePool->rampNewestMs = *std::max_element(rampParts.begin(), rampParts.end());
+    candidatePool->weights.assign(candidatePool->nodes.size(), 0);
+    candidatePool->version = ++this->poolVersion;
+    if (transition) {
+        candidatePool->transitionStartMs = SlowStartNowMs();
+        // a whole new fleet has nothing to move from
+        if (std::accumulate(movedParts.begin(), movedParts.end(), static_cast<size_t>(0))==0) {
+            candidatePool->previousFactors.clear();
+            candidatePool->transitionStartMs = 0;
+        }
+    }
+    for (size_t k = 0; k < kept; k++) {
+        auto &stats = candidatePool->nodes[k]->stats;
+        if (stats!=nullptr) {
+            stats->poolVersion = candidatePool->version;
+            stats->poolFactor = candidatePool->factors[k];
+        }
+    }
+    // every reachable zone above the threshold, nowhere left to spill
+    if (this->cpuThreshold > 0 && this->cpuThreshold < 100 && minWorkload > this->cpuThreshold) {
+        candidatePool->overload = std::min(1.0, (minWorkload - this->cpuThreshold)/(100 - this->cpuThreshold));
+    }
+
+    if (learning) {
+        this->unbalancedNodeNum = unbalancedNodeNum;
     }
 
     // metric
@@ -376,23 +886,15 @@ std::tuple<int, std::string> ConsulResolver::updateCandidatePool() {
     metric->candidatePoolSize = candidatePool->nodes.size();
 
     this->serviceUpdaterMutex.lock();
-    LOG4CPLUS_INFO(*(this->logger), "previous metric: " << this->metric->to_json().dump());
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_INFO(*(this->logger), "previous metric: " << this->metric->to_json().dump());
+    }
     this->candidatePool = candidatePool;
     this->metric = metric;
     this->serviceUpdaterMutex.unlock();
-    return std::make_tuple(0, "");
-}
-
-std::tuple<int, std::string> ConsulResolver::expireBalanceFactorCache() {
-    static std::random_device rd;
-    static std::mt19937 mt(rd());
-    static std::uniform_int_distribution<int> dist(1, this->onlinelab.factorCacheExpire);
-    if (1==dist(mt)) {
-        this->balanceFactorCache.clear();
-        LOG4CPLUS_INFO(*(this->logger), "balanceFactorCache expired");
-    } else {
-        LOG4CPLUS_DEBUG(*(this->logger), "balanceFactorCache alive");
-    }
+    this->traceRefresh(*candidatePool);
+    this->diffTopology(candidatePool);
+    this->stats.stageLastUs[REFRESH_POOL].store(elapsedUs(poolAt), std::memory_order_relaxed);
     return std::make_tuple(0, "");
 }
 
@@ -406,40 +908,191 @@ bool ConsulResolver::zoneBalanced(const kit::ServiceZone &localZone, const kit::
 }
 
 std::shared_ptr<ServiceNode> ConsulResolver::SelectedNode() {
+    auto candidatePool = this->getCandidatePool();
+    auto idx = candidatePool!=nullptr ? this->selection.Select(*candidatePool) : -1;
+    if (idx < 0) {
+        if (this->logger!=nullptr) {
+            LOG4CPLUS_FATAL(*(this->logger), "SelectedNode: have no service nodes");
+        }
+        return nullptr;
+    }
+    this->countSelected(*(candidatePool->nodes[idx]));
+
+    if (this->logger!=nullptr) {
+        LOG4CPLUS_DEBUG(*(this->logger), "SelectedNode: " << candidatePool->nodes[idx]->to_json().dump());
+    }
+    return candidatePool->nodes[idx];
+}
+
+void ConsulResolver::countSelected(const ServiceNode &node) {
     this->serviceUpdaterMutex.lock_shared();
-    auto candidatePool = this->candidatePool;
     auto metric = this->metric;
     this->serviceUpdaterMutex.unlock_shared();
-    std::lock_guard<std::mutex> lock_guard(this->discoverMutex);
 
-    if (candidatePool->nodes.size() == 0) {
-        LOG4CPLUS_FATAL(*(this->logger), "SelectedNode: have no service nodes");
-        return nullptr;
+    metric->selectNum.fetch_add(1, std::memory_order_relaxed);
+    this->stats.selectNum.fetch_add(1, std::memory_order_relaxed);
+    if (node.zone!=this->zone) {
+        metric->crossZoneNum.fetch_add(1, std::memory_order_relaxed);
+        this->stats.crossZoneNum.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (node.stats!=nullptr) {
+        node.stats->selectNum.fetch_add(1, std::memory_order_relaxed);
     }
+}
+
+std::shared_ptr<ResolverMetric> ConsulResolver::getMetric() {
+    boost::shared_lock<boost::shared_mutex> lock(this->serviceUpdaterMutex);
+    return this->metric;
+}
+
+const std::string &ConsulResolver::getLocalZone() const {
+    return this->zone;
+}
+
+std::shared_ptr<CandidatePool> ConsulResolver::getCandidatePool() {
+    boost::shared_lock<boost::shared_mutex> lock(this->serviceUpdaterMutex);
+    return this->candidatePool;
+}
 
-    int idx = 0;
-    double max = 0;
-    for (int i = 0; i < candidatePool->factors.size(); i++) {
-        candidatePool->weights[i] += candidatePool->factors[i];
-        if (max < candidatePool->weights[i]) {
-            max = candidatePool->weights[i];
-            idx = i;
+void ConsulResolver::SetCandidatePool(const std::shared_ptr<CandidatePool> &candidatePool) {
+    auto metric = std::make_shared<ResolverMetric>();
+    metric->candidatePoolSize = candidatePool->nodes.size();
+
+    this->serviceUpdaterMutex.lock();
+    this->candidatePool = candidatePool;
+    this->metric = metric;
+    this->serviceUpdaterMutex.unlock();
+    this->traceRefresh(*candidatePool);
+    this->diffTopology(candidatePool);
+}
+
+void ConsulResolver::traceRefresh(const CandidatePool &candidatePool) {
+    if (this->trace==nullptr) {
+        return;
+    }
+    auto size = static_cast<int32_t>(candidatePool.nodes.size());
+    // the refresh and every factor of it fit the ring at once, a large pool would
+    // overwrite its own refresh otherwise
+    this->trace->Reserve(size + 1);
+    this->trace->Record(TRACE_REFRESH, candidatePool.version, size, 0, candidatePool.factorSum);
+    for (int32_t i = 0; i < size; i++) {
+        this->trace->Record(TRACE_FACTOR, candidatePool.version, i, candidatePool.factors[i], candidatePool.factorSum);
+    }
+}
+
+void ConsulResolver::RenderMetrics(PrometheusWriter &writer) {
+    const auto &service = this->service;
+    writer.Family("clb_selections_total", "counter", "Nodes selected.");
+    writer.Sample("clb_selections_total", {{"service", service}}, this->stats.selectNum.load(std::memory_order_relaxed));
+    writer.Family("clb_cross_zone_selections_total", "counter", "Nodes selected out of the local zone.");
+    writer.Sample("clb_cross_zone_selections_total", {{"service", service}},
+                  this->stats.crossZoneNum.load(std::memory_order_relaxed));
+    auto metric = this->getMetric();
+    auto selectNum = metric->selectNum.load(std::memory_order_relaxed);
+    writer.Family("clb_cross_zone_ratio", "gauge", "Share of the selections out of the local zone since the last pool swap.");
+    writer.Sample("clb_cross_zone_ratio", {{"service", service}},
+                  selectNum==0 ? 0 : static_cast<double>(metric->crossZoneNum.load(std::memory_order_relaxed))/selectNum);
+
+    // nodes of the current pool, nodes from shared memory carry no counters
+    auto candidatePool = this->getCandidatePool();
+    auto size = candidatePool!=nullptr ? candidatePool->nodes.size() : 0;
+    writer.Family("clb_candidate_pool_size", "gauge", "Nodes in the candidate pool.");
+    writer.Sample("clb_candidate_pool_size", {{"service", service}}, size);
+    writer.Family("clb_node_selections_total", "counter", "Selections of a node since it was first seen.");
+    for (size_t i = 0; i < size; i++) {
+        const auto &node = *(candidatePool->nodes[i]);
+        if (node.stats!=nullptr) {
+            writer.Sample("clb_node_selections_total",
+                          {{"service", service}, {"zone", node.zone}, {"instance", node.instanceID}},
+                          node.stats->selectNum.load(std::memory_order_relaxed));
         }
     }
-    candidatePool->weights[idx] -= candidatePool->factorSum;
+    writer.Family("clb_node_factor", "gauge", "Factor of a node in the candidate pool.");
+    for (size_t i = 0; i < size; i++) {
+        const auto &node = *(candidatePool->nodes[i]);
+        writer.Sample("clb_node_factor", {{"service", service}, {"zone", node.zone}, {"instance", node.instanceID}},
+                      candidatePool->factors[i]);
+    }
 
-    // metric
-    metric->selectNum += 1;
-    if (candidatePool->nodes[idx]->zone!=this->zone) {
-        metric->crossZoneNum += 1;
+    writer.Family("clb_refresh_duration_seconds", "summary", "Time of a refresh from consul.");
+    writer.Sample("clb_refresh_duration_seconds_sum", {{"service", service}},
+                  this->stats.refreshUs.load(std::memory_order_relaxed)/1e6);
+    writer.Sample("clb_refresh_duration_seconds_count", {{"service", service}},
+                  this->stats.refreshNum.load(std::memory_order_relaxed));
+    writer.Family("clb_refresh_last_duration_seconds", "gauge", "Time of the last refresh from consul.");
+    writer.Sample("clb_refresh_last_duration_seconds", {{"service", service}},
+                  this->stats.refreshLastUs.load(std::memory_order_relaxed)/1e6);
+    writer.Family("clb_refresh_stage_last_duration_seconds", "gauge", "Time of each stage of the last refresh.");
+    for (int stage = 0; stage < REFRESH_STAGE_NUM; stage++) {
+        writer.Sample("clb_refresh_stage_last_duration_seconds", {{"service", service}, {"stage", RefreshStageName(stage)}},
+                      this->stats.stageLastUs[stage].load(std::memory_order_relaxed)/1e6);
     }
 
-    LOG4CPLUS_DEBUG(*(this->logger), "SelectedNode: " << candidatePool->nodes[idx]->to_json().dump());
-    return candidatePool->nodes[idx];
+    // consul sources, read under the lock instead of copying the freshness out
+    auto now = static_cast<uint64_t>(time(nullptr));
+    std::lock_guard<std::mutex> lock_guard(this->freshnessMutex);
+    writer.Family("clb_consul_errors_total", "counter", "Failed fetches of a consul source.");
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (this->sourceEnabled(static_cast<DataSource>(source))) {
+            writer.Sample("clb_consul_errors_total", {{"service", service}, {"source", DataSourceName(source)}},
+                          this->freshness[source].errors);
+        }
+    }
+    writer.Family("clb_consul_consecutive_failures", "gauge", "Failed fetches of a consul source since its last success.");
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (this->sourceEnabled(static_cast<DataSource>(source))) {
+            writer.Sample("clb_consul_consecutive_failures", {{"service", service}, {"source", DataSourceName(source)}},
+                          this->freshness[source].failures);
+        }
+    }
+    writer.Family("clb_data_age_seconds", "gauge", "Age of the data of a consul source, +Inf before the first fetch.");
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (this->sourceEnabled(static_cast<DataSource>(source))) {
+            auto age = this->freshness[source].Age(now);
+            writer.Sample("clb_data_age_seconds", {{"service", service}, {"source", DataSourceName(source)}},
+                          age==UINT64_MAX ? HUGE_VAL : static_cast<double>(age));
+        }
+    }
+    writer.Family("clb_data_expired", "gauge", "1 while a consul source is older than its staleness policy allows.");
+    for (int source = 0; source < DATA_SOURCE_NUM; source++) {
+        if (this->sourceEnabled(static_cast<DataSource>(source))) {
+            writer.Sample("clb_data_expired", {{"service", service}, {"source", DataSourceName(source)}},
+                          this->freshness[source].expired ? 1 : 0);
+        }
+    }
 }
 
-std::string ConsulResolver::getLocalZone() {
-    return this->zone;
+void ConsulResolver::diffTopology(const std::shared_ptr<CandidatePool> &candidatePool) {
+    std::lock_guard<std::mutex> lock_guard(this->topologyMutex);
+    if (not this->topologyEnabled || candidatePool==nullptr) {
+        return;
+    }
+    auto delta = this->topologyDiffer.Diff(*candidatePool);
+    if (delta!=nullptr) {
+        this->topologyDispatcher.Publish(delta);
+    }
+}
+
+uint64_t ConsulResolver::SubscribeTopology(const TopologyCallback &callback) {
+    std::lock_guard<std::mutex> lock_guard(this->topologyMutex);
+    if (not this->topologyEnabled) {
+        // catch up with the current pool, the first subscriber gets it as its snapshot
+        this->topologyEnabled = true;
+        auto candidatePool = this->getCandidatePool();
+        if (candidatePool!=nullptr) {
+            this->topologyDiffer.Diff(*candidatePool);
+        }
+    }
+    return this->topologyDispatcher.Subscribe(callback, this->topologyDiffer.Snapshot());
+}
+
+void ConsulResolver::UnsubscribeTopology(uint64_t id) {
+    this->topologyDispatcher.Unsubscribe(id);
+}
+
+void ConsulResolver::SetTopologyOption(const TopologyOption &option) {
+    std::lock_guard<std::mutex> lock_guard(this->topologyMutex);
+    this->topologyDiffer.SetOption(option);
 }
 
 }
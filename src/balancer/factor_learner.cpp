@@ -0,0 +1,107 @@
+#include "balancer/factor_learner.h"
+#include <algorithm>
+#include <cmath>
+
+namespace kit {
+
+void LearningBatch::Clear() {
+    this->workload.clear();
+    this->zoneWorkload.clear();
+    this->configFactor.clear();
+    this->cachedFactor.clear();
+    this->cached.clear();
+    this->local.clear();
+    this->spill.clear();
+    this->factor.clear();
+}
+
+void LearningBatch::Add(double workload, double zoneWorkload, double configFactor, bool cached, double cachedFactor,
+                        bool local, bool spill) {
+    this->workload.emplace_back(workload);
+    this->zoneWorkload.emplace_back(zoneWorkload);
+    this->configFactor.emplace_back(configFactor);
+    this->cachedFactor.emplace_back(cached ? cachedFactor : 0);
+    this->cached.emplace_back(cached);
+    this->local.emplace_back(local);
+    this->spill.emplace_back(spill);
+}
+
+void LearningBatch::Resize(size_t n) {
+    this->workload.resize(n);
+    this->zoneWorkload.resize(n);
+    this->configFactor.resize(n);
+    this->cachedFactor.resize(n);
+    this->cached.resize(n);
+    this->local.resize(n);
+    this->spill.resize(n);
+}
+
+FactorLearner::FactorLearner() {
+    this->localAvgFactor = 0;
+}
+
+int FactorLearner::Learn(const OnlineLab& onlinelab, bool learning, LearningBatch& batch) {
+    auto n = batch.Size();
+    batch.factor.resize(n);
+    auto* workload     = batch.workload.data();
+    auto* zoneWorkload = batch.zoneWorkload.data();
+    auto* configFactor = batch.configFactor.data();
+    auto* cachedFactor = batch.cachedFactor.data();
+    auto* cached       = batch.cached.data();
+    auto* local        = batch.local.data();
+    auto* spill        = batch.spill.data();
+    auto* factor       = batch.factor.data();
+
+    // fresh new local node: config factor on cold start, otherwise downshift it
+    bool   factorCached = std::find(batch.cached.begin(), batch.cached.end(), 1) != batch.cached.end();
+    double freshRate    = onlinelab.factorStartRate;
+    double freshAvg     = this->localAvgFactor;
+    double crossRate    = this->limit.crossRate;
+    double minCross     = this->limit.minCross;
+    for (size_t i = 0; i < n; i++) {
+        double fresh = !factorCached ? configFactor[i] : (freshAvg != 0 ? freshAvg : configFactor[i] * freshRate);
+        double cross = spill[i] ? configFactor[i] * crossRate : minCross;
+        factor[i]    = cached[i] ? cachedFactor[i] : (local[i] ? fresh : cross);
+    }
+
+    double threshold = onlinelab.rateThreshold;
+    if (learning) {
+        double lr         = onlinelab.learningRate;
+        double startCross = this->limit.startCross;
+        for (size_t i = 0; i < n; i++) {
+            // zone level, cross zone only
+            double f = factor[i];
+            if (!local[i]) {
+                f = spill[i] ? std::max(f, startCross) * (1 + lr) : f * (1 - lr);
+            }
+            // node level
+            bool balanced = std::abs(workload[i] - zoneWorkload[i]) / 100.0 < threshold;
+            double rate   = balanced ? 0 : (workload[i] > zoneWorkload[i] ? -lr : lr);
+            factor[i]     = f + f * rate;
+        }
+    }
+
+    // risk control. a node pushed against the bound it is clamped to cannot move any
+    // further, it is out of balance for good and does not count
+    int    unbalanced = 0;
+    double localSum   = 0;
+    size_t localNum   = 0;
+    for (size_t i = 0; i < n; i++) {
+        double lo = local[i] ? this->limit.minLocal : this->limit.minCross;
+        double hi = local[i] ? this->limit.maxLocal : this->limit.maxCross;
+        factor[i] = std::min(std::max(factor[i], lo), hi);
+        localSum += local[i] ? factor[i] : 0;
+        localNum += local[i];
+        bool balanced = std::abs(workload[i] - zoneWorkload[i]) / 100.0 < threshold;
+        bool pinned   = workload[i] > zoneWorkload[i] ? factor[i] <= lo : factor[i] >= hi;
+        unbalanced += learning && !balanced && !pinned;
+    }
+
+    // update local zone avg factor for fresh new node
+    if (localNum > 0) {
+        this->localAvgFactor = localSum / localNum;
+    }
+    return unbalanced;
+}
+
+}
@@ -0,0 +1,134 @@
+#include "balancer/factor_store.h"
+#include <algorithm>
+
+namespace kit {
+
+FactorStore::FactorStore(const FactorStoreOption& option) : option(option), generation(0) {}
+
+uint32_t FactorStore::jitteredTTL(const std::string& instanceID) const {
+    // fnv-1a, spreads the expiry of nodes learned in the same refresh
+    uint32_t h = 2166136261u;
+    for (unsigned char c : instanceID) {
+        h = (h ^ c) * 16777619u;
+    }
+    auto ttl = std::max(this->option.ttl, 1u);
+    return ttl / 2 + h % ttl + 1;
+}
+
+void FactorStore::Begin() {
+    this->generation++;
+}
+
+uint32_t FactorStore::Acquire(const std::string& instanceID) {
+    auto it = this->ids.find(instanceID);
+    if (it != this->ids.end()) {
+        this->seenGen[it->second] = this->generation;
+        return it->second;
+    }
+
+    uint32_t id;
+    if (!this->freeIDs.empty()) {
+        id = this->freeIDs.back();
+        this->freeIDs.pop_back();
+        this->instanceIDs[id] = instanceID;
+    } else {
+        id = static_cast<uint32_t>(this->instanceIDs.size());
+        this->instanceIDs.emplace_back(instanceID);
+        this->factors.emplace_back(0);
+        this->bornGen.emplace_back(0);
+        this->seenGen.emplace_back(0);
+        this->expireGen.emplace_back(0);
+    }
+    this->factors[id]   = 0;
+    this->bornGen[id]   = 0;
+    this->seenGen[id]   = this->generation;
+    this->expireGen[id] = 0;
+    this->ids[instanceID] = id;
+    return id;
+}
+
+uint32_t FactorStore::Acquire(const std::string& instanceID, uint32_t hint) {
+    // released ids are cleared and reused ones renamed, an empty id is never trusted
+    if (hint < this->instanceIDs.size() && !instanceID.empty() && this->instanceIDs[hint] == instanceID) {
+        this->seenGen[hint] = this->generation;
+        return hint;
+    }
+    return this->Acquire(instanceID);
+}
+
+bool FactorStore::Get(uint32_t id, double& factor) const {
+    if (this->bornGen[id] == 0 || this->generation >= this->expireGen[id]) {
+        return false;
+    }
+    factor = this->factors[id];
+    return true;
+}
+
+void FactorStore::Set(uint32_t id, double factor) {
+    if (this->bornGen[id] == 0 || this->generation >= this->expireGen[id]) {
+        // learned afresh, a new life starts
+        this->bornGen[id]   = this->generation;
+        this->expireGen[id] = this->generation + this->jitteredTTL(this->instanceIDs[id]);
+    }
+    this->factors[id] = factor;
+}
+
+void FactorStore::release(uint32_t id) {
+    this->ids.erase(this->instanceIDs[id]);
+    this->instanceIDs[id].clear();
+    this->bornGen[id] = 0;
+    this->seenGen[id] = 0;
+    this->freeIDs.emplace_back(id);
+}
+
+void FactorStore::End() {
+    auto& live = this->sweep;
+    live.clear();
+    // the dense arrays instead of the map, free slots are never seen
+    for (uint32_t id = 0; id < this->seenGen.size(); id++) {
+        if (this->seenGen[id] == 0) {
+            continue;
+        }
+        if (this->generation - this->seenGen[id] >= this->option.departedTTL) {
+            live.emplace_back(0, id);  // departed
+        } else {
+            live.emplace_back(this->seenGen[id], id);
+        }
+    }
+
+    size_t drop = 0;
+    for (const auto& item : live) {
+        drop += item.first == 0;
+    }
+    if (live.size() - drop > this->option.capacity) {
+        // over capacity, the least recently seen go first
+        std::sort(live.begin(), live.end());
+        drop = live.size() - this->option.capacity;
+    } else {
+        std::partition(live.begin(), live.end(),
+                       [](const std::pair<uint32_t, uint32_t>& item) { return item.first == 0; });
+    }
+    for (size_t i = 0; i < drop; i++) {
+        this->release(live[i].second);
+    }
+}
+
+void FactorStore::Clear() {
+    this->ids.clear();
+    this->instanceIDs.clear();
+    this->factors.clear();
+    this->bornGen.clear();
+    this->seenGen.clear();
+    this->expireGen.clear();
+    this->freeIDs.clear();
+}
+
+json11::Json FactorStore::to_json() const {
+    return json11::Json::object{
+        {"size", static_cast<int>(this->ids.size())},
+        {"slots", static_cast<int>(this->instanceIDs.size())},
+        {"generation", static_cast<double>(this->generation)},
+    };
+}
+
+}
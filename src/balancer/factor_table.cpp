@@ -0,0 +1,132 @@
+#include "balancer/factor_table.h"
+#include <algorithm>
+
+namespace kit {
+
+namespace factor_table {
+
+template <typename T>
+static void append(std::string& out, T v) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out.push_back(static_cast<char>(static_cast<uint8_t>(v >> (8 * i))));
+    }
+}
+
+static void append(std::string& out, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    append(out, bits);
+}
+
+std::string Encode(std::vector<std::pair<std::string, double>> values, uint64_t updated) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end(),
+                             [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
+                                 return a.first == b.first;
+                             }),
+                 values.end());
+
+    std::string out;
+    out.append(MAGIC, sizeof(MAGIC));
+    append(out, VERSION);
+    append(out, uint16_t(0));
+    append(out, static_cast<uint32_t>(values.size()));
+    append(out, updated);
+    uint32_t offset = 0;
+    for (const auto& item : values) {
+        append(out, offset);
+        offset += item.first.size();
+    }
+    append(out, offset);
+    for (const auto& item : values) {
+        append(out, static_cast<float>(item.second));
+    }
+    for (const auto& item : values) {
+        out.append(item.first);
+    }
+    return out;
+}
+
+}
+
+bool FactorTableView::Parse(const char* data, size_t size, std::string& err) {
+    this->Reset();
+    if (size < factor_table::HEADER_SIZE || memcmp(data, factor_table::MAGIC, sizeof(factor_table::MAGIC)) != 0) {
+        err = "not a factor table";
+        return false;
+    }
+    auto version = factor_table::LoadLE<uint16_t>(data + 4);
+    auto count   = factor_table::LoadLE<uint32_t>(data + 8);
+    auto updated = factor_table::LoadLE<uint64_t>(data + 12);
+    if (version != factor_table::VERSION) {
+        err = "unsupported factor table version " + std::to_string(version);
+        return false;
+    }
+
+    auto fixed = factor_table::HEADER_SIZE + (static_cast<size_t>(count) + 1) * sizeof(uint32_t) +
+                 static_cast<size_t>(count) * sizeof(float);
+    if (fixed > size) {
+        err = "factor table truncated";
+        return false;
+    }
+    this->data    = data;
+    this->count   = count;
+    this->updated = updated;
+    this->offsets = data + factor_table::HEADER_SIZE;
+    this->values  = this->offsets + (count + 1) * sizeof(uint32_t);
+    this->ids     = data + fixed;
+
+    // offsets must grow and stay inside the buffer, ids sorted for the binary search
+    auto idsSize = size - fixed;
+    for (uint32_t i = 0; i < count; i++) {
+        auto begin = this->offset(i);
+        auto end   = this->offset(i + 1);
+        if (begin > end || end > idsSize) {
+            this->Reset();
+            err = "factor table offset out of range";
+            return false;
+        }
+        if (i > 0) {
+            auto prev = this->offset(i - 1);
+            auto n    = std::min(begin - prev, end - begin);
+            auto cmp  = memcmp(this->ids + prev, this->ids + begin, n);
+            if (cmp > 0 || (cmp == 0 && begin - prev >= end - begin)) {
+                this->Reset();
+                err = "factor table ids not sorted";
+                return false;
+            }
+        }
+    }
+    if (this->offset(0) != 0 && count > 0) {
+        this->Reset();
+        err = "factor table offset out of range";
+        return false;
+    }
+    return true;
+}
+
+bool FactorTableView::Find(const char* id, size_t len, double& value) const {
+    uint32_t lo = 0;
+    uint32_t hi = this->count;
+    while (lo < hi) {
+        auto mid   = lo + (hi - lo) / 2;
+        auto begin = this->offset(mid);
+        auto size  = this->offset(mid + 1) - begin;
+        auto cmp   = memcmp(this->ids + begin, id, std::min<size_t>(size, len));
+        if (cmp == 0) {
+            cmp = size < len ? -1 : (size > len ? 1 : 0);
+        }
+        if (cmp == 0) {
+            value = this->Value(mid);
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+}
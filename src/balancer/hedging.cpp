@@ -0,0 +1,163 @@
+#include "balancer/hedging.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace kit {
+
+LatencyTracker::LatencyTracker(const HedgeOption& option) : option(option) {
+    for (auto& window : this->windows) {
+        for (auto& count : window.counts) {
+            count.store(0);
+        }
+    }
+    this->current.store(0);
+    this->rotateAtMs.store(0);
+    this->cachedAtMs.store(0);
+    this->cachedUs.store(0);
+}
+
+// below 4us one bucket per us, then 4 buckets per power of two
+int LatencyTracker::Bucket(uint64_t latencyUs) {
+    if (latencyUs < 4) {
+        return static_cast<int>(latencyUs);
+    }
+    int  octave  = 63 - __builtin_clzll(latencyUs);
+    auto quarter = (latencyUs >> (octave - 2)) & 3;
+    return std::min(BUCKET_NUM - 1, octave * 4 + static_cast<int>(quarter));
+}
+
+uint64_t LatencyTracker::BucketUpper(int bucket) {
+    if (bucket < 8) {
+        return static_cast<uint64_t>(bucket) + 1;
+    }
+    int  octave  = bucket / 4;
+    auto quarter = static_cast<uint64_t>(bucket % 4);
+    if (octave >= 62) {
+        return UINT64_MAX;
+    }
+    // bucket covers [2^o * (4+q)/4, 2^o * (5+q)/4)
+    return (5 + quarter) << (octave - 2);
+}
+
+void LatencyTracker::rotate(uint64_t nowMs) {
+    auto at = this->rotateAtMs.load(std::memory_order_relaxed);
+    if (nowMs < at || !this->rotateAtMs.compare_exchange_strong(
+                          at, nowMs + static_cast<uint64_t>(this->option.windowS) * 1000, std::memory_order_relaxed)) {
+        return;
+    }
+    // the oldest window becomes the current one, idle for two windows clears both
+    auto  next   = this->current.load(std::memory_order_relaxed) + 1;
+    auto& window = this->windows[next % 2];
+    for (auto& count : window.counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    if (at != 0 && nowMs >= at + static_cast<uint64_t>(this->option.windowS) * 1000) {
+        for (auto& count : this->windows[(next + 1) % 2].counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+    this->current.store(next, std::memory_order_relaxed);
+    this->cachedAtMs.store(0, std::memory_order_relaxed);
+}
+
+void LatencyTracker::Report(uint64_t latencyUs, uint64_t nowMs) {
+    this->rotate(nowMs);
+    auto& window = this->windows[this->current.load(std::memory_order_relaxed) % 2];
+    window.counts[Bucket(latencyUs)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyTracker::Percentile(double percentile, uint64_t nowMs) {
+    this->rotate(nowMs);
+    uint64_t counts[BUCKET_NUM];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        counts[i] = this->windows[0].counts[i].load(std::memory_order_relaxed) +
+                    this->windows[1].counts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0 || total < static_cast<uint64_t>(this->option.minSamples)) {
+        return 0;
+    }
+    auto     rank = static_cast<uint64_t>(std::ceil(percentile * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return BucketUpper(i);
+        }
+    }
+    return BucketUpper(BUCKET_NUM - 1);
+}
+
+uint64_t LatencyTracker::Delay(uint64_t nowMs) {
+    auto at = this->cachedAtMs.load(std::memory_order_relaxed);
+    if (at != 0 && nowMs < at + 100) {
+        return this->cachedUs.load(std::memory_order_relaxed);
+    }
+    auto us = this->Percentile(this->option.percentile, nowMs);
+    if (us != 0) {
+        us = std::max(us, this->option.minDelayUs);
+    }
+    this->cachedUs.store(us, std::memory_order_relaxed);
+    this->cachedAtMs.store(nowMs, std::memory_order_relaxed);
+    return us;
+}
+
+RetryBudget::RetryBudget(const HedgeOption& option) : option(option) {
+    this->milliTokens.store(static_cast<int64_t>(option.budgetCapacity * 1000));
+    this->refilledAtMs.store(0);
+}
+
+void RetryBudget::add(int64_t milliTokens) {
+    auto capacity = static_cast<int64_t>(this->option.budgetCapacity * 1000);
+    auto tokens   = this->milliTokens.load(std::memory_order_relaxed);
+    while (tokens < capacity &&
+           !this->milliTokens.compare_exchange_weak(tokens, std::min(capacity, tokens + milliTokens),
+                                                    std::memory_order_relaxed)) {
+    }
+}
+
+void RetryBudget::Deposit() {
+    this->add(static_cast<int64_t>(this->option.budgetRatio * 1000));
+}
+
+bool RetryBudget::Withdraw(uint64_t nowMs) {
+    // time based refill, whoever moves refilledAtMs forward adds the elapsed share
+    auto at = this->refilledAtMs.load(std::memory_order_relaxed);
+    if (nowMs > at && this->refilledAtMs.compare_exchange_strong(at, nowMs, std::memory_order_relaxed) && at != 0) {
+        this->add(static_cast<int64_t>(this->option.budgetPerSecond * (nowMs - at)));
+    }
+    auto tokens = this->milliTokens.load(std::memory_order_relaxed);
+    while (tokens >= 1000) {
+        if (this->milliTokens.compare_exchange_weak(tokens, tokens - 1000, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RetryBudget::Refund() {
+    this->add(1000);
+}
+
+Hedger::Hedger(const HedgeOption& option) : option(option), latency(option), budget(option) {}
+
+uint64_t Hedger::Begin(uint64_t nowMs) {
+    this->budget.Deposit();
+    return this->latency.Delay(nowMs);
+}
+
+bool Hedger::AcquireRetry(uint64_t nowMs) {
+    return this->budget.Withdraw(nowMs);
+}
+
+void Hedger::ReleaseRetry() {
+    this->budget.Refund();
+}
+
+void Hedger::ReportLatency(uint64_t latencyUs, uint64_t nowMs) {
+    this->latency.Report(latencyUs, nowMs);
+}
+
+}
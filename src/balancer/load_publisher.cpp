@@ -0,0 +1,113 @@
+#include "balancer/load_publisher.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include "util/constant.h"
+#include "util/util.h"
+
+namespace kit {
+
+LoadPublisher::LoadPublisher(const std::string& address,
+                             const std::string& prefix,
+                             const std::string& instanceID,
+                             const LoadPublisherOption& option)
+    : client(address), inflight(0) {
+    this->key       = prefix + "/" + instanceID;
+    this->option    = option;
+    this->cpuFunc   = []() { return CPUUsage(); };
+    this->stopped   = true;
+    this->publisher = nullptr;
+}
+
+LoadPublisher::~LoadPublisher() {
+    this->Stop();
+}
+
+static bool movedRatio(int64_t last, int64_t current, double ratio) {
+    auto base = std::max<int64_t>(std::abs(last), 1);
+    return std::abs(current - last) > ratio * base;
+}
+
+bool LoadPublisher::ShouldPublish(const InstanceLoad& last, const InstanceLoad& current,
+                                  const LoadPublisherOption& option) {
+    if (last.updated == 0 || current.updated >= last.updated + option.maxSilenceS) {
+        return true;
+    }
+    return std::fabs(current.cpu - last.cpu) > option.cpuDelta ||
+           movedRatio(last.inflight, current.inflight, option.inflightDelta) ||
+           movedRatio(last.queueDepth, current.queueDepth, option.inflightDelta);
+}
+
+InstanceLoad LoadPublisher::Sample() const {
+    InstanceLoad load;
+    load.cpu        = this->cpuFunc();
+    load.inflight   = this->inflight.load(std::memory_order_relaxed);
+    load.queueDepth = this->queueDepthFunc ? this->queueDepthFunc() : 0;
+    load.updated    = static_cast<uint64_t>(time(nullptr));
+    return load;
+}
+
+std::tuple<int, std::string> LoadPublisher::PublishOnce(bool force) {
+    std::lock_guard<std::mutex> lock_guard(this->publishMutex);
+    auto load = this->Sample();
+    if (load.cpu < 0) {
+        // not sampled yet, a load of -1 would read as idle
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+    if (!force && !ShouldPublish(this->published, load, this->option)) {
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+    int code;
+    std::string err;
+    std::tie(code, err) = this->client.PutKV(this->key, load.Encode(), this->option.timeoutMs);
+    if (code != STATUSCODE::SUCCESS) {
+        return std::make_tuple(code, "PutKV [" + this->key + "] failed. err [" + err + "]");
+    }
+    this->published = load;
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> LoadPublisher::Start() {
+    if (this->publisher != nullptr) {
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+    int code;
+    std::string err;
+    std::tie(code, err) = this->PublishOnce(true);
+
+    this->stopped   = false;
+    this->publisher = new std::thread([this]() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->cond.wait_for(lock, std::chrono::milliseconds(this->option.intervalMs),
+                                    [this]() { return this->stopped; })) {
+            lock.unlock();
+            // failures are retried on the next tick, the heartbeat forces a write anyway
+            this->PublishOnce();
+            lock.lock();
+        }
+    });
+    return std::make_tuple(code, err);
+}
+
+void LoadPublisher::Stop() {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+    }
+    this->cond.notify_all();
+    if (this->publisher != nullptr) {
+        if (this->publisher->joinable()) {
+            this->publisher->join();
+        }
+        delete this->publisher;
+        this->publisher = nullptr;
+        // best effort, a key left behind ages out on the reader side
+        std::lock_guard<std::mutex> lock_guard(this->publishMutex);
+        this->client.DeleteKV(this->key, this->option.timeoutMs);
+        this->published = InstanceLoad();
+    }
+}
+
+}
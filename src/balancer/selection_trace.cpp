@@ -0,0 +1,312 @@
+#include "balancer/selection_trace.h"
+
+#include <signal.h>
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+#include "util/constant.h"
+
+namespace kit {
+
+static const char TRACE_MAGIC[8] = {'C', 'K', 'T', 'R', 'A', 'C', 'E', '\0'};
+static const uint32_t TRACE_VERSION = 1;
+
+static std::atomic<uint64_t> traceIDs(0);
+// signals received, counted by the handler, compared by the watchers
+static std::atomic<uint64_t> traceSignals(0);
+
+// per signal: traces dumping on it and the action they replaced, under signalMutex. the
+// action is only written before the handler goes in, the handler reads it unlocked
+static std::mutex       signalMutex;
+static int              signalTraces[NSIG];
+static struct sigaction signalPrevious[NSIG];
+
+static void onTraceSignal(int signo, siginfo_t* info, void* context) {
+    traceSignals.fetch_add(1, std::memory_order_relaxed);
+    // chain, the default action and ignore are what the trace replaced on purpose
+    const auto& previous = signalPrevious[signo];
+    if (previous.sa_flags & SA_SIGINFO) {
+        if (previous.sa_sigaction != nullptr) {
+            previous.sa_sigaction(signo, info, context);
+        }
+    } else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+        previous.sa_handler(signo);
+    }
+}
+
+static uint64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+SelectionTrace::SelectionTrace(const TraceOption& option)
+    : option(option), id(traceIDs.fetch_add(1) + 1), rings(std::make_shared<Rings>()), watcher(nullptr),
+      watching(false), signo(0) {
+    uint32_t capacity = 1;
+    while (capacity < option.capacity) {
+        capacity <<= 1;
+    }
+    this->option.capacity = capacity;
+    this->baseTicks = TraceTicks();
+    this->baseNs    = steadyNs();
+}
+
+SelectionTrace::~SelectionTrace() {
+    if (this->watcher != nullptr) {
+        this->watching.store(false);
+        this->watcher->join();
+        delete this->watcher;
+    }
+    if (this->signo != 0) {
+        std::lock_guard<std::mutex> lock_guard(signalMutex);
+        if (--signalTraces[this->signo] == 0) {
+            sigaction(this->signo, &signalPrevious[this->signo], nullptr);
+        }
+    }
+    // the rings go with the trace, a stale thread cache entry never matches a new id and
+    // the threads still holding a ring find it expired on exit
+}
+
+SelectionTrace::Held::~Held() {
+    for (const auto& held : this->rings) {
+        auto rings = held.first.lock();
+        if (rings == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock_guard(rings->mutex);
+        held.second->owner = std::thread::id();
+        rings->free.emplace_back(held.second);
+    }
+}
+
+SelectionTrace::Ring* SelectionTrace::ring() {
+    static thread_local Held held;
+    auto  self  = std::this_thread::get_id();
+    Ring* ring  = nullptr;
+    bool  taken = false;
+    {
+        auto&                       rings = *(this->rings);
+        std::lock_guard<std::mutex> lock_guard(rings.mutex);
+        for (const auto& r : rings.all) {
+            if (r->owner == self) {
+                ring = r.get();
+                break;
+            }
+        }
+        if (ring == nullptr && !rings.free.empty()) {
+            // the events of the exited owner stay, the new one writes on after them
+            ring = rings.free.back();
+            rings.free.pop_back();
+            ring->owner = self;
+            taken       = true;
+        }
+        if (ring == nullptr) {
+            if (rings.all.size() > std::numeric_limits<uint16_t>::max()) {
+                return nullptr;
+            }
+            ring        = new Ring();
+            ring->slots.reset(new Slot[this->option.capacity]);
+            ring->mask  = this->option.capacity - 1;
+            ring->head.store(0);
+            ring->thread = static_cast<uint16_t>(rings.all.size());
+            ring->owner  = self;
+            for (uint32_t i = 0; i < this->option.capacity; i++) {
+                ring->slots[i].seq.store(0, std::memory_order_relaxed);
+            }
+            rings.all.emplace_back(ring);
+            taken = true;
+        }
+    }
+    if (taken) {
+        // forget the traces gone meanwhile
+        held.rings.erase(std::remove_if(held.rings.begin(), held.rings.end(),
+                                        [](const std::pair<std::weak_ptr<Rings>, Ring*>& r) {
+                                            return r.first.expired();
+                                        }),
+                         held.rings.end());
+        held.rings.emplace_back(this->rings, ring);
+    }
+    auto& cache = SelectionTrace::cache();
+    cache.id    = this->id;
+    cache.ring  = ring;
+    return ring;
+}
+
+void SelectionTrace::Reserve(uint64_t events) {
+    auto& cache = SelectionTrace::cache();
+    auto  ring  = cache.id == this->id ? cache.ring : this->ring();
+    if (ring == nullptr || events <= ring->mask + 1) {
+        return;
+    }
+    uint64_t capacity = ring->mask + 1;
+    while (capacity < events) {
+        capacity <<= 1;
+    }
+    std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+    for (uint64_t i = 0; i < capacity; i++) {
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+    // only this thread writes the ring, the readers copy it under the mutex
+    std::lock_guard<std::mutex> lock_guard(this->rings->mutex);
+    auto head  = ring->head.load(std::memory_order_relaxed);
+    auto begin = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+    for (auto i = begin; i < head; i++) {
+        auto& from = ring->slots[i & ring->mask];
+        auto& to   = slots[i & (capacity - 1)];
+        to.ticks.store(from.ticks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.poolVersion.store(from.poolVersion.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.nodeType.store(from.nodeType.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.weight.store(from.weight.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.factorSum.store(from.factorSum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.seq.store(from.seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    ring->slots.swap(slots);
+    ring->mask = capacity - 1;
+}
+
+void SelectionTrace::Snapshot(std::vector<TraceRecord>& records) {
+    records.clear();
+    // ticks to ns over the whole life of the trace
+    auto   ticks = TraceTicks();
+    auto   ns    = steadyNs();
+    double rate  = ticks > this->baseTicks ? static_cast<double>(ns - this->baseNs) / (ticks - this->baseTicks) : 1;
+
+    std::lock_guard<std::mutex> lock_guard(this->rings->mutex);
+    for (const auto& ring : this->rings->all) {
+        auto head  = ring->head.load(std::memory_order_acquire);
+        auto begin = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+        for (auto i = begin; i < head; i++) {
+            auto& slot = ring->slots[i & ring->mask];
+            auto  seq  = slot.seq.load(std::memory_order_acquire);
+            if (seq != i + 1) {
+                continue;
+            }
+            TraceRecord record;
+            auto        eventTicks = slot.ticks.load(std::memory_order_relaxed);
+            auto        nodeType   = slot.nodeType.load(std::memory_order_relaxed);
+            record.poolVersion     = slot.poolVersion.load(std::memory_order_relaxed);
+            record.weight          = fromBits(slot.weight.load(std::memory_order_relaxed));
+            record.factorSum       = fromBits(slot.factorSum.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // overwritten by the owner while being copied
+            if (slot.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            auto elapsed  = static_cast<int64_t>(eventTicks - this->baseTicks);
+            record.timeNs = this->baseNs + static_cast<int64_t>(elapsed * rate);
+            record.node   = static_cast<int32_t>(nodeType & 0xffffffff);
+            record.type   = static_cast<uint16_t>(nodeType >> 32);
+            record.thread = ring->thread;
+            records.emplace_back(record);
+        }
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [](const TraceRecord& a, const TraceRecord& b) { return a.timeNs < b.timeNs; });
+}
+
+std::tuple<int, std::string> SelectionTrace::Dump(const std::string& path) {
+    std::vector<TraceRecord> records;
+    this->Snapshot(records);
+
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version    = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.recordNum  = records.size();
+    // written aside and renamed, a reader never sees half a dump
+    auto tmp = path + ".tmp";
+    auto fp  = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "open [" + tmp + "] failed");
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              (records.empty() || fwrite(records.data(), sizeof(TraceRecord), records.size(), fp) == records.size());
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "write [" + path + "] failed");
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> SelectionTrace::DumpOnSignal(int signo, const std::string& path) {
+    if (this->watcher != nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "already dumping on signal");
+    }
+    if (signo <= 0 || signo >= NSIG) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "invalid signal " + std::to_string(signo));
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(signalMutex);
+        if (signalTraces[signo] == 0) {
+            // the action replaced is in place before the handler can run
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_sigaction = onTraceSignal;
+            action.sa_flags     = SA_RESTART | SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(signo, nullptr, &signalPrevious[signo]) != 0 || sigaction(signo, &action, nullptr) != 0) {
+                return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT,
+                                       "sigaction " + std::to_string(signo) + " failed");
+            }
+        }
+        signalTraces[signo]++;
+        this->signo = signo;
+    }
+    this->watching.store(true);
+    auto seen = traceSignals.load(std::memory_order_relaxed);
+    this->watcher = new std::thread([this, path, seen]() mutable {
+        while (this->watching.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            auto signals = traceSignals.load(std::memory_order_relaxed);
+            if (signals != seen) {
+                seen = signals;
+                this->Dump(path);
+            }
+        }
+    });
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> SelectionTrace::Load(const std::string& path, std::vector<TraceRecord>& records) {
+    records.clear();
+    auto fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "open [" + path + "] failed");
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fclose(fp);
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "[" + path + "] is not a selection trace");
+    }
+    if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        fclose(fp);
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT,
+                               "unsupported trace version " + std::to_string(header.version));
+    }
+    // the count of a corrupt or cut header is not trusted further than the file goes
+    auto at   = ftell(fp);
+    auto size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    if (at < 0 || size < at || fseek(fp, at, SEEK_SET) != 0) {
+        fclose(fp);
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "read [" + path + "] failed");
+    }
+    auto available = static_cast<uint64_t>(size - at) / sizeof(TraceRecord);
+    records.resize(std::min<uint64_t>(header.recordNum, available));
+    auto n = records.empty() ? 0 : fread(records.data(), sizeof(TraceRecord), records.size(), fp);
+    fclose(fp);
+    if (n != header.recordNum) {
+        records.resize(n);
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "[" + path + "] truncated");
+    }
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+}
@@ -0,0 +1,318 @@
+#include "balancer/shm_pool.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <thread>
+#include "util/constant.h"
+
+namespace kit {
+
+static std::string errnoString(const std::string& what, const std::string& name) {
+    std::stringstream ss;
+    ss << what << " [" << name << "] failed. errno: [" << errno << "] " << strerror(errno);
+    return ss.str();
+}
+
+template <size_t N>
+static void copyField(char (&dst)[N], const std::string& src) {
+    auto len = std::min(src.size(), N - 1);
+    memcpy(dst, src.data(), len);
+    dst[len] = '\0';
+}
+
+template <size_t N>
+static std::string readField(const char (&src)[N]) {
+    return std::string(src, strnlen(src, N));
+}
+
+SharedPoolWriter::SharedPoolWriter(const std::string& name, uint32_t capacity) {
+    this->name     = name;
+    this->capacity = capacity;
+    this->fd       = -1;
+    this->addr     = nullptr;
+    this->header   = nullptr;
+}
+
+SharedPoolWriter::~SharedPoolWriter() {
+    this->Close(false);
+}
+
+std::tuple<int, std::string> SharedPoolWriter::Open() {
+    this->fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (this->fd < 0) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, errnoString("shm_open", this->name));
+    }
+    // grow only, readers may still map the previous size
+    auto size = shm::SegmentSize(this->capacity);
+    struct stat st;
+    if (fstat(this->fd, &st) != 0) {
+        auto err = errnoString("fstat", this->name);
+        this->Close(false);
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, err);
+    }
+    if (static_cast<size_t>(st.st_size) < size && ftruncate(this->fd, size) != 0) {
+        auto err = errnoString("ftruncate", this->name);
+        this->Close(false);
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, err);
+    }
+    this->addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (this->addr == MAP_FAILED) {
+        this->addr = nullptr;
+        auto err   = errnoString("mmap", this->name);
+        this->Close(false);
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, err);
+    }
+
+    this->header = static_cast<shm::Header*>(this->addr);
+    if (this->header->magic != shm::MAGIC) {
+        // fresh segment
+        new (&this->header->sequence) std::atomic<uint64_t>(0);
+        this->header->nodeNum       = 0;
+        this->header->capacity      = this->capacity;
+        this->header->layoutVersion = shm::LAYOUT_VERSION;
+        this->header->magic         = shm::MAGIC;
+    } else if (this->header->layoutVersion != shm::LAYOUT_VERSION || this->header->capacity != this->capacity) {
+        // left by an incompatible publisher, readers may be attached: rewritten as a
+        // publish, the sequence goes on from where it was
+        auto seq = this->header->sequence.load(std::memory_order_relaxed);
+        seq += seq & 1;
+        this->header->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        this->header->nodeNum           = 0;
+        this->header->updated           = 0;
+        this->header->factorSum         = 0;
+        this->header->rampNewestMs      = 0;
+        this->header->overload          = 0;
+        this->header->transitionStartMs = 0;
+        this->header->capacity          = this->capacity;
+        this->header->layoutVersion     = shm::LAYOUT_VERSION;
+        this->header->sequence.store(seq + 2, std::memory_order_release);
+    } else if (this->header->sequence.load() & 1) {
+        // previous publisher died in the middle of a write
+        this->header->sequence.fetch_add(1);
+    }
+
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> SharedPoolWriter::Publish(const CandidatePool& pool, uint64_t updated) {
+    if (this->header == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, "shared pool [" + this->name + "] not opened");
+    }
+    if (pool.nodes.size() > this->capacity) {
+        std::stringstream ss;
+        ss << "shared pool [" << this->name << "] capacity [" << this->capacity << "] less than nodes ["
+           << pool.nodes.size() << "]";
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, ss.str());
+    }
+
+    auto records = reinterpret_cast<shm::NodeRecord*>(this->header + 1);
+    auto seq     = this->header->sequence.load(std::memory_order_relaxed);
+    this->header->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < pool.nodes.size(); i++) {
+        auto& node   = *pool.nodes[i];
+        auto& record = records[i];
+        copyField(record.host, node.host);
+        copyField(record.instanceID, node.instanceID);
+        copyField(record.publicIP, node.publicIP);
+        copyField(record.zone, node.zone);
+        record.port          = node.port;
+        record.balanceFactor = node.balanceFactor;
+        record.currentFactor = node.currentFactor;
+        record.workload      = node.workload;
+        record.factor        = pool.factors[i];
+        record.rampStartMs   = i < pool.rampStartMs.size() ? pool.rampStartMs[i] : 0;
+        record.previousFactor = i < pool.previousFactors.size() ? pool.previousFactors[i] : pool.factors[i];
+    }
+    this->header->nodeNum      = pool.nodes.size();
+    this->header->factorSum    = pool.factorSum;
+    this->header->rampNewestMs = pool.rampNewestMs;
+    this->header->overload     = pool.overload;
+    this->header->transitionStartMs = pool.previousFactors.size() == pool.nodes.size() ? pool.transitionStartMs : 0;
+    this->header->updated   = updated;
+
+    this->header->sequence.store(seq + 2, std::memory_order_release);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+void SharedPoolWriter::Close(bool unlink) {
+    if (this->addr != nullptr) {
+        munmap(this->addr, shm::SegmentSize(this->capacity));
+        this->addr   = nullptr;
+        this->header = nullptr;
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+    if (unlink) {
+        shm_unlink(this->name.c_str());
+    }
+}
+
+SharedPoolReader::SharedPoolReader(const std::string& name) : header(nullptr), version(0), updated(0) {
+    this->name   = name;
+    this->fd     = -1;
+    this->addr   = nullptr;
+    this->size   = 0;
+}
+
+SharedPoolReader::~SharedPoolReader() {
+    this->Close();
+}
+
+std::tuple<int, std::string> SharedPoolReader::Open() {
+    this->fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+    if (this->fd < 0) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, errnoString("shm_open", this->name));
+    }
+    struct stat st;
+    if (fstat(this->fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(shm::Header)) {
+        this->Close();
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, "shared pool [" + this->name + "] too small");
+    }
+    this->size = st.st_size;
+    this->addr = mmap(nullptr, this->size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if (this->addr == MAP_FAILED) {
+        this->addr = nullptr;
+        auto err   = errnoString("mmap", this->name);
+        this->Close();
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, err);
+    }
+    auto header = static_cast<const shm::Header*>(this->addr);
+    if (header->magic != shm::MAGIC || header->layoutVersion != shm::LAYOUT_VERSION ||
+        shm::SegmentSize(header->capacity) > this->size) {
+        this->Close();
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, "shared pool [" + this->name + "] layout mismatch");
+    }
+    this->header.store(header, std::memory_order_release);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+std::tuple<int, std::string> SharedPoolReader::remap() {
+    struct stat st;
+    if (fstat(this->fd, &st) != 0) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, errnoString("fstat", this->name));
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if (addr == MAP_FAILED) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, errnoString("mmap", this->name));
+    }
+    // Changed may still read the old header, kept mapped until Close
+    this->retired.emplace_back(this->addr, this->size);
+    this->addr = addr;
+    this->size = size;
+    this->header.store(static_cast<const shm::Header*>(addr), std::memory_order_release);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+void SharedPoolReader::Close() {
+    if (this->addr != nullptr) {
+        this->header.store(nullptr, std::memory_order_release);
+        munmap(this->addr, this->size);
+        this->addr = nullptr;
+    }
+    for (auto& mapping : this->retired) {
+        munmap(mapping.first, mapping.second);
+    }
+    this->retired.clear();
+    if (this->fd >= 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+std::tuple<int, std::shared_ptr<CandidatePool>, std::string> SharedPoolReader::Refresh() {
+    std::lock_guard<std::mutex> lock_guard(this->copyMutex);
+    auto header = this->header.load(std::memory_order_relaxed);
+    if (header == nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, this->pool,
+                               "shared pool [" + this->name + "] not opened");
+    }
+
+    for (int retry = 0; retry < 64; retry++) {
+        auto begin = header->sequence.load(std::memory_order_acquire);
+        if (begin == this->version.load(std::memory_order_relaxed)) {
+            return std::make_tuple(STATUSCODE::SUCCESS, this->pool, "");
+        }
+        if (begin & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (header->layoutVersion != shm::LAYOUT_VERSION) {
+            return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, this->pool,
+                                   "shared pool [" + this->name + "] layout mismatch, use previous copy");
+        }
+        // taken over by a publisher of a larger capacity
+        if (shm::SegmentSize(header->capacity) > this->size) {
+            int         code;
+            std::string err;
+            std::tie(code, err) = this->remap();
+            if (code != STATUSCODE::SUCCESS) {
+                return std::make_tuple(code, this->pool, err);
+            }
+            header = this->header.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        // never past the mapping, whatever a torn header says
+        auto     records = reinterpret_cast<const shm::NodeRecord*>(header + 1);
+        uint32_t mapped  = (this->size - sizeof(shm::Header)) / sizeof(shm::NodeRecord);
+        uint32_t nodeNum = std::min(header->nodeNum, std::min(header->capacity, mapped));
+        auto     pool    = std::make_shared<CandidatePool>();
+        pool->nodes.reserve(nodeNum);
+        pool->factors.reserve(nodeNum);
+        pool->rampStartMs.reserve(nodeNum);
+        pool->weights.assign(nodeNum, 0);
+        bool transition = header->transitionStartMs != 0;
+        if (transition) {
+            pool->previousFactors.reserve(nodeNum);
+        }
+        for (uint32_t i = 0; i < nodeNum; i++) {
+            auto& record        = records[i];
+            auto  node          = std::make_shared<ServiceNode>();
+            node->host          = readField(record.host);
+            node->instanceID    = readField(record.instanceID);
+            node->publicIP      = readField(record.publicIP);
+            node->zone          = readField(record.zone);
+            node->port          = record.port;
+            node->balanceFactor = record.balanceFactor;
+            node->currentFactor = record.currentFactor;
+            node->workload      = record.workload;
+            pool->nodes.emplace_back(node);
+            pool->factors.emplace_back(record.factor);
+            pool->rampStartMs.emplace_back(record.rampStartMs);
+            if (transition) {
+                pool->previousFactors.emplace_back(record.previousFactor);
+            }
+        }
+        pool->factorSum    = header->factorSum;
+        pool->rampNewestMs = header->rampNewestMs;
+        pool->overload     = header->overload;
+        pool->transitionStartMs = header->transitionStartMs;
+        pool->version = begin / 2;
+        auto updated    = header->updated;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) != begin) {
+            continue;
+        }
+        this->pool = pool;
+        this->updated.store(updated, std::memory_order_relaxed);
+        this->version.store(begin, std::memory_order_relaxed);
+        return std::make_tuple(STATUSCODE::SUCCESS, this->pool, "");
+    }
+    return std::make_tuple(STATUSCODE::ERROR_SHARED_MEMORY, this->pool,
+                           "shared pool [" + this->name + "] keeps changing, use previous copy");
+}
+
+}
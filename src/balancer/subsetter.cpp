@@ -0,0 +1,79 @@
+#include "balancer/subsetter.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace kit {
+
+// fnv-1a with a murmur finalizer, identical on every client whatever the std::hash
+static uint64_t hash64(const std::string& a, const std::string& b) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : a) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (unsigned char c : b) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+Subsetter::Subsetter(const SubsetOption& option) : option(option), round(0) {}
+
+void Subsetter::SetOption(const SubsetOption& option) {
+    this->option = option;
+    this->scores.clear();
+}
+
+double Subsetter::Score(const std::string& instanceID, double weight) const {
+    // uniform in (0, 1)
+    double u = (static_cast<double>(hash64(this->option.clientID, instanceID) >> 11) + 0.5) / 9007199254740992.0;
+    return std::max(weight, 1e-6) / -std::log(u);
+}
+
+void Subsetter::Begin() {
+    this->round++;
+}
+
+void Subsetter::Select(const std::vector<std::shared_ptr<ServiceNode>>& nodes, size_t begin, size_t end,
+                       std::vector<char>& keep) {
+    auto size = static_cast<size_t>(this->option.subsetSize);
+    auto& ranked = this->ranked;
+    ranked.clear();
+    for (size_t i = begin; i < end; i++) {
+        auto& node = *nodes[i];
+        auto& ranking = this->scores[node.instanceID];
+        if (ranking.round == 0 || ranking.weight != node.balanceFactor) {
+            ranking.weight = node.balanceFactor;
+            ranking.score  = this->Score(node.instanceID, node.balanceFactor);
+        }
+        ranking.round = this->round;
+        ranked.emplace_back(ranking.score, i);
+    }
+    if (ranked.size() <= size) {
+        return;
+    }
+
+    std::nth_element(ranked.begin(), ranked.begin() + size, ranked.end(),
+                     std::greater<std::pair<double, size_t>>());
+    for (size_t i = size; i < ranked.size(); i++) {
+        keep[ranked[i].second] = 0;
+    }
+}
+
+void Subsetter::End() {
+    for (auto it = this->scores.begin(); it != this->scores.end();) {
+        if (it->second.round != this->round) {
+            it = this->scores.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+}
@@ -0,0 +1,184 @@
+#include "balancer/topology.h"
+#include <cmath>
+
+namespace kit {
+
+TopologyDiffer::TopologyDiffer(const TopologyOption& option) : option(option), version(0) {}
+
+std::shared_ptr<TopologyDelta> TopologyDiffer::Diff(const CandidatePool& pool) {
+    auto delta = std::make_shared<TopologyDelta>();
+    auto& events = delta->events;
+
+    for (auto& item : this->nodes) {
+        item.second.seen = false;
+    }
+    std::map<std::string, double> zones;
+    for (size_t i = 0; i < pool.nodes.size(); i++) {
+        auto& node   = pool.nodes[i];
+        auto  factor = pool.factors[i];
+        zones[node->zone] += factor;
+
+        auto it = this->nodes.find(node->instanceID);
+        if (it == this->nodes.end()) {
+            this->nodes[node->instanceID] = Reported{node, factor, true};
+            events.emplace_back(TopologyEvent{TopologyEventType::NODE_ADDED, node, node->zone, 0, factor});
+            continue;
+        }
+        auto& reported = it->second;
+        reported.seen  = true;
+        reported.node  = node;
+        if (std::fabs(factor - reported.factor) > this->option.factorThreshold * std::max(reported.factor, 1.0)) {
+            events.emplace_back(
+                TopologyEvent{TopologyEventType::FACTOR_CHANGED, node, node->zone, reported.factor, factor});
+            reported.factor = factor;
+        }
+    }
+    for (auto it = this->nodes.begin(); it != this->nodes.end();) {
+        if (!it->second.seen) {
+            auto& node = it->second.node;
+            events.emplace_back(
+                TopologyEvent{TopologyEventType::NODE_REMOVED, node, node->zone, it->second.factor, 0});
+            it = this->nodes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // zone shares, zones gone report a share of 0
+    for (auto& item : zones) {
+        item.second = pool.factorSum > 0 ? item.second / pool.factorSum : 0;
+    }
+    for (const auto& item : this->zones) {
+        if (zones.count(item.first) == 0) {
+            zones[item.first] = 0;
+        }
+    }
+    for (const auto& item : zones) {
+        auto it     = this->zones.find(item.first);
+        auto before = it != this->zones.end() ? it->second : 0;
+        if (it == this->zones.end() || std::fabs(item.second - before) > this->option.zoneThreshold) {
+            events.emplace_back(
+                TopologyEvent{TopologyEventType::ZONE_WEIGHT_CHANGED, nullptr, item.first, before, item.second});
+            this->zones[item.first] = item.second;
+        }
+        if (item.second == 0) {
+            this->zones.erase(item.first);
+        }
+    }
+
+    if (events.empty()) {
+        return nullptr;
+    }
+    delta->version = ++this->version;
+    return delta;
+}
+
+std::shared_ptr<TopologyDelta> TopologyDiffer::Snapshot() const {
+    auto delta     = std::make_shared<TopologyDelta>();
+    delta->version = this->version;
+    for (const auto& item : this->nodes) {
+        auto& node = item.second.node;
+        delta->events.emplace_back(
+            TopologyEvent{TopologyEventType::NODE_ADDED, node, node->zone, 0, item.second.factor});
+    }
+    for (const auto& item : this->zones) {
+        delta->events.emplace_back(
+            TopologyEvent{TopologyEventType::ZONE_WEIGHT_CHANGED, nullptr, item.first, 0, item.second});
+    }
+    return delta;
+}
+
+TopologyDispatcher::TopologyDispatcher() : nextID(1), stopped(false), calling(0), dispatcher(nullptr) {}
+
+TopologyDispatcher::~TopologyDispatcher() {
+    this->Stop();
+}
+
+uint64_t TopologyDispatcher::Subscribe(const TopologyCallback& callback,
+                                       const std::shared_ptr<const TopologyDelta>& snapshot) {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    auto id = this->nextID++;
+    this->subscribers[id] = Subscriber{callback, snapshot != nullptr ? snapshot->version : 0};
+    if (snapshot != nullptr && !snapshot->events.empty()) {
+        this->queue.emplace_back(Pending{id, snapshot});
+        this->cond.notify_all();
+    }
+    if (this->dispatcher == nullptr && !this->stopped) {
+        this->dispatcher = new std::thread(&TopologyDispatcher::run, this);
+    }
+    return id;
+}
+
+void TopologyDispatcher::Unsubscribe(uint64_t id) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->subscribers.erase(id);
+    if (this->dispatcher != nullptr && std::this_thread::get_id() == this->dispatcher->get_id()) {
+        return;
+    }
+    this->called.wait(lock, [this, id]() { return this->calling != id; });
+}
+
+void TopologyDispatcher::Publish(const std::shared_ptr<const TopologyDelta>& delta) {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    if (this->subscribers.empty() || this->stopped) {
+        return;
+    }
+    this->queue.emplace_back(Pending{0, delta});
+    this->cond.notify_all();
+}
+
+void TopologyDispatcher::run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->cond.wait(lock, [this]() { return this->stopped || !this->queue.empty(); });
+        if (this->stopped) {
+            return;
+        }
+        auto pending = this->queue.front();
+        this->queue.pop_front();
+        std::vector<uint64_t> ids;
+        for (const auto& item : this->subscribers) {
+            if (pending.subscriber == item.first ||
+                (pending.subscriber == 0 && pending.delta->version > item.second.since)) {
+                ids.emplace_back(item.first);
+            }
+        }
+
+        // looked up again before every call, a subscriber may be gone meanwhile
+        for (auto id : ids) {
+            auto it = this->subscribers.find(id);
+            if (it == this->subscribers.end() || this->stopped) {
+                continue;
+            }
+            auto callback = it->second.callback;
+            this->calling = id;
+            lock.unlock();
+            callback(pending.delta);
+            lock.lock();
+            this->calling = 0;
+            this->called.notify_all();
+        }
+    }
+}
+
+void TopologyDispatcher::Stop() {
+    std::thread* dispatcher;
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+        this->queue.clear();
+        dispatcher = this->dispatcher;
+    }
+    this->cond.notify_all();
+    if (dispatcher != nullptr) {
+        if (dispatcher->joinable()) {
+            dispatcher->join();
+        }
+        // Unsubscribe reads it under the mutex
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        delete this->dispatcher;
+        this->dispatcher = nullptr;
+    }
+}
+
+}
@@ -0,0 +1,71 @@
+#include "balancer/update_scheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace kit {
+
+UpdateScheduler::UpdateScheduler(const SchedulerOption& option) : mt(std::random_device()()) {
+    this->option    = option;
+    this->failures  = 0;
+    this->steady    = 0;
+    this->intervalS = option.intervalS;
+    this->stopped   = false;
+}
+
+void UpdateScheduler::SetOption(const SchedulerOption& option) {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    this->option    = option;
+    this->failures  = 0;
+    this->steady    = 0;
+    this->intervalS = option.intervalS;
+}
+
+std::chrono::milliseconds UpdateScheduler::Next(bool success, bool converging) {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    double intervalS;
+    if (!success) {
+        this->failures++;
+        this->steady = 0;
+        intervalS    = this->option.intervalS * std::pow(this->option.backoffMultiplier, this->failures);
+        intervalS    = std::min(intervalS, static_cast<double>(this->option.maxBackoffS));
+    } else {
+        this->failures = 0;
+        if (converging) {
+            this->steady    = 0;
+            this->intervalS = this->option.minIntervalS;
+        } else if (++this->steady >= this->option.steadyRounds) {
+            this->intervalS = std::max(this->intervalS, static_cast<double>(this->option.intervalS));
+            this->intervalS = std::min(this->intervalS * this->option.slowdownMultiplier,
+                                       static_cast<double>(this->option.maxIntervalS));
+        } else {
+            this->intervalS = this->option.intervalS;
+        }
+        intervalS = this->intervalS;
+    }
+
+    std::uniform_real_distribution<double> dist(1 - this->option.jitter, 1 + this->option.jitter);
+    return std::chrono::milliseconds(static_cast<int64_t>(intervalS * dist(this->mt) * 1000));
+}
+
+bool UpdateScheduler::Wait(std::chrono::milliseconds d) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return !this->cond.wait_for(lock, d, [this]() { return this->stopped; });
+}
+
+void UpdateScheduler::Stop() {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+    }
+    this->cond.notify_all();
+}
+
+void UpdateScheduler::Reset() {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    this->stopped   = false;
+    this->failures  = 0;
+    this->steady    = 0;
+    this->intervalS = this->option.intervalS;
+}
+
+}
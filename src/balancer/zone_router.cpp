@@ -0,0 +1,141 @@
+#include "balancer/zone_router.h"
+
+#include <cstring>
+
+#include "util/util.h"
+
+namespace kit {
+
+static uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+ZoneRouter::ZoneRouter(const ZoneRouterOption& option)
+    : option(option), rtts(std::make_shared<RTTMap>()) {
+    this->total.store(0);
+    this->cross.store(0);
+    this->windowAtMs.store(0);
+    this->debt.store(0);
+}
+
+void ZoneRouter::ReportRTT(const std::string& zone, uint64_t rttUs) {
+    auto rtts = std::atomic_load(&this->rtts);
+    auto it   = rtts->find(zone);
+    std::shared_ptr<RTT> rtt;
+    if (it != rtts->end()) {
+        rtt = it->second;
+    } else {
+        std::lock_guard<std::mutex> lock_guard(this->rttMutex);
+        rtts = std::atomic_load(&this->rtts);
+        it   = rtts->find(zone);
+        if (it == rtts->end()) {
+            // first sample seeds the ewma
+            rtt = std::make_shared<RTT>();
+            rtt->bits.store(toBits(static_cast<double>(rttUs)));
+            auto copy = std::make_shared<RTTMap>(*rtts);
+            (*copy)[zone] = rtt;
+            std::atomic_store(&this->rtts, copy);
+            return;
+        }
+        rtt = it->second;
+    }
+    auto old = rtt->bits.load(std::memory_order_relaxed);
+    while (true) {
+        auto ewma = fromBits(old) * (1 - this->option.alpha) + rttUs * this->option.alpha;
+        if (rtt->bits.compare_exchange_weak(old, toBits(ewma), std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+double ZoneRouter::ZoneRTT(const std::string& zone) const {
+    auto rtts = std::atomic_load(&this->rtts);
+    auto it   = rtts->find(zone);
+    if (it == rtts->end()) {
+        return 0;
+    }
+    return fromBits(it->second->bits.load(std::memory_order_relaxed));
+}
+
+bool ZoneRouter::Fits(const std::string& zone, uint64_t budgetUs) const {
+    return budgetUs == 0 || this->ZoneRTT(zone) <= budgetUs;
+}
+
+bool ZoneRouter::AllowCross(uint64_t nowMs) {
+    auto at = this->windowAtMs.load(std::memory_order_relaxed);
+    if (nowMs >= at + static_cast<uint64_t>(this->option.windowS) * 1000 &&
+        this->windowAtMs.compare_exchange_strong(at, nowMs, std::memory_order_relaxed)) {
+        // decay instead of reset, the share stays meaningful right after a window ends
+        this->total.store(this->total.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+        this->cross.store(this->cross.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    double total = this->total.load(std::memory_order_relaxed);
+    return this->cross.load(std::memory_order_relaxed) < this->option.crossZoneShare * (total + 1);
+}
+
+void ZoneRouter::Count(bool crossZone) {
+    this->total.fetch_add(1, std::memory_order_relaxed);
+    if (crossZone) {
+        this->cross.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ZoneRouter::Defer() {
+    auto old = this->debt.load(std::memory_order_relaxed);
+    while (old < this->option.maxDebt &&
+           !this->debt.compare_exchange_weak(old, old + 1, std::memory_order_relaxed)) {
+    }
+}
+
+bool ZoneRouter::TakeDebt() {
+    auto old = this->debt.load(std::memory_order_relaxed);
+    while (old > 0) {
+        if (this->debt.compare_exchange_weak(old, old - 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int ZoneRouter::Pick(const CandidatePool& pool, const std::string& localZone, bool local, uint64_t budgetUs) const {
+    auto eligible = [&](size_t i) {
+        const auto& zone = pool.nodes[i]->zone;
+        return local ? zone == localZone : zone != localZone && this->Fits(zone, budgetUs);
+    };
+    double sum = 0;
+    int last = -1;
+    for (size_t i = 0; i < pool.nodes.size() && i < pool.factors.size(); i++) {
+        if (eligible(i)) {
+            sum += pool.factors[i];
+            last = static_cast<int>(i);
+        }
+    }
+    if (last < 0 || sum <= 0) {
+        return last;
+    }
+    auto draw = ThreadRandom01() * sum;
+    for (int i = 0; i < last; i++) {
+        if (eligible(i)) {
+            draw -= pool.factors[i];
+            if (draw < 0) {
+                return i;
+            }
+        }
+    }
+    return last;
+}
+
+double ZoneRouter::CrossShare() const {
+    auto total = this->total.load(std::memory_order_relaxed);
+    return total == 0 ? 0 : static_cast<double>(this->cross.load(std::memory_order_relaxed)) / total;
+}
+
+}
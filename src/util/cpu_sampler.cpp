@@ -0,0 +1,400 @@
+#include "util/cpu_sampler.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace kit {
+
+// a reader raced a publish, the writer is done within microseconds
+static void backoff(int& spins) {
+    if (++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    std::this_thread::yield();
+}
+
+static uint64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static bool exists(const std::string& path) {
+    return access(path.c_str(), R_OK) == 0;
+}
+
+static std::string readAll(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// "/a/b" and "/" both join as expected
+static std::string joinPath(const std::string& root, const std::string& path) {
+    if (path.empty() || path == "/") {
+        return root;
+    }
+    return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+CPUSampler::CPUSampler(const CPUSamplerOption& option) {
+    this->option = option;
+    if (this->option.intervalMs <= 0) {
+        this->option.intervalMs = 1000;
+    }
+    if (this->option.windowsS.empty()) {
+        this->option.windowsS.emplace_back(1);
+    }
+    if (this->option.windowsS.size() > CPU_SAMPLER_MAX_WINDOWS) {
+        this->option.windowsS.resize(CPU_SAMPLER_MAX_WINDOWS);
+    }
+    this->statFD        = -1;
+    this->cgroupFD      = -1;
+    this->cgroupVersion = CGROUP_NONE;
+    this->quotaCores    = 0;
+    this->sampleNum     = 0;
+    this->head          = 0;
+    this->stopped       = false;
+    this->sampler       = nullptr;
+    this->buffer.resize(64 * 1024);
+    for (auto& slot : this->slots) {
+        slot.sequence = 0;
+        memset(&slot.snapshot, 0, sizeof(slot.snapshot));
+        slot.snapshot.host   = -1;
+        slot.snapshot.cgroup = -1;
+    }
+}
+
+CPUSampler::~CPUSampler() {
+    this->Stop();
+    this->closeSources();
+}
+
+void CPUSampler::closeSources() {
+    for (auto fd : {this->statFD, this->cgroupFD}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    this->statFD        = -1;
+    this->cgroupFD      = -1;
+    this->cgroupVersion = CGROUP_NONE;
+    this->quotaCores    = 0;
+}
+
+void CPUSampler::openSources() {
+    // a restart after Stop, the cgroup may have moved meanwhile
+    this->closeSources();
+    this->statFD = open((this->option.procRoot + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+
+    // cgroup of this process, v1 lines are "id:controllers:path", v2 is "0::path"
+    std::string v1Controllers, v1Path, v2Path;
+    bool        v2 = false;
+    std::stringstream lines(readAll(this->option.procRoot + "/self/cgroup"));
+    std::string line;
+    while (std::getline(lines, line)) {
+        auto first  = line.find(':');
+        auto second = first == std::string::npos ? std::string::npos : line.find(':', first + 1);
+        if (second == std::string::npos) {
+            continue;
+        }
+        auto controllers = line.substr(first + 1, second - first - 1);
+        auto path        = line.substr(second + 1);
+        if (controllers.empty()) {
+            v2     = true;
+            v2Path = path;
+            continue;
+        }
+        std::stringstream names(controllers);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+            if (name == "cpuacct") {
+                v1Controllers = controllers;
+                v1Path        = path;
+            }
+        }
+    }
+
+    auto& root = this->option.cgroupRoot;
+    if (!v1Controllers.empty()) {
+        // the path is "/" inside a cgroup namespace, the mount is then our own cgroup
+        for (const auto& dir : {joinPath(root + "/" + v1Controllers, v1Path), joinPath(root + "/cpuacct", v1Path),
+                                root + "/" + v1Controllers, root + "/cpuacct"}) {
+            if (exists(dir + "/cpuacct.usage")) {
+                this->cgroupFD      = open((dir + "/cpuacct.usage").c_str(), O_RDONLY | O_CLOEXEC);
+                this->cgroupVersion = CGROUP_V1;
+                for (const auto& cpuDir : {joinPath(root + "/cpu", v1Path), root + "/cpu", dir}) {
+                    if (exists(cpuDir + "/cpu.cfs_quota_us")) {
+                        auto quota  = std::atof(readAll(cpuDir + "/cpu.cfs_quota_us").c_str());
+                        auto period = std::atof(readAll(cpuDir + "/cpu.cfs_period_us").c_str());
+                        this->quotaCores = quota > 0 && period > 0 ? quota / period : 0;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    } else if (v2) {
+        for (const auto& dir : {joinPath(root, v2Path), root}) {
+            if (exists(dir + "/cpu.stat")) {
+                this->cgroupFD      = open((dir + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+                this->cgroupVersion = CGROUP_V2;
+                // "max 100000" or "50000 100000"
+                std::stringstream cpuMax(readAll(dir + "/cpu.max"));
+                std::string quota;
+                double period = 0;
+                cpuMax >> quota >> period;
+                this->quotaCores = quota != "max" && period > 0 ? std::atof(quota.c_str()) / period : 0;
+                break;
+            }
+        }
+    }
+    if (this->cgroupFD < 0) {
+        this->cgroupVersion = CGROUP_NONE;
+    }
+}
+
+bool CPUSampler::readFile(int fd, std::string& content) {
+    if (fd < 0) {
+        return false;
+    }
+    auto n = pread(fd, this->buffer.data(), this->buffer.size() - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    content.assign(this->buffer.data(), n);
+    return true;
+}
+
+bool CPUSampler::sample(Sample& s) {
+    s.timestampMs   = nowMs();
+    s.hostBusy      = 0;
+    s.hostTotal     = 0;
+    s.cgroupUsageUs = 0;
+
+    std::string content;
+    if (!this->readFile(this->statFD, content)) {
+        return false;
+    }
+    // cpu  user nice system idle iowait irq softirq steal ...
+    const char* p   = content.c_str();
+    size_t      core = 0;
+    while (*p != '\0' && strncmp(p, "cpu", 3) == 0) {
+        p += 3;
+        long index = -1;
+        if (*p != ' ') {
+            index = strtol(p, const_cast<char**>(&p), 10);
+        }
+        uint64_t fields[8] = {0};
+        for (auto& field : fields) {
+            field = strtoull(p, const_cast<char**>(&p), 10);
+        }
+        uint64_t total = 0;
+        for (auto field : fields) {
+            total += field;
+        }
+        uint64_t busy = total - fields[3] - fields[4];
+        if (index < 0) {
+            s.hostBusy  = busy;
+            s.hostTotal = total;
+        } else if (core < CPU_SAMPLER_MAX_CORES) {
+            if (s.coreBusy.size() <= core) {
+                s.coreBusy.resize(core + 1);
+                s.coreTotal.resize(core + 1);
+            }
+            s.coreBusy[core]  = busy;
+            s.coreTotal[core] = total;
+            core++;
+        }
+        p = strchr(p, '\n');
+        if (p == nullptr) {
+            break;
+        }
+        p++;
+    }
+    s.coreBusy.resize(core);
+    s.coreTotal.resize(core);
+
+    if (this->readFile(this->cgroupFD, content)) {
+        if (this->cgroupVersion == CGROUP_V1) {
+            s.cgroupUsageUs = strtoull(content.c_str(), nullptr, 10) / 1000;
+        } else {
+            auto pos = content.find("usage_usec");
+            if (pos != std::string::npos) {
+                s.cgroupUsageUs = strtoull(content.c_str() + pos + strlen("usage_usec"), nullptr, 10);
+            }
+        }
+    }
+    return true;
+}
+
+static double percent(uint64_t busy, uint64_t lastBusy, uint64_t total, uint64_t lastTotal) {
+    if (total <= lastTotal || busy < lastBusy) {
+        return -1;
+    }
+    return 100.0 * (busy - lastBusy) / (total - lastTotal);
+}
+
+void CPUSampler::publish() {
+    auto  capacity = this->samples.size();
+    auto& newest   = this->samples[(this->head + capacity - 1) % capacity];
+
+    for (size_t w = 0; w < this->option.windowsS.size(); w++) {
+        // the newest sample at least one window old, or the oldest we have
+        auto    target = newest.timestampMs - static_cast<uint64_t>(this->option.windowsS[w]) * 1000;
+        Sample* oldest = nullptr;
+        for (size_t i = 2; i <= this->sampleNum; i++) {
+            oldest = &this->samples[(this->head + capacity - i) % capacity];
+            if (oldest->timestampMs <= target) {
+                break;
+            }
+        }
+
+        auto& slot = this->slots[w];
+        auto  seq  = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto& snapshot       = slot.snapshot;
+        snapshot.timestampMs = newest.timestampMs;
+        snapshot.quotaCores  = this->quotaCores;
+        snapshot.coreNum     = static_cast<int>(newest.coreBusy.size());
+        if (oldest == nullptr || oldest->timestampMs >= newest.timestampMs) {
+            snapshot.windowMs    = 0;
+            snapshot.host        = -1;
+            snapshot.cgroup      = -1;
+            snapshot.cgroupCores = -1;
+            snapshot.coreNum     = 0;
+        } else {
+            snapshot.windowMs = static_cast<int>(newest.timestampMs - oldest->timestampMs);
+            snapshot.host     = percent(newest.hostBusy, oldest->hostBusy, newest.hostTotal, oldest->hostTotal);
+            for (int c = 0; c < snapshot.coreNum; c++) {
+                snapshot.cores[c] = c < static_cast<int>(oldest->coreBusy.size())
+                                        ? percent(newest.coreBusy[c], oldest->coreBusy[c], newest.coreTotal[c],
+                                                  oldest->coreTotal[c])
+                                        : -1;
+            }
+            if (this->cgroupVersion == CGROUP_NONE || newest.cgroupUsageUs < oldest->cgroupUsageUs) {
+                snapshot.cgroup      = -1;
+                snapshot.cgroupCores = -1;
+            } else {
+                snapshot.cgroupCores =
+                    (newest.cgroupUsageUs - oldest->cgroupUsageUs) / (snapshot.windowMs * 1000.0);
+                auto cores      = this->quotaCores > 0 ? this->quotaCores : std::max(snapshot.coreNum, 1);
+                snapshot.cgroup = std::min(100.0, 100.0 * snapshot.cgroupCores / cores);
+            }
+        }
+
+        slot.sequence.store(seq + 2, std::memory_order_release);
+    }
+}
+
+void CPUSampler::Start(bool wait) {
+    if (this->sampler != nullptr) {
+        return;
+    }
+    this->openSources();
+
+    int maxWindowS = *std::max_element(this->option.windowsS.begin(), this->option.windowsS.end());
+    this->samples.resize(static_cast<size_t>(maxWindowS) * 1000 / this->option.intervalMs + 2);
+    this->sampleNum = 0;
+    this->head      = 0;
+
+    auto tick = [this]() {
+        if (this->sample(this->samples[this->head])) {
+            this->head      = (this->head + 1) % this->samples.size();
+            this->sampleNum = std::min(this->sampleNum + 1, this->samples.size());
+            this->publish();
+        }
+    };
+    // two quick samples so the first reader gets a real value
+    auto quickMs = std::min(this->option.intervalMs, 100);
+    tick();
+    if (wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(quickMs));
+        tick();
+    }
+
+    this->stopped = false;
+    this->sampler = new std::thread([this, tick, wait, quickMs]() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto intervalMs = wait ? this->option.intervalMs : quickMs;
+        while (!this->cond.wait_for(lock, std::chrono::milliseconds(intervalMs),
+                                    [this]() { return this->stopped; })) {
+            tick();
+            intervalMs = this->option.intervalMs;
+        }
+    });
+}
+
+void CPUSampler::Stop() {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+    }
+    this->cond.notify_all();
+    if (this->sampler != nullptr) {
+        if (this->sampler->joinable()) {
+            this->sampler->join();
+        }
+        delete this->sampler;
+        this->sampler = nullptr;
+    }
+}
+
+bool CPUSampler::Snapshot(size_t window, CPUUsageSnapshot& snapshot) const {
+    if (window >= this->option.windowsS.size()) {
+        return false;
+    }
+    auto& slot = this->slots[window];
+    int spins = 0;
+    while (true) {
+        auto begin = slot.sequence.load(std::memory_order_acquire);
+        if (begin & 1) {
+            backoff(spins);
+            continue;
+        }
+        memcpy(&snapshot, &slot.snapshot, sizeof(snapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == begin) {
+            return true;
+        }
+        backoff(spins);
+    }
+}
+
+double CPUSampler::Usage() const {
+    auto& slot = this->slots[0];
+    int spins = 0;
+    while (true) {
+        auto begin = slot.sequence.load(std::memory_order_acquire);
+        if (begin & 1) {
+            backoff(spins);
+            continue;
+        }
+        auto usage = slot.snapshot.cgroup >= 0 ? slot.snapshot.cgroup : slot.snapshot.host;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == begin) {
+            return usage;
+        }
+        backoff(spins);
+    }
+}
+
+CPUSampler& CPUSampler::Default() {
+    static CPUSampler sampler;
+    static bool       started = (sampler.Start(false), true);
+    (void)started;
+    return sampler;
+}
+
+}
@@ -0,0 +1,128 @@
+#include "util/metrics_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "util/constant.h"
+
+namespace kit {
+
+MetricsServer::MetricsServer(const std::function<void(std::string&)>& render)
+    : render(render), fd(-1), port(0), stopped(false), server(nullptr) {}
+
+MetricsServer::~MetricsServer() {
+    this->Stop();
+}
+
+std::tuple<int, std::string> MetricsServer::Start(int port, const std::string& address) {
+    if (this->server != nullptr) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "metrics server already started");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        return std::make_tuple(STATUSCODE::ERROR_INVALID_ARGUMENT, "invalid address: " + address);
+    }
+    this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (this->fd < 0) {
+        return std::make_tuple(STATUSCODE::ERROR_CONNECT, std::string("socket: ") + strerror(errno));
+    }
+    int on = 1;
+    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(this->fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(this->fd, 16) != 0) {
+        std::string err = std::string("listen: ") + strerror(errno);
+        close(this->fd);
+        this->fd = -1;
+        return std::make_tuple(STATUSCODE::ERROR_CONNECT, err);
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(this->fd, (sockaddr*)&addr, &len);
+    this->port = ntohs(addr.sin_port);
+    this->stopped.store(false);
+    this->server = new std::thread(&MetricsServer::serve, this);
+    return std::make_tuple(STATUSCODE::SUCCESS, "");
+}
+
+void MetricsServer::Stop() {
+    if (this->server == nullptr) {
+        return;
+    }
+    // wakes up accept
+    this->stopped.store(true);
+    shutdown(this->fd, SHUT_RDWR);
+    this->server->join();
+    delete this->server;
+    this->server = nullptr;
+    close(this->fd);
+    this->fd = -1;
+}
+
+static bool writeAll(int conn, const char* data, size_t size) {
+    while (size > 0) {
+        auto n = send(conn, data, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void MetricsServer::serve() {
+    char request[4096];
+    char header[192];
+    while (!this->stopped.load()) {
+        int conn = accept(this->fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (this->stopped.load()) {
+                return;
+            }
+            continue;
+        }
+        // a stuck scraper must not hold the only thread
+        timeval timeout{1, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // the request line and headers, the body of a GET is ignored
+        size_t size = 0;
+        while (size < sizeof(request) - 1) {
+            auto n = recv(conn, request + size, sizeof(request) - 1 - size, 0);
+            if (n <= 0) {
+                break;
+            }
+            size += n;
+            request[size] = '\0';
+            if (strstr(request, "\r\n\r\n") != nullptr) {
+                break;
+            }
+        }
+        request[size] = '\0';
+
+        int n;
+        if (size >= 4 && (memcmp(request, "GET ", 4) == 0)) {
+            this->render(this->body);
+            n = snprintf(header, sizeof(header),
+                         "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                         this->body.size());
+            if (writeAll(conn, header, n)) {
+                writeAll(conn, this->body.data(), this->body.size());
+            }
+        } else {
+            n = snprintf(header, sizeof(header),
+                         "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            writeAll(conn, header, n);
+        }
+        close(conn);
+    }
+}
+
+}
@@ -0,0 +1,172 @@
+#include "util/numa.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace kit {
+
+std::vector<int> ParseCPUList(const std::string& list) {
+    std::vector<int>  cpus;
+    std::stringstream ss(list);
+    std::string       item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty() || item[0] < '0' || item[0] > '9') {
+            continue;
+        }
+        char* end   = nullptr;
+        auto  first = strtol(item.c_str(), &end, 10);
+        auto  last  = first;
+        if (*end == '-') {
+            last = strtol(end + 1, nullptr, 10);
+        }
+        for (auto cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+NumaTopology::NumaTopology(const std::string& root) {
+    auto dir = opendir(root.c_str());
+    if (dir != nullptr) {
+        std::vector<std::pair<int, std::vector<int>>> nodes;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 || name[4] < '0' || name[4] > '9') {
+                continue;
+            }
+            std::ifstream in(root + "/" + name + "/cpulist");
+            std::string   list;
+            std::getline(in, list);
+            auto cpus = ParseCPUList(list);
+            if (!cpus.empty()) {
+                nodes.emplace_back(atoi(name.c_str() + 4), cpus);
+            }
+        }
+        closedir(dir);
+        // node ids may have holes, e.g. memory only nodes, renumber in id order
+        std::sort(nodes.begin(), nodes.end());
+        for (auto& node : nodes) {
+            this->nodeCPUs.emplace_back(std::move(node.second));
+        }
+    }
+    if (this->nodeCPUs.empty()) {
+        std::vector<int> cpus;
+        for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++) {
+            cpus.push_back(static_cast<int>(i));
+        }
+        this->nodeCPUs.emplace_back(cpus);
+    }
+    for (int node = 0; node < this->NodeNum(); node++) {
+        for (auto cpu : this->nodeCPUs[node]) {
+            if (cpu >= static_cast<int>(this->cpuNode.size())) {
+                this->cpuNode.resize(cpu + 1, 0);
+            }
+            this->cpuNode[cpu] = node;
+        }
+    }
+}
+
+int NumaTopology::CurrentNode() const {
+    if (this->NodeNum() <= 1) {
+        return 0;
+    }
+    // vdso on linux, no syscall
+    return this->NodeOf(sched_getcpu());
+}
+
+bool NumaTopology::Pin(int node) const {
+    if (node < 0 || node >= this->NodeNum()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : this->nodeCPUs[node]) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void NumaTopology::RunOnNode(int node, const std::function<void()>& fn) const {
+    std::thread worker([this, node, &fn]() {
+        this->Pin(node);
+        fn();
+    });
+    worker.join();
+}
+
+const NumaTopology& NumaTopology::Default() {
+    static NumaTopology topology;
+    return topology;
+}
+
+NodeWorkers::NodeWorkers(const NumaTopology& topology)
+    : nodeNum(topology.NodeNum()), round(0), arrived(0), stopped(false), body(nullptr) {
+    for (int node = 0; node < this->nodeNum; node++) {
+        // pinned before the constructor returns, the topology may go away after
+        std::mutex              pinMutex;
+        std::condition_variable pinned;
+        bool                    done = false;
+        this->workers.emplace_back([this, node, &topology, &pinMutex, &pinned, &done]() {
+            topology.Pin(node);
+            {
+                // notified under the lock, the waiter destroys pinned as soon as it sees done
+                std::lock_guard<std::mutex> lock_guard(pinMutex);
+                done = true;
+                pinned.notify_one();
+            }
+            this->work(node);
+        });
+        std::unique_lock<std::mutex> lock(pinMutex);
+        pinned.wait(lock, [&done]() { return done; });
+    }
+}
+
+NodeWorkers::~NodeWorkers() {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+    }
+    this->wake.notify_all();
+    for (auto& worker : this->workers) {
+        worker.join();
+    }
+}
+
+void NodeWorkers::work(int node) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wake.wait(lock, [&]() { return this->stopped || this->round != seen; });
+        if (this->stopped) {
+            return;
+        }
+        seen = this->round;
+        lock.unlock();
+        (*this->body)(node);
+        lock.lock();
+        if (++this->arrived == this->nodeNum) {
+            this->finished.notify_one();
+        }
+    }
+}
+
+void NodeWorkers::RunAll(const Body& body) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->body    = &body;
+    this->arrived = 0;
+    this->round++;
+    this->wake.notify_all();
+    this->finished.wait(lock, [&]() { return this->arrived == this->nodeNum; });
+    this->body = nullptr;
+}
+
+}
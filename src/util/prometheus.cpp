@@ -0,0 +1,90 @@
+#include "util/prometheus.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace kit {
+
+PrometheusWriter::PrometheusWriter(std::string& out) : out(out) {
+    this->out.clear();
+}
+
+void PrometheusWriter::appendValue(double value) {
+    if (std::isnan(value)) {
+        this->out.append("NaN");
+        return;
+    }
+    if (std::isinf(value)) {
+        this->out.append(value > 0 ? "+Inf" : "-Inf");
+        return;
+    }
+    // integers up to 2^53 print exactly, without exponent
+    char buf[32];
+    int  n = std::floor(value) == value && std::fabs(value) < 9007199254740992.0
+                 ? snprintf(buf, sizeof(buf), "%.0f", value)
+                 : snprintf(buf, sizeof(buf), "%.17g", value);
+    this->out.append(buf, n);
+}
+
+void PrometheusWriter::appendLabels(std::initializer_list<PrometheusLabel> labels) {
+    if (labels.size() == 0) {
+        return;
+    }
+    this->out.push_back('{');
+    bool first = true;
+    for (const auto& label : labels) {
+        if (!first) {
+            this->out.push_back(',');
+        }
+        first = false;
+        this->out.append(label.name);
+        this->out.append("=\"");
+        for (size_t i = 0; i < label.size; i++) {
+            auto c = label.value[i];
+            if (c == '\\' || c == '"') {
+                this->out.push_back('\\');
+                this->out.push_back(c);
+            } else if (c == '\n') {
+                this->out.append("\\n");
+            } else {
+                this->out.push_back(c);
+            }
+        }
+        this->out.push_back('"');
+    }
+    this->out.push_back('}');
+}
+
+void PrometheusWriter::Family(const char* name, const char* type, const char* help) {
+    this->out.append("# HELP ");
+    this->out.append(name);
+    this->out.push_back(' ');
+    for (auto c = help; *c != '\0'; c++) {
+        if (*c == '\\') {
+            this->out.append("\\\\");
+        } else if (*c == '\n') {
+            this->out.append("\\n");
+        } else {
+            this->out.push_back(*c);
+        }
+    }
+    this->out.append("\n# TYPE ");
+    this->out.append(name);
+    this->out.push_back(' ');
+    this->out.append(type);
+    this->out.push_back('\n');
+}
+
+void PrometheusWriter::Sample(const char* name, double value) {
+    this->Sample(name, {}, value);
+}
+
+void PrometheusWriter::Sample(const char* name, std::initializer_list<PrometheusLabel> labels, double value) {
+    this->out.append(name);
+    this->appendLabels(labels);
+    this->out.push_back(' ');
+    this->appendValue(value);
+    this->out.push_back('\n');
+}
+
+}
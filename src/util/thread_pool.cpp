@@ -0,0 +1,80 @@
+#include "util/thread_pool.h"
+#include <algorithm>
+
+namespace kit {
+
+ThreadPool::ThreadPool(int threads)
+    : round(0), arrived(0), stopped(false), body(nullptr), n(0), parts(0), next(0) {
+    for (int i = 0; i < threads; i++) {
+        this->workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->stopped = true;
+    }
+    this->wake.notify_all();
+    for (auto& worker : this->workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::Parts(size_t n, size_t minPart) const {
+    minPart = std::max(minPart, static_cast<size_t>(1));
+    auto parts = std::min(this->workers.size() + 1, (n + minPart - 1) / minPart);
+    return std::max(parts, static_cast<size_t>(1));
+}
+
+void ThreadPool::runParts() {
+    size_t part;
+    while ((part = this->next.fetch_add(1)) < this->parts) {
+        (*this->body)(part, this->n * part / this->parts, this->n * (part + 1) / this->parts);
+    }
+}
+
+void ThreadPool::work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wake.wait(lock, [&]() { return this->stopped || this->round != seen; });
+        if (this->stopped) {
+            return;
+        }
+        seen = this->round;
+        lock.unlock();
+        this->runParts();
+        lock.lock();
+        // the caller waits for every worker, none is left reading a loop that is over
+        if (++this->arrived == this->workers.size()) {
+            this->finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(size_t n, size_t parts, const Body& body) {
+    if (parts <= 1 || this->workers.empty()) {
+        for (size_t part = 0; part < parts; part++) {
+            body(part, n * part / parts, n * (part + 1) / parts);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        this->body    = &body;
+        this->n       = n;
+        this->parts   = parts;
+        this->arrived = 0;
+        this->next.store(0);
+        this->round++;
+    }
+    this->wake.notify_all();
+    this->runParts();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->finished.wait(lock, [&]() { return this->arrived == this->workers.size(); });
+    this->body = nullptr;
+}
+
+}
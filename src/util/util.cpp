@@ -1,7 +1,11 @@
 #include "util/util.h"
+#include "util/cpu_sampler.h"
+#include "util/zone.h"
 #include <curl/curl.h>
 #include <array>
+#include <cctype>
 #include <boost/algorithm/string.hpp>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <iostream>
@@ -9,73 +13,86 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace kit {
 
 double CPUUsage() {
-    static uint64_t lastUser, lastUserLow, lastSys, lastIdle;
-
-    double   percent;
-    uint64_t user, userLow, sys, idle, total;
-
-    auto fp = fopen("/proc/stat", "r");
-    if (fp == nullptr) {
-        return -1.0;
-    }
-    fscanf(fp, "cpu %llu %llu %llu %llu", &user, &userLow, &sys, &idle);
-    fclose(fp);
-
-    if (user < lastUser || userLow < lastUserLow ||
-        sys < lastSys || idle < lastIdle) {
-        percent = -1.0;
-    } else {
-        total   = (user - lastUser) + (userLow - lastUserLow) + (sys - lastSys);
-        percent = total;
-        total += (idle - lastIdle);
-        percent /= total;
-        percent *= 100;
-    }
+    return CPUSampler::Default().Usage();
+}
 
-    lastUser    = user;
-    lastUserLow = userLow;
-    lastSys     = sys;
-    lastIdle    = idle;
+uint64_t SteadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
 
-    return percent;
+double ThreadRandom01() {
+    static thread_local uint64_t state =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+        (static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) << 20) ^
+        0x9E3779B97F4A7C15ULL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<double>(state >> 11) / static_cast<double>(1ULL << 53);
 }
 
 std::tuple<int, std::string> GetStatusOutput(const std::string &command) {
-    std::array<char, 128> buffer;
-    std::string           result;
-    auto                  fp = popen(command.c_str(), "r");
+    std::array<char, 4096> buffer;
+    std::string            result;
+    auto                   fp = popen(command.c_str(), "r");
     if (fp == nullptr) {
         return std::make_tuple(-1, "");
     }
-    while (!feof(fp)) {
-        if (fgets(buffer.data(), 128, fp) != nullptr) {
-            result += buffer.data();
-        }
+    size_t n;
+    while ((n = fread(buffer.data(), 1, buffer.size(), fp)) > 0) {
+        result.append(buffer.data(), n);
     }
     return std::make_tuple(pclose(fp), result);
 }
 
-std::string Zone() {
-    std::string output;
-    int         status;
-    std::tie(status, output) = GetStatusOutput("/opt/aws/bin/ec2-metadata -z");
-    if (status != 0) {
-        return "unknown";
+std::string Base64Decode(const std::string &in) {
+    static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve(in.size()*3/4);
+    uint32_t buf = 0;
+    int      bits = 0;
+    for (auto ch : in) {
+        auto pos = alphabet.find(ch);
+        if (pos == std::string::npos) {
+            // '=' padding, whitespace
+            continue;
+        }
+        buf = (buf << 6) | static_cast<uint32_t>(pos);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((buf >> bits) & 0xFF));
+        }
     }
+    return out;
+}
 
-    std::vector<std::string> kv;
-    auto                     str = output.substr(0, output.length() - 1);
-    boost::split(kv, str, [](char ch) { return ch == ' '; });
-    if (kv.size() != 2) {
-        return "unknown";
+std::string UrlEncode(const std::string &in) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    out.reserve(in.size()*3);
+    for (unsigned char ch : in) {
+        if (isalnum(ch) || ch == '-' || ch == '_' || ch == '.' || ch == '~') {
+            out.push_back(static_cast<char>(ch));
+        } else {
+            out.push_back('%');
+            out.push_back(hex[ch >> 4]);
+            out.push_back(hex[ch & 0x0F]);
+        }
     }
+    return out;
+}
 
-    return kv[1];
+std::string Zone() {
+    return ZoneProvider::Default().Get();
 }
 
 static size_t WriteToStream(void *ptr, size_t size, size_t nmemb, std::stringstream *stream) {
@@ -83,7 +100,14 @@ static size_t WriteToStream(void *ptr, size_t size, size_t nmemb, std::stringstr
     return size * nmemb;
 }
 
+// curl_global_init is not thread safe, run it once before any concurrent fetch
+static CURLcode curlGlobalInit() {
+    static auto code = curl_global_init(CURL_GLOBAL_ALL);
+    return code;
+}
+
 std::tuple<int, std::string, std::string> HttpGet(const std::string &url) {
+    curlGlobalInit();
     auto curl = curl_easy_init();
     if (!curl) {
         return std::make_tuple(-1, "", "curl_easy_init failed");
@@ -95,6 +119,8 @@ std::tuple<int, std::string, std::string> HttpGet(const std::string &url) {
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
     curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    // every encoding curl was built with, decoded on the fly as the body streams in
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteToStream);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
     auto code = curl_easy_perform(curl);
@@ -117,6 +143,7 @@ std::tuple<int, std::string, std::string> HttpGet(const std::string &url) {
 }
 
 std::tuple<int, std::string, std::map<std::string, std::string>, std::string> HttpGet(const std::string &url, std::map<std::string, std::string> reqheader) {
+    curlGlobalInit();
     auto curl = curl_easy_init();
     if (!curl) {
         return std::make_tuple(-1, "", std::map<std::string, std::string>{}, "curl_easy_init failed");
@@ -135,6 +162,7 @@ std::tuple<int, std::string, std::map<std::string, std::string>, std::string> Ht
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
     curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteToStream);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, &resheaderStr);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteToStream);
@@ -171,4 +199,54 @@ std::tuple<int, std::string, std::map<std::string, std::string>, std::string> Ht
     ss << "curl_easy_perform is not ok, status: [" << status << "] url: [" << url << "]";
     return std::make_tuple(status, body.str(), resheader, ss.str());
 }
+std::tuple<int, std::string, std::string> HttpRequest(const std::string &method,
+                                                      const std::string &url,
+                                                      const std::map<std::string, std::string> &reqheader,
+                                                      const std::string &reqbody,
+                                                      long connectTimeoutMs,
+                                                      long timeoutMs) {
+    curlGlobalInit();
+    auto curl = curl_easy_init();
+    if (!curl) {
+        return std::make_tuple(-1, "", "curl_easy_init failed");
+    }
+
+    std::stringstream  body;
+    long               status;
+    struct curl_slist *reqheaderStr = nullptr;
+    for (const auto &kv : reqheader) {
+        reqheaderStr = curl_slist_append(reqheaderStr, (kv.first + ":" + kv.second).c_str());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, reqheaderStr);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    if (method != "GET") {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, reqbody.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(reqbody.size()));
+    }
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connectTimeoutMs);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeoutMs);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteToStream);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    auto code = curl_easy_perform(curl);
+    curl_slist_free_all(reqheaderStr);
+    if (code != CURLE_OK) {
+        curl_easy_cleanup(curl);
+        std::stringstream ss;
+        ss << "curl_easy_perform is not ok, code: [" << code << "] url: [" << url << "]";
+        return std::make_tuple(-1, body.str(), ss.str());
+    }
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(curl);
+
+    if (status >= 200 && status < 300) {
+        return std::make_tuple(status, body.str(), "");
+    }
+
+    std::stringstream ss;
+    ss << "curl_easy_perform is not ok, status: [" << status << "] url: [" << url << "]";
+    return std::make_tuple(status, body.str(), ss.str());
+}
 }
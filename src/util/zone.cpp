@@ -0,0 +1,101 @@
+#include "util/zone.h"
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "util/util.h"
+
+namespace kit {
+
+ZoneProvider::ZoneProvider(const ZoneOption &option) {
+    this->option    = option;
+    this->resolved  = false;
+    this->retryAtMs = 0;
+    this->backoffMs = option.retryMs;
+}
+
+std::string ZoneProvider::fromMetadata() {
+    auto &option = this->option;
+    int status;
+    std::string body;
+    std::tie(status, body, std::ignore) =
+        HttpRequest("PUT", option.endpoint + "/latest/api/token",
+                    {{"X-aws-ec2-metadata-token-ttl-seconds", std::to_string(option.tokenTTLS)}}, "",
+                    option.connectTimeoutMs, option.timeoutMs);
+
+    std::map<std::string, std::string> header;
+    this->source = "imdsv1";
+    // any token failure, a timeout included, falls back to the IMDSv1 read
+    if (status==200 && !body.empty()) {
+        header["X-aws-ec2-metadata-token"] = body;
+        this->source = "imdsv2";
+    }
+    std::tie(status, body, std::ignore) =
+        HttpRequest("GET", option.endpoint + "/latest/meta-data/placement/availability-zone", header, "",
+                    option.connectTimeoutMs, option.timeoutMs);
+    if (status!=200) {
+        return "";
+    }
+    return boost::trim_copy(body);
+}
+
+std::string ZoneProvider::Get() {
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    if (this->resolved) {
+        return this->zone;
+    }
+    auto now = SteadyNowMs();
+    if (now < this->retryAtMs) {
+        return this->zone;
+    }
+    this->resolved = true;
+
+    auto env = getenv(this->option.envName.c_str());
+    if (env!=nullptr && env[0]!='\0') {
+        this->zone = env;
+        this->source = "env";
+        return this->zone;
+    }
+
+    auto file = this->option.file;
+    auto fileEnv = getenv(this->option.fileEnvName.c_str());
+    if (fileEnv!=nullptr && fileEnv[0]!='\0') {
+        file = fileEnv;
+    }
+    if (!file.empty()) {
+        std::ifstream in(file);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        auto zone = boost::trim_copy(ss.str());
+        if (!zone.empty()) {
+            this->zone = zone;
+            this->source = "file";
+            return this->zone;
+        }
+    }
+
+    this->zone = this->fromMetadata();
+    if (this->zone.empty()) {
+        this->zone = "unknown";
+        this->source = "unknown";
+        this->resolved = false;
+        this->retryAtMs = SteadyNowMs() + this->backoffMs;
+        this->backoffMs = std::min(this->backoffMs * 2, std::max(this->option.maxRetryMs, this->option.retryMs));
+    }
+    return this->zone;
+}
+
+std::string ZoneProvider::getSource() {
+    this->Get();
+    std::lock_guard<std::mutex> lock_guard(this->mutex);
+    return this->source;
+}
+
+ZoneProvider &ZoneProvider::Default() {
+    static ZoneProvider provider;
+    return provider;
+}
+
+}
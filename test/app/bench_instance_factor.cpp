@@ -0,0 +1,65 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <json11.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "balancer/factor_table.h"
+
+// compare the json and the binary instance factor formats, one refresh is a parse
+// of the kv value plus a lookup per instance, as the resolver does
+//   bench_instance_factor [instances] [rounds]
+int main(int argc, char** argv) {
+    int instances = argc > 1 ? atoi(argv[1]) : 5000;
+    int rounds    = argc > 2 ? atoi(argv[2]) : 200;
+
+    std::vector<std::pair<std::string, double>> values;
+    json11::Json::array data;
+    for (int i = 0; i < instances; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "i-%016x", i * 2654435761u);
+        values.emplace_back(id, 20 + i % 60);
+        data.emplace_back(json11::Json::object{{"instanceid", std::string(id)}, {"CPUUtilization", 20 + i % 60}});
+    }
+    auto text   = json11::Json(json11::Json::object{{"updated", 1600000000}, {"data", data}}).dump();
+    auto binary = kit::factor_table::Encode(values, 1600000000);
+
+    double sum   = 0;
+    auto   begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        std::string err;
+        auto kv = json11::Json::parse(text, err);
+        std::unordered_map<std::string, double> factors;
+        for (const auto& item : kv["data"].array_items()) {
+            factors[item["instanceid"].string_value()] = item["CPUUtilization"].number_value();
+        }
+        for (const auto& item : values) {
+            sum += factors[item.first];
+        }
+    }
+    auto jsonNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        std::string err;
+        kit::FactorTableView table;
+        if (!table.Parse(binary.data(), binary.size(), err)) {
+            fprintf(stderr, "parse failed: %s\n", err.c_str());
+            return EXIT_FAILURE;
+        }
+        for (const auto& item : values) {
+            double factor = 0;
+            table.Find(item.first, factor);
+            sum += factor;
+        }
+    }
+    auto binaryNs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("instances: %d, rounds: %d, checksum: %.0f\n", instances, rounds, sum);
+    printf("json:   %8zu bytes, %10.1f us/refresh\n", text.size(), jsonNs / 1000.0 / rounds);
+    printf("binary: %8zu bytes, %10.1f us/refresh\n", binary.size(), binaryNs / 1000.0 / rounds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <log4cplus/logger.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "balancer/consul_resolver.h"
+
+// time a refresh of a large service once the consul data is in, per stage, the way the
+// updater runs it: health nodes applied, then the candidate pool built. every round drops
+// and adds a few instances so the joining path is measured too
+//   bench_refresh [nodes] [threads] [rounds] [zones]
+int main(int argc, char** argv) {
+    int nodeNum = argc > 1 ? atoi(argv[1]) : 50000;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    int rounds  = argc > 3 ? atoi(argv[3]) : 20;
+    int zoneNum = argc > 4 ? atoi(argv[4]) : 5;
+
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("bench");
+    kit::ConsulResolver resolver("http://127.0.0.1:1", "zone-0", "rs");
+    resolver.SetLogger(&logger);
+    resolver.SetRefreshThreads(threads);
+    std::string err;
+    resolver.applyZoneCPUMap(json11::Json::parse(R"({"updated": 1, "data": [{"zone-0": 60}, {"zone-1": 40}]})", err));
+
+    auto nodes = [&](int round) {
+        std::vector<std::shared_ptr<kit::ServiceNode>> nodes;
+        for (int i = round * 10; i < nodeNum + round * 10; i++) {
+            char id[32];
+            snprintf(id, sizeof(id), "i-%016x", i * 2654435761u);
+            auto node = std::make_shared<kit::ServiceNode>();
+            node->zone = "zone-" + std::to_string(i % zoneNum);
+            node->host = "10." + std::to_string(i / 65536 % 256) + "." + std::to_string(i / 256 % 256) + "." +
+                         std::to_string(i % 256);
+            node->port = 8080;
+            node->instanceID = id;
+            node->balanceFactor = 1000;
+            nodes.emplace_back(node);
+        }
+        return nodes;
+    };
+
+    double total[REFRESH_STAGE_NUM] = {};
+    double worst = 0;
+    double sum   = 0;
+    for (int round = 0; round <= rounds; round++) {
+        auto health = nodes(round);
+        auto begin  = std::chrono::steady_clock::now();
+        resolver.applyServiceNodes(health, true);
+        resolver.updateCandidatePool();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+        // the first round builds every instance state, a restart not a refresh
+        if (round == 0) {
+            printf("first: %lld us\n", (long long)us);
+            continue;
+        }
+        for (int stage = 0; stage < REFRESH_STAGE_NUM; stage++) {
+            total[stage] += resolver.getStageUs(static_cast<RefreshStage>(stage));
+        }
+        worst = std::max(worst, static_cast<double>(us));
+        sum += us;
+    }
+
+    printf("nodes: %d, zones: %d, threads: %d, pool: %zu\n", nodeNum, zoneNum, threads,
+           resolver.getCandidatePool()->nodes.size());
+    for (int stage = 0; stage < REFRESH_STAGE_NUM; stage++) {
+        printf("%-8s %10.1f us\n", RefreshStageName(stage), total[stage] / rounds);
+    }
+    printf("refresh  %10.1f us, worst %.1f us\n", sum / rounds, worst);
+    return EXIT_SUCCESS;
+}
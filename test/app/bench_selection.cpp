@@ -0,0 +1,78 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <log4cplus/logger.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "balancer/consul_resolver.h"
+
+// selection throughput of a resolver whose candidate pool is rebuilt every millisecond,
+// for 1, 2, 4 ... up to threads selecting threads
+//   bench_selection [nodes] [threads] [durationMs]
+int main(int argc, char** argv) {
+    int nodeNum    = argc > 1 ? atoi(argv[1]) : 32;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+    int durationMs = argc > 3 ? atoi(argv[3]) : 300;
+
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("bench");
+    logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+    kit::ConsulResolver resolver("http://127.0.0.1:1", "zone-a", "rs");
+    resolver.SetLogger(&logger);
+    std::vector<std::shared_ptr<kit::ServiceNode>> nodes;
+    for (int i = 0; i < nodeNum; i++) {
+        auto node = std::make_shared<kit::ServiceNode>();
+        node->zone = "zone-a";
+        node->host = "zone-a-host-" + std::to_string(i);
+        node->port = 8080;
+        node->instanceID = "zone-a-i-" + std::to_string(i);
+        node->balanceFactor = 1000;
+        nodes.emplace_back(node);
+    }
+    resolver.applyServiceNodes(nodes, true);
+    resolver.updateCandidatePool();
+
+    for (int threadNum = 1; threadNum <= maxThreads; threadNum *= 2) {
+        std::atomic<bool> stopped(false);
+        std::atomic<uint64_t> selections(0);
+        std::atomic<uint64_t> misses(0);
+        uint64_t refreshes = 0;
+        std::thread updater([&]() {
+            while (not stopped.load()) {
+                resolver.updateCandidatePool();
+                refreshes++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        std::vector<std::thread> selectors;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < threadNum; i++) {
+            selectors.emplace_back([&]() {
+                uint64_t local = 0;
+                uint64_t missed = 0;
+                while (not stopped.load(std::memory_order_relaxed)) {
+                    missed += resolver.SelectedNode()==nullptr ? 1 : 0;
+                    local++;
+                }
+                selections += local;
+                misses += missed;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+        stopped.store(true);
+        for (auto& t : selectors) {
+            t.join();
+        }
+        updater.join();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        printf("threads: %d, selections/s: %llu, selections/s per thread: %llu, refreshes: %llu, misses: %llu\n",
+               threadNum, (unsigned long long)(selections / seconds),
+               (unsigned long long)(selections / seconds / threadNum), (unsigned long long)refreshes,
+               (unsigned long long)misses.load());
+    }
+    return EXIT_SUCCESS;
+}
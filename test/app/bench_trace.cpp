@@ -0,0 +1,20 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "balancer/selection_trace.h"
+
+// cost of one SelectionTrace::Record on the thread that owns the ring
+//   bench_trace [events]
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    kit::SelectionTrace trace;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        trace.Record(kit::TRACE_SELECT, 1, i & 63, i, 64);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    printf("record: %.2f ns/event\n", static_cast<double>(ns) / n);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "balancer/selection_trace.h"
+
+// print a dump of SelectionTrace, one event per line, or per pool the selections of every
+// node next to its share of the factors, where a skew shows up
+//   trace_decoder <dump> [--summary]
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <dump> [--summary]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool summary = argc > 2 && strcmp(argv[2], "--summary") == 0;
+
+    std::vector<kit::TraceRecord> records;
+    int         code;
+    std::string err;
+    std::tie(code, err) = kit::SelectionTrace::Load(argv[1], records);
+    if (code != 0) {
+        fprintf(stderr, "load failed: %s\n", err.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!summary) {
+        for (const auto& record : records) {
+            switch (record.type) {
+                case kit::TRACE_SELECT:
+                    printf("%llu thread=%u pool=%llu select node=%d weight=%g factorSum=%g\n",
+                           (unsigned long long)record.timeNs, record.thread, (unsigned long long)record.poolVersion,
+                           record.node, record.weight, record.factorSum);
+                    break;
+                case kit::TRACE_REFRESH:
+                    printf("%llu thread=%u pool=%llu refresh size=%d factorSum=%g\n", (unsigned long long)record.timeNs,
+                           record.thread, (unsigned long long)record.poolVersion, record.node, record.factorSum);
+                    break;
+                case kit::TRACE_FACTOR:
+                    printf("%llu thread=%u pool=%llu factor node=%d factor=%g\n", (unsigned long long)record.timeNs,
+                           record.thread, (unsigned long long)record.poolVersion, record.node, record.weight);
+                    break;
+                default:
+                    printf("%llu thread=%u pool=%llu unknown type=%u\n", (unsigned long long)record.timeNs,
+                           record.thread, (unsigned long long)record.poolVersion, record.type);
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    struct Pool {
+        double                  factorSum = 0;
+        std::map<int, double>   factors;
+        std::map<int, uint64_t> selected;
+        uint64_t                selectNum = 0;
+    };
+    std::map<uint64_t, Pool> pools;
+    for (const auto& record : records) {
+        auto& pool = pools[record.poolVersion];
+        if (record.type == kit::TRACE_REFRESH) {
+            pool.factorSum = record.factorSum;
+        } else if (record.type == kit::TRACE_FACTOR) {
+            pool.factors[record.node] = record.weight;
+        } else if (record.type == kit::TRACE_SELECT) {
+            pool.selected[record.node]++;
+            pool.selectNum++;
+        }
+    }
+    for (const auto& item : pools) {
+        const auto& pool = item.second;
+        printf("pool %llu: %llu selections, factorSum %g%s\n", (unsigned long long)item.first,
+               (unsigned long long)pool.selectNum, pool.factorSum,
+               pool.factors.empty() ? ", refresh not in the dump" : "");
+        std::map<int, bool> nodes;
+        for (const auto& kv : pool.factors) {
+            nodes[kv.first] = true;
+        }
+        for (const auto& kv : pool.selected) {
+            nodes[kv.first] = true;
+        }
+        for (const auto& kv : nodes) {
+            auto   factor   = pool.factors.count(kv.first) ? pool.factors.at(kv.first) : 0;
+            auto   selected = pool.selected.count(kv.first) ? pool.selected.at(kv.first) : 0;
+            double share    = pool.selectNum > 0 ? 100.0 * selected / pool.selectNum : 0;
+            double expected = pool.factorSum > 0 ? 100.0 * factor / pool.factorSum : 0;
+            printf("  node %4d  selected %8llu  %6.2f%%  factor %10g  %6.2f%%\n", kv.first,
+                   (unsigned long long)selected, share, factor, expected);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "balancer/consul_node.h"
+
+namespace kit {
+
+// n nodes of zone with the default factor, numbered from start. host and instance id
+// carry the zone, a node without one is just "i-<number>"
+inline std::vector<std::shared_ptr<ServiceNode>> mockNodes(const std::string &zone, int n, int start = 0) {
+    auto prefix = zone.empty() ? "" : zone + "-";
+    std::vector<std::shared_ptr<ServiceNode>> nodes;
+    for (int i = start; i < start + n; i++) {
+        auto node = std::make_shared<ServiceNode>();
+        node->zone = zone;
+        if (not zone.empty()) {
+            node->host = prefix + "host-" + std::to_string(i);
+            node->port = 8080;
+        }
+        node->instanceID = prefix + "i-" + std::to_string(i);
+        node->balanceFactor = 1000;
+        nodes.emplace_back(node);
+    }
+    return nodes;
+}
+
+}
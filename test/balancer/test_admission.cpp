@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include "balancer/admission.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// seeded, the same draws on every run
+static std::function<double()> seeded(uint64_t seed) {
+    return [seed]() mutable {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return static_cast<double>(seed >> 11) / static_cast<double>(1ULL << 53);
+    };
+}
+
+TEST(testAdmission, caseHealthy) {
+    AdmissionController admission;
+    uint64_t now = 1000000;
+    for (int i = 0; i < 1000; i++) {
+        GTEST_ASSERT_EQ(true, admission.Admit(0, now + i));
+        admission.ReportResult(true, now + i);
+    }
+    ASSERT_DOUBLE_EQ(0, admission.RejectProbability(0, now + 1000));
+}
+
+TEST(testAdmission, caseClientSide) {
+    AdmissionOption option;
+    option.k = 2;
+    option.windowS = 10;
+    option.maxRejectRatio = 1;
+    AdmissionController admission(option);
+    admission.SetRandom(seeded(42));
+    uint64_t now = 1000000;
+
+    // half of the requests served, k = 2 tolerates it
+    for (int i = 0; i < 100; i++) {
+        admission.Admit(0, now);
+        admission.ReportResult(i % 2 == 0, now);
+    }
+    ASSERT_DOUBLE_EQ(0, admission.RejectProbability(0, now));
+
+    // the backend stops serving: 300 requests, 50 accepts, (300 - 100) / 301
+    int admitted = 0;
+    for (int i = 0; i < 200; i++) {
+        admitted += admission.Admit(0, now + 1000) ? 1 : 0;
+    }
+    ASSERT_DOUBLE_EQ(200.0 / 301, admission.RejectProbability(0, now + 1000));
+    GTEST_ASSERT_LT(admitted, 200);
+
+    // out of the window, nothing left of the history
+    ASSERT_DOUBLE_EQ(0, admission.RejectProbability(0, now + 20000));
+}
+
+TEST(testAdmission, caseOverload) {
+    AdmissionOption option;
+    option.maxRejectRatio = 0.9;
+    AdmissionController admission(option);
+    admission.SetRandom(seeded(42));
+    uint64_t now = 1000000;
+
+    ASSERT_DOUBLE_EQ(0.5, admission.RejectProbability(0.5, now));
+    ASSERT_DOUBLE_EQ(0.9, admission.RejectProbability(1, now));
+
+    // shed for the overload, not held against the backend: the client term stays at 0
+    // and admission at half, second after second
+    int admitted = 0;
+    for (int second = 0; second < 5; second++) {
+        for (int i = 0; i < 2000; i++) {
+            if (admission.Admit(0.5, now + second * 1000)) {
+                admitted++;
+                admission.ReportResult(true, now + second * 1000);
+            }
+        }
+        ASSERT_DOUBLE_EQ(0.5, admission.RejectProbability(0.5, now + second * 1000));
+    }
+    GTEST_ASSERT_GT(admitted, 4700);
+    GTEST_ASSERT_LT(admitted, 5300);
+}
+
+}
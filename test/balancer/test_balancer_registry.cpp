@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <log4cplus/configurator.h>
+#include <log4cplus/loggingmacros.h>
+
+#include "balancer/balancer_registry.h"
+#include "util/constant.h"
+
+int main(int argc, char *argv[]) {
+    log4cplus::initialize();
+    log4cplus::BasicConfigurator config;
+    config.configure();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testBalancerRegistry, caseRegister) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BalancerRegistry registry("http://127.0.0.1:1", "ap-southeast-1a");
+    registry.SetLogger(&logger);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = registry.Register("rs");
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, err) = registry.Register("as", "clb/as/cpu_threshold.json", "clb/rs/zone_cpu.json",
+                                            "clb/as/instance_factor.json", "clb/rs/onlinelab_factor.json");
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, err) = registry.Register("rs");
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_INVALID_ARGUMENT, code);
+
+    GTEST_ASSERT_NE(nullptr, registry.getResolver("as"));
+    GTEST_ASSERT_EQ("clb/as/cpu_threshold.json", registry.getResolver("as")->getKey(DATA_CPU_THRESHOLD));
+    GTEST_ASSERT_EQ("clb/rs/cpu_threshold.json", registry.getResolver("rs")->getKey(DATA_CPU_THRESHOLD));
+    GTEST_ASSERT_EQ(nullptr, registry.getResolver("unknown"));
+    GTEST_ASSERT_EQ("ap-southeast-1a", registry.getResolver("rs")->getLocalZone());
+}
+
+TEST(testBalancerRegistry, caseConsulDown) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BalancerRegistry registry("http://127.0.0.1:1", "ap-southeast-1a");
+    registry.SetLogger(&logger);
+    registry.Register("rs");
+    registry.Register("as");
+
+    int code;
+    std::string err;
+    std::tie(code, err) = registry.updateAll();
+    GTEST_ASSERT_NE(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(nullptr, registry.SelectedNode("rs"));
+    GTEST_ASSERT_EQ(nullptr, registry.SelectedNode("unknown"));
+    GTEST_ASSERT_EQ(0, registry.getLastUpdated("rs"));
+    GTEST_ASSERT_EQ(1, registry.getResolver("rs")->getFreshness(DATA_ZONE_CPU).failures);
+}
+
+TEST(testBalancerRegistry, caseNoLogger) {
+    // the logger is optional, the resolvers are handed a null one
+    BalancerRegistry registry("http://127.0.0.1:1", "ap-southeast-1a");
+    registry.Register("rs");
+
+    int code;
+    std::string err;
+    std::tie(code, err) = registry.updateAll();
+    GTEST_ASSERT_NE(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(nullptr, registry.SelectedNode("rs"));
+    GTEST_ASSERT_EQ(nullptr, registry.getResolver("rs")->SelectedNode());
+}
+
+}
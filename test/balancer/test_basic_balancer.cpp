@@ -0,0 +1,343 @@
+#include <gtest/gtest.h>
+#include <log4cplus/configurator.h>
+#include <log4cplus/loggingmacros.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <type_traits>
+
+#include "balancer/balancer.h"
+#include "mock_nodes.h"
+#include "util/constant.h"
+#include "util/util.h"
+
+int main(int argc, char *argv[]) {
+    log4cplus::initialize();
+    log4cplus::BasicConfigurator config;
+    config.configure();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// a fixed pool instead of consul
+class StaticDiscovery {
+    std::shared_ptr<CandidatePool> candidatePool;
+    std::string                    zone;
+
+   public:
+    int updateNum = 0;
+
+    StaticDiscovery(const std::string &zone, const std::vector<std::pair<std::string, double>> &nodes)
+        : candidatePool(std::make_shared<CandidatePool>()), zone(zone) {
+        this->candidatePool->factorSum = 0;
+        for (const auto &item : nodes) {
+            auto node = std::make_shared<ServiceNode>();
+            node->instanceID = item.first;
+            node->zone = item.first.substr(0, item.first.find('/'));
+            this->candidatePool->nodes.emplace_back(node);
+            this->candidatePool->factors.emplace_back(item.second);
+            this->candidatePool->factorSum += item.second;
+        }
+        this->candidatePool->weights.assign(nodes.size(), 0);
+    }
+
+    std::tuple<int, std::string> updateAll() {
+        this->updateNum++;
+        return std::make_tuple(STATUSCODE::SUCCESS, "");
+    }
+    bool Converging() const {
+        return false;
+    }
+    std::shared_ptr<CandidatePool> getCandidatePool() {
+        return this->candidatePool;
+    }
+    void SetCandidatePool(const std::shared_ptr<CandidatePool> &candidatePool) {
+        this->candidatePool = candidatePool;
+    }
+    const std::string &getLocalZone() const {
+        return this->zone;
+    }
+    json11::Json to_json() const {
+        return json11::Json::object{{"zone", this->zone}};
+    }
+    void SetLogger(log4cplus::Logger *) {}
+};
+
+struct FirstSelection {
+    int Select(CandidatePool &pool) {
+        return pool.nodes.empty() ? -1 : 0;
+    }
+};
+
+struct CountingMetrics {
+    int selectNum = 0;
+    int crossZoneNum = 0;
+    int updateNum = 0;
+
+    void OnSelected(StaticDiscovery &source, const ServiceNode &node) {
+        this->selectNum++;
+        if (node.zone!=source.getLocalZone()) {
+            this->crossZoneNum++;
+        }
+    }
+    void OnUpdated(StaticDiscovery &, int code) {
+        if (code==STATUSCODE::SUCCESS) {
+            this->updateNum++;
+        }
+    }
+};
+
+TEST(testBasicBalancer, caseDefault) {
+    GTEST_ASSERT_EQ(true, (std::is_same<Balancer, BasicBalancer<SmoothWeightedSelection, ConsulResolver, ResolverMetrics>>::value));
+    GTEST_ASSERT_EQ(true, std::is_empty<NullMetrics>::value);
+}
+
+TEST(testBasicBalancer, caseSmoothWeighted) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, CountingMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}, {"zone-a/1", 2}, {"zone-b/2", 3}});
+    balancer.SetLogger(&logger);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = balancer.Start();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(1, balancer.getDiscovery().updateNum);
+    GTEST_ASSERT_EQ(1, balancer.getMetrics().updateNum);
+
+    // every round of factorSum selections follows the factors exactly
+    std::map<std::string, int> selected;
+    for (int i = 0; i < 60; i++) {
+        selected[balancer.SelectedNode()->instanceID]++;
+    }
+    GTEST_ASSERT_EQ(10, selected["zone-a/0"]);
+    GTEST_ASSERT_EQ(20, selected["zone-a/1"]);
+    GTEST_ASSERT_EQ(30, selected["zone-b/2"]);
+    GTEST_ASSERT_EQ(60, balancer.getMetrics().selectNum);
+    GTEST_ASSERT_EQ(30, balancer.getMetrics().crossZoneNum);
+    balancer.Stop();
+}
+
+TEST(testBasicBalancer, caseCustomPolicy) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<FirstSelection, StaticDiscovery, NullMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}, {"zone-a/1", 2}});
+    balancer.SetLogger(&logger);
+
+    GTEST_ASSERT_EQ("zone-a", balancer.getLocalZone());
+    for (int i = 0; i < 3; i++) {
+        GTEST_ASSERT_EQ("zone-a/0", balancer.SelectedNode()->instanceID);
+    }
+
+    balancer.getDiscovery().SetCandidatePool(std::make_shared<CandidatePool>());
+    GTEST_ASSERT_EQ(nullptr, balancer.SelectedNode());
+}
+
+TEST(testBasicBalancer, caseNumaReplicas) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    char tmpl[] = "/tmp/ckit-numa-XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    mkdir((root + "/node0").c_str(), 0755);
+    mkdir((root + "/node1").c_str(), 0755);
+    std::ofstream(root + "/node0/cpulist") << "0\n";
+    std::ofstream(root + "/node1/cpulist") << "1-1023\n";
+
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, CountingMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}, {"zone-a/1", 2}, {"zone-b/2", 3}});
+    balancer.SetLogger(&logger);
+    {
+        // kept by the balancer, the caller's copy may go
+        NumaTopology scoped(root);
+        balancer.SetNumaReplicas(true, scoped);
+    }
+    NumaTopology topology(root);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = balancer.Start();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+
+    // a replica is selected from, not the pool of the discovery source.
+    // pinned to one node, a migrating thread would split the rounds across two replicas
+    auto source = balancer.getDiscovery().getCandidatePool();
+    std::map<std::string, int> selected;
+    topology.RunOnNode(1, [&]() {
+        for (int i = 0; i < 60; i++) {
+            auto node = balancer.SelectedNode();
+            GTEST_ASSERT_EQ(true, std::find(source->nodes.begin(), source->nodes.end(), node)==source->nodes.end());
+            selected[node->instanceID]++;
+        }
+    });
+    GTEST_ASSERT_EQ(10, selected["zone-a/0"]);
+    GTEST_ASSERT_EQ(20, selected["zone-a/1"]);
+    GTEST_ASSERT_EQ(30, selected["zone-b/2"]);
+    for (auto weight : source->weights) {
+        ASSERT_DOUBLE_EQ(0, weight);
+    }
+    balancer.Stop();
+}
+
+TEST(testBasicBalancer, caseAdmission) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, NullMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}});
+    balancer.SetLogger(&logger);
+    AdmissionOption option;
+    option.maxRejectRatio = 1;
+    balancer.SetAdmission(option);
+
+    int code;
+    std::shared_ptr<ServiceNode> node;
+    std::tie(code, node, std::ignore) = balancer.AdmittedNode();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    balancer.ReportResult(true);
+
+    // the whole fleet saturated, everything is shed, SelectedNode still answers
+    balancer.getDiscovery().getCandidatePool()->overload = 1;
+    std::tie(code, node, std::ignore) = balancer.AdmittedNode();
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_OVERLOAD, code);
+    GTEST_ASSERT_EQ(nullptr, node);
+    GTEST_ASSERT_NE(nullptr, balancer.SelectedNode());
+}
+
+TEST(testBasicBalancer, caseHedging) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, CountingMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 5}, {"zone-a/1", 1}});
+    balancer.SetLogger(&logger);
+    for (int i = 0; i < 2; i++) {
+        auto node = balancer.getDiscovery().getCandidatePool()->nodes[i];
+        node->host = "host-" + std::to_string(i);
+        node->port = 8080;
+    }
+    HedgeOption option;
+    option.budgetCapacity = 3;
+    option.budgetRatio = 0;
+    option.budgetPerSecond = 0;
+    option.maxBackupTries = 6;
+    balancer.SetHedging(option);
+
+    int code;
+    HedgePlan plan;
+    std::tie(code, plan, std::ignore) = balancer.SelectedHedge();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(0, plan.delayUs);
+
+    // the heavy node comes back most of the time, the backup is still the other one
+    auto primary = balancer.getDiscovery().getCandidatePool()->nodes[0];
+    std::shared_ptr<ServiceNode> backup;
+    for (int i = 0; i < 3; i++) {
+        std::tie(code, backup, std::ignore) = balancer.SelectedBackup(primary);
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+        GTEST_ASSERT_EQ("zone-a/1", backup->instanceID);
+    }
+    // the primary picked and skipped is not counted again
+    GTEST_ASSERT_EQ(4, balancer.getMetrics().selectNum);
+    std::tie(code, backup, std::ignore) = balancer.SelectedBackup(primary);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_OVERLOAD, code);
+}
+
+TEST(testBasicBalancer, caseHedgingNoBackup) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, CountingMetrics> balancer(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}});
+    balancer.SetLogger(&logger);
+    HedgeOption option;
+    option.budgetCapacity = 1;
+    option.budgetRatio = 0;
+    option.budgetPerSecond = 0;
+    balancer.SetHedging(option);
+
+    // a single node has no backup, the token is given back every time
+    int code;
+    std::shared_ptr<ServiceNode> backup;
+    auto primary = balancer.getDiscovery().getCandidatePool()->nodes[0];
+    for (int i = 0; i < 3; i++) {
+        std::tie(code, backup, std::ignore) = balancer.SelectedBackup(primary);
+        GTEST_ASSERT_EQ(STATUSCODE::UNKNOWN, code);
+        GTEST_ASSERT_EQ(nullptr, backup);
+    }
+    GTEST_ASSERT_EQ(0, balancer.getMetrics().selectNum);
+    std::tie(code, backup, std::ignore) = balancer.SelectedBackup(nullptr);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(1, balancer.getMetrics().selectNum);
+    std::tie(code, backup, std::ignore) = balancer.SelectedBackup(nullptr);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_OVERLOAD, code);
+}
+
+TEST(testBasicBalancer, caseZoneRouting) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, NullMetrics> balancer(
+        60, "zone-a",
+        std::vector<std::pair<std::string, double>>{{"zone-a/0", 1}, {"zone-a/1", 1}, {"zone-b/2", 1}, {"zone-b/3", 1}});
+    balancer.SetLogger(&logger);
+    ZoneRouterOption option;
+    option.crossZoneShare = 0.5;
+    balancer.SetZoneRouting(option);
+    balancer.ReportRTT(*(balancer.getDiscovery().getCandidatePool()->nodes[2]), 5000);
+
+    int code;
+    std::shared_ptr<ServiceNode> node;
+    // tight deadlines never leave the local zone
+    for (int i = 0; i < 40; i++) {
+        std::tie(code, node, std::ignore) = balancer.RoutedNode(1000);
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+        GTEST_ASSERT_EQ("zone-a", node->zone);
+    }
+    // requests with slack make up for them, within the share
+    int cross = 0;
+    for (int i = 0; i < 40; i++) {
+        std::tie(code, node, std::ignore) = balancer.RoutedNode(10000);
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+        cross += node->zone=="zone-b" ? 1 : 0;
+    }
+    GTEST_ASSERT_GT(cross, 30);
+    GTEST_ASSERT_LE(cross, 40);
+
+    // no local node to fall back on, a tight request is not sent over the budget
+    BasicBalancer<SmoothWeightedSelection, StaticDiscovery, NullMetrics> remote(
+        60, "zone-a", std::vector<std::pair<std::string, double>>{{"zone-b/0", 1}});
+    remote.SetZoneRouting(option);
+    remote.ReportRTT(*(remote.getDiscovery().getCandidatePool()->nodes[0]), 5000);
+    std::tie(code, node, std::ignore) = remote.RoutedNode(1000);
+    GTEST_ASSERT_EQ(STATUSCODE::UNKNOWN, code);
+    GTEST_ASSERT_EQ(nullptr, node);
+    std::tie(code, node, std::ignore) = remote.RoutedNode(10000);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+}
+
+TEST(testBasicBalancer, caseRenderMetrics) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    Balancer balancer("http://127.0.0.1:1", "zone-a", "rs");
+    balancer.SetLogger(&logger);
+    balancer.SetHedging(HedgeOption());
+    balancer.getDiscovery().applyServiceNodes(mockNodes("zone-a", 2), true);
+    balancer.getDiscovery().updateCandidatePool();
+    for (int i = 0; i < 4; i++) {
+        balancer.SelectedNode();
+    }
+
+    std::string out;
+    balancer.RenderMetrics(out);
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_selections_total{service=\"rs\"} 4\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_retry_budget_tokens{service=\"rs\"} 100\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_pool_overload{service=\"rs\"} 0\n"));
+    GTEST_ASSERT_EQ(std::string::npos, out.find("clb_admission_reject_probability"));
+
+    int code;
+    std::string err;
+    std::string body;
+    std::tie(code, err) = balancer.ServeMetrics(0, "127.0.0.1");
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, body, err) = HttpGet("http://127.0.0.1:" + std::to_string(balancer.getMetricsPort()) + "/metrics");
+    GTEST_ASSERT_EQ(200, code);
+    GTEST_ASSERT_EQ(out, body);
+    balancer.Stop();
+    GTEST_ASSERT_EQ(0, balancer.getMetricsPort());
+}
+
+}
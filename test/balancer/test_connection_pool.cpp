@@ -0,0 +1,152 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "balancer/connection_pool.h"
+#include "util/constant.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// listening socket on an ephemeral loopback port, the kernel completes the handshakes
+class Listener {
+    int fd;
+    int port;
+
+   public:
+    Listener() {
+        this->fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(this->fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        listen(this->fd, 64);
+        socklen_t len = sizeof(addr);
+        getsockname(this->fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        this->port = ntohs(addr.sin_port);
+    }
+    ~Listener() {
+        close(this->fd);
+    }
+    int getPort() const {
+        return this->port;
+    }
+};
+
+static std::shared_ptr<ServiceNode> mockNode(int port) {
+    auto node = std::make_shared<ServiceNode>();
+    node->host = "127.0.0.1";
+    node->port = port;
+    node->instanceID = "i-" + std::to_string(port);
+    return node;
+}
+
+TEST(testConnectionPool, caseLease) {
+    Listener listener;
+    auto node = mockNode(listener.getPort());
+    CandidatePool pool;
+    pool.nodes.emplace_back(node);
+
+    ConnectionPoolOption option;
+    option.prewarm = 2;
+    option.maxIdlePerNode = 2;
+    ConnectionPool connectionPool(option);
+    connectionPool.Refresh(pool);
+    GTEST_ASSERT_EQ(2, connectionPool.IdleNum(node->Address()));
+
+    int code;
+    std::unique_ptr<Connection> conn;
+    std::string err;
+    std::tie(code, conn, err) = connectionPool.Acquire(node);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_GE(conn->getFD(), 0);
+    GTEST_ASSERT_EQ(node, conn->getNode());
+    GTEST_ASSERT_EQ(1, connectionPool.IdleNum(node->Address()));
+
+    // released connections are reused, broken ones closed
+    int fd = conn->getFD();
+    conn.reset();
+    GTEST_ASSERT_EQ(2, connectionPool.IdleNum(node->Address()));
+    std::tie(code, conn, err) = connectionPool.Acquire(node);
+    GTEST_ASSERT_EQ(fd, conn->getFD());
+    conn->MarkBroken();
+    conn.reset();
+    GTEST_ASSERT_EQ(1, connectionPool.IdleNum(node->Address()));
+
+    // node removed, its connections are torn down, leases close on release
+    std::tie(code, conn, err) = connectionPool.Acquire(node);
+    connectionPool.Refresh(CandidatePool());
+    GTEST_ASSERT_EQ(-1, connectionPool.IdleNum(node->Address()));
+    conn.reset();
+}
+
+TEST(testConnectionPool, casePrewarm) {
+    // joining nodes are connected together, the unreachable one costs no other node its
+    // connections
+    Listener listeners[3];
+    int port;
+    {
+        Listener closed;
+        port = closed.getPort();
+    }
+    CandidatePool pool;
+    for (auto &listener : listeners) {
+        pool.nodes.emplace_back(mockNode(listener.getPort()));
+    }
+    pool.nodes.emplace_back(mockNode(port));
+
+    ConnectionPoolOption option;
+    option.prewarm = 2;
+    option.maxIdlePerNode = 4;
+    ConnectionPool connectionPool(option);
+    connectionPool.Refresh(pool);
+    for (int i = 0; i < 3; i++) {
+        GTEST_ASSERT_EQ(2, connectionPool.IdleNum(pool.nodes[i]->Address()));
+    }
+    GTEST_ASSERT_EQ(0, connectionPool.IdleNum(pool.nodes[3]->Address()));
+}
+
+TEST(testConnectionPool, caseUnreachable) {
+    int port;
+    {
+        Listener listener;
+        port = listener.getPort();
+    }
+    auto node = mockNode(port);
+    CandidatePool pool;
+    pool.nodes.emplace_back(node);
+    ConnectionPool connectionPool;
+    connectionPool.Refresh(pool);
+    GTEST_ASSERT_EQ(0, connectionPool.IdleNum(node->Address()));
+
+    int code;
+    std::unique_ptr<Connection> conn;
+    std::string err;
+    std::tie(code, conn, err) = connectionPool.Acquire(node);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_CONNECT, code);
+    GTEST_ASSERT_EQ(nullptr, conn);
+    GTEST_ASSERT_NE("", err);
+}
+
+TEST(testConnectionPool, caseIdleTimeout) {
+    Listener listener;
+    auto node = mockNode(listener.getPort());
+    CandidatePool pool;
+    pool.nodes.emplace_back(node);
+    ConnectionPoolOption option;
+    option.idleTimeoutMs = 10;
+    ConnectionPool connectionPool(option);
+    connectionPool.Refresh(pool);
+    GTEST_ASSERT_EQ(1, connectionPool.IdleNum(node->Address()));
+    usleep(30*1000);
+    connectionPool.Refresh(pool);
+    GTEST_ASSERT_EQ(0, connectionPool.IdleNum(node->Address()));
+}
+
+}
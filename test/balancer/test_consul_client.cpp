@@ -40,6 +40,15 @@ TEST(testConsulClient, caseGetKV) {
 
 }
 
+TEST(testConsulClient, caseServiceFilter) {
+    ServiceFilter filter;
+    GTEST_ASSERT_EQ("", filter.Query());
+
+    filter.expression = "Service.Meta.zone == \"zone-a\"";
+    filter.nodeMeta["rack"] = "r1";
+    GTEST_ASSERT_EQ("&filter=Service.Meta.zone%20%3D%3D%20%22zone-a%22&node-meta=rack%3Ar1", filter.Query());
+}
+
 TEST(testConsulClient, caseGetService) {
     log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
 
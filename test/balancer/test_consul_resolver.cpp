@@ -7,6 +7,8 @@
 #include <unordered_map>
 
 #include "balancer/consul_resolver.h"
+#include "mock_nodes.h"
+#include "util/constant.h"
 
 int main(int argc, char *argv[]) {
     log4cplus::initialize();
@@ -170,3 +172,419 @@ TEST(testResolver, caseConcurrency) {
 //    resolver->Stop();
 }
 }
+
+namespace kit {
+
+TEST(testResolver, caseFreshness) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+
+    // never fetched, expired right away and fall back to defaults
+    uint64_t now = 100000;
+    resolver->expireStaleData(now);
+    GTEST_ASSERT_EQ(true, resolver->getFreshness(DATA_ZONE_CPU).expired);
+
+    std::string err;
+    auto zoneCPU = json11::Json::parse(R"({"updated": 99990, "data": [{"zone-a": 60}, {"zone-b": 40}]})", err);
+    int code;
+    std::tie(code, err) = resolver->applyZoneCPUMap(zoneCPU);
+    GTEST_ASSERT_EQ(0, code);
+    resolver->markFetched(DATA_ZONE_CPU, code, err, now);
+    auto freshness = resolver->getFreshness(DATA_ZONE_CPU);
+    GTEST_ASSERT_EQ(99990, freshness.dataUpdated);
+    GTEST_ASSERT_EQ(10, freshness.Age(now));
+
+    // a failing source keeps its previous data and counts failures
+    resolver->markFetched(DATA_INSTANCE_FACTOR, STATUSCODE::ERROR_CONSUL_VALUE, "broken", now);
+    resolver->markFetched(DATA_INSTANCE_FACTOR, STATUSCODE::ERROR_CONSUL_VALUE, "broken", now);
+    GTEST_ASSERT_EQ(2, resolver->getFreshness(DATA_INSTANCE_FACTOR).failures);
+    GTEST_ASSERT_EQ("broken", resolver->getFreshness(DATA_INSTANCE_FACTOR).lastError);
+
+    resolver->expireStaleData(now);
+    GTEST_ASSERT_EQ(false, resolver->getFreshness(DATA_ZONE_CPU).expired);
+    GTEST_ASSERT_EQ(true, resolver->getFreshness(DATA_INSTANCE_FACTOR).expired);
+
+    // topology still builds from the nodes with the remaining data
+    auto nodes = mockNodes("zone-a", 3);
+    auto crossNodes = mockNodes("zone-b", 2);
+    nodes.insert(nodes.end(), crossNodes.begin(), crossNodes.end());
+    std::tie(code, err) = resolver->applyServiceNodes(nodes, true);
+    GTEST_ASSERT_EQ(0, code);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    GTEST_ASSERT_EQ(5, resolver->getCandidatePool()->nodes.size());
+
+    // zone cpu ages out once the producer stops updating
+    StalenessPolicy policy;
+    policy.maxStalenessS[DATA_ZONE_CPU] = 60;
+    resolver->SetStalenessPolicy(policy);
+    resolver->expireStaleData(now + 100);
+    GTEST_ASSERT_EQ(true, resolver->getFreshness(DATA_ZONE_CPU).expired);
+    GTEST_ASSERT_EQ("0", resolver->getIndex(DATA_ZONE_CPU));
+}
+
+
+TEST(testResolver, caseInstanceLoad) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+    resolver->SetInstanceLoadPrefix("clb/load/rs");
+    GTEST_ASSERT_EQ("clb/load/rs", resolver->getKey(DATA_INSTANCE_LOAD));
+
+    auto now = static_cast<uint64_t>(time(nullptr));
+    InstanceLoad fresh;
+    fresh.cpu = 80;
+    fresh.updated = now;
+    InstanceLoad old = fresh;
+    old.cpu = 10;
+    // past the 30s max age of a report, whatever the staleness policy of the source
+    old.updated = now - 45;
+    StalenessPolicy policy;
+    policy.maxStalenessS[DATA_INSTANCE_LOAD] = 0;
+    resolver->SetStalenessPolicy(policy);
+    json11::Json::object loads{
+        {"zone-a-i-0", fresh.Encode()},
+        {"zone-a-i-1", fresh.Encode()},
+        {"zone-a-i-2", old.Encode()},
+        {"zone-b-i-0", "garbage"},
+    };
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyInstanceLoadMap(loads);
+    GTEST_ASSERT_EQ(0, code);
+    GTEST_ASSERT_EQ(now, resolver->getFreshness(DATA_INSTANCE_LOAD).dataUpdated);
+
+    auto nodes = mockNodes("zone-a", 3);
+    auto crossNodes = mockNodes("zone-b", 2);
+    nodes.insert(nodes.end(), crossNodes.begin(), crossNodes.end());
+    std::tie(code, err) = resolver->applyServiceNodes(nodes, true);
+    GTEST_ASSERT_EQ(0, code);
+
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+
+    // fresh reports win, stale and broken ones fall back to the default workload
+    std::unordered_map<std::string, double> workloads;
+    for (const auto &node : resolver->getCandidatePool()->nodes) {
+        workloads[node->instanceID] = node->workload;
+    }
+    ASSERT_DOUBLE_EQ(80, workloads["zone-a-i-0"]);
+    ASSERT_DOUBLE_EQ(80, workloads["zone-a-i-1"]);
+    ASSERT_DOUBLE_EQ(70, workloads["zone-a-i-2"]);
+}
+
+
+TEST(testResolver, caseSubset) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+    SubsetOption option;
+    option.clientID = "client-1";
+    option.subsetSize = 4;
+    resolver->SetSubsetOption(option);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 20), true);
+    GTEST_ASSERT_EQ(0, code);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+
+    // the subset carries the weight of the whole zone
+    auto pool = resolver->getCandidatePool();
+    GTEST_ASSERT_EQ(4, pool->nodes.size());
+    ASSERT_DOUBLE_EQ(20*pool->nodes[0]->currentFactor, pool->factorSum);
+}
+
+
+TEST(testResolver, caseSlowStart) {
+    SlowStartOption option;
+    option.windowS = 100;
+    ASSERT_DOUBLE_EQ(0.1, option.Ratio(0));
+    ASSERT_DOUBLE_EQ(0.5, option.Ratio(50000));
+    ASSERT_DOUBLE_EQ(1, option.Ratio(100000));
+    option.aggression = 2;
+    ASSERT_DOUBLE_EQ(0.5, option.Ratio(25000));
+
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+    option.aggression = 1;
+    resolver->SetSlowStartOption(option);
+
+    // the first nodes are warm, a node joining later ramps from 10%
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 4), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, resolver->getCandidatePool()->rampNewestMs);
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 5), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    GTEST_ASSERT_NE(0, resolver->getCandidatePool()->rampNewestMs);
+
+    std::unordered_map<std::string, int> selected;
+    for (int i = 0; i < 4100; i++) {
+        selected[resolver->SelectedNode()->instanceID]++;
+    }
+    GTEST_ASSERT_LE(selected["zone-a-i-4"], 110);
+    GTEST_ASSERT_GE(selected["zone-a-i-0"], 990);
+}
+
+
+TEST(testResolver, caseInstanceFactorBinary) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+
+    int code;
+    std::string err;
+    auto binary = factor_table::Encode({{"zone-a-i-0", 30}, {"zone-a-i-1", 60}}, 0);
+    std::tie(code, err) = resolver->applyInstanceFactorMap(json11::Json(binary));
+    GTEST_ASSERT_EQ(0, code);
+    double factor = 0;
+    GTEST_ASSERT_EQ(true, resolver->instanceFactor("zone-a-i-1", factor));
+    ASSERT_DOUBLE_EQ(60, factor);
+    GTEST_ASSERT_EQ(false, resolver->instanceFactor("zone-a-i-2", factor));
+
+    // a broken table keeps the previous one
+    std::tie(code, err) = resolver->applyInstanceFactorMap(json11::Json(binary.substr(0, 30)));
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_CONSUL_VALUE, code);
+    GTEST_ASSERT_EQ(true, resolver->instanceFactor("zone-a-i-0", factor));
+
+    // back to json
+    auto kv = json11::Json::parse(R"({"data": [{"instanceid": "zone-a-i-2", "CPUUtilization": 45}]})", err);
+    std::tie(code, err) = resolver->applyInstanceFactorMap(kv);
+    GTEST_ASSERT_EQ(0, code);
+    GTEST_ASSERT_EQ(true, resolver->instanceFactor("zone-a-i-2", factor));
+    ASSERT_DOUBLE_EQ(45, factor);
+    GTEST_ASSERT_EQ(false, resolver->instanceFactor("zone-a-i-0", factor));
+}
+
+TEST(testResolver, caseServiceFilter) {
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+
+    std::string index = "42";
+    std::string query;
+    // no filter, nothing to reset
+    auto filter = resolver->prepareHealthFilter(index, query);
+    GTEST_ASSERT_EQ("", filter.expression);
+    GTEST_ASSERT_EQ("42", index);
+
+    ServiceFilter custom;
+    custom.expression = "Service.Tags contains \"v2\"";
+    resolver->SetServiceFilter(custom, true);
+    // cross zone is on by default, the zone is not folded in
+    filter = resolver->prepareHealthFilter(index, query);
+    GTEST_ASSERT_EQ(custom.expression, filter.expression);
+    GTEST_ASSERT_EQ("0", index);
+
+    index = "43";
+    filter = resolver->prepareHealthFilter(index, query);
+    GTEST_ASSERT_EQ("43", index);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyOnlinelabFactor(json11::Json::object{{"crossZone", false}});
+    GTEST_ASSERT_EQ(0, code);
+    filter = resolver->prepareHealthFilter(index, query);
+    GTEST_ASSERT_EQ("(Service.Tags contains \"v2\") and Service.Meta.zone == \"zone-a\"", filter.expression);
+    GTEST_ASSERT_EQ("0", index);
+}
+
+TEST(testResolver, caseOverload) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyCPUThreshold(json11::Json::object{{"cpuThreshold", 50}});
+    GTEST_ASSERT_EQ(0, code);
+    auto zoneCPU = json11::Json::parse(R"({"updated": 1, "data": [{"zone-a": 90}, {"zone-b": 80}]})", err);
+    std::tie(code, err) = resolver->applyZoneCPUMap(zoneCPU);
+    GTEST_ASSERT_EQ(0, code);
+
+    auto nodes = mockNodes("zone-a", 3);
+    auto crossNodes = mockNodes("zone-b", 2);
+    nodes.insert(nodes.end(), crossNodes.begin(), crossNodes.end());
+    std::tie(code, err) = resolver->applyServiceNodes(nodes, true);
+    GTEST_ASSERT_EQ(0, code);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    // the least loaded zone is 30 points into the 50 left above the threshold
+    ASSERT_DOUBLE_EQ(0.6, resolver->getCandidatePool()->overload);
+
+    // one zone with headroom is enough
+    zoneCPU = json11::Json::parse(R"({"updated": 2, "data": [{"zone-a": 90}, {"zone-b": 40}]})", err);
+    std::tie(code, err) = resolver->applyZoneCPUMap(zoneCPU);
+    resolver->buildServiceZone();
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    ASSERT_DOUBLE_EQ(0, resolver->getCandidatePool()->overload);
+}
+
+TEST(testResolver, caseTransition) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 2), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    // nothing to move from
+    GTEST_ASSERT_EQ(0, resolver->getCandidatePool()->previousFactors.size());
+    auto factor = resolver->getCandidatePool()->factors[0];
+
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 3), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    GTEST_ASSERT_EQ(0, code);
+    auto candidatePool = resolver->getCandidatePool();
+    GTEST_ASSERT_EQ(3, candidatePool->previousFactors.size());
+    GTEST_ASSERT_NE(0, candidatePool->transitionStartMs);
+    for (size_t i = 0; i < candidatePool->nodes.size(); i++) {
+        if (candidatePool->nodes[i]->instanceID=="zone-a-i-2") {
+            ASSERT_DOUBLE_EQ(0, candidatePool->previousFactors[i]);
+        } else {
+            ASSERT_DOUBLE_EQ(factor, candidatePool->previousFactors[i]);
+        }
+    }
+
+    // right after the refresh the joining node gets almost nothing
+    TransitionOption option;
+    option.windowS = 1000;
+    resolver->SetTransitionOption(option);
+    for (int i = 0; i < 100; i++) {
+        GTEST_ASSERT_NE("zone-a-i-2", resolver->SelectedNode()->instanceID);
+    }
+    // half way it has half its factor
+    candidatePool->transitionStartMs = SlowStartNowMs() - 500*1000;
+    std::unordered_map<std::string, int> selected;
+    for (int i = 0; i < 1000; i++) {
+        selected[resolver->SelectedNode()->instanceID]++;
+    }
+    GTEST_ASSERT_GT(selected["zone-a-i-2"], 180);
+    GTEST_ASSERT_LT(selected["zone-a-i-2"], 220);
+}
+
+TEST(testResolver, caseRefreshThreads) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto serial = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    auto parallel = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    parallel->SetRefreshThreads(3);
+    std::string err;
+    auto zoneCPU = json11::Json::parse(R"({"updated": 1, "data": [{"zone-a": 70}, {"zone-b": 40}, {"zone-c": 50}]})", err);
+    for (auto &resolver : {serial, parallel}) {
+        resolver->SetLogger(&logger);
+        resolver->applyZoneCPUMap(zoneCPU);
+    }
+
+    // enough nodes to be split, the zones interleaved, some leave and join in between
+    auto health = [](int start) {
+        std::vector<std::shared_ptr<ServiceNode>> nodes;
+        auto a = mockNodes("zone-a", 6000, start);
+        auto b = mockNodes("zone-b", 3000);
+        auto c = mockNodes("zone-c", 3000, start);
+        for (size_t i = 0; i < a.size(); i++) {
+            nodes.emplace_back(a[i]);
+            if (i < b.size()) {
+                nodes.emplace_back(b[i]);
+                nodes.emplace_back(c[i]);
+            }
+        }
+        return nodes;
+    };
+    for (int start : {0, 200, 200, 500}) {
+        auto nodes = health(start);
+        for (auto &resolver : {serial, parallel}) {
+            int code;
+            std::tie(code, err) = resolver->applyServiceNodes(nodes, true);
+            GTEST_ASSERT_EQ(0, code);
+            std::tie(code, err) = resolver->updateCandidatePool();
+            GTEST_ASSERT_EQ(0, code);
+        }
+
+        // the same pool whatever the threads
+        auto expected = serial->getCandidatePool();
+        auto pool = parallel->getCandidatePool();
+        GTEST_ASSERT_EQ(12000, expected->nodes.size());
+        GTEST_ASSERT_EQ(expected->nodes.size(), pool->nodes.size());
+        GTEST_ASSERT_EQ(expected->factorSum, pool->factorSum);
+        GTEST_ASSERT_EQ(expected->previousFactors.size(), pool->previousFactors.size());
+        for (size_t i = 0; i < pool->nodes.size(); i++) {
+            GTEST_ASSERT_EQ(expected->nodes[i]->instanceID, pool->nodes[i]->instanceID);
+            GTEST_ASSERT_EQ(expected->nodes[i]->workload, pool->nodes[i]->workload);
+            GTEST_ASSERT_EQ(expected->factors[i], pool->factors[i]);
+            GTEST_ASSERT_EQ(expected->rampStartMs[i]==0, pool->rampStartMs[i]==0);
+            if (!pool->previousFactors.empty()) {
+                GTEST_ASSERT_EQ(expected->previousFactors[i], pool->previousFactors[i]);
+            }
+        }
+    }
+    // joining nodes ramp up and move from 0, the others keep their previous factor
+    auto pool = parallel->getCandidatePool();
+    GTEST_ASSERT_EQ(12000, pool->previousFactors.size());
+    for (size_t i = 0; i < pool->nodes.size(); i++) {
+        bool joined = pool->nodes[i]->instanceID=="zone-a-i-6400" || pool->nodes[i]->instanceID=="zone-c-i-3400";
+        if (joined) {
+            GTEST_ASSERT_NE(0, pool->rampStartMs[i]);
+            ASSERT_DOUBLE_EQ(0, pool->previousFactors[i]);
+        }
+        if (pool->nodes[i]->instanceID=="zone-a-i-600") {
+            GTEST_ASSERT_NE(0, pool->previousFactors[i]);
+        }
+    }
+
+    std::string out;
+    PrometheusWriter writer(out);
+    parallel->RenderMetrics(writer);
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_refresh_stage_last_duration_seconds{service=\"rs\",stage=\"zone\"}"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_refresh_stage_last_duration_seconds{service=\"rs\",stage=\"pool\"}"));
+}
+
+TEST(testResolver, caseRenderMetrics) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 3), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    for (int i = 0; i < 30; i++) {
+        resolver->SelectedNode();
+    }
+    // new node objects of the same instances keep counting, a node gone is dropped
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 2), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    for (int i = 0; i < 10; i++) {
+        resolver->SelectedNode();
+    }
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 3), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    resolver->markFetched(DATA_ZONE_CPU, STATUSCODE::ERROR_CONNECT, "refused", 100);
+    resolver->markFetched(DATA_ZONE_CPU, STATUSCODE::ERROR_CONNECT, "refused", 101);
+
+    std::string out;
+    PrometheusWriter writer(out);
+    resolver->RenderMetrics(writer);
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_selections_total{service=\"rs\"} 40\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_cross_zone_selections_total{service=\"rs\"} 0\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_candidate_pool_size{service=\"rs\"} 3\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find(
+        "clb_node_selections_total{service=\"rs\",zone=\"zone-a\",instance=\"zone-a-i-0\"} 15\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find(
+        "clb_node_selections_total{service=\"rs\",zone=\"zone-a\",instance=\"zone-a-i-2\"} 0\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_node_factor{service=\"rs\",zone=\"zone-a\",instance=\"zone-a-i-1\"}"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_consul_errors_total{service=\"rs\",source=\"zoneCPU\"} 2\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_consul_consecutive_failures{service=\"rs\",source=\"zoneCPU\"} 2\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_data_age_seconds{service=\"rs\",source=\"health\"} +Inf\n"));
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_refresh_duration_seconds_count{service=\"rs\"} 0\n"));
+    // the instance load source is off by default
+    GTEST_ASSERT_EQ(std::string::npos, out.find("instanceLoad"));
+}
+
+}
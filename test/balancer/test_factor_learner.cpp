@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "balancer/factor_learner.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static OnlineLab defaultOnlinelab() {
+    OnlineLab onlinelab;
+    onlinelab.crossZone = true;
+    onlinelab.crossZoneRate = 0.01;
+    onlinelab.factorCacheExpire = 500;
+    onlinelab.factorStartRate = 0.8;
+    onlinelab.learningRate = 0.1;
+    onlinelab.rateThreshold = 0.1;
+    return onlinelab;
+}
+
+TEST(testFactorLearner, caseColdStart) {
+    FactorLearner learner;
+    LearningBatch batch;
+    batch.Add(50, 50, 1000, false, 0, true, false);
+    batch.Add(50, 50, 5000, false, 0, true, false);
+    batch.Add(50, 50, 1000, false, 0, false, false);
+    batch.Add(50, 50, 1000, false, 0, false, true);
+
+    GTEST_ASSERT_EQ(0, learner.Learn(defaultOnlinelab(), false, batch));
+    GTEST_ASSERT_EQ(1000, batch.factor[0]);
+    GTEST_ASSERT_EQ(3000, batch.factor[1]);  // clamped to maxLocal
+    GTEST_ASSERT_EQ(1, batch.factor[2]);     // cross zone without spill
+    GTEST_ASSERT_EQ(100, batch.factor[3]);   // cross zone spill, crossRate
+    GTEST_ASSERT_EQ(2000, learner.getLocalAvgFactor());
+}
+
+TEST(testFactorLearner, caseLearning) {
+    FactorLearner learner;
+    LearningBatch batch;
+    batch.Add(80, 50, 1000, true, 1000, true, false);   // busy
+    batch.Add(20, 50, 1000, true, 1000, true, false);   // lazy
+    batch.Add(55, 50, 1000, true, 1000, true, false);   // balanced
+    batch.Add(50, 50, 1000, true, 100, false, true);    // spill
+    batch.Add(50, 50, 1000, true, 100, false, false);   // no spill
+
+    GTEST_ASSERT_EQ(2, learner.Learn(defaultOnlinelab(), true, batch));
+    ASSERT_DOUBLE_EQ(900, batch.factor[0]);
+    ASSERT_DOUBLE_EQ(1100, batch.factor[1]);
+    ASSERT_DOUBLE_EQ(1000, batch.factor[2]);
+    ASSERT_DOUBLE_EQ(110, batch.factor[3]);
+    ASSERT_DOUBLE_EQ(90, batch.factor[4]);
+
+    // fresh new local node starts from the local average
+    batch.Clear();
+    batch.Add(50, 50, 1000, true, 900, true, false);
+    batch.Add(50, 50, 2000, false, 0, true, false);
+    learner.Learn(defaultOnlinelab(), false, batch);
+    ASSERT_DOUBLE_EQ(1000, batch.factor[1]);
+
+    // pushed against the limit, out of balance for good and no reason to keep converging
+    batch.Clear();
+    batch.Add(90, 50, 1000, true, 200, true, false);   // busy at minLocal
+    batch.Add(10, 50, 1000, true, 3000, true, false);  // lazy at maxLocal
+    batch.Add(10, 50, 1000, true, 200, true, false);   // lazy, can still grow
+    GTEST_ASSERT_EQ(1, learner.Learn(defaultOnlinelab(), true, batch));
+    ASSERT_DOUBLE_EQ(200, batch.factor[0]);
+    ASSERT_DOUBLE_EQ(3000, batch.factor[1]);
+}
+
+TEST(testFactorLearner, caseInstanceScoped) {
+    FactorLearner a;
+    FactorLearner b;
+    LearningBatch batch;
+    batch.Add(50, 50, 400, false, 0, true, false);
+    a.Learn(defaultOnlinelab(), false, batch);
+    GTEST_ASSERT_EQ(400, a.getLocalAvgFactor());
+    GTEST_ASSERT_EQ(0, b.getLocalAvgFactor());
+}
+
+}
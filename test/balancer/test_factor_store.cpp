@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include "balancer/factor_store.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// one refresh with the given nodes, every node learns factor
+static void refresh(FactorStore &store, int from, int to, double factor) {
+    store.Begin();
+    for (int i = from; i < to; i++) {
+        auto id = store.Acquire("i-" + std::to_string(i));
+        store.Set(id, factor);
+    }
+    store.End();
+}
+
+TEST(testFactorStore, caseGetSet) {
+    FactorStore store;
+    store.Begin();
+    auto id = store.Acquire("i-0");
+    double factor = 0;
+    GTEST_ASSERT_EQ(false, store.Get(id, factor));
+    store.Set(id, 1200);
+    store.End();
+
+    store.Begin();
+    GTEST_ASSERT_EQ(id, store.Acquire("i-0"));
+    GTEST_ASSERT_EQ(true, store.Get(id, factor));
+    ASSERT_DOUBLE_EQ(1200, factor);
+    store.End();
+}
+
+TEST(testFactorStore, caseDeparted) {
+    FactorStoreOption option;
+    option.departedTTL = 2;
+    FactorStore store(option);
+    refresh(store, 0, 10, 1000);
+    GTEST_ASSERT_EQ(10, store.Size());
+
+    // missing once is tolerated, twice is gone, the ids are reused
+    refresh(store, 0, 5, 1000);
+    GTEST_ASSERT_EQ(10, store.Size());
+    refresh(store, 0, 5, 1000);
+    GTEST_ASSERT_EQ(5, store.Size());
+    refresh(store, 0, 10, 1000);
+    GTEST_ASSERT_EQ(10, store.Size());
+    GTEST_ASSERT_EQ(10, store.to_json()["slots"].int_value());
+}
+
+TEST(testFactorStore, caseStaggeredTTL) {
+    FactorStoreOption option;
+    option.ttl = 100;
+    FactorStore store(option);
+    refresh(store, 0, 1000, 1000);
+
+    // entries learned together expire spread over [ttl/2, 1.5 ttl], never all at once
+    int maxExpired = 0;
+    for (int round = 0; round < 200; round++) {
+        store.Begin();
+        int expired = 0;
+        for (int i = 0; i < 1000; i++) {
+            auto id = store.Acquire("i-" + std::to_string(i));
+            double factor;
+            if (!store.Get(id, factor)) {
+                expired++;
+            }
+            store.Set(id, 1000);
+        }
+        store.End();
+        if (round < 48) {
+            GTEST_ASSERT_EQ(0, expired);
+        }
+        maxExpired = std::max(maxExpired, expired);
+    }
+    GTEST_ASSERT_GT(maxExpired, 0);
+    GTEST_ASSERT_LT(maxExpired, 100);
+}
+
+TEST(testFactorStore, caseCapacity) {
+    FactorStoreOption option;
+    option.capacity = 100;
+    option.departedTTL = 1000;
+    FactorStore store(option);
+    for (int round = 0; round < 10; round++) {
+        refresh(store, round*50, round*50 + 50, 1000);
+        GTEST_ASSERT_LE(store.Size(), 100);
+    }
+
+    // the most recent nodes survive
+    store.Begin();
+    double factor;
+    GTEST_ASSERT_EQ(true, store.Get(store.Acquire("i-499"), factor));
+    store.End();
+}
+
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "balancer/factor_table.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testFactorTable, caseEncode) {
+    auto binary = factor_table::Encode({{"i-b", 2}, {"i-a", 1}, {"i-ab", 1.5}, {"i-c", 3}}, 1600000000);
+    GTEST_ASSERT_EQ(true, factor_table::IsBinary(binary));
+    GTEST_ASSERT_EQ(false, factor_table::IsBinary(R"({"data": []})"));
+    // little endian on any host: count 4, updated 0x5F5E1000, the first value 1.0f
+    GTEST_ASSERT_EQ(std::string("\x04\x00\x00\x00", 4), binary.substr(8, 4));
+    GTEST_ASSERT_EQ(std::string("\x00\x10\x5e\x5f\x00\x00\x00\x00", 8), binary.substr(12, 8));
+    GTEST_ASSERT_EQ(std::string("\x00\x00\x80\x3f", 4), binary.substr(factor_table::HEADER_SIZE + 5 * 4, 4));
+
+    FactorTableView table;
+    std::string err;
+    GTEST_ASSERT_EQ(true, table.Parse(binary.data(), binary.size(), err));
+    GTEST_ASSERT_EQ(4, table.Size());
+    GTEST_ASSERT_EQ(1600000000, table.getUpdated());
+    GTEST_ASSERT_EQ("i-a", table.ID(0));
+    GTEST_ASSERT_EQ("i-ab", table.ID(1));
+
+    double value = 0;
+    GTEST_ASSERT_EQ(true, table.Find("i-ab", value));
+    ASSERT_DOUBLE_EQ(1.5, value);
+    GTEST_ASSERT_EQ(true, table.Find("i-c", value));
+    ASSERT_DOUBLE_EQ(3, value);
+    GTEST_ASSERT_EQ(false, table.Find("i-", value));
+    GTEST_ASSERT_EQ(false, table.Find("i-abc", value));
+    GTEST_ASSERT_EQ(false, table.Find("i-d", value));
+
+    auto empty = factor_table::Encode({}, 0);
+    GTEST_ASSERT_EQ(true, table.Parse(empty.data(), empty.size(), err));
+    GTEST_ASSERT_EQ(false, table.Find("i-a", value));
+}
+
+TEST(testFactorTable, caseMalformed) {
+    auto binary = factor_table::Encode({{"i-a", 1}, {"i-b", 2}}, 0);
+    FactorTableView table;
+    std::string err;
+
+    GTEST_ASSERT_EQ(false, table.Parse(binary.data(), 10, err));
+    GTEST_ASSERT_EQ(false, table.Parse(binary.data(), binary.size() - 1, err));
+    GTEST_ASSERT_EQ(false, table.Valid());
+
+    auto version = binary;
+    version[4] = 9;
+    GTEST_ASSERT_EQ(false, table.Parse(version.data(), version.size(), err));
+
+    // ids out of order
+    auto unsorted = binary;
+    std::swap(unsorted[unsorted.size() - 1], unsorted[unsorted.size() - 4]);
+    GTEST_ASSERT_EQ(false, table.Parse(unsorted.data(), unsorted.size(), err));
+    GTEST_ASSERT_EQ("factor table ids not sorted", err);
+}
+
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include "balancer/hedging.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testHedging, caseBucket) {
+    for (uint64_t us : {0, 1, 3, 4, 5, 7, 8, 100, 1000, 12345, 1000000}) {
+        auto bucket = LatencyTracker::Bucket(us);
+        GTEST_ASSERT_GT(LatencyTracker::BucketUpper(bucket), us);
+        // about 25% wide at most
+        GTEST_ASSERT_LE(LatencyTracker::BucketUpper(bucket), us + us / 4 + 1);
+    }
+    GTEST_ASSERT_LT(LatencyTracker::Bucket(999), LatencyTracker::Bucket(1300));
+}
+
+TEST(testHedging, casePercentile) {
+    HedgeOption option;
+    option.minSamples = 10;
+    option.windowS = 10;
+    LatencyTracker tracker(option);
+    uint64_t now = 1000000;
+
+    for (int i = 0; i < 5; i++) {
+        tracker.Report(1000, now);
+    }
+    // not enough history
+    GTEST_ASSERT_EQ(0, tracker.Percentile(0.95, now));
+
+    for (int i = 0; i < 90; i++) {
+        tracker.Report(1000, now);
+    }
+    for (int i = 0; i < 5; i++) {
+        tracker.Report(50000, now);
+    }
+    auto p95 = tracker.Percentile(0.95, now);
+    GTEST_ASSERT_GT(p95, 1000);
+    GTEST_ASSERT_LE(p95, 1250);
+    GTEST_ASSERT_GT(tracker.Percentile(0.99, now), 50000);
+
+    // still there one window later, gone after two
+    GTEST_ASSERT_EQ(p95, tracker.Percentile(0.95, now + 10000));
+    GTEST_ASSERT_EQ(0, tracker.Percentile(0.95, now + 20000));
+}
+
+TEST(testHedging, caseDelay) {
+    HedgeOption option;
+    option.minSamples = 1;
+    option.minDelayUs = 5000;
+    Hedger hedger(option);
+    uint64_t now = 1000000;
+
+    GTEST_ASSERT_EQ(0, hedger.Begin(now));
+    hedger.ReportLatency(100, now);
+    // cached for 100ms
+    GTEST_ASSERT_EQ(0, hedger.Begin(now + 50));
+    GTEST_ASSERT_EQ(5000, hedger.Begin(now + 200));
+}
+
+TEST(testHedging, caseBudget) {
+    HedgeOption option;
+    option.budgetCapacity = 2;
+    option.budgetRatio = 0.5;
+    option.budgetPerSecond = 1;
+    RetryBudget budget(option);
+    uint64_t now = 1000000;
+
+    GTEST_ASSERT_EQ(true, budget.Withdraw(now));
+    GTEST_ASSERT_EQ(true, budget.Withdraw(now));
+    GTEST_ASSERT_EQ(false, budget.Withdraw(now));
+
+    // two requests earn one retry
+    budget.Deposit();
+    budget.Deposit();
+    GTEST_ASSERT_EQ(true, budget.Withdraw(now));
+    GTEST_ASSERT_EQ(false, budget.Withdraw(now));
+
+    // time refills up to the capacity
+    GTEST_ASSERT_EQ(true, budget.Withdraw(now + 1000));
+    GTEST_ASSERT_EQ(false, budget.Withdraw(now + 1000));
+    budget.Withdraw(now + 60000);
+    ASSERT_DOUBLE_EQ(1, budget.Tokens());
+
+    // a refund never goes past the capacity
+    budget.Refund();
+    budget.Refund();
+    ASSERT_DOUBLE_EQ(2, budget.Tokens());
+}
+
+}
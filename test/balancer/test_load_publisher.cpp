@@ -0,0 +1,166 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "balancer/load_publisher.h"
+#include "util/constant.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// consul kv stub, records the request lines and answers 200 to all
+class KVStub {
+    int fd;
+    int port;
+    std::mutex mutex;
+    std::vector<std::string> requests;
+    std::thread server;
+
+   public:
+    KVStub() {
+        this->fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(this->fd, (sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(this->fd, (sockaddr*)&addr, &len);
+        this->port = ntohs(addr.sin_port);
+        listen(this->fd, 8);
+        this->server = std::thread([this]() {
+            while (true) {
+                int conn = accept(this->fd, nullptr, nullptr);
+                if (conn < 0) {
+                    return;
+                }
+                char buf[4096] = {0};
+                auto n = read(conn, buf, sizeof(buf) - 1);
+                std::string req(buf, n > 0 ? n : 0);
+                {
+                    std::lock_guard<std::mutex> lock_guard(this->mutex);
+                    this->requests.emplace_back(req.substr(0, req.find(" HTTP/")));
+                }
+                std::string resp = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nConnection: close\r\n\r\ntrue";
+                write(conn, resp.data(), resp.size());
+                close(conn);
+            }
+        });
+    }
+    ~KVStub() {
+        shutdown(this->fd, SHUT_RDWR);
+        close(this->fd);
+        this->server.join();
+    }
+    std::string Address() const {
+        return "http://127.0.0.1:" + std::to_string(this->port);
+    }
+    std::vector<std::string> Requests() {
+        std::lock_guard<std::mutex> lock_guard(this->mutex);
+        return this->requests;
+    }
+};
+
+TEST(testLoadPublisher, caseEncode) {
+    InstanceLoad load;
+    load.cpu = 42.5;
+    load.inflight = 12;
+    load.queueDepth = 3;
+    load.updated = 1600000000;
+    GTEST_ASSERT_EQ("v1,42.5,12,3,1600000000", load.Encode());
+
+    InstanceLoad decoded;
+    GTEST_ASSERT_EQ(true, InstanceLoad::Decode(load.Encode(), decoded));
+    ASSERT_DOUBLE_EQ(42.5, decoded.cpu);
+    GTEST_ASSERT_EQ(12, decoded.inflight);
+    GTEST_ASSERT_EQ(3, decoded.queueDepth);
+    GTEST_ASSERT_EQ(1600000000, decoded.updated);
+
+    GTEST_ASSERT_EQ(false, InstanceLoad::Decode("v2,1,2,3,4", decoded));
+    GTEST_ASSERT_EQ(false, InstanceLoad::Decode("", decoded));
+}
+
+TEST(testLoadPublisher, caseShouldPublish) {
+    LoadPublisherOption option;
+    InstanceLoad last;
+    InstanceLoad current;
+    current.updated = 1000;
+
+    // never published
+    GTEST_ASSERT_EQ(true, LoadPublisher::ShouldPublish(last, current, option));
+
+    last.cpu = 50;
+    last.inflight = 100;
+    last.updated = 1000;
+    current = last;
+    current.updated = 1001;
+    GTEST_ASSERT_EQ(false, LoadPublisher::ShouldPublish(last, current, option));
+
+    // small moves are suppressed
+    current.cpu = 53;
+    current.inflight = 110;
+    GTEST_ASSERT_EQ(false, LoadPublisher::ShouldPublish(last, current, option));
+
+    current.cpu = 56;
+    GTEST_ASSERT_EQ(true, LoadPublisher::ShouldPublish(last, current, option));
+    current.cpu = 50;
+    current.inflight = 130;
+    GTEST_ASSERT_EQ(true, LoadPublisher::ShouldPublish(last, current, option));
+
+    // heartbeat
+    current = last;
+    current.updated = last.updated + option.maxSilenceS;
+    GTEST_ASSERT_EQ(true, LoadPublisher::ShouldPublish(last, current, option));
+}
+
+TEST(testLoadPublisher, caseSample) {
+    LoadPublisher publisher("http://127.0.0.1:1", "clb/load/rs", "i-0");
+    publisher.SetCPUFunc([]() { return 33.0; });
+    publisher.SetQueueDepthFunc([]() { return int64_t(7); });
+    publisher.Begin();
+    publisher.Begin();
+    publisher.End();
+
+    auto load = publisher.Sample();
+    ASSERT_DOUBLE_EQ(33, load.cpu);
+    GTEST_ASSERT_EQ(1, load.inflight);
+    GTEST_ASSERT_EQ(7, load.queueDepth);
+
+    // nothing listens there
+    int code;
+    std::string err;
+    std::tie(code, err) = publisher.PublishOnce(true);
+    GTEST_ASSERT_NE(STATUSCODE::SUCCESS, code);
+}
+
+TEST(testLoadPublisher, caseStopDeletes) {
+    KVStub stub;
+    LoadPublisherOption option;
+    option.intervalMs = 60000;
+    LoadPublisher publisher(stub.Address(), "clb/load/rs", "i-0", option);
+    publisher.SetCPUFunc([]() { return 33.0; });
+    int code;
+    std::string err;
+    std::tie(code, err) = publisher.Start();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+
+    // the key of a stopped instance is gone, not left to look alive
+    publisher.Stop();
+    auto requests = stub.Requests();
+    GTEST_ASSERT_EQ(2, requests.size());
+    GTEST_ASSERT_EQ("PUT /v1/kv/clb/load/rs/i-0", requests[0]);
+    GTEST_ASSERT_EQ("DELETE /v1/kv/clb/load/rs/i-0", requests[1]);
+    // stopping twice deletes once
+    publisher.Stop();
+    GTEST_ASSERT_EQ(2, stub.Requests().size());
+}
+
+}
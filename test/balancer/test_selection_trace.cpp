@@ -0,0 +1,325 @@
+#include <gtest/gtest.h>
+#include <log4cplus/configurator.h>
+#include <log4cplus/loggingmacros.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+
+#include "balancer/consul_resolver.h"
+#include "balancer/selection_trace.h"
+#include "mock_nodes.h"
+#include "util/constant.h"
+
+int main(int argc, char *argv[]) {
+    log4cplus::initialize();
+    log4cplus::BasicConfigurator config;
+    config.configure();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testSelectionTrace, caseRecord) {
+    SelectionTrace trace;
+    trace.Record(TRACE_REFRESH, 7, 2, 0, 30);
+    trace.Record(TRACE_SELECT, 7, 1, 20, 30);
+    trace.Record(TRACE_SELECT, 7, -1, 0.5, 30);
+
+    std::vector<TraceRecord> records;
+    trace.Snapshot(records);
+    GTEST_ASSERT_EQ(3, records.size());
+    GTEST_ASSERT_EQ(TRACE_REFRESH, records[0].type);
+    GTEST_ASSERT_EQ(2, records[0].node);
+    GTEST_ASSERT_EQ(7, records[1].poolVersion);
+    GTEST_ASSERT_EQ(1, records[1].node);
+    ASSERT_DOUBLE_EQ(20, records[1].weight);
+    ASSERT_DOUBLE_EQ(30, records[1].factorSum);
+    GTEST_ASSERT_EQ(-1, records[2].node);
+    GTEST_ASSERT_LE(records[0].timeNs, records[2].timeNs);
+    GTEST_ASSERT_EQ(0, records[2].thread);
+}
+
+TEST(testSelectionTrace, caseWrap) {
+    TraceOption option;
+    option.capacity = 6;  // rounded up to 8
+    SelectionTrace trace(option);
+    for (int i = 0; i < 20; i++) {
+        trace.Record(TRACE_SELECT, 1, i, 0, 0);
+    }
+    std::vector<TraceRecord> records;
+    trace.Snapshot(records);
+    GTEST_ASSERT_EQ(8, records.size());
+    for (int i = 0; i < 8; i++) {
+        GTEST_ASSERT_EQ(12 + i, records[i].node);
+    }
+}
+
+TEST(testSelectionTrace, caseReserve) {
+    TraceOption option;
+    option.capacity = 8;
+    SelectionTrace trace(option);
+    for (int i = 0; i < 12; i++) {
+        trace.Record(TRACE_SELECT, 1, i, 0, 0);
+    }
+    // the events kept move over, the ring never shrinks
+    trace.Reserve(20);
+    trace.Reserve(4);
+    for (int i = 12; i < 36; i++) {
+        trace.Record(TRACE_SELECT, 1, i, 0, 0);
+    }
+    std::vector<TraceRecord> records;
+    trace.Snapshot(records);
+    GTEST_ASSERT_EQ(32, records.size());
+    for (int i = 0; i < 32; i++) {
+        GTEST_ASSERT_EQ(4 + i, records[i].node);
+    }
+}
+
+TEST(testSelectionTrace, caseThreads) {
+    TraceOption option;
+    option.capacity = 256;
+    SelectionTrace trace(option);
+    std::atomic<int> done(0);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.emplace_back([&trace, &done, t]() {
+            for (int i = 0; i < 20000; i++) {
+                trace.Record(TRACE_SELECT, t, i, i*2.0, t);
+            }
+            // alive until all wrote, a ring released on exit would be taken by the next
+            done++;
+            while (done.load() < 4) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    // copies taken while the rings are written never hold a torn event
+    std::vector<TraceRecord> records;
+    for (int round = 0; round < 50; round++) {
+        trace.Snapshot(records);
+        for (const auto &record : records) {
+            ASSERT_DOUBLE_EQ(record.node*2.0, record.weight);
+            ASSERT_DOUBLE_EQ(record.poolVersion, record.factorSum);
+        }
+    }
+    for (auto &t : writers) {
+        t.join();
+    }
+    trace.Snapshot(records);
+    GTEST_ASSERT_EQ(4*256, records.size());
+    std::map<uint16_t, uint64_t> versions;
+    for (const auto &record : records) {
+        versions[record.thread] = record.poolVersion;
+    }
+    GTEST_ASSERT_EQ(4, versions.size());
+}
+
+TEST(testSelectionTrace, caseRecycle) {
+    TraceOption option;
+    option.capacity = 16;
+    SelectionTrace trace(option);
+    trace.Record(TRACE_SELECT, 1, 0, 1, 1);
+    // threads one after the other take the ring the previous one left, events kept
+    for (int t = 0; t < 100; t++) {
+        std::thread([&trace, t]() {
+            trace.Record(TRACE_SELECT, 2, t, 1, 1);
+        }).join();
+    }
+    std::vector<TraceRecord> records;
+    trace.Snapshot(records);
+    GTEST_ASSERT_EQ(17, records.size());
+    for (const auto &record : records) {
+        GTEST_ASSERT_EQ(record.poolVersion==1 ? 0 : 1, record.thread);
+    }
+    GTEST_ASSERT_EQ(99, records.back().node);
+
+    // a thread outliving the trace gives its ring back to nothing
+    std::atomic<bool> recorded(false);
+    std::atomic<bool> release(false);
+    std::thread late;
+    {
+        SelectionTrace gone(option);
+        late = std::thread([&]() {
+            gone.Record(TRACE_SELECT, 1, 0, 1, 1);
+            recorded = true;
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+        });
+        while (!recorded.load()) {
+            std::this_thread::yield();
+        }
+    }
+    release = true;
+    late.join();
+}
+
+TEST(testSelectionTrace, caseDump) {
+    SelectionTrace trace;
+    for (int i = 0; i < 10; i++) {
+        trace.Record(TRACE_SELECT, 3, i, i, 10);
+    }
+    char path[] = "/tmp/ckit-trace-XXXXXX";
+    close(mkstemp(path));
+    int code;
+    std::string err;
+    std::tie(code, err) = trace.Dump(path);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+
+    std::vector<TraceRecord> expected;
+    std::vector<TraceRecord> loaded;
+    trace.Snapshot(expected);
+    std::tie(code, err) = SelectionTrace::Load(path, loaded);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(expected.size(), loaded.size());
+    // timestamps are recalibrated on every snapshot, the events are the same
+    for (size_t i = 0; i < loaded.size(); i++) {
+        GTEST_ASSERT_EQ(expected[i].node, loaded[i].node);
+        GTEST_ASSERT_EQ(expected[i].poolVersion, loaded[i].poolVersion);
+        ASSERT_DOUBLE_EQ(expected[i].weight, loaded[i].weight);
+    }
+
+    // a record count past the end of the file is cut to the records there
+    auto fp = fopen(path, "r+b");
+    uint64_t recordNum = 1ull << 60;
+    fseek(fp, offsetof(TraceFileHeader, recordNum), SEEK_SET);
+    fwrite(&recordNum, sizeof(recordNum), 1, fp);
+    fclose(fp);
+    std::tie(code, err) = SelectionTrace::Load(path, loaded);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_INVALID_ARGUMENT, code);
+    GTEST_ASSERT_NE(std::string::npos, err.find("truncated"));
+    GTEST_ASSERT_EQ(expected.size(), loaded.size());
+
+    // anything else is rejected
+    fp = fopen(path, "wb");
+    fputs("not a trace at all, just text", fp);
+    fclose(fp);
+    std::tie(code, err) = SelectionTrace::Load(path, loaded);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_INVALID_ARGUMENT, code);
+    remove(path);
+}
+
+TEST(testSelectionTrace, caseSignal) {
+    SelectionTrace trace;
+    trace.Record(TRACE_SELECT, 5, 0, 1, 1);
+    std::string path = "/tmp/ckit-trace-signal-" + std::to_string(getpid());
+    int code;
+    std::string err;
+    std::tie(code, err) = trace.DumpOnSignal(SIGUSR2, path);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    raise(SIGUSR2);
+
+    std::vector<TraceRecord> loaded;
+    for (int i = 0; i < 50; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::tie(code, err) = SelectionTrace::Load(path, loaded);
+        if (code==STATUSCODE::SUCCESS) {
+            break;
+        }
+    }
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(1, loaded.size());
+    GTEST_ASSERT_EQ(5, loaded[0].poolVersion);
+    remove(path.c_str());
+}
+
+static std::atomic<int> appSignals(0);
+
+static void onAppSignal(int) {
+    appSignals++;
+}
+
+TEST(testSelectionTrace, caseSignalChain) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onAppSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+
+    std::string path = "/tmp/ckit-trace-chain-" + std::to_string(getpid());
+    {
+        // the handler of the application still runs, and is back once the traces go
+        SelectionTrace a;
+        SelectionTrace b;
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, std::get<0>(a.DumpOnSignal(SIGUSR1, path)));
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, std::get<0>(b.DumpOnSignal(SIGUSR1, path)));
+        raise(SIGUSR1);
+        GTEST_ASSERT_EQ(1, appSignals.load());
+    }
+    struct sigaction current;
+    sigaction(SIGUSR1, nullptr, &current);
+    GTEST_ASSERT_EQ(true, (current.sa_flags & SA_SIGINFO)==0 && current.sa_handler==onAppSignal);
+    raise(SIGUSR1);
+    GTEST_ASSERT_EQ(2, appSignals.load());
+    remove(path.c_str());
+}
+
+TEST(testSelectionTrace, caseResolver) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+    auto trace = std::make_shared<SelectionTrace>();
+    resolver->SetTrace(trace);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 3), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    for (int i = 0; i < 6; i++) {
+        resolver->SelectedNode();
+    }
+    std::tie(code, err) = resolver->updateCandidatePool();
+    resolver->SelectedNode();
+
+    std::vector<TraceRecord> records;
+    trace->Snapshot(records);
+    // refresh, 3 factors, 6 selections, refresh, 3 factors, 1 selection
+    GTEST_ASSERT_EQ(15, records.size());
+    GTEST_ASSERT_EQ(TRACE_REFRESH, records[0].type);
+    GTEST_ASSERT_EQ(3, records[0].node);
+    GTEST_ASSERT_EQ(TRACE_FACTOR, records[1].type);
+    auto version = records[0].poolVersion;
+    std::map<int, int> selected;
+    for (int i = 4; i < 10; i++) {
+        GTEST_ASSERT_EQ(TRACE_SELECT, records[i].type);
+        GTEST_ASSERT_EQ(version, records[i].poolVersion);
+        ASSERT_DOUBLE_EQ(records[0].factorSum, records[i].factorSum);
+        selected[records[i].node]++;
+    }
+    GTEST_ASSERT_EQ(2, selected[0]);
+    GTEST_ASSERT_EQ(2, selected[2]);
+    GTEST_ASSERT_EQ(version + 1, records[14].poolVersion);
+}
+
+TEST(testSelectionTrace, caseLargePool) {
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    TraceOption option;
+    option.capacity = 16;
+    auto trace = std::make_shared<SelectionTrace>(option);
+    resolver->SetTrace(trace);
+
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", 100), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+
+    // a refresh larger than the ring is kept whole
+    std::vector<TraceRecord> records;
+    trace->Snapshot(records);
+    GTEST_ASSERT_EQ(101, records.size());
+    GTEST_ASSERT_EQ(TRACE_REFRESH, records[0].type);
+    GTEST_ASSERT_EQ(100, records[0].node);
+    for (int i = 0; i < 100; i++) {
+        GTEST_ASSERT_EQ(TRACE_FACTOR, records[1 + i].type);
+        GTEST_ASSERT_EQ(i, records[1 + i].node);
+    }
+}
+
+}
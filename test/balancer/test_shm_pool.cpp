@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <sstream>
+
+#include "balancer/shm_pool.h"
+#include "util/constant.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static std::string shmName() {
+    std::stringstream ss;
+    ss << "/ckit.test." << getpid();
+    return ss.str();
+}
+
+static CandidatePool makePool(int n) {
+    CandidatePool pool;
+    pool.factorSum = 0;
+    for (int i = 0; i < n; i++) {
+        auto node = std::make_shared<ServiceNode>();
+        node->host = "10.0.0." + std::to_string(i);
+        node->port = 8000 + i;
+        node->zone = i%2==0 ? "ap-southeast-1a" : "ap-southeast-1b";
+        node->instanceID = "i-" + std::to_string(i);
+        node->balanceFactor = 1000;
+        node->currentFactor = 100*(i + 1);
+        node->workload = 50;
+        pool.nodes.emplace_back(node);
+        pool.factors.emplace_back(100*(i + 1));
+        pool.weights.emplace_back(0);
+        pool.factorSum += 100*(i + 1);
+    }
+    return pool;
+}
+
+TEST(testShmPool, casePublishRefresh) {
+    auto name = shmName();
+    SharedPoolWriter writer(name, 16);
+    int code;
+    std::string err;
+    std::tie(code, err) = writer.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+
+    SharedPoolReader reader(name);
+    std::tie(code, err) = reader.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+
+    std::shared_ptr<CandidatePool> pool;
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(nullptr, pool);
+    GTEST_ASSERT_EQ(false, reader.Changed());
+
+    std::tie(code, err) = writer.Publish(makePool(3), 1234);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(true, reader.Changed());
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(3, pool->nodes.size());
+    GTEST_ASSERT_EQ(600, pool->factorSum);
+    GTEST_ASSERT_EQ("10.0.0.2:8002", pool->nodes[2]->Address());
+    GTEST_ASSERT_EQ("ap-southeast-1b", pool->nodes[1]->zone);
+    GTEST_ASSERT_EQ(200, pool->factors[1]);
+    GTEST_ASSERT_EQ(3, pool->weights.size());
+    GTEST_ASSERT_EQ(1234, reader.getLastUpdated());
+    GTEST_ASSERT_EQ(false, reader.Changed());
+
+    // unchanged segment returns the same local copy
+    std::shared_ptr<CandidatePool> same;
+    std::tie(code, same, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(pool, same);
+
+    std::tie(code, err) = writer.Publish(makePool(1), 1235);
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(1, pool->nodes.size());
+    GTEST_ASSERT_EQ(0, pool->previousFactors.size());
+
+    // the transition travels with the pool
+    auto moving = makePool(2);
+    moving.previousFactors = {50, 0};
+    moving.transitionStartMs = 4321;
+    std::tie(code, err) = writer.Publish(moving, 1236);
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(std::vector<double>({50, 0}), pool->previousFactors);
+    GTEST_ASSERT_EQ(4321, pool->transitionStartMs);
+
+    // too many nodes
+    std::tie(code, err) = writer.Publish(makePool(17), 1237);
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_SHARED_MEMORY, code);
+
+    reader.Close();
+    writer.Close();
+}
+
+TEST(testShmPool, caseCapacityChange) {
+    auto name = shmName() + ".capacity";
+    int code;
+    std::string err;
+    std::shared_ptr<CandidatePool> pool;
+    {
+        SharedPoolWriter writer(name, 4);
+        std::tie(code, err) = writer.Open();
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+        std::tie(code, err) = writer.Publish(makePool(3), 1234);
+        GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    }
+
+    SharedPoolReader reader(name);
+    std::tie(code, err) = reader.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(3, pool->nodes.size());
+    auto version = pool->version;
+
+    // a publisher of a larger capacity takes over: the sequence goes on and the reader
+    // maps the grown segment
+    SharedPoolWriter larger(name, 64);
+    std::tie(code, err) = larger.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(true, reader.Changed());
+    std::tie(code, err) = larger.Publish(makePool(40), 1235);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(40, pool->nodes.size());
+    GTEST_ASSERT_EQ("10.0.0.39:8039", pool->nodes[39]->Address());
+    GTEST_ASSERT_GT(pool->version, version);
+    larger.Close(false);
+
+    // a smaller one keeps the segment size, readers still mapping it stay valid
+    SharedPoolWriter smaller(name, 2);
+    std::tie(code, err) = smaller.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, err) = smaller.Publish(makePool(2), 1236);
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    std::tie(code, pool, err) = reader.Refresh();
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_EQ(2, pool->nodes.size());
+
+    reader.Close();
+    smaller.Close();
+}
+
+TEST(testShmPool, caseReaderWithoutWriter) {
+    SharedPoolReader reader(shmName() + ".none");
+    int code;
+    std::string err;
+    std::tie(code, err) = reader.Open();
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_SHARED_MEMORY, code);
+}
+
+}
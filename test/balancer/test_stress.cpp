@@ -0,0 +1,162 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <gtest/gtest.h>
+#include <log4cplus/configurator.h>
+#include <log4cplus/loggingmacros.h>
+#include <thread>
+#include <unordered_map>
+
+#include "balancer/consul_resolver.h"
+#include "mock_nodes.h"
+
+// selections racing a resolver that refreshes every millisecond, no consul needed.
+// build with -DC_KIT_TSAN=ON to run it under ThreadSanitizer
+
+int main(int argc, char *argv[]) {
+    log4cplus::initialize();
+    log4cplus::BasicConfigurator config;
+    config.configure();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+struct StressResult {
+    uint64_t                                  selections = 0;
+    uint64_t                                  refreshes  = 0;
+    uint64_t                                  misses     = 0;  // no node selected
+    std::unordered_map<std::string, uint64_t> selected;
+    double                                    seconds    = 0;
+};
+
+// threadNum selectors for durationMs while refresh runs in a loop on its own thread
+static StressResult stress(const std::shared_ptr<ConsulResolver> &resolver, int threadNum, int durationMs,
+                           const std::function<void(uint64_t)> &refresh) {
+    std::atomic<bool> stopped(false);
+    std::vector<StressResult> results(threadNum);
+    std::vector<std::thread> selectors;
+    StressResult result;
+
+    std::thread updater([&]() {
+        while (not stopped.load()) {
+            refresh(result.refreshes++);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < threadNum; i++) {
+        selectors.emplace_back([&](int idx) {
+            auto &local = results[idx];
+            while (not stopped.load(std::memory_order_relaxed)) {
+                auto node = resolver->SelectedNode();
+                local.selections++;
+                if (node==nullptr || node->instanceID.empty()) {
+                    local.misses++;
+                    continue;
+                }
+                local.selected[node->instanceID]++;
+            }
+        }, i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    stopped.store(true);
+    for (auto &t : selectors) {
+        t.join();
+    }
+    updater.join();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const auto &local : results) {
+        result.selections += local.selections;
+        result.misses += local.misses;
+        for (const auto &kv : local.selected) {
+            result.selected[kv.first] += kv.second;
+        }
+    }
+    return result;
+}
+
+static std::shared_ptr<ConsulResolver> mockResolver(log4cplus::Logger &logger, int nodeNum) {
+    auto resolver = std::make_shared<ConsulResolver>("http://127.0.0.1:1", "zone-a", "rs");
+    resolver->SetLogger(&logger);
+    int code;
+    std::string err;
+    std::tie(code, err) = resolver->applyServiceNodes(mockNodes("zone-a", nodeNum), true);
+    std::tie(code, err) = resolver->updateCandidatePool();
+    return resolver;
+}
+
+TEST(testStress, caseFairness) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+    auto resolver = mockResolver(logger, 8);
+
+    // every refresh swaps in a new pool with the same factors
+    auto result = stress(resolver, 4, 500, [&](uint64_t) {
+        resolver->updateCandidatePool();
+    });
+    GTEST_ASSERT_EQ(0, result.misses);
+    GTEST_ASSERT_GT(result.refreshes, 10);
+    GTEST_ASSERT_EQ(8, result.selected.size());
+    for (const auto &kv : result.selected) {
+        ASSERT_NEAR(1.0/8, static_cast<double>(kv.second)/result.selections, 0.2/8) << kv.first;
+    }
+}
+
+TEST(testStress, caseChurn) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+    auto resolver = mockResolver(logger, 6);
+    SlowStartOption slowStart;
+    slowStart.windowS = 1;
+    resolver->SetSlowStartOption(slowStart);
+    TransitionOption transition;
+    transition.windowS = 1;
+    resolver->SetTransitionOption(transition);
+    std::atomic<int> deltas(0);
+    resolver->SubscribeTopology([&](const std::shared_ptr<const TopologyDelta> &) { deltas++; });
+
+    // nodes join and leave on every refresh, ramped and interpolated at selection
+    auto result = stress(resolver, 4, 500, [&](uint64_t i) {
+        resolver->applyServiceNodes(mockNodes("zone-a", 6, i%3), true);
+        resolver->updateCandidatePool();
+    });
+    GTEST_ASSERT_EQ(0, result.misses);
+    GTEST_ASSERT_GT(result.refreshes, 10);
+    // only the 8 nodes ever fed
+    std::unordered_map<std::string, int> known;
+    for (const auto &node : mockNodes("zone-a", 8)) {
+        known[node->instanceID] = 1;
+    }
+    for (const auto &kv : result.selected) {
+        GTEST_ASSERT_EQ(1, known.count(kv.first)) << kv.first;
+    }
+    GTEST_ASSERT_GT(deltas.load(), 0);
+}
+
+TEST(testStress, caseMetric) {
+    log4cplus::Logger logger = log4cplus::Logger::getInstance("test");
+    logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+    auto resolver = mockResolver(logger, 4);
+
+    // no refresh, every selection lands in the same metric
+    int threadNum = 8;
+    int selectNum = 20000;
+    std::vector<std::thread> selectors;
+    for (int i = 0; i < threadNum; i++) {
+        selectors.emplace_back([&]() {
+            for (int j = 0; j < selectNum; j++) {
+                resolver->SelectedNode();
+            }
+        });
+    }
+    for (auto &t : selectors) {
+        t.join();
+    }
+    GTEST_ASSERT_EQ(threadNum*selectNum, resolver->getMetric()->selectNum.load());
+    GTEST_ASSERT_EQ(0, resolver->getMetric()->crossZoneNum.load());
+}
+
+}
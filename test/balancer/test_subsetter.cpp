@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <unordered_map>
+
+#include "balancer/subsetter.h"
+#include "mock_nodes.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static std::vector<std::string> selected(Subsetter &subsetter, const std::vector<std::shared_ptr<ServiceNode>> &nodes) {
+    std::vector<char> keep(nodes.size(), 1);
+    subsetter.Begin();
+    subsetter.Select(nodes, 0, nodes.size(), keep);
+    subsetter.End();
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (keep[i]) {
+            ids.emplace_back(nodes[i]->instanceID);
+        }
+    }
+    return ids;
+}
+
+TEST(testSubsetter, caseDeterministic) {
+    SubsetOption option;
+    option.clientID = "client-1";
+    option.subsetSize = 10;
+    Subsetter a(option);
+    Subsetter b(option);
+    auto nodes = mockNodes("", 100);
+
+    auto ids = selected(a, nodes);
+    GTEST_ASSERT_EQ(10, ids.size());
+    GTEST_ASSERT_EQ(ids, selected(b, nodes));
+    GTEST_ASSERT_EQ(ids, selected(a, nodes));
+
+    // smaller zones are kept whole
+    GTEST_ASSERT_EQ(5, selected(a, mockNodes("", 5)).size());
+}
+
+TEST(testSubsetter, caseStable) {
+    SubsetOption option;
+    option.clientID = "client-1";
+    option.subsetSize = 10;
+    Subsetter subsetter(option);
+    auto nodes = mockNodes("", 100);
+    auto before = selected(subsetter, nodes);
+
+    // a node joining moves at most one member of the subset
+    auto grown = nodes;
+    grown.emplace_back(mockNodes("", 1, 100)[0]);
+    auto after = selected(subsetter, grown);
+    int moved = 0;
+    for (const auto &id : before) {
+        moved += std::find(after.begin(), after.end(), id)==after.end();
+    }
+    GTEST_ASSERT_LE(moved, 1);
+
+    // a member leaving is replaced, the others stay
+    auto shrunk = std::vector<std::shared_ptr<ServiceNode>>();
+    for (const auto &node : nodes) {
+        if (node->instanceID!=before[0]) {
+            shrunk.emplace_back(node);
+        }
+    }
+    after = selected(subsetter, shrunk);
+    GTEST_ASSERT_EQ(10, after.size());
+    for (size_t i = 1; i < before.size(); i++) {
+        GTEST_ASSERT_NE(after.end(), std::find(after.begin(), after.end(), before[i]));
+    }
+}
+
+TEST(testSubsetter, caseSpread) {
+    auto nodes = mockNodes("", 50);
+    nodes[0]->balanceFactor = 4000;
+    std::unordered_map<std::string, int> clients;
+    SubsetOption option;
+    option.subsetSize = 5;
+    for (int c = 0; c < 2000; c++) {
+        option.clientID = "client-" + std::to_string(c);
+        Subsetter subsetter(option);
+        for (const auto &id : selected(subsetter, nodes)) {
+            clients[id]++;
+        }
+    }
+
+    // 200 clients per node on average, heavier nodes are picked more often
+    for (int i = 1; i < 50; i++) {
+        auto n = clients["i-" + std::to_string(i)];
+        GTEST_ASSERT_GT(n, 100);
+        GTEST_ASSERT_LT(n, 300);
+    }
+    GTEST_ASSERT_GT(clients["i-0"], 400);
+}
+
+}
@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "balancer/topology.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static void addNode(CandidatePool &pool, const std::string &id, const std::string &zone, double factor) {
+    auto node = std::make_shared<ServiceNode>();
+    node->instanceID = id;
+    node->zone = zone;
+    pool.nodes.emplace_back(node);
+    pool.factors.emplace_back(factor);
+    pool.factorSum += factor;
+}
+
+static int count(const TopologyDelta &delta, TopologyEventType type) {
+    int n = 0;
+    for (const auto &event : delta.events) {
+        n += event.type==type;
+    }
+    return n;
+}
+
+TEST(testTopology, caseDiff) {
+    TopologyDiffer differ;
+    CandidatePool pool;
+    pool.factorSum = 0;
+    addNode(pool, "a-1", "zone-a", 1000);
+    addNode(pool, "a-2", "zone-a", 1000);
+    addNode(pool, "b-1", "zone-b", 500);
+
+    auto delta = differ.Diff(pool);
+    GTEST_ASSERT_NE(nullptr, delta);
+    GTEST_ASSERT_EQ(1, delta->version);
+    GTEST_ASSERT_EQ(3, count(*delta, TopologyEventType::NODE_ADDED));
+    GTEST_ASSERT_EQ(2, count(*delta, TopologyEventType::ZONE_WEIGHT_CHANGED));
+
+    // nothing moved
+    GTEST_ASSERT_EQ(nullptr, differ.Diff(pool));
+
+    // small moves are held back until they add up
+    pool.factors[0] = 1050;
+    pool.factorSum = 2550;
+    GTEST_ASSERT_EQ(nullptr, differ.Diff(pool));
+    pool.factors[0] = 1150;
+    pool.factorSum = 2650;
+    delta = differ.Diff(pool);
+    GTEST_ASSERT_EQ(1, delta->events.size());
+    GTEST_ASSERT_EQ(TopologyEventType::FACTOR_CHANGED, delta->events[0].type);
+    ASSERT_DOUBLE_EQ(1000, delta->events[0].before);
+    ASSERT_DOUBLE_EQ(1150, delta->events[0].after);
+
+    // a zone leaving removes its nodes and its share
+    CandidatePool next;
+    next.factorSum = 0;
+    addNode(next, "a-1", "zone-a", 1150);
+    addNode(next, "a-2", "zone-a", 1000);
+    delta = differ.Diff(next);
+    GTEST_ASSERT_EQ(1, count(*delta, TopologyEventType::NODE_REMOVED));
+    GTEST_ASSERT_EQ(2, count(*delta, TopologyEventType::ZONE_WEIGHT_CHANGED));
+
+    auto snapshot = differ.Snapshot();
+    GTEST_ASSERT_EQ(2, count(*snapshot, TopologyEventType::NODE_ADDED));
+    GTEST_ASSERT_EQ(1, count(*snapshot, TopologyEventType::ZONE_WEIGHT_CHANGED));
+}
+
+TEST(testTopology, caseDispatch) {
+    TopologyDispatcher dispatcher;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<uint64_t> versions;
+    auto callerThread = std::this_thread::get_id();
+    bool offCaller = true;
+
+    auto snapshot = std::make_shared<TopologyDelta>();
+    snapshot->version = 1;
+    snapshot->events.emplace_back(TopologyEvent{TopologyEventType::NODE_ADDED, nullptr, "zone-a", 0, 1});
+    auto id = dispatcher.Subscribe([&](const std::shared_ptr<const TopologyDelta> &delta) {
+        std::lock_guard<std::mutex> lock_guard(mutex);
+        offCaller = offCaller && std::this_thread::get_id()!=callerThread;
+        versions.emplace_back(delta->version);
+        cond.notify_all();
+    }, snapshot);
+    for (uint64_t version = 2; version <= 4; version++) {
+        auto delta = std::make_shared<TopologyDelta>();
+        delta->version = version;
+        dispatcher.Publish(delta);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::seconds(5), [&]() { return versions.size()==4; });
+    GTEST_ASSERT_EQ((std::vector<uint64_t>{1, 2, 3, 4}), versions);
+    GTEST_ASSERT_EQ(true, offCaller);
+    lock.unlock();
+
+    dispatcher.Unsubscribe(id);
+    dispatcher.Publish(std::make_shared<TopologyDelta>());
+    dispatcher.Stop();
+    GTEST_ASSERT_EQ(4, versions.size());
+}
+
+static std::shared_ptr<TopologyDelta> versioned(uint64_t version) {
+    auto delta = std::make_shared<TopologyDelta>();
+    delta->version = version;
+    delta->events.emplace_back(TopologyEvent{TopologyEventType::NODE_ADDED, nullptr, "zone-a", 0, 1});
+    return delta;
+}
+
+TEST(testTopology, caseLateSubscriber) {
+    TopologyDispatcher dispatcher;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool released = false;
+    std::vector<uint64_t> first, late;
+
+    // the first subscriber holds the dispatcher, deltas 2 and 3 stay queued
+    dispatcher.Subscribe([&](const std::shared_ptr<const TopologyDelta> &delta) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return released; });
+        first.emplace_back(delta->version);
+        cond.notify_all();
+    }, versioned(1));
+    dispatcher.Publish(versioned(2));
+    dispatcher.Publish(versioned(3));
+
+    // its snapshot already holds 3, it sees nothing older after it
+    dispatcher.Subscribe([&](const std::shared_ptr<const TopologyDelta> &delta) {
+        std::lock_guard<std::mutex> lock_guard(mutex);
+        late.emplace_back(delta->version);
+        cond.notify_all();
+    }, versioned(3));
+    dispatcher.Publish(versioned(4));
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex);
+        released = true;
+        cond.notify_all();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::seconds(5), [&]() { return first.size()==4 && late.size()==2; });
+    GTEST_ASSERT_EQ((std::vector<uint64_t>{1, 2, 3, 4}), first);
+    GTEST_ASSERT_EQ((std::vector<uint64_t>{3, 4}), late);
+}
+
+TEST(testTopology, caseUnsubscribeWaits) {
+    TopologyDispatcher dispatcher;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool entered = false;
+    std::atomic<bool> returned(false);
+
+    auto id = dispatcher.Subscribe([&](const std::shared_ptr<const TopologyDelta> &) {
+        {
+            std::lock_guard<std::mutex> lock_guard(mutex);
+            entered = true;
+            cond.notify_all();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        returned = true;
+    }, versioned(1));
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait_for(lock, std::chrono::seconds(5), [&]() { return entered; });
+    }
+    // the callback is running, Unsubscribe returns only once it is through
+    dispatcher.Unsubscribe(id);
+    GTEST_ASSERT_EQ(true, returned.load());
+
+    // a callback may unsubscribe itself
+    std::atomic<bool> done(false);
+    uint64_t self = 0;
+    std::mutex selfMutex;
+    {
+        std::lock_guard<std::mutex> lock_guard(selfMutex);
+        self = dispatcher.Subscribe([&](const std::shared_ptr<const TopologyDelta> &) {
+            std::lock_guard<std::mutex> lock_guard(selfMutex);
+            dispatcher.Unsubscribe(self);
+            done = true;
+        }, versioned(1));
+    }
+    for (int i = 0; i < 500 && !done; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    GTEST_ASSERT_EQ(true, done.load());
+}
+
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "balancer/update_scheduler.h"
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testUpdateScheduler, caseNext) {
+    SchedulerOption option(60);
+    option.jitter = 0;
+    UpdateScheduler scheduler(option);
+
+    // steady rounds slow down up to maxIntervalS
+    GTEST_ASSERT_EQ(60000, scheduler.Next(true, false).count());
+    for (int i = 0; i < 3; i++) {
+        scheduler.Next(true, false);
+    }
+    GTEST_ASSERT_EQ(90000, scheduler.Next(true, false).count());
+    GTEST_ASSERT_EQ(120000, scheduler.Next(true, false).count());
+    GTEST_ASSERT_EQ(120000, scheduler.Next(true, false).count());
+
+    // converging polls fast
+    GTEST_ASSERT_EQ(15000, scheduler.Next(true, true).count());
+
+    // failures back off exponentially up to maxBackoffS
+    GTEST_ASSERT_EQ(120000, scheduler.Next(false, false).count());
+    GTEST_ASSERT_EQ(240000, scheduler.Next(false, false).count());
+    GTEST_ASSERT_EQ(480000, scheduler.Next(false, false).count());
+    GTEST_ASSERT_EQ(480000, scheduler.Next(false, false).count());
+    GTEST_ASSERT_EQ(60000, scheduler.Next(true, false).count());
+}
+
+TEST(testUpdateScheduler, caseJitter) {
+    SchedulerOption option(10);
+    option.jitter = 0.2;
+    UpdateScheduler scheduler(option);
+    for (int i = 0; i < 100; i++) {
+        auto d = scheduler.Next(true, false).count();
+        GTEST_ASSERT_GE(d, 8000);
+        GTEST_ASSERT_LE(d, 12000);
+        scheduler.Reset();
+    }
+}
+
+TEST(testUpdateScheduler, caseStop) {
+    UpdateScheduler scheduler(SchedulerOption(60));
+    auto start = std::chrono::steady_clock::now();
+    std::thread t([&]() { GTEST_ASSERT_EQ(false, scheduler.Wait(std::chrono::seconds(60))); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    scheduler.Stop();
+    t.join();
+    GTEST_ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+    GTEST_ASSERT_EQ(false, scheduler.Wait(std::chrono::milliseconds(10)));
+
+    scheduler.Reset();
+    GTEST_ASSERT_EQ(true, scheduler.Wait(std::chrono::milliseconds(10)));
+}
+
+}
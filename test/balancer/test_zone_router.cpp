@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "balancer/zone_router.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testZoneRouter, caseRTT) {
+    ZoneRouterOption option;
+    option.alpha = 0.5;
+    ZoneRouter router(option);
+
+    ASSERT_DOUBLE_EQ(0, router.ZoneRTT("zone-b"));
+    GTEST_ASSERT_EQ(true, router.Fits("zone-b", 100));
+
+    router.ReportRTT("zone-b", 4000);
+    ASSERT_DOUBLE_EQ(4000, router.ZoneRTT("zone-b"));
+    router.ReportRTT("zone-b", 2000);
+    ASSERT_DOUBLE_EQ(3000, router.ZoneRTT("zone-b"));
+
+    GTEST_ASSERT_EQ(false, router.Fits("zone-b", 2000));
+    GTEST_ASSERT_EQ(true, router.Fits("zone-b", 3000));
+    GTEST_ASSERT_EQ(true, router.Fits("zone-b", 0));
+    GTEST_ASSERT_EQ(true, router.Fits("zone-c", 1));
+}
+
+TEST(testZoneRouter, caseShare) {
+    ZoneRouterOption option;
+    option.crossZoneShare = 0.25;
+    option.windowS = 10;
+    ZoneRouter router(option);
+    uint64_t now = 1000000;
+
+    int cross = 0;
+    for (int i = 0; i < 100; i++) {
+        bool allowed = router.AllowCross(now);
+        router.Count(allowed);
+        cross += allowed ? 1 : 0;
+    }
+    GTEST_ASSERT_LE(cross, 26);
+    GTEST_ASSERT_GE(cross, 24);
+
+    // the counters decay each window
+    router.AllowCross(now + 10000);
+    ASSERT_NEAR(0.25, router.CrossShare(), 0.02);
+}
+
+TEST(testZoneRouter, caseDebt) {
+    ZoneRouterOption option;
+    option.maxDebt = 2;
+    ZoneRouter router(option);
+
+    GTEST_ASSERT_EQ(false, router.HasDebt());
+    GTEST_ASSERT_EQ(false, router.TakeDebt());
+    for (int i = 0; i < 5; i++) {
+        router.Defer();
+    }
+    GTEST_ASSERT_EQ(true, router.TakeDebt());
+    GTEST_ASSERT_EQ(true, router.TakeDebt());
+    GTEST_ASSERT_EQ(false, router.TakeDebt());
+}
+
+TEST(testZoneRouter, casePick) {
+    ZoneRouter router;
+    CandidatePool pool;
+    const char* zones[] = {"zone-a", "zone-b", "zone-c", "zone-a"};
+    for (int i = 0; i < 4; i++) {
+        auto node = std::make_shared<ServiceNode>();
+        node->zone = zones[i];
+        pool.nodes.emplace_back(node);
+        pool.factors.emplace_back(i==0 ? 0 : 1);
+        pool.weights.emplace_back(0);
+    }
+    router.ReportRTT("zone-b", 5000);
+
+    // drawn by factor, the weights stay as they are
+    for (int i = 0; i < 20; i++) {
+        GTEST_ASSERT_EQ(3, router.Pick(pool, "zone-a", true, 0));
+        GTEST_ASSERT_EQ(2, router.Pick(pool, "zone-a", false, 1000));
+    }
+    int b = 0;
+    for (int i = 0; i < 200; i++) {
+        b += router.Pick(pool, "zone-a", false, 0)==1 ? 1 : 0;
+    }
+    GTEST_ASSERT_GT(b, 50);
+    GTEST_ASSERT_LT(b, 150);
+    for (auto weight : pool.weights) {
+        ASSERT_DOUBLE_EQ(0, weight);
+    }
+    GTEST_ASSERT_EQ(-1, router.Pick(pool, "zone-d", true, 0));
+}
+
+}
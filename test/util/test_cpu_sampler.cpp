@@ -0,0 +1,128 @@
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "util/cpu_sampler.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static void writeFile(const std::string& path, const std::string& content) {
+    std::ofstream out(path, std::ios::trunc);
+    out << content;
+}
+
+static std::string procStat(uint64_t busy, uint64_t idle) {
+    std::stringstream ss;
+    ss << "cpu  " << busy*2 << " 0 0 " << idle*2 << " 0 0 0 0 0 0\n";
+    ss << "cpu0 " << busy << " 0 0 " << idle << " 0 0 0 0 0 0\n";
+    ss << "cpu1 " << busy << " 0 0 " << idle << " 0 0 0 0 0 0\n";
+    ss << "intr 1 2 3\n";
+    return ss.str();
+}
+
+TEST(testCPUSampler, caseCgroupV2) {
+    char tmpl[] = "/tmp/ckit-cpu-XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    mkdir((root + "/proc").c_str(), 0755);
+    mkdir((root + "/proc/self").c_str(), 0755);
+    mkdir((root + "/cgroup").c_str(), 0755);
+    mkdir((root + "/cgroup/app").c_str(), 0755);
+    writeFile(root + "/proc/self/cgroup", "0::/app\n");
+    writeFile(root + "/proc/stat", procStat(100, 100));
+    writeFile(root + "/cgroup/app/cpu.stat", "usage_usec 0\nuser_usec 0\n");
+    writeFile(root + "/cgroup/app/cpu.max", "50000 100000\n");
+
+    CPUSamplerOption option;
+    option.intervalMs = 20;
+    option.windowsS = {1};
+    option.procRoot = root + "/proc";
+    option.cgroupRoot = root + "/cgroup";
+    CPUSampler sampler(option);
+    sampler.Start();
+    GTEST_ASSERT_EQ(CGROUP_V2, sampler.getCgroupVersion());
+
+    // 75% busy on the host, the cgroup burns half a core = its whole quota
+    auto start = std::chrono::steady_clock::now();
+    writeFile(root + "/proc/stat", procStat(250, 150));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    writeFile(root + "/cgroup/app/cpu.stat", "usage_usec " + std::to_string(us/2 + 100000) + "\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    CPUUsageSnapshot snapshot;
+    GTEST_ASSERT_EQ(false, sampler.Snapshot(1, snapshot));
+    GTEST_ASSERT_EQ(true, sampler.Snapshot(0, snapshot));
+    sampler.Stop();
+
+    ASSERT_DOUBLE_EQ(0.5, snapshot.quotaCores);
+    GTEST_ASSERT_EQ(2, snapshot.coreNum);
+    ASSERT_NEAR(75, snapshot.host, 0.01);
+    ASSERT_NEAR(75, snapshot.cores[1], 0.01);
+    GTEST_ASSERT_GT(snapshot.cgroupCores, 0);
+    GTEST_ASSERT_LE(snapshot.cgroup, 100);
+    ASSERT_DOUBLE_EQ(snapshot.cgroup, snapshot.Usage());
+
+    system(("rm -rf " + root).c_str());
+}
+
+static int openFDs() {
+    int n = 0;
+    auto dir = opendir("/proc/self/fd");
+    while (dir != nullptr && readdir(dir) != nullptr) {
+        n++;
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+    return n;
+}
+
+TEST(testCPUSampler, caseRestart) {
+    CPUSamplerOption option;
+    option.intervalMs = 20;
+    option.windowsS = {1};
+    CPUSampler sampler(option);
+    sampler.Start(false);
+    sampler.Stop();
+    auto fds = openFDs();
+
+    // a restart reopens the sources in place of the old ones
+    for (int i = 0; i < 3; i++) {
+        sampler.Start(false);
+        sampler.Stop();
+    }
+    GTEST_ASSERT_EQ(fds, openFDs());
+
+    // not waiting, the value is unknown until the sampler thread takes its second sample
+    option.intervalMs = 1000;
+    CPUSampler fresh(option);
+    fresh.Start(false);
+    ASSERT_DOUBLE_EQ(-1, fresh.Usage());
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    GTEST_ASSERT_GE(fresh.Usage(), 0);
+    fresh.Stop();
+}
+
+TEST(testCPUSampler, caseHost) {
+    CPUSamplerOption option;
+    option.intervalMs = 50;
+    CPUSampler sampler(option);
+    sampler.Start();
+    auto usage = sampler.Usage();
+    GTEST_ASSERT_GE(usage, 0);
+    GTEST_ASSERT_LE(usage, 100);
+    std::cout << "cgroup version: " << sampler.getCgroupVersion() << ", usage: " << usage << std::endl;
+    sampler.Stop();
+}
+
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include "util/numa.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static void writeFile(const std::string& path, const std::string& content) {
+    std::ofstream out(path);
+    out << content;
+}
+
+TEST(testNuma, caseParseCPUList) {
+    GTEST_ASSERT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}), ParseCPUList("0-3,8,10-11\n"));
+    GTEST_ASSERT_EQ(std::vector<int>({5}), ParseCPUList("5"));
+    GTEST_ASSERT_EQ(std::vector<int>(), ParseCPUList(""));
+}
+
+TEST(testNuma, caseSysfs) {
+    char tmpl[] = "/tmp/ckit-numa-XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    // node1 is memory only, node ids are renumbered
+    for (auto node : {"node0", "node1", "node2"}) {
+        mkdir((root + "/" + node).c_str(), 0755);
+    }
+    mkdir((root + "/power").c_str(), 0755);
+    writeFile(root + "/node0/cpulist", "0-1,4-5\n");
+    writeFile(root + "/node1/cpulist", "\n");
+    writeFile(root + "/node2/cpulist", "2-3,6-7\n");
+
+    NumaTopology topology(root);
+    GTEST_ASSERT_EQ(2, topology.NodeNum());
+    GTEST_ASSERT_EQ(std::vector<int>({2, 3, 6, 7}), topology.CPUs(1));
+    GTEST_ASSERT_EQ(0, topology.NodeOf(5));
+    GTEST_ASSERT_EQ(1, topology.NodeOf(6));
+    GTEST_ASSERT_EQ(0, topology.NodeOf(100));
+
+    // pinning may fail on a smaller host, fn runs anyway
+    std::thread::id worker;
+    topology.RunOnNode(1, [&worker]() { worker = std::this_thread::get_id(); });
+    GTEST_ASSERT_NE(std::this_thread::get_id(), worker);
+}
+
+TEST(testNuma, caseNoSysfs) {
+    NumaTopology topology("/nonexistent");
+    GTEST_ASSERT_EQ(1, topology.NodeNum());
+    GTEST_ASSERT_EQ(0, topology.CurrentNode());
+    GTEST_ASSERT_EQ(true, topology.CPUs(0).size() >= 1);
+}
+
+TEST(testNuma, caseNodeWorkers) {
+    char tmpl[] = "/tmp/ckit-numa-XXXXXX";
+    std::string root = mkdtemp(tmpl);
+    for (auto node : {"node0", "node1"}) {
+        mkdir((root + "/" + node).c_str(), 0755);
+    }
+    writeFile(root + "/node0/cpulist", "0\n");
+    writeFile(root + "/node1/cpulist", "1-1023\n");
+
+    std::unique_ptr<NodeWorkers> workers;
+    {
+        NumaTopology topology(root);
+        workers.reset(new NodeWorkers(topology));
+    }
+    GTEST_ASSERT_EQ(2, workers->NodeNum());
+
+    // the same thread of every node on each run, none of them the caller
+    std::vector<std::thread::id> first(2), second(2);
+    workers->RunAll([&first](int node) { first[node] = std::this_thread::get_id(); });
+    workers->RunAll([&second](int node) { second[node] = std::this_thread::get_id(); });
+    GTEST_ASSERT_EQ(first, second);
+    GTEST_ASSERT_NE(first[0], first[1]);
+    GTEST_ASSERT_NE(std::this_thread::get_id(), first[0]);
+}
+
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <cmath>
+
+#include "util/constant.h"
+#include "util/metrics_server.h"
+#include "util/prometheus.h"
+#include "util/util.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+static void render(std::string& out, double selected) {
+    PrometheusWriter writer(out);
+    writer.Family("clb_selections_total", "counter", "Nodes selected.");
+    writer.Sample("clb_selections_total", selected);
+    writer.Family("clb_node_factor", "gauge", "Factor of a node.");
+    std::string instance = "i-\"1\"\\a\nb";
+    writer.Sample("clb_node_factor", {{"zone", "zone-a"}, {"instance", instance}}, 0.25);
+    writer.Sample("clb_node_factor", {{"zone", "zone-a"}, {"instance", "i-2"}}, HUGE_VAL);
+    writer.Sample("clb_node_factor", {{"zone", "zone-a"}, {"instance", "i-3"}}, NAN);
+}
+
+TEST(testPrometheus, caseWriter) {
+    std::string out;
+    render(out, 12345678901);
+    GTEST_ASSERT_EQ(
+        "# HELP clb_selections_total Nodes selected.\n"
+        "# TYPE clb_selections_total counter\n"
+        "clb_selections_total 12345678901\n"
+        "# HELP clb_node_factor Factor of a node.\n"
+        "# TYPE clb_node_factor gauge\n"
+        "clb_node_factor{zone=\"zone-a\",instance=\"i-\\\"1\\\"\\\\a\\nb\"} 0.25\n"
+        "clb_node_factor{zone=\"zone-a\",instance=\"i-2\"} +Inf\n"
+        "clb_node_factor{zone=\"zone-a\",instance=\"i-3\"} NaN\n",
+        out);
+
+    // the buffer of the previous scrape is reused
+    auto data = out.data();
+    auto capacity = out.capacity();
+    render(out, 1);
+    GTEST_ASSERT_EQ(data, out.data());
+    GTEST_ASSERT_EQ(capacity, out.capacity());
+    GTEST_ASSERT_NE(std::string::npos, out.find("clb_selections_total 1\n"));
+}
+
+TEST(testPrometheus, caseServer) {
+    int scrapes = 0;
+    MetricsServer server([&scrapes](std::string& out) {
+        scrapes++;
+        render(out, scrapes);
+    });
+    int code;
+    std::string err;
+    std::tie(code, err) = server.Start(0, "127.0.0.1");
+    GTEST_ASSERT_EQ(STATUSCODE::SUCCESS, code);
+    GTEST_ASSERT_GT(server.getPort(), 0);
+
+    auto url = "http://127.0.0.1:" + std::to_string(server.getPort()) + "/metrics";
+    std::string body;
+    std::tie(code, body, err) = HttpGet(url);
+    GTEST_ASSERT_EQ(200, code);
+    GTEST_ASSERT_NE(std::string::npos, body.find("clb_selections_total 1\n"));
+    std::tie(code, body, err) = HttpGet(url);
+    GTEST_ASSERT_NE(std::string::npos, body.find("clb_selections_total 2\n"));
+
+    std::tie(code, body, err) = HttpRequest("POST", url, {}, "", 1000, 1000);
+    GTEST_ASSERT_EQ(405, code);
+    GTEST_ASSERT_EQ(2, scrapes);
+
+    std::tie(code, err) = server.Start(0, "127.0.0.1");
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_INVALID_ARGUMENT, code);
+    server.Stop();
+    std::tie(code, body, err) = HttpGet(url);
+    GTEST_ASSERT_NE(200, code);
+
+    MetricsServer invalid([](std::string&) {});
+    std::tie(code, err) = invalid.Start(0, "not an address");
+    GTEST_ASSERT_EQ(STATUSCODE::ERROR_INVALID_ARGUMENT, code);
+}
+
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+TEST(testThreadPool, caseParts) {
+    ThreadPool serial;
+    GTEST_ASSERT_EQ(0, serial.getThreads());
+    GTEST_ASSERT_EQ(1, serial.Parts(100000, 100));
+
+    ThreadPool pool(3);
+    GTEST_ASSERT_EQ(3, pool.getThreads());
+    // never more than the threads and the caller, never smaller than minPart
+    GTEST_ASSERT_EQ(4, pool.Parts(100000, 100));
+    GTEST_ASSERT_EQ(2, pool.Parts(150, 100));
+    GTEST_ASSERT_EQ(1, pool.Parts(100, 100));
+    GTEST_ASSERT_EQ(1, pool.Parts(0, 100));
+    GTEST_ASSERT_EQ(4, pool.Parts(4, 0));
+}
+
+TEST(testThreadPool, caseParallelFor) {
+    for (int threads : {0, 1, 3}) {
+        ThreadPool pool(threads);
+        for (size_t n : {0, 1, 7, 1000, 100003}) {
+            auto parts = pool.Parts(n, 16);
+            std::vector<int> visited(n, 0);
+            std::vector<size_t> partNum(parts, 0);
+            pool.ParallelFor(n, parts, [&](size_t part, size_t begin, size_t end) {
+                partNum[part]++;
+                // the parts are contiguous and in order
+                GTEST_ASSERT_EQ(n * part / parts, begin);
+                GTEST_ASSERT_EQ(n * (part + 1) / parts, end);
+                for (size_t i = begin; i < end; i++) {
+                    visited[i]++;
+                }
+            });
+            for (size_t i = 0; i < n; i++) {
+                GTEST_ASSERT_EQ(1, visited[i]);
+            }
+            for (size_t part = 0; part < parts; part++) {
+                GTEST_ASSERT_EQ(1, partNum[part]);
+            }
+        }
+    }
+}
+
+TEST(testThreadPool, caseReuse) {
+    // loops back to back, a part may go to another thread each time and still sees what
+    // the previous loop wrote
+    ThreadPool pool(3);
+    std::vector<uint64_t> values(10000, 0);
+    std::atomic<int> stale(0);
+    for (uint64_t round = 0; round < 500; round++) {
+        pool.ParallelFor(values.size(), pool.Parts(values.size(), 100), [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                stale += values[i] != round;
+                values[i]++;
+            }
+        });
+    }
+    GTEST_ASSERT_EQ(0, stale.load());
+
+    // a single part stays on the caller, no thread woken
+    auto caller = std::this_thread::get_id();
+    bool inlined = false;
+    pool.ParallelFor(50, pool.Parts(50, 100), [&](size_t, size_t, size_t) {
+        inlined = std::this_thread::get_id() == caller;
+    });
+    GTEST_ASSERT_EQ(true, inlined);
+}
+
+}
@@ -17,6 +17,12 @@ TEST(testUtil, caseZone) {
     std::cout << Zone() << std::endl;
 }
 
+TEST(testUtil, caseUrlEncode) {
+    GTEST_ASSERT_EQ("abc-_.~09", UrlEncode("abc-_.~09"));
+    GTEST_ASSERT_EQ("Service.Meta.zone%20%3D%3D%20%22us-east-1%22", UrlEncode("Service.Meta.zone == \"us-east-1\""));
+    GTEST_ASSERT_EQ("%E4%B8%AD", UrlEncode("\xE4\xB8\xAD"));
+}
+
 TEST(testUtil, caseHttpGet) {
     std::string body;
     int         status;
@@ -0,0 +1,159 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include "util/zone.h"
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace kit {
+
+// metadata service stub, answers a token on PUT and the zone on GET when the token matches
+class MetadataStub {
+    int fd;
+    int port;
+    bool v2;
+    std::atomic<bool> down;
+    std::atomic<int> requests;
+    std::thread* server;
+
+   public:
+    explicit MetadataStub(bool v2) : v2(v2), down(false), requests(0) {
+        this->fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(this->fd, (sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(this->fd, (sockaddr*)&addr, &len);
+        this->port = ntohs(addr.sin_port);
+        listen(this->fd, 8);
+        this->server = new std::thread([this]() {
+            while (true) {
+                int conn = accept(this->fd, nullptr, nullptr);
+                if (conn < 0) {
+                    return;
+                }
+                this->requests++;
+                char buf[4096] = {0};
+                auto n = read(conn, buf, sizeof(buf) - 1);
+                std::string req(buf, n > 0 ? n : 0);
+                std::string status = "200 OK";
+                std::string body;
+                if (this->down) {
+                    status = "503 Service Unavailable";
+                } else if (req.compare(0, 3, "PUT") == 0) {
+                    body = "token-123";
+                    if (!this->v2) {
+                        status = "404 Not Found";
+                        body = "";
+                    }
+                } else if (this->v2 && req.find("X-aws-ec2-metadata-token:token-123") == std::string::npos) {
+                    status = "401 Unauthorized";
+                } else {
+                    body = "ap-southeast-1b";
+                }
+                auto resp = "HTTP/1.1 " + status + "\r\nContent-Length: " + std::to_string(body.size()) +
+                            "\r\nConnection: close\r\n\r\n" + body;
+                write(conn, resp.data(), resp.size());
+                close(conn);
+            }
+        });
+    }
+    ~MetadataStub() {
+        shutdown(this->fd, SHUT_RDWR);
+        close(this->fd);
+        this->server->join();
+        delete this->server;
+    }
+    std::string Endpoint() const {
+        return "http://127.0.0.1:" + std::to_string(this->port);
+    }
+    int Requests() const {
+        return this->requests;
+    }
+    // every request answered 503
+    void SetDown(bool down) {
+        this->down = down;
+    }
+};
+
+static ZoneOption stubOption(const std::string& endpoint) {
+    ZoneOption option;
+    option.endpoint = endpoint;
+    option.envName = "CKIT_TEST_ZONE";
+    option.fileEnvName = "CKIT_TEST_ZONE_FILE";
+    return option;
+}
+
+TEST(testZone, caseIMDSv2) {
+    MetadataStub stub(true);
+    ZoneProvider provider(stubOption(stub.Endpoint()));
+    GTEST_ASSERT_EQ("ap-southeast-1b", provider.Get());
+    GTEST_ASSERT_EQ("imdsv2", provider.getSource());
+    GTEST_ASSERT_EQ(2, stub.Requests());
+    // cached
+    GTEST_ASSERT_EQ("ap-southeast-1b", provider.Get());
+    GTEST_ASSERT_EQ(2, stub.Requests());
+}
+
+TEST(testZone, caseIMDSv1) {
+    MetadataStub stub(false);
+    ZoneProvider provider(stubOption(stub.Endpoint()));
+    GTEST_ASSERT_EQ("ap-southeast-1b", provider.Get());
+    GTEST_ASSERT_EQ("imdsv1", provider.getSource());
+}
+
+TEST(testZone, caseOverride) {
+    setenv("CKIT_TEST_ZONE", "eu-central-1a", 1);
+    ZoneProvider envProvider(stubOption("http://127.0.0.1:1"));
+    GTEST_ASSERT_EQ("eu-central-1a", envProvider.Get());
+    GTEST_ASSERT_EQ("env", envProvider.getSource());
+    unsetenv("CKIT_TEST_ZONE");
+
+    std::string file = "/tmp/ckit-zone-" + std::to_string(getpid());
+    std::ofstream(file) << "us-east-1c\n";
+    setenv("CKIT_TEST_ZONE_FILE", file.c_str(), 1);
+    ZoneProvider fileProvider(stubOption("http://127.0.0.1:1"));
+    GTEST_ASSERT_EQ("us-east-1c", fileProvider.Get());
+    GTEST_ASSERT_EQ("file", fileProvider.getSource());
+    unsetenv("CKIT_TEST_ZONE_FILE");
+    unlink(file.c_str());
+}
+
+TEST(testZone, caseUnavailable) {
+    ZoneProvider provider(stubOption("http://127.0.0.1:1"));
+    GTEST_ASSERT_EQ("unknown", provider.Get());
+    GTEST_ASSERT_EQ("unknown", provider.getSource());
+}
+
+TEST(testZone, caseRetry) {
+    MetadataStub stub(true);
+    stub.SetDown(true);
+    auto option = stubOption(stub.Endpoint());
+    option.retryMs = 100;
+    ZoneProvider provider(option);
+    // the token failed, the IMDSv1 read is still tried
+    GTEST_ASSERT_EQ("unknown", provider.Get());
+    GTEST_ASSERT_EQ(2, stub.Requests());
+
+    // not asked again before the retry is due, then resolved for good
+    stub.SetDown(false);
+    GTEST_ASSERT_EQ("unknown", provider.Get());
+    GTEST_ASSERT_EQ(2, stub.Requests());
+    usleep(150 * 1000);
+    GTEST_ASSERT_EQ("ap-southeast-1b", provider.Get());
+    GTEST_ASSERT_EQ("imdsv2", provider.getSource());
+    GTEST_ASSERT_EQ(4, stub.Requests());
+}
+
+}